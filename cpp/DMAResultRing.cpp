@@ -0,0 +1,46 @@
+#include <string.h>
+
+#include "bdbmpcie.h"
+#include "DMAResultRing.h"
+
+DMAResultRing::DMAResultRing(const char* name, uint32_t offset, uint32_t bytes, unsigned int writtenReg, unsigned int consumedReg)
+	: m_written(name, writtenReg) {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	m_ring = (uint8_t*)pcie->dmaBuffer() + offset;
+	m_bytes = bytes;
+	m_written_reg = writtenReg;
+	m_consumed_reg = consumedReg;
+	m_read = 0;
+	m_seen = 0;
+}
+
+void
+DMAResultRing::resume() {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	m_read = pcie->userReadWord(m_written_reg);
+	m_seen = m_read;
+	pcie->userWriteWord(m_consumed_reg, m_read);
+}
+
+bool
+DMAResultRing::wait(uint32_t count) {
+	// the count seen last time may already cover it
+	if ( m_seen - m_read >= count ) return true;
+	if ( !m_written.waitCount(m_read, count) ) return false;
+	m_seen = m_written.value();
+	return true;
+}
+
+bool
+DMAResultRing::take(void* out, size_t want, uint32_t count) {
+	if ( !wait(count) ) return false;
+
+	uint32_t off = m_read % m_bytes;
+	size_t first = (off + want > m_bytes) ? m_bytes - off : want;
+	memcpy(out, m_ring + off, first);
+	memcpy((uint8_t*)out + first, m_ring, want - first);
+
+	m_read += count;
+	BdbmPcie::getInstance()->userWriteWord(m_consumed_reg, m_read);
+	return true;
+}
@@ -0,0 +1,43 @@
+#ifndef __DMA_RESULT_RING__H__
+#define __DMA_RESULT_RING__H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "PcieCompletion.h"
+
+/****
+Host side of mkDMAResultRing (src/DMAResultRing.bsv)
+
+The card writes results into [offset, offset+bytes) of the DMA buffer and counts the bytes
+written in one user register. take() waits for them through a PcieCompletion, copies them
+out across the wrap-around, and writes the bytes consumed to another user register, which
+frees the space for the card. Both counts run freely mod 2^32.
+****/
+
+class DMAResultRing {
+public:
+	// writtenReg and consumedReg are byte offsets, as userReadWord/userWriteWord take them
+	DMAResultRing(const char* name, uint32_t offset, uint32_t bytes, unsigned int writtenReg, unsigned int consumedReg);
+
+	// Continues from the card's current write count, for rings that survive between runs
+	void resume();
+	// Waits until count more bytes are in the ring. Returns false when the wait times out
+	bool wait(uint32_t count);
+	// Waits for count more bytes, copies the first want of them to out, then hands all count
+	// back to the card. Returns false when the wait times out
+	bool take(void* out, size_t want, uint32_t count);
+
+	uint32_t readBytes() { return m_read; }
+
+private:
+	uint8_t* m_ring;
+	uint32_t m_bytes;
+	unsigned int m_written_reg;
+	unsigned int m_consumed_reg;
+	uint32_t m_read;
+	uint32_t m_seen; // card's write count at the last read
+	PcieCompletion m_written;
+};
+
+#endif
@@ -5,6 +5,8 @@ For use with dram/src/DRAMHostDMA.bsv
 
 
 #include "DRAMHostDMA.h"
+#include "PcieStats.h"
+#include "PcieTrace.h"
 
 DRAMHostDMA*
 DRAMHostDMA::m_pInstance = NULL;
@@ -31,6 +33,8 @@ bool
 DRAMHostDMA::CopyToFPGA(size_t offset, void* buffer, size_t bytes) {
 	m_mutex.lock();
 	BdbmPcie* pcie = BdbmPcie::getInstance();
+	uint64_t copy_start = PCIE_STAT_TIME();
+	PCIE_STAT_ADD(STAT_DRAM_TO_FPGA_BYTES, bytes);
 
 	size_t offset_frag = offset % m_fpga_alignment;
 	if ( offset_frag != 0 ) {
@@ -62,6 +66,7 @@ DRAMHostDMA::CopyToFPGA(size_t offset, void* buffer, size_t bytes) {
 		} else {
 			memcpy(dmabuf8+bufoff, ((uint8_t*)buffer)+host_offset, curbyte);
 		}
+		PCIE_TRACE_DMA(true, bufoff, curbyte);
 
 		size_t hostpageoff = bufoff/m_fpga_alignment;
 		size_t pages = curbyte/m_fpga_alignment;
@@ -74,11 +79,15 @@ DRAMHostDMA::CopyToFPGA(size_t offset, void* buffer, size_t bytes) {
 		pcie->userWriteWord(m_to_fpga_cmd, pages);
 
 	
+		uint64_t poll_start = PCIE_STAT_TIME();
 		uint32_t writecnt = pcie->userReadWord(m_fpga_write_stat_off);
+		PCIE_STAT_ADD(STAT_DRAM_POLLS, 1);
 		//printf( "Waiting for %d to reach %ld\n", writecnt, m_write_done_total + i );
 		while ( writecnt < m_write_done_total + i ) {
 			writecnt = pcie->userReadWord(m_fpga_write_stat_off);
+			PCIE_STAT_ADD(STAT_DRAM_POLLS, 1);
 		}
+		PCIE_STAT_RECORD(HIST_DRAM_POLL_NS, poll_start);
 		//printf( "Write done!\n" );
 
 		host_offset += curbyte;
@@ -91,13 +100,18 @@ DRAMHostDMA::CopyToFPGA(size_t offset, void* buffer, size_t bytes) {
 		fprintf( stderr, "DRAMHostDMA CopyToFPGA bytes remaining after write! %ld %s:%d\n", bytes, __FILE__, __LINE__ );
 	}
 
+	uint64_t poll_start = PCIE_STAT_TIME();
 	uint32_t writecnt = pcie->userReadWord(m_fpga_write_stat_off);
+	PCIE_STAT_ADD(STAT_DRAM_POLLS, 1);
 	//printf( "Waiting for %d to reach %ld\n", writecnt, m_write_done_total +writes_cnt );
 	while ( writecnt < m_write_done_total + writes_cnt ) {
 		writecnt = pcie->userReadWord(m_fpga_write_stat_off);
+		PCIE_STAT_ADD(STAT_DRAM_POLLS, 1);
 	}
+	PCIE_STAT_RECORD(HIST_DRAM_POLL_NS, poll_start);
 	m_write_done_total = writecnt;
 	//printf( "Write done!\n" );
+	PCIE_STAT_RECORD(HIST_DRAM_TO_FPGA_NS, copy_start);
 
 
 	m_mutex.unlock();
@@ -108,6 +122,8 @@ bool
 DRAMHostDMA::CopyFromFPGA(size_t offset, void* buffer, size_t bytes) {
 	m_mutex.lock();
 	BdbmPcie* pcie = BdbmPcie::getInstance();
+	uint64_t copy_start = PCIE_STAT_TIME();
+	PCIE_STAT_ADD(STAT_DRAM_FROM_FPGA_BYTES, bytes);
 	//m_read_done_total = pcie->userReadWord(m_fpga_read_stat_off);
 
 	size_t dst_bytes = bytes;
@@ -145,16 +161,21 @@ DRAMHostDMA::CopyFromFPGA(size_t offset, void* buffer, size_t bytes) {
 		pcie->userWriteWord(m_fpga_mem_arg, pageoff);
 		pcie->userWriteWord(m_to_host_cmd, pages);
 		
+		uint64_t poll_start = PCIE_STAT_TIME();
 		uint32_t readcnt = pcie->userReadWord(m_fpga_read_stat_off);
+		PCIE_STAT_ADD(STAT_DRAM_POLLS, 1);
 		//printf( "Waiting for %d to be %ld\n", readcnt, m_read_done_total + i );
 		while ( readcnt < m_read_done_total + i ) {
 			readcnt = pcie->userReadWord(m_fpga_read_stat_off);
+			PCIE_STAT_ADD(STAT_DRAM_POLLS, 1);
 		}
+		PCIE_STAT_RECORD(HIST_DRAM_POLL_NS, poll_start);
 
 		if ( i > 0 ) {
 			size_t bufoff = 0;
 			if ( i%2 == 0 ) bufoff = m_max_dma_bytes/2;
 			memcpy(((uint8_t*)buffer)+host_offset, dmabuf8 + bufoff, lastbyte);
+			PCIE_TRACE_DMA(false, bufoff, lastbyte);
 			host_offset += lastbyte;
 			dst_bytes -= lastbyte;
 		}
@@ -167,10 +188,14 @@ DRAMHostDMA::CopyFromFPGA(size_t offset, void* buffer, size_t bytes) {
 		fprintf( stderr, "DRAMHostDMA CopyToFPGA bytes remaining after read! %ld %s:%d\n", bytes, __FILE__, __LINE__ );
 	}
 
+	uint64_t poll_start = PCIE_STAT_TIME();
 	uint32_t readcnt = pcie->userReadWord(m_fpga_read_stat_off);
+	PCIE_STAT_ADD(STAT_DRAM_POLLS, 1);
 	while ( readcnt < m_read_done_total + reads_cnt ) {
 		readcnt = pcie->userReadWord(m_fpga_read_stat_off);
+		PCIE_STAT_ADD(STAT_DRAM_POLLS, 1);
 	}
+	PCIE_STAT_RECORD(HIST_DRAM_POLL_NS, poll_start);
 	m_read_done_total = readcnt;
 
 	size_t bufoff = 0;
@@ -181,6 +206,8 @@ DRAMHostDMA::CopyFromFPGA(size_t offset, void* buffer, size_t bytes) {
 		memcpy(((uint8_t*)buffer)+host_offset, dmabuf8+bufoff, dst_bytes);
 		memset(((uint8_t*)buffer)+host_offset+dst_bytes, 0xff, m_max_dma_bytes/2-dst_bytes);
 	}
+	PCIE_TRACE_DMA(false, bufoff, dst_bytes >= m_max_dma_bytes/2 ? m_max_dma_bytes/2 : dst_bytes);
+	PCIE_STAT_RECORD(HIST_DRAM_FROM_FPGA_NS, copy_start);
 
 	m_mutex.unlock();
 	return true;
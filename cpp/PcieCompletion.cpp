@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bdbmpcie.h"
+#include "PcieCompletion.h"
+#include "PcieStats.h"
+
+static double completionNow() {
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + (double)t.tv_nsec/1000000000;
+}
+
+PcieCompletion::PcieCompletion(const char* name, unsigned int reg) {
+	m_name = name;
+	m_reg = reg;
+	m_timeout_ms = pcieCompletionTimeoutMs();
+	m_interrupt = false;
+	m_value = 0;
+	m_polls = 0;
+	m_wait_time = 0;
+}
+
+bool
+PcieCompletion::waitCount(uint32_t base, uint32_t count) {
+	return wait(WAIT_COUNT, base, count);
+}
+
+bool
+PcieCompletion::waitEqual(uint32_t value) {
+	return wait(WAIT_EQUAL, value, 0);
+}
+
+bool
+PcieCompletion::waitNotEqual(uint32_t value) {
+	return wait(WAIT_NOT_EQUAL, value, 0);
+}
+
+bool
+PcieCompletion::wait(WaitKind kind, uint32_t a, uint32_t b) {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	uint64_t stat_start = PCIE_STAT_TIME();
+	double start = completionNow();
+	uint64_t polls = 0;
+	bool ok = true;
+
+	while ( true ) {
+		m_value = pcie->userReadWord(m_reg);
+		polls++;
+		if ( done(kind, a, b) ) break;
+
+		if ( polls < PCIE_COMPLETION_SPINS ) continue;
+
+		// the clock is only read once the wait stops being short
+		double elapsed = completionNow() - start;
+		if ( m_timeout_ms > 0 && elapsed*1000 >= m_timeout_ms ) {
+			timedOut(kind, a, b, elapsed, polls);
+			ok = false;
+			break;
+		}
+
+#if !defined(BLUESIM) && !defined(BDBM_MOCK)
+		uint32_t sleep_us = pcieBackoffSleepUs(polls);
+		if ( m_interrupt && sleep_us > 0 ) {
+			// waits for an interrupt, or the next register check
+			pcie->waitInterrupt((sleep_us + 999)/1000);
+			continue;
+		}
+#endif
+		pcieBackoff(polls);
+	}
+
+	m_polls += polls;
+	m_wait_time += completionNow() - start;
+	PCIE_STAT_ADD(STAT_COMPLETION_POLLS, polls);
+	PCIE_STAT_RECORD(HIST_COMPLETION_WAIT_NS, stat_start);
+	return ok;
+}
+
+void
+PcieCompletion::timedOut(WaitKind kind, uint32_t a, uint32_t b, double elapsed, uint64_t polls) {
+	PCIE_STAT_ADD(STAT_COMPLETION_TIMEOUTS, 1);
+	fprintf(stderr, "PcieCompletion %s: timed out after %.3f s (%lu polls) on user register %u, ",
+		m_name, elapsed, polls, m_reg>>2);
+	if ( kind == WAIT_COUNT ) {
+		fprintf(stderr, "waiting for %u past %u, last %u (%u done)\n", b, a, m_value, m_value - a);
+	} else if ( kind == WAIT_EQUAL ) {
+		fprintf(stderr, "waiting for 0x%x, last 0x%x\n", a, m_value);
+	} else {
+		fprintf(stderr, "waiting for anything but 0x%x\n", a);
+	}
+}
@@ -0,0 +1,107 @@
+#ifndef __PCIE_COMPLETION__H__
+#define __PCIE_COMPLETION__H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <time.h>
+
+/****
+Waiting for the card to finish something, without a fixed delay
+
+A PcieCompletion watches one user register, read through BdbmPcie::userReadWord, until it
+satisfies a condition:
+	waitCount    : done counters and sequence numbers, until reg - base >= count (mod 2^32)
+	waitEqual    : status registers, until reg == value
+	waitNotEqual : status FIFOs whose read pops an entry and returns a marker when empty
+	               (7777 or 0xffffffff in the examples), until reg != marker.
+	               The popped entry is value()
+Polling backs off as the wait grows: PCIE_COMPLETION_SPINS back-to-back reads, then
+PCIE_COMPLETION_YIELDS reads with sched_yield between them, then sleeps doubling from 1 us
+up to PCIE_COMPLETION_SLEEP_MAX_US. Short waits stay at PCIe read latency, long ones stop
+burning a core. pcieBackoff is the same backoff for polling loops of their own.
+
+With setInterrupt(true), the sleeps are replaced by BdbmPcie::waitInterrupt, so a design that
+raises an interrupt on completion wakes the host right away. Only the PCIe backend really
+blocks there; bluesim and mock builds keep sleeping.
+
+A wait gives up after the timeout, PCIE_COMPLETION_TIMEOUT_MS or the BDBM_COMPLETION_TIMEOUT_MS
+environment variable (0 waits forever), prints what it was waiting for and the last value it
+saw to stderr, and returns false.
+****/
+
+#define PCIE_COMPLETION_TIMEOUT_MS 10000
+#define PCIE_COMPLETION_SPINS 64
+#define PCIE_COMPLETION_YIELDS 64
+#define PCIE_COMPLETION_SLEEP_MAX_US 1000
+
+// PCIE_COMPLETION_TIMEOUT_MS, or BDBM_COMPLETION_TIMEOUT_MS from the environment (0 waits forever)
+static inline int pcieCompletionTimeoutMs() {
+	char* env = getenv("BDBM_COMPLETION_TIMEOUT_MS");
+	return (env != NULL) ? atoi(env) : PCIE_COMPLETION_TIMEOUT_MS;
+}
+
+// microseconds to sleep after idle fruitless polls, 0 while still spinning or yielding
+static inline uint32_t pcieBackoffSleepUs(uint64_t idle, uint32_t maxSleepUs = PCIE_COMPLETION_SLEEP_MAX_US) {
+	if ( idle < PCIE_COMPLETION_SPINS + PCIE_COMPLETION_YIELDS ) return 0;
+	uint64_t steps = idle - PCIE_COMPLETION_SPINS - PCIE_COMPLETION_YIELDS;
+	uint32_t us = (steps < 31) ? (1u << steps) : maxSleepUs;
+	return (us < maxSleepUs) ? us : maxSleepUs;
+}
+
+// one step of the PcieCompletion backoff: nothing, sched_yield or a sleep as idle grows
+static inline void pcieBackoff(uint64_t idle, uint32_t maxSleepUs = PCIE_COMPLETION_SLEEP_MAX_US) {
+	if ( idle < PCIE_COMPLETION_SPINS ) return;
+	uint32_t us = pcieBackoffSleepUs(idle, maxSleepUs);
+	if ( us == 0 ) {
+		sched_yield();
+		return;
+	}
+	timespec t = {(time_t)(us/1000000), (long)(us%1000000)*1000};
+	nanosleep(&t, NULL);
+}
+
+class PcieCompletion {
+public:
+	// reg is a byte offset, as userReadWord takes it. name is only used in diagnostics
+	PcieCompletion(const char* name, unsigned int reg);
+
+	void setTimeout(int ms) { m_timeout_ms = ms; }
+	void setInterrupt(bool on) { m_interrupt = on; }
+
+	bool waitCount(uint32_t base, uint32_t count);
+	bool waitEqual(uint32_t value);
+	bool waitNotEqual(uint32_t value);
+
+	// last value read by a wait
+	uint32_t value() { return m_value; }
+	// register reads and seconds spent in waits, over the lifetime of this object
+	uint64_t polls() { return m_polls; }
+	double waitTime() { return m_wait_time; }
+
+private:
+	typedef enum {
+		WAIT_COUNT,
+		WAIT_EQUAL,
+		WAIT_NOT_EQUAL
+	} WaitKind;
+
+	bool wait(WaitKind kind, uint32_t a, uint32_t b);
+	inline bool done(WaitKind kind, uint32_t a, uint32_t b) {
+		if ( kind == WAIT_COUNT ) return (uint32_t)(m_value - a) >= b;
+		if ( kind == WAIT_EQUAL ) return m_value == a;
+		return m_value != a;
+	}
+	void timedOut(WaitKind kind, uint32_t a, uint32_t b, double elapsed, uint64_t polls);
+
+	const char* m_name;
+	unsigned int m_reg;
+	int m_timeout_ms;
+	bool m_interrupt;
+
+	uint32_t m_value;
+	uint64_t m_polls;
+	double m_wait_time;
+};
+
+#endif
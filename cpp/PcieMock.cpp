@@ -0,0 +1,411 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/mman.h>
+
+#include "bdbmpcie.h"
+#include "PcieMock.h"
+
+// Matches PcieCtrl.bsv
+#define MOCK_MAGIC 0xc001d00d
+#define MOCK_DRAM_PAGE 4096
+// DMAWideCtrl hw->sw ring: 128 slots of 32 bytes at the start of the DMA buffer
+#define MOCK_SPLITTER_RING (1024*4)
+#define MOCK_SPLITTER_SLOTS (MOCK_SPLITTER_RING/32)
+// DMAWideCtrl ioRecvQ depth, and how many words the echoing user design holds
+#define MOCK_SPLITTER_RECV_DEPTH 8
+#define MOCK_SPLITTER_USER_WORDS 16
+// DMAWideCtrl send ring and credit status, as in dmasplitter.h
+#define MOCK_SPLITTER_STATUS_OFFSET (4*1024)
+#define MOCK_SPLITTER_SEND_RING_OFFSET (8*1024)
+#define MOCK_SPLITTER_SEND_RING_ENTRIES 1024
+#define MOCK_SPLITTER_CREDIT_MAGIC 0xc4ed1700
+
+static uint64_t
+envValue(const char* name, uint64_t def) {
+	char* v = getenv(name);
+	if ( v == NULL || v[0] == '\0' ) return def;
+	char* end;
+	uint64_t r = strtoull(v, &end, 0);
+	if ( *end == 'k' || *end == 'K' ) r *= 1024;
+	else if ( *end == 'm' || *end == 'M' ) r *= 1024*1024;
+	return r;
+}
+
+PcieMock*
+PcieMock::m_pInstance = NULL;
+
+PcieMock*
+PcieMock::getInstance() {
+	if ( m_pInstance == NULL ) {
+		m_pInstance = new PcieMock();
+	}
+	return m_pInstance;
+}
+
+PcieMock::PcieMock() {
+	pthread_mutex_init(&m_lock, NULL);
+
+	m_device = MOCK_ECHO;
+	char* dev = getenv("BDBM_MOCK_DEVICE");
+	if ( dev != NULL ) {
+		if ( strcmp(dev, "splitter") == 0 ) m_device = MOCK_SPLITTER;
+		else if ( strcmp(dev, "cq") == 0 ) m_device = MOCK_CQ;
+		else if ( strcmp(dev, "dram") == 0 ) m_device = MOCK_DRAM;
+		else if ( strcmp(dev, "echo") != 0 ) {
+			fprintf(stderr, "PcieMock unknown BDBM_MOCK_DEVICE %s, using echo\n", dev);
+		}
+	}
+	m_io_ns = envValue("BDBM_MOCK_IO_NS", 0);
+	m_dma_ns = envValue("BDBM_MOCK_DMA_NS", 0);
+	m_dma_mbps = envValue("BDBM_MOCK_DMA_MBPS", 0);
+	m_cq_bytes = envValue("BDBM_MOCK_CQ_BYTES", 512*1024);
+	if ( m_cq_bytes == 0 || m_cq_bytes > DMA_DRIVER_BUFFER_SIZE || (m_cq_bytes & (m_cq_bytes-1)) != 0 ) {
+		fprintf(stderr, "PcieMock BDBM_MOCK_CQ_BYTES must be a power of two up to %d, using 512K\n", DMA_DRIVER_BUFFER_SIZE);
+		m_cq_bytes = 512*1024;
+	}
+
+	// page aligned and zeroed, like the driver's buffer. Only the DMA_DRIVER_BUFFER_SIZE bytes
+	// the driver backs are accessible, anything past them faults
+	m_dmabuf = (uint8_t*)mmap(NULL, DMA_BUFFER_SIZE, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if ( m_dmabuf == MAP_FAILED || mprotect(m_dmabuf, DMA_DRIVER_BUFFER_SIZE, PROT_READ|PROT_WRITE) != 0 ) {
+		fprintf(stderr, "PcieMock DMA buffer allocation failed\n");
+		exit(1);
+	}
+	m_config = (uint32_t*)calloc(CONFIG_BUFFER_ISIZE, sizeof(uint32_t));
+
+	m_io_free_at = 0;
+	m_wemit = 0;
+	m_remit = 0;
+	m_violations = 0;
+	m_dma_free_at = now();
+
+	memset(m_regs, 0, sizeof(m_regs));
+
+	memset(m_write_buf, 0, sizeof(m_write_buf));
+	m_enq_idx = 0;
+	m_enq_received_idx = 0;
+	m_enq_offset = 0;
+	m_send_enabled = false;
+	m_send_force = false;
+	m_ring_produced = 0;
+	m_ring_fetched = 0;
+	m_recv_dequeued = 0;
+
+	m_cq_started = false;
+	m_cq_write_bytes = 0;
+	m_cq_read_bytes = 0;
+	m_cq_pattern = 0;
+	memset(m_cq_stat, 0, sizeof(m_cq_stat));
+
+	m_dram_busy = false;
+	m_dram_done_at = 0;
+	m_dram_host_arg = 0;
+	m_dram_fpga_arg = 0;
+	m_dram_write_done = 0;
+	m_dram_read_done = 0;
+
+	const char* names[] = {"echo", "splitter", "cq", "dram"};
+	printf( "PCIe mock device (%s) initialized\n", names[m_device] ); fflush(stdout);
+}
+
+uint64_t
+PcieMock::now() {
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((uint64_t)t.tv_sec*1000000000ULL) + t.tv_nsec;
+}
+
+uint64_t
+PcieMock::dmaCost(uint64_t bytes) {
+	if ( m_dma_mbps == 0 ) return 0;
+	return (bytes*1000000000ULL)/(m_dma_mbps*1024*1024);
+}
+
+void
+PcieMock::waitUntil(uint64_t t) {
+	while ( now() < t );
+}
+
+void*
+PcieMock::dmaBuffer() {
+	return m_dmabuf;
+}
+
+void
+PcieMock::write(uint32_t addr, uint32_t data) {
+	pthread_mutex_lock(&m_lock);
+	advance();
+
+	if ( addr < CONFIG_BUFFER_SIZE ) {
+		if ( addr == 0 ) {
+			// Init, resets the emit counters
+			m_wemit = 0;
+			m_remit = 0;
+		} else {
+			m_config[addr>>2] = data;
+		}
+		pthread_mutex_unlock(&m_lock);
+		return;
+	}
+
+	uint32_t off = (addr-CONFIG_BUFFER_SIZE)>>2;
+	if ( m_io_ns == 0 ) {
+		userWrite(off, data);
+		m_wemit++;
+		deviceStep(now());
+		pthread_mutex_unlock(&m_lock);
+		return;
+	}
+
+	uint64_t t = now();
+	if ( m_io_free_at < t ) m_io_free_at = t;
+	m_io_free_at += m_io_ns;
+	PendingWrite w = {m_io_free_at, off, data};
+	m_pending.push_back(w);
+	if ( m_pending.size() > IO_QUEUE_SIZE ) {
+		if ( m_violations == 0 ) {
+			fprintf(stderr, "PcieMock: %lu user writes in flight, IO queue only holds %d\n", m_pending.size(), IO_QUEUE_SIZE);
+		}
+		m_violations++;
+	}
+	pthread_mutex_unlock(&m_lock);
+}
+
+uint32_t
+PcieMock::read(uint32_t addr) {
+	pthread_mutex_lock(&m_lock);
+	uint32_t data = 0;
+
+	if ( addr < CONFIG_BUFFER_SIZE ) {
+		// served by PcieCtrl directly, not queued behind user IO
+		advance();
+		uint32_t idx = addr>>2;
+		if ( idx == 0 ) data = MOCK_MAGIC;
+		else if ( idx == 1 ) data = 0; // debug code
+		else if ( idx == CONFIG_BUFFER_ISIZE-2 ) data = m_remit;
+		else if ( idx == CONFIG_BUFFER_ISIZE-1 ) data = m_wemit;
+		else data = m_config[idx];
+		pthread_mutex_unlock(&m_lock);
+		return data;
+	}
+
+	// user reads are served in order, after every write before them
+	uint64_t t = now();
+	if ( m_io_free_at < t ) m_io_free_at = t;
+	m_io_free_at += m_io_ns;
+	waitUntil(m_io_free_at);
+	advance();
+
+	data = userRead((addr-CONFIG_BUFFER_SIZE)>>2);
+	m_remit++;
+	pthread_mutex_unlock(&m_lock);
+	return data;
+}
+
+void
+PcieMock::waitInterrupt(int timeout) {
+	pthread_mutex_lock(&m_lock);
+	advance();
+	pthread_mutex_unlock(&m_lock);
+}
+
+// apply every queued write whose time has come, then let the device run
+void
+PcieMock::advance() {
+	uint64_t t = now();
+	while ( !m_pending.empty() && m_pending.front().time <= t ) {
+		PendingWrite w = m_pending.front();
+		m_pending.pop_front();
+		userWrite(w.off, w.data);
+		m_wemit++;
+	}
+	deviceStep(t);
+}
+
+void
+PcieMock::userWrite(uint32_t off, uint32_t data) {
+	switch (m_device) {
+	case MOCK_ECHO:
+		m_regs[off & 1023] = data;
+		break;
+	case MOCK_SPLITTER:
+		if ( off == 0 ) {
+			// d0 write sends the word, echoed back to the host
+			m_recv_q.push_back(m_write_buf[4]);
+			m_recv_q.push_back(data);
+			m_recv_q.push_back(m_write_buf[1]);
+			m_recv_q.push_back(m_write_buf[2]);
+			m_recv_q.push_back(m_write_buf[3]);
+			if ( m_send_enabled && m_recv_q.size()/5 > MOCK_SPLITTER_RECV_DEPTH ) {
+				if ( m_violations == 0 ) {
+					fprintf(stderr, "PcieMock: %lu words in the splitter receive queue, it only holds %d\n", m_recv_q.size()/5, MOCK_SPLITTER_RECV_DEPTH);
+				}
+				m_violations++;
+			}
+		} else if ( off < 16 ) {
+			m_write_buf[off & 7] = data;
+		} else if ( off == 16 ) {
+			m_enq_received_idx = data;
+		} else if ( off == 17 ) {
+			m_enq_idx = data;
+		} else if ( off == 18 ) {
+			m_ring_produced = data;
+		} else if ( off == 19 ) {
+			m_send_enabled = (data != 0);
+			m_send_force = true;
+		}
+		break;
+	case MOCK_CQ:
+		if ( off == 16 ) m_cq_started = true;
+		else if ( off == 17 ) m_cq_read_bytes = data;
+		break;
+	case MOCK_DRAM:
+		if ( off == 256 ) m_dram_host_arg = data;
+		else if ( off == 257 ) m_dram_fpga_arg = data;
+		else if ( off == 258 || off == 259 ) {
+			DramCmd c = {off == 259, m_dram_host_arg, m_dram_fpga_arg, data, now()};
+			m_dram_cmds.push_back(c);
+		}
+		break;
+	}
+}
+
+uint32_t
+PcieMock::userRead(uint32_t off) {
+	switch (m_device) {
+	case MOCK_ECHO:
+		return m_regs[off & 1023];
+	case MOCK_SPLITTER:
+		return 0;
+	case MOCK_CQ:
+		if ( off > 0 && off < 16 ) return m_cq_stat[off];
+		return 0;
+	case MOCK_DRAM:
+		if ( off == 256 ) return m_dram_write_done;
+		if ( off == 257 ) return m_dram_read_done;
+		return 0;
+	}
+	return 0;
+}
+
+uint8_t*
+PcieMock::dramPage(uint64_t page) {
+	std::map<uint64_t, uint8_t*>::iterator it = m_dram.find(page);
+	if ( it != m_dram.end() ) return it->second;
+	uint8_t* p = (uint8_t*)calloc(1, MOCK_DRAM_PAGE);
+	m_dram[page] = p;
+	return p;
+}
+
+// run the device's DMA engine up to time t
+void
+PcieMock::deviceStep(uint64_t t) {
+	switch (m_device) {
+	case MOCK_ECHO:
+		break;
+	case MOCK_SPLITTER: {
+		uint32_t* ubuf = (uint32_t*)m_dmabuf;
+		uint32_t* status = (uint32_t*)(m_dmabuf + MOCK_SPLITTER_STATUS_OFFSET);
+		uint32_t statusFetched = m_ring_fetched;
+		uint32_t statusDequeued = m_recv_dequeued;
+		while ( true ) {
+			// the user design takes words while it has room to echo them
+			while ( !m_recv_q.empty() && m_loopback.size() < MOCK_SPLITTER_USER_WORDS*5 ) {
+				for ( int i = 0; i < 5; i++ ) {
+					m_loopback.push_back(m_recv_q.front()); m_recv_q.pop_front();
+				}
+				m_recv_dequeued++;
+			}
+			// send ring entries are fetched while the receive queue has room
+			if ( !m_send_enabled || m_ring_fetched == m_ring_produced
+				|| m_recv_q.size()/5 >= MOCK_SPLITTER_RECV_DEPTH ) break;
+			uint64_t done = m_dma_free_at + dmaCost(32);
+			if ( done > t ) break;
+			m_dma_free_at = done;
+
+			uint32_t slot = m_ring_fetched % MOCK_SPLITTER_SEND_RING_ENTRIES;
+			uint32_t* e = (uint32_t*)(m_dmabuf + MOCK_SPLITTER_SEND_RING_OFFSET) + slot*8;
+			m_recv_q.push_back(e[4]);
+			for ( int i = 0; i < 4; i++ ) m_recv_q.push_back(e[i]);
+			m_ring_fetched++;
+		}
+		if ( m_send_enabled && (m_send_force || statusFetched != m_ring_fetched || statusDequeued != m_recv_dequeued) ) {
+			status[0] = m_ring_fetched;
+			status[1] = m_recv_dequeued;
+			status[2] = m_ring_produced;
+			status[3] = MOCK_SPLITTER_CREDIT_MAGIC | MOCK_SPLITTER_RECV_DEPTH;
+			m_send_force = false;
+		}
+
+		while ( !m_loopback.empty() && m_enq_idx - m_enq_received_idx < MOCK_SPLITTER_SLOTS ) {
+			uint64_t done = m_dma_free_at + dmaCost(32);
+			if ( done > t ) break;
+			m_dma_free_at = done;
+
+			uint32_t* slot = ubuf + (m_enq_offset/4);
+			uint32_t header = m_loopback.front(); m_loopback.pop_front();
+			for ( int i = 0; i < 4; i++ ) {
+				slot[i] = m_loopback.front(); m_loopback.pop_front();
+			}
+			slot[4] = header;
+			slot[5] = m_enq_idx;
+			m_enq_idx++;
+			m_enq_offset = (m_enq_offset+32)%MOCK_SPLITTER_RING;
+		}
+		// idle time is not banked as bandwidth
+		if ( m_loopback.empty() || m_enq_idx - m_enq_received_idx >= MOCK_SPLITTER_SLOTS ) {
+			if ( m_dma_free_at < t ) m_dma_free_at = t;
+		}
+		break;
+	}
+	case MOCK_CQ:
+		// 128 byte bursts, like DMACircularQueue
+		while ( m_cq_started && m_cq_write_bytes - m_cq_read_bytes + 128 <= m_cq_bytes ) {
+			uint64_t done = m_dma_free_at + dmaCost(128);
+			if ( done > t ) break;
+			m_dma_free_at = done;
+
+			uint32_t* dst = (uint32_t*)(m_dmabuf + (m_cq_write_bytes % m_cq_bytes));
+			for ( int i = 0; i < 128/4; i++ ) dst[i] = m_cq_pattern++;
+			m_cq_write_bytes += 128;
+			m_cq_stat[1] = m_cq_write_bytes;
+		}
+		if ( !m_cq_started || m_cq_write_bytes - m_cq_read_bytes + 128 > m_cq_bytes ) {
+			if ( m_dma_free_at < t ) m_dma_free_at = t;
+		}
+		break;
+	case MOCK_DRAM:
+		while ( true ) {
+			if ( m_dram_busy ) {
+				if ( m_dram_done_at > t ) break;
+				// data lands when the command completes
+				DramCmd& c = m_dram_cur;
+				uint64_t hoff = (uint64_t)c.host_page*MOCK_DRAM_PAGE;
+				if ( hoff + (uint64_t)c.pages*MOCK_DRAM_PAGE > DMA_DRIVER_BUFFER_SIZE ) {
+					fprintf(stderr, "PcieMock DRAM command outside the DMA buffer (host page %u, %u pages)\n", c.host_page, c.pages);
+				} else {
+					for ( uint32_t i = 0; i < c.pages; i++ ) {
+						uint8_t* page = dramPage((uint64_t)c.fpga_page+i);
+						uint8_t* host = m_dmabuf + hoff + (uint64_t)i*MOCK_DRAM_PAGE;
+						if ( c.to_host ) memcpy(host, page, MOCK_DRAM_PAGE);
+						else memcpy(page, host, MOCK_DRAM_PAGE);
+					}
+				}
+				if ( c.to_host ) m_dram_read_done++;
+				else m_dram_write_done++;
+				m_dram_busy = false;
+				m_dma_free_at = m_dram_done_at;
+			}
+			if ( m_dram_cmds.empty() ) break;
+
+			m_dram_cur = m_dram_cmds.front();
+			m_dram_cmds.pop_front();
+			uint64_t start = m_dma_free_at > m_dram_cur.issued ? m_dma_free_at : m_dram_cur.issued;
+			m_dram_done_at = start + m_dma_ns + dmaCost((uint64_t)m_dram_cur.pages*MOCK_DRAM_PAGE);
+			m_dram_busy = true;
+		}
+		break;
+	}
+}
@@ -0,0 +1,137 @@
+#ifndef __PCIE_MOCK__H__
+#define __PCIE_MOCK__H__
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <deque>
+#include <map>
+
+/****
+In-process software model of the FPGA side of the PCIe link.
+Used by BdbmPcie when built with -DBDBM_MOCK, instead of /dev/bdbm_regs0 or Bluesim.
+
+It models the PcieCtrl IO queue and its io_wemit/io_remit emit counters,
+and one of the following user designs, selected with BDBM_MOCK_DEVICE:
+	echo     : (default) user registers read back the last value written
+	splitter : DMAWideCtrl send/receive slots. Every word sent is echoed back through the hw->sw ring.
+	           Models the send ring and credit status, and counts receive queue overflows
+	           as violations once credits are enabled
+	cq       : DMACircularQueue. After start, streams an incrementing 32-bit pattern into the ring.
+	           stat register 1 holds the write byte count
+	dram     : DRAMHostDMA page commands against a sparse in-memory DRAM
+
+Timing model, all default to 0 (everything completes immediately, fully deterministic):
+	BDBM_MOCK_IO_NS    : time the hardware takes to emit each user IO write or read
+	BDBM_MOCK_DMA_NS   : fixed latency of each DMA command
+	BDBM_MOCK_DMA_MBPS : DMA bandwidth in MB/s, 0 is unlimited
+	BDBM_MOCK_CQ_BYTES : DMACircularQueue ring size (default 512 KB)
+
+The host must never have more than IO_QUEUE_SIZE user writes in flight.
+Violations of this are counted and reported, to catch flow control regressions.
+****/
+
+class PcieMock {
+public:
+	static PcieMock* getInstance();
+
+	// addr is a BAR0 byte address, as used by BdbmPcie
+	void write(uint32_t addr, uint32_t data);
+	uint32_t read(uint32_t addr);
+	void waitInterrupt(int timeout);
+	void* dmaBuffer();
+
+	uint64_t violations() { return m_violations; }
+
+	typedef enum {
+		MOCK_ECHO,
+		MOCK_SPLITTER,
+		MOCK_CQ,
+		MOCK_DRAM
+	} MockDevice;
+
+private:
+	PcieMock();
+	PcieMock(PcieMock const&) = delete;
+	PcieMock& operator=(PcieMock const&) = delete;
+	static PcieMock* m_pInstance;
+
+	uint64_t now();
+	uint64_t dmaCost(uint64_t bytes);
+	void waitUntil(uint64_t t);
+	void advance();
+	void userWrite(uint32_t off, uint32_t data);
+	uint32_t userRead(uint32_t off);
+	void deviceStep(uint64_t t);
+
+	uint8_t* dramPage(uint64_t page);
+
+	pthread_mutex_t m_lock;
+
+	MockDevice m_device;
+	uint64_t m_io_ns;
+	uint64_t m_dma_ns;
+	uint64_t m_dma_mbps;
+
+	uint8_t* m_dmabuf;
+	uint32_t* m_config;
+
+	// PcieCtrl IO queue
+	typedef struct {
+		uint64_t time;
+		uint32_t off;
+		uint32_t data;
+	} PendingWrite;
+	std::deque<PendingWrite> m_pending;
+	uint64_t m_io_free_at;
+	uint32_t m_wemit;
+	uint32_t m_remit;
+	uint64_t m_violations;
+
+	// DMA engine, shared by all device models
+	uint64_t m_dma_free_at;
+
+	// echo
+	uint32_t m_regs[1024];
+
+	// splitter (DMAWideCtrl)
+	uint32_t m_write_buf[8];
+	uint32_t m_enq_idx;
+	uint32_t m_enq_received_idx;
+	uint32_t m_enq_offset;
+	std::deque<uint32_t> m_loopback; // header, d0..d3 per word
+	std::deque<uint32_t> m_recv_q; // ioRecvQ, header, d0..d3 per word
+	bool m_send_enabled;
+	bool m_send_force;
+	uint32_t m_ring_produced;
+	uint32_t m_ring_fetched;
+	uint32_t m_recv_dequeued;
+
+	// cq (DMACircularQueue)
+	bool m_cq_started;
+	uint32_t m_cq_bytes;
+	uint32_t m_cq_write_bytes;
+	uint32_t m_cq_read_bytes;
+	uint32_t m_cq_pattern;
+	uint32_t m_cq_stat[16];
+
+	// dram (DRAMHostDMA)
+	typedef struct {
+		bool to_host;
+		uint32_t host_page;
+		uint32_t fpga_page;
+		uint32_t pages;
+		uint64_t issued;
+	} DramCmd;
+	std::deque<DramCmd> m_dram_cmds;
+	bool m_dram_busy;
+	uint64_t m_dram_done_at;
+	DramCmd m_dram_cur;
+	uint32_t m_dram_host_arg;
+	uint32_t m_dram_fpga_arg;
+	uint32_t m_dram_write_done;
+	uint32_t m_dram_read_done;
+	std::map<uint64_t, uint8_t*> m_dram;
+};
+
+#endif
@@ -0,0 +1,186 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "PcieStats.h"
+
+bool PcieStats::m_enabled = false;
+__thread PcieStatsThread* PcieStats::t_local = NULL;
+
+// Thread blocks are never freed, so statistics of exited threads stay visible
+static PcieStatsThread* g_threads = NULL;
+static pthread_mutex_t g_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* g_counter_names[STAT_COUNTER_COUNT] = {
+	"write_words",
+	"write_stalls",
+	"write_stall_polls",
+	"read_words",
+	"read_stalls",
+	"read_stall_polls",
+	"scan_calls",
+	"scan_empty",
+	"scan_words",
+	"dram_to_fpga_bytes",
+	"dram_from_fpga_bytes",
+	"dram_polls",
+	"completion_polls",
+	"completion_timeouts",
+	"send_credit_waits",
+	"send_ring_words",
+	"send_doorbells"
+};
+
+static const char* g_hist_names[HIST_COUNT] = {
+	"write_stall_ns",
+	"read_wait_ns",
+	"read_ns",
+	"dram_poll_ns",
+	"dram_to_fpga_ns",
+	"dram_from_fpga_ns",
+	"completion_wait_ns",
+	"send_credit_wait_ns"
+};
+
+static void pcieStatsAtExit() {
+	char* dest = getenv("BDBM_STATS_DUMP");
+	if ( dest == NULL ) return;
+
+	if ( strcmp(dest, "stderr") == 0 ) {
+		PcieStats::dump(stderr);
+	} else if ( strcmp(dest, "stdout") == 0 || dest[0] == '\0' ) {
+		PcieStats::dump(stdout);
+	} else {
+		FILE* fout = fopen(dest, "w");
+		if ( fout == NULL ) {
+			fprintf(stderr, "PcieStats cannot open %s for dump\n", dest);
+			return;
+		}
+		PcieStats::dump(fout);
+		fclose(fout);
+	}
+}
+
+// Reads the environment once, before main
+static class PcieStatsInit {
+public:
+	PcieStatsInit() {
+		char* en = getenv("BDBM_STATS");
+		char* dest = getenv("BDBM_STATS_DUMP");
+		if ( (en != NULL && strcmp(en, "0") != 0) || dest != NULL ) {
+			PcieStats::enable(true);
+		}
+		if ( dest != NULL ) atexit(pcieStatsAtExit);
+	}
+} g_pcie_stats_init;
+
+void
+PcieStats::enable(bool on) {
+	m_enabled = on;
+}
+
+PcieStatsThread*
+PcieStats::registerThread() {
+	PcieStatsThread* t = (PcieStatsThread*)calloc(1, sizeof(PcieStatsThread));
+	pthread_mutex_lock(&g_threads_lock);
+	t->next = g_threads;
+	g_threads = t;
+	pthread_mutex_unlock(&g_threads_lock);
+	return t;
+}
+
+uint64_t
+PcieStats::counter(PcieStatCounter c) {
+	uint64_t total = 0;
+	pthread_mutex_lock(&g_threads_lock);
+	for ( PcieStatsThread* t = g_threads; t != NULL; t = t->next ) {
+		total += t->counter[c];
+	}
+	pthread_mutex_unlock(&g_threads_lock);
+	return total;
+}
+
+void
+PcieStats::histogram(PcieStatHistogram h, PcieHistogram* out) {
+	memset(out, 0, sizeof(PcieHistogram));
+	pthread_mutex_lock(&g_threads_lock);
+	for ( PcieStatsThread* t = g_threads; t != NULL; t = t->next ) {
+		PcieHistogram* src = &t->hist[h];
+		if ( src->count == 0 ) continue;
+		if ( out->count == 0 || src->min < out->min ) out->min = src->min;
+		if ( src->max > out->max ) out->max = src->max;
+		out->count += src->count;
+		out->sum += src->sum;
+		for ( int i = 0; i < PCIE_HIST_BUCKETS; i++ ) out->bucket[i] += src->bucket[i];
+	}
+	pthread_mutex_unlock(&g_threads_lock);
+}
+
+// lower bound of the values that fall into bucket b
+uint64_t
+PcieStats::bucketValue(int b) {
+	if ( b < PCIE_HIST_SUB ) return b;
+	int shift = (b>>PCIE_HIST_SUB_BITS) - 1;
+	uint64_t sub = b & (PCIE_HIST_SUB-1);
+	return (((uint64_t)PCIE_HIST_SUB)|sub)<<shift;
+}
+
+uint64_t
+PcieStats::percentile(const PcieHistogram* hist, double p) {
+	if ( hist->count == 0 ) return 0;
+	uint64_t target = (uint64_t)(p*hist->count);
+	if ( target >= hist->count ) target = hist->count - 1;
+	uint64_t seen = 0;
+	for ( int i = 0; i < PCIE_HIST_BUCKETS; i++ ) {
+		seen += hist->bucket[i];
+		if ( seen > target ) {
+			uint64_t v = bucketValue(i);
+			if ( v < hist->min ) v = hist->min;
+			if ( v > hist->max ) v = hist->max;
+			return v;
+		}
+	}
+	return hist->max;
+}
+
+void
+PcieStats::reset() {
+	pthread_mutex_lock(&g_threads_lock);
+	for ( PcieStatsThread* t = g_threads; t != NULL; t = t->next ) {
+		memset(t->counter, 0, sizeof(t->counter));
+		memset(t->hist, 0, sizeof(t->hist));
+	}
+	pthread_mutex_unlock(&g_threads_lock);
+}
+
+const char*
+PcieStats::counterName(PcieStatCounter c) {
+	return g_counter_names[c];
+}
+
+const char*
+PcieStats::histogramName(PcieStatHistogram h) {
+	return g_hist_names[h];
+}
+
+void
+PcieStats::dump(FILE* fout) {
+	fprintf(fout, "{\n\t\"counters\": {\n");
+	for ( int i = 0; i < STAT_COUNTER_COUNT; i++ ) {
+		fprintf(fout, "\t\t\"%s\": %lu%s\n", g_counter_names[i],
+			counter((PcieStatCounter)i), (i+1==STAT_COUNTER_COUNT)?"":",");
+	}
+	fprintf(fout, "\t},\n\t\"histograms\": {\n");
+	for ( int i = 0; i < HIST_COUNT; i++ ) {
+		PcieHistogram h;
+		histogram((PcieStatHistogram)i, &h);
+		fprintf(fout, "\t\t\"%s\": {\"count\": %lu, \"mean\": %.1f, \"min\": %lu, "
+			"\"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu}%s\n",
+			g_hist_names[i], h.count, h.count ? (double)h.sum/h.count : 0.0, h.min,
+			percentile(&h, 0.5), percentile(&h, 0.9), percentile(&h, 0.99),
+			percentile(&h, 0.999), h.max, (i+1==HIST_COUNT)?"":",");
+	}
+	fprintf(fout, "\t}\n}\n");
+	fflush(fout);
+}
@@ -0,0 +1,129 @@
+#ifndef __PCIE_STATS__H__
+#define __PCIE_STATS__H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/****
+Hot-path counters and latency histograms for the host library
+
+Counters and histograms are kept per thread, so recording never takes a lock.
+Recording is compiled in by default but only happens after PcieStats::enable(true),
+or when the BDBM_STATS environment variable is set to something other than "0".
+When disabled, every record site costs one predictable branch.
+Build with -DBDBM_NO_STATS to remove the record sites entirely.
+
+If BDBM_STATS_DUMP is set ("stderr", "stdout" or a file path),
+the merged statistics of all threads are dumped at exit.
+****/
+
+typedef enum {
+	STAT_WRITE_WORDS,
+	STAT_WRITE_STALLS, // writeWord ran out of budget and had to wait for io_wemit
+	STAT_WRITE_STALL_POLLS, // io_wemit reads while stalled
+	STAT_READ_WORDS,
+	STAT_READ_STALLS, // readWord ran out of budget and had to wait for io_remit
+	STAT_READ_STALL_POLLS,
+	STAT_SCAN_CALLS, // DMASplitter::scanReceive
+	STAT_SCAN_EMPTY, // scanReceive calls that found nothing
+	STAT_SCAN_WORDS,
+	STAT_DRAM_TO_FPGA_BYTES,
+	STAT_DRAM_FROM_FPGA_BYTES,
+	STAT_DRAM_POLLS, // DRAMHostDMA completion counter reads
+	STAT_COMPLETION_POLLS, // PcieCompletion status register reads
+	STAT_COMPLETION_TIMEOUTS,
+	STAT_SEND_CREDIT_WAITS, // DMASplitter sends that found no send credit
+	STAT_SEND_RING_WORDS, // words sent through the DMASplitter send ring
+	STAT_SEND_DOORBELLS,
+	STAT_COUNTER_COUNT
+} PcieStatCounter;
+
+typedef enum {
+	HIST_WRITE_STALL_NS, // time writeWord spent waiting for io_wemit
+	HIST_READ_WAIT_NS, // time readWord spent waiting for read credits
+	HIST_READ_NS, // full readWord round trip
+	HIST_DRAM_POLL_NS, // time DRAMHostDMA spent polling completion counters, per command
+	HIST_DRAM_TO_FPGA_NS, // full CopyToFPGA call
+	HIST_DRAM_FROM_FPGA_NS, // full CopyFromFPGA call
+	HIST_COMPLETION_WAIT_NS, // PcieCompletion wait, per call
+	HIST_SEND_CREDIT_WAIT_NS, // DMASplitter wait for send credit, per wait
+	HIST_COUNT
+} PcieStatHistogram;
+
+// HDR-style log-linear histogram: 16 linear sub-buckets per power of two (~6% resolution)
+#define PCIE_HIST_SUB_BITS 4
+#define PCIE_HIST_SUB (1<<PCIE_HIST_SUB_BITS)
+#define PCIE_HIST_BUCKETS (64*PCIE_HIST_SUB)
+
+typedef struct PcieHistogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+	uint64_t bucket[PCIE_HIST_BUCKETS];
+} PcieHistogram;
+
+typedef struct PcieStatsThread {
+	uint64_t counter[STAT_COUNTER_COUNT];
+	PcieHistogram hist[HIST_COUNT];
+	struct PcieStatsThread* next;
+} PcieStatsThread;
+
+class PcieStats {
+public:
+	static void enable(bool on);
+	static bool enabled() { return m_enabled; }
+
+	// totals over all threads, including threads that have exited
+	static uint64_t counter(PcieStatCounter c);
+	static void histogram(PcieStatHistogram h, PcieHistogram* out);
+	static uint64_t percentile(const PcieHistogram* hist, double p);
+	static void reset();
+	static void dump(FILE* fout);
+
+	static const char* counterName(PcieStatCounter c);
+	static const char* histogramName(PcieStatHistogram h);
+
+	static inline PcieStatsThread* local() {
+		if ( t_local == NULL ) t_local = registerThread();
+		return t_local;
+	}
+	static inline uint64_t now() {
+		timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		return ((uint64_t)t.tv_sec*1000000000ULL) + t.tv_nsec;
+	}
+	static inline void record(PcieHistogram* h, uint64_t v) {
+		h->count++;
+		h->sum += v;
+		if ( h->count == 1 || v < h->min ) h->min = v;
+		if ( v > h->max ) h->max = v;
+		h->bucket[bucketOf(v)]++;
+	}
+	static inline int bucketOf(uint64_t v) {
+		if ( v < PCIE_HIST_SUB ) return (int)v;
+		int msb = 63 - __builtin_clzll(v);
+		int shift = msb - PCIE_HIST_SUB_BITS;
+		return ((shift+1)<<PCIE_HIST_SUB_BITS) + (int)((v>>shift) & (PCIE_HIST_SUB-1));
+	}
+	static uint64_t bucketValue(int b);
+
+	static bool m_enabled;
+private:
+	static PcieStatsThread* registerThread();
+	static __thread PcieStatsThread* t_local;
+};
+
+#ifndef BDBM_NO_STATS
+#define PCIE_STAT_ADD(c, n) do { if ( PcieStats::m_enabled ) PcieStats::local()->counter[c] += (n); } while (0)
+#define PCIE_STAT_TIME() (PcieStats::m_enabled ? PcieStats::now() : 0)
+#define PCIE_STAT_RECORD(h, start) do { if ( PcieStats::m_enabled && (start) != 0 ) \
+	PcieStats::record(&PcieStats::local()->hist[h], PcieStats::now()-(start)); } while (0)
+#else
+#define PCIE_STAT_ADD(c, n) do {} while (0)
+#define PCIE_STAT_TIME() ((uint64_t)0)
+#define PCIE_STAT_RECORD(h, start) do {} while (0)
+#endif
+
+#endif
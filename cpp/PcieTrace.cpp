@@ -0,0 +1,188 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include <vector>
+
+#include "PcieTrace.h"
+
+#define TRACE_BUFFER_RECORDS 4096
+
+bool PcieTrace::m_enabled = false;
+
+// One per thread, so recording never waits on another thread. Its lock is only contended while
+// flush or close writes the buffer out. A buffer outlives its thread and goes to the next new one
+typedef struct TraceBuffer {
+	pthread_mutex_t lock;
+	PcieTraceRecord records[TRACE_BUFFER_RECORDS];
+	int count;
+	bool owned;
+} TraceBuffer;
+
+// the file, the buffer list and thread indices
+static pthread_mutex_t g_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE* g_trace_file = NULL;
+static uint64_t g_trace_start = 0;
+static std::vector<TraceBuffer*> g_trace_buffers;
+static uint16_t g_thread_next = 0;
+
+class TraceThread {
+public:
+	TraceThread() { buffer = NULL; index = 0; }
+	~TraceThread() {
+		if ( buffer == NULL ) return;
+		pthread_mutex_lock(&g_trace_lock);
+		buffer->owned = false;
+		pthread_mutex_unlock(&g_trace_lock);
+	}
+	TraceBuffer* buffer;
+	uint16_t index;
+};
+static thread_local TraceThread t_trace;
+
+static void pcieTraceAtExit() {
+	PcieTrace::close();
+}
+
+// Reads the environment once, before main
+static class PcieTraceInit {
+public:
+	PcieTraceInit() {
+		char* path = getenv("BDBM_TRACE");
+		if ( path != NULL && path[0] != '\0' ) {
+			if ( PcieTrace::open(path) ) atexit(pcieTraceAtExit);
+		}
+	}
+} g_pcie_trace_init;
+
+bool
+PcieTrace::open(const char* path) {
+	pthread_mutex_lock(&g_trace_lock);
+	if ( g_trace_file != NULL ) {
+		pthread_mutex_unlock(&g_trace_lock);
+		return true;
+	}
+	FILE* fout = fopen(path, "wb");
+	if ( fout == NULL ) {
+		fprintf(stderr, "PcieTrace cannot open %s\n", path);
+		pthread_mutex_unlock(&g_trace_lock);
+		return false;
+	}
+
+	PcieTraceHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, PCIE_TRACE_MAGIC, 8);
+	g_trace_start = now();
+	h.start_ns = g_trace_start;
+	h.record_bytes = sizeof(PcieTraceRecord);
+#if defined(BLUESIM)
+	h.backend = 1;
+#elif defined(BDBM_MOCK)
+	h.backend = 2;
+#else
+	h.backend = 0;
+#endif
+	fwrite(&h, sizeof(h), 1, fout);
+
+	// records of an earlier session are not part of this one
+	for ( size_t i = 0; i < g_trace_buffers.size(); i++ ) {
+		pthread_mutex_lock(&g_trace_buffers[i]->lock);
+		g_trace_buffers[i]->count = 0;
+		pthread_mutex_unlock(&g_trace_buffers[i]->lock);
+	}
+	g_trace_file = fout;
+	m_enabled = true;
+	pthread_mutex_unlock(&g_trace_lock);
+	return true;
+}
+
+// Takes a buffer a finished thread left behind, or a new one
+static TraceBuffer*
+traceAdopt() {
+	pthread_mutex_lock(&g_trace_lock);
+	TraceBuffer* b = NULL;
+	for ( size_t i = 0; i < g_trace_buffers.size() && b == NULL; i++ ) {
+		if ( !g_trace_buffers[i]->owned ) b = g_trace_buffers[i];
+	}
+	if ( b == NULL ) {
+		b = (TraceBuffer*)malloc(sizeof(TraceBuffer));
+		pthread_mutex_init(&b->lock, NULL);
+		b->count = 0;
+		g_trace_buffers.push_back(b);
+	}
+	b->owned = true;
+	t_trace.buffer = b;
+	t_trace.index = g_thread_next++;
+	pthread_mutex_unlock(&g_trace_lock);
+	return b;
+}
+
+// b->lock held. Blocks from different threads interleave in the file, readers sort by time_ns
+static void
+writeBuffer(TraceBuffer* b) {
+	pthread_mutex_lock(&g_trace_lock);
+	if ( g_trace_file != NULL && b->count > 0 ) {
+		fwrite(b->records, sizeof(PcieTraceRecord), b->count, g_trace_file);
+	}
+	b->count = 0;
+	pthread_mutex_unlock(&g_trace_lock);
+}
+
+// Writes out every thread's buffer. Buffers are locked before the file, as record() does
+static void
+writeAll() {
+	pthread_mutex_lock(&g_trace_lock);
+	std::vector<TraceBuffer*> buffers(g_trace_buffers);
+	pthread_mutex_unlock(&g_trace_lock);
+	for ( size_t i = 0; i < buffers.size(); i++ ) {
+		pthread_mutex_lock(&buffers[i]->lock);
+		writeBuffer(buffers[i]);
+		pthread_mutex_unlock(&buffers[i]->lock);
+	}
+}
+
+void
+PcieTrace::flush() {
+	writeAll();
+	pthread_mutex_lock(&g_trace_lock);
+	if ( g_trace_file != NULL ) fflush(g_trace_file);
+	pthread_mutex_unlock(&g_trace_lock);
+}
+
+void
+PcieTrace::close() {
+	m_enabled = false;
+	writeAll();
+	pthread_mutex_lock(&g_trace_lock);
+	if ( g_trace_file != NULL ) fclose(g_trace_file);
+	g_trace_file = NULL;
+	pthread_mutex_unlock(&g_trace_lock);
+}
+
+void
+PcieTrace::record(PcieTraceType type, uint32_t addr, uint32_t data, uint64_t start) {
+	uint64_t end = now();
+	if ( start == 0 ) start = end;
+
+	TraceBuffer* b = t_trace.buffer;
+	if ( b == NULL ) b = traceAdopt();
+
+	pthread_mutex_lock(&b->lock);
+	PcieTraceRecord* r = &b->records[b->count++];
+	r->time_ns = start - g_trace_start;
+	r->addr = addr;
+	r->data = data;
+	r->duration_ns = (end-start > 0xffffffffULL) ? 0xffffffff : (uint32_t)(end-start);
+	r->thread = t_trace.index;
+	r->type = (uint8_t)type;
+	r->pad = 0;
+
+	if ( b->count == TRACE_BUFFER_RECORDS ) writeBuffer(b);
+	pthread_mutex_unlock(&b->lock);
+}
+
+void
+PcieTrace::dmaTouch(bool write, size_t offset, size_t bytes) {
+	record(write ? TRACE_DMA_WRITE : TRACE_DMA_READ, (uint32_t)offset, (uint32_t)bytes, 0);
+}
@@ -0,0 +1,80 @@
+#ifndef __PCIE_TRACE__H__
+#define __PCIE_TRACE__H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+/****
+Transaction trace of a host library session
+
+When the BDBM_TRACE environment variable holds a file path (or after PcieTrace::open),
+every BdbmPcie writeWord/readWord/waitInterrupt call and every DMA buffer region the library
+touches is appended to a binary log. distribute/tracereplay prints, summarizes and replays it.
+
+File layout: a PcieTraceHeader, followed by PcieTraceRecords, all little endian.
+Every thread records into a buffer of its own, without a shared lock, and the buffers are
+written out in blocks when they fill and on flush() or close(). Blocks of different threads
+interleave, so readers order records by time_ns. Build with -DBDBM_NO_TRACE to remove the
+record sites.
+****/
+
+#define PCIE_TRACE_MAGIC "BDBMTRC1"
+
+typedef enum {
+	TRACE_WRITE = 1, // addr, data
+	TRACE_READ, // addr, data returned
+	TRACE_INTERRUPT, // addr = timeout
+	TRACE_DMA_READ, // host read DMA buffer bytes [addr, addr+data)
+	TRACE_DMA_WRITE // host wrote DMA buffer bytes [addr, addr+data)
+} PcieTraceType;
+
+typedef struct PcieTraceHeader {
+	char magic[8];
+	uint64_t start_ns; // CLOCK_MONOTONIC at open
+	uint32_t record_bytes;
+	uint32_t backend; // 0 pcie, 1 bsim, 2 mock
+} PcieTraceHeader;
+
+typedef struct PcieTraceRecord {
+	uint64_t time_ns; // since start_ns, when the call started
+	uint32_t addr;
+	uint32_t data;
+	uint32_t duration_ns; // until the call returned, includes flow control stalls
+	uint16_t thread; // small per-process thread index
+	uint8_t type;
+	uint8_t pad;
+} PcieTraceRecord;
+
+class PcieTrace {
+public:
+	static bool open(const char* path);
+	static void close();
+	static void flush();
+
+	static void record(PcieTraceType type, uint32_t addr, uint32_t data, uint64_t start);
+	// for application code that reads or fills the DMA buffer itself
+	static void dmaTouch(bool write, size_t offset, size_t bytes);
+
+	static inline uint64_t now() {
+		timespec t;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		return ((uint64_t)t.tv_sec*1000000000ULL) + t.tv_nsec;
+	}
+
+	static bool m_enabled;
+};
+
+#ifndef BDBM_NO_TRACE
+#define PCIE_TRACE_TIME() (PcieTrace::m_enabled ? PcieTrace::now() : 0)
+#define PCIE_TRACE(type, addr, data, start) do { if ( PcieTrace::m_enabled ) \
+	PcieTrace::record(type, addr, data, start); } while (0)
+#define PCIE_TRACE_DMA(write, offset, bytes) do { if ( PcieTrace::m_enabled ) \
+	PcieTrace::dmaTouch(write, offset, bytes); } while (0)
+#else
+#define PCIE_TRACE_TIME() ((uint64_t)0)
+#define PCIE_TRACE(type, addr, data, start) do {} while (0)
+#define PCIE_TRACE_DMA(write, offset, bytes) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "SplitterRpc.h"
+#include "PcieCompletion.h"
+
+#define RPC_SLEEP_MAX_US 50
+
+SplitterRpc::SplitterRpc(int maxInFlight) {
+	m_dma = DMASplitter::getInstance();
+	if ( maxInFlight < 1 ) maxInFlight = 1;
+	if ( maxInFlight > RPC_MAX_TAGS ) maxInFlight = RPC_MAX_TAGS;
+	m_max_in_flight = maxInFlight;
+
+	m_table.resize(maxInFlight);
+	for ( int i = maxInFlight-1; i >= 0; i-- ) {
+		m_table[i].busy = false;
+		m_free_tags.push_back(i);
+	}
+	m_in_flight.store(0);
+	m_requests.store(0);
+	m_responses.store(0);
+	m_strays.store(0);
+	m_failures.store(0);
+	m_stop = false;
+	m_broken = false;
+	m_receiver = std::thread(&SplitterRpc::receiveThread, this);
+}
+
+// Requests still in flight get a broken promise
+SplitterRpc::~SplitterRpc() {
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_stop = true;
+	}
+	m_work.notify_all();
+	m_receiver.join();
+}
+
+bool
+SplitterRpc::tooLarge(size_t bytes) {
+	if ( bytes <= (size_t)RPC_MAX_WORDS*16 ) return false;
+	fprintf(stderr, "SplitterRpc: %lu byte payload is over %d bytes, not sent\n", bytes, RPC_MAX_WORDS*16);
+	m_failures++;
+	return true;
+}
+
+bool
+SplitterRpc::takeTag(uint32_t& tag) {
+	std::unique_lock<std::mutex> lock(m_lock);
+	m_tag_free.wait(lock, [this] { return m_broken || !m_free_tags.empty(); });
+	if ( m_broken ) return false;
+	tag = m_free_tags.back();
+	m_free_tags.pop_back();
+	return true;
+}
+
+bool
+SplitterRpc::linkBroken() {
+	std::lock_guard<std::mutex> lock(m_lock);
+	return m_broken;
+}
+
+void
+SplitterRpc::send(uint8_t opcode, uint32_t tag, const void* payload, size_t bytes) {
+	const uint8_t* p = (const uint8_t*)payload;
+	size_t words = (bytes + 15)/16;
+	if ( words == 0 ) words = 1;
+
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_in_flight++;
+	}
+	m_requests++;
+	m_work.notify_one();
+
+	std::vector<PCIeWord> message(words);
+	for ( size_t i = 0; i < words; i++ ) {
+		PCIeWord& w = message[i];
+		memset(w.d, 0, sizeof(w.d));
+		size_t off = i*16;
+		if ( off < bytes ) memcpy(w.d, p + off, (bytes - off < 16) ? bytes - off : 16);
+		w.header = rpcHeader(opcode, tag, words - 1 - i);
+	}
+	// the words of one message stay together
+	bool sent;
+	int wordsSent;
+	{
+		std::lock_guard<std::mutex> lock(m_send_lock);
+		sent = m_dma->sendWords(message.data(), words, &wordsSent);
+	}
+	if ( !sent ) fail(tag, wordsSent > 0);
+}
+
+// Gives up on a request that could not be sent, completing it with RPC_SEND_FAILED outside the lock.
+// partial: some of its words went out, so the tag is retired and the link is broken
+void
+SplitterRpc::fail(uint32_t tag, bool partial) {
+	std::promise<RpcResponse> promise;
+	RpcCallback callback;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		InFlight& e = m_table[tag];
+		if ( !e.busy ) return;
+		promise = std::move(e.promise);
+		callback = std::move(e.callback);
+		e.callback = NULL;
+		e.busy = false;
+		if ( partial ) m_broken = true;
+		else m_free_tags.push_back(tag);
+		m_in_flight--;
+	}
+	if ( partial ) {
+		fprintf(stderr, "SplitterRpc: tag %u went out in part, the design has to be reset\n", tag);
+		m_tag_free.notify_all();
+	} else {
+		m_tag_free.notify_one();
+	}
+	m_failures++;
+
+	RpcResponse response;
+	response.status = RPC_SEND_FAILED;
+	response.opcode = 0;
+	if ( callback ) callback(response);
+	else promise.set_value(std::move(response));
+}
+
+// A request that never took a tag, already complete
+static std::future<RpcResponse> rpcRejected(RpcStatus status) {
+	std::promise<RpcResponse> rejected;
+	RpcResponse response;
+	response.status = status;
+	response.opcode = 0;
+	rejected.set_value(std::move(response));
+	return rejected.get_future();
+}
+
+std::future<RpcResponse>
+SplitterRpc::call(uint8_t opcode, const void* payload, size_t bytes) {
+	if ( tooLarge(bytes) ) return rpcRejected(RPC_TOO_LARGE);
+	uint32_t tag;
+	if ( !takeTag(tag) ) {
+		m_failures++;
+		return rpcRejected(RPC_SEND_FAILED);
+	}
+	std::future<RpcResponse> f;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		InFlight& e = m_table[tag];
+		e.busy = true;
+		e.started = false;
+		e.promise = std::promise<RpcResponse>();
+		e.callback = NULL;
+		f = e.promise.get_future();
+	}
+	send(opcode, tag, payload, bytes);
+	return f;
+}
+
+bool
+SplitterRpc::call(uint8_t opcode, const void* payload, size_t bytes, RpcCallback callback) {
+	if ( tooLarge(bytes) ) return false;
+	uint32_t tag;
+	if ( !takeTag(tag) ) {
+		m_failures++;
+		return false;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		InFlight& e = m_table[tag];
+		e.busy = true;
+		e.started = false;
+		e.callback = callback;
+	}
+	send(opcode, tag, payload, bytes);
+	return true;
+}
+
+// Adds w to its message, and completes the request once the message is whole
+void
+SplitterRpc::receive(const PCIeWord& w) {
+	uint32_t tag = rpcTag(w.header);
+	uint32_t left = rpcLeft(w.header);
+	std::promise<RpcResponse> promise;
+	RpcCallback callback;
+	RpcResponse response;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		if ( tag >= (uint32_t)m_max_in_flight || !m_table[tag].busy
+			|| (m_table[tag].started && left + 1 != m_table[tag].expect) ) {
+			m_strays++;
+			return;
+		}
+		InFlight& e = m_table[tag];
+		if ( !e.started ) {
+			e.started = true;
+			e.response.opcode = rpcOpcode(w.header);
+			e.response.payload.clear();
+			e.response.payload.reserve((left + 1)*4);
+		}
+		e.response.payload.insert(e.response.payload.end(), w.d, w.d + 4);
+		e.expect = left;
+		if ( left > 0 ) return;
+
+		// whole, hand it over outside the lock so the tag can be reused right away
+		response.status = RPC_OK;
+		response.opcode = e.response.opcode;
+		response.payload.swap(e.response.payload);
+		promise = std::move(e.promise);
+		callback = std::move(e.callback);
+		e.callback = NULL;
+		e.busy = false;
+		m_free_tags.push_back(tag);
+		m_in_flight--;
+	}
+	m_tag_free.notify_one();
+	m_responses++;
+
+	if ( callback ) callback(response);
+	else promise.set_value(std::move(response));
+}
+
+void
+SplitterRpc::receiveThread() {
+	uint64_t idle = 0;
+	while ( true ) {
+		{
+			std::unique_lock<std::mutex> lock(m_lock);
+			m_work.wait(lock, [this] { return m_stop || m_in_flight.load() > 0; });
+			if ( m_stop ) break;
+		}
+
+		PCIeWord w;
+		if ( m_dma->tryRecvWord(w) ) {
+			receive(w);
+			idle = 0;
+			continue;
+		}
+		// spin, then yield, then sleep up to RPC_SLEEP_MAX_US
+		pcieBackoff(++idle, RPC_SLEEP_MAX_US);
+	}
+}
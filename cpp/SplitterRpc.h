@@ -0,0 +1,135 @@
+#ifndef __SPLITTER_RPC__H__
+#define __SPLITTER_RPC__H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "dmasplitter.h"
+
+/****
+Asynchronous requests and responses over DMASplitter
+
+Every 128 bit DMASplitter word of a message carries the same opcode and tag in its header,
+and the number of words of the message still to come:
+	header[31:24] opcode, header[23:12] tag, header[11:0] words after this one
+so a message is 1 to RPC_MAX_WORDS words (16 bytes each). A hardware kernel answers a
+request with a message of any opcode and length, under the request's tag. Responses may come
+back in any order, and their words may interleave with other responses', as long as each
+message's own words stay in order.
+
+call() takes a free tag, records the request in the in-flight table and sends it, without
+waiting for anything but a free tag, so up to maxInFlight requests are outstanding at once.
+The response completes a std::future, or runs a callback on the receive thread.
+The receive thread scans DMASplitter only while something is in flight.
+Every response carries a status. A payload over RPC_MAX_WORDS*16 bytes is rejected before it
+takes a tag: the future holds RPC_TOO_LARGE, or the callback call() returns false. A request
+whose words DMASplitter could not send completes with RPC_SEND_FAILED, on the thread that
+called call(). Both count in failures().
+If DMASplitter gave up after some words of a message went out, the design holds half a
+message under that tag and the link is out of step: the tag is retired, and from then on
+every call() fails with RPC_SEND_FAILED (linkBroken()) until the design is reset and a new
+SplitterRpc is made. A send that failed before its first word only frees the tag.
+call() may be used from any number of threads. Nothing else may use the DMASplitter
+while a SplitterRpc exists.
+****/
+
+#define RPC_TAG_BITS 12
+#define RPC_LEFT_BITS 12
+#define RPC_MAX_TAGS (1<<RPC_TAG_BITS)
+#define RPC_MAX_WORDS (1<<RPC_LEFT_BITS)
+#define RPC_DEFAULT_IN_FLIGHT 256
+
+static inline uint32_t rpcHeader(uint8_t opcode, uint32_t tag, uint32_t left) {
+	return ((uint32_t)opcode << 24) | (tag << RPC_LEFT_BITS) | left;
+}
+static inline uint8_t rpcOpcode(uint32_t header) { return header >> 24; }
+static inline uint32_t rpcTag(uint32_t header) { return (header >> RPC_LEFT_BITS) & (RPC_MAX_TAGS-1); }
+static inline uint32_t rpcLeft(uint32_t header) { return header & (RPC_MAX_WORDS-1); }
+
+typedef enum {
+	RPC_OK = 0,
+	RPC_TOO_LARGE,   // payload over RPC_MAX_WORDS*16 bytes, nothing was sent
+	RPC_SEND_FAILED  // DMASplitter gave up sending the request
+} RpcStatus;
+
+typedef struct RpcResponse {
+	RpcStatus status;
+	// opcode and payload only with RPC_OK
+	uint8_t opcode;
+	// whole words, 4 per 128 bit DMASplitter word
+	std::vector<uint32_t> payload;
+} RpcResponse;
+
+typedef std::function<void(const RpcResponse&)> RpcCallback;
+
+class SplitterRpc {
+public:
+	SplitterRpc(int maxInFlight = RPC_DEFAULT_IN_FLIGHT);
+	~SplitterRpc();
+
+	// bytes of payload, padded with zeros to whole words. Blocks while maxInFlight are out.
+	// The callback form returns false, without running callback, for a payload that is too large
+	// or once the link is broken
+	std::future<RpcResponse> call(uint8_t opcode, const void* payload, size_t bytes);
+	bool call(uint8_t opcode, const void* payload, size_t bytes, RpcCallback callback);
+
+	int inFlight() { return m_in_flight.load(); }
+	uint64_t requests() { return m_requests.load(); }
+	uint64_t responses() { return m_responses.load(); }
+	// words that matched no request in flight, dropped
+	uint64_t strays() { return m_strays.load(); }
+	// requests rejected as too large, or DMASplitter gave up sending
+	uint64_t failures() { return m_failures.load(); }
+	// a message went out in part, the design has to be reset
+	bool linkBroken();
+
+private:
+	typedef struct {
+		bool busy;
+		bool started;
+		uint32_t expect;
+		std::promise<RpcResponse> promise;
+		RpcCallback callback;
+		RpcResponse response;
+	} InFlight;
+
+	bool tooLarge(size_t bytes);
+	// false once the link is broken
+	bool takeTag(uint32_t& tag);
+	void send(uint8_t opcode, uint32_t tag, const void* payload, size_t bytes);
+	void receiveThread();
+	void receive(const PCIeWord& w);
+	void fail(uint32_t tag, bool partial);
+
+	DMASplitter* m_dma;
+	int m_max_in_flight;
+	std::vector<InFlight> m_table;
+
+	// tags, the in-flight table entries and the free list
+	std::mutex m_lock;
+	std::condition_variable m_tag_free;
+	std::condition_variable m_work;
+	std::vector<uint32_t> m_free_tags;
+	// a message is several register writes, or ring entries
+	std::mutex m_send_lock;
+
+	std::atomic<int> m_in_flight;
+	std::atomic<uint64_t> m_requests;
+	std::atomic<uint64_t> m_responses;
+	std::atomic<uint64_t> m_strays;
+	std::atomic<uint64_t> m_failures;
+	bool m_stop;
+	bool m_broken;
+	std::thread m_receiver;
+};
+
+#endif
@@ -17,6 +17,8 @@
 
 
 #include "bdbmpcie.h"
+#include "PcieStats.h"
+#include "PcieTrace.h"
 
 
 void interruptHandler() {
@@ -129,12 +131,33 @@ BdbmPcie::Init_Pcie() {
 	//pthread_create(&pollThread, NULL, bdbmPollThread, NULL);
 }
 
+// In-process device model, see PcieMock.h
+void
+BdbmPcie::Init_Mock() {
+	this->bsim = false;
+#ifdef BDBM_MOCK
+	this->mock = PcieMock::getInstance();
+	this->mmap_io = NULL;
+	this->mmap_dma = mock->dmaBuffer();
+	this->reg_fd = -1;
+
+	ioWrite(0, 0); // Init
+
+	this->io_wreq = 0;
+	this->io_rreq = 0;
+	this->io_wbudget = 0;
+	this->io_rbudget = 0;
+#endif
+}
+
 BdbmPcie::BdbmPcie() {
 	pthread_mutex_init(&write_lock, NULL);
 	pthread_mutex_init(&read_lock, NULL);
 	//pthread_cond_init(&pcie_cond, NULL);
 #ifdef BLUESIM
 	this->Init_Bluesim();
+#elif defined(BDBM_MOCK)
+	this->Init_Mock();
 #else
 	this->Init_Pcie();
 #endif
@@ -144,34 +167,52 @@ void
 BdbmPcie::userWriteWord(unsigned int addr, unsigned int data) {
 	this->writeWord(addr+CONFIG_BUFFER_SIZE, data);
 }
-inline void
+void
 BdbmPcie::writeWord(unsigned int addr, unsigned int data) {
+	uint64_t trace_start = PCIE_TRACE_TIME();
 #ifdef BLUESIM
 	uint64_t d1 = 1;
 	d1 <<= (32+24);
 	uint64_t d2 = addr;
 	d2 <<= (32);
 	uint64_t d = ((uint64_t)data) | d1 | d2;
-	while ( outfifo->full() ) {usleep(1000);}
+	PCIE_STAT_ADD(STAT_WRITE_WORDS, 1);
+	if ( outfifo->full() ) {
+		uint64_t stall_start = PCIE_STAT_TIME();
+		PCIE_STAT_ADD(STAT_WRITE_STALLS, 1);
+		while ( outfifo->full() ) {
+			usleep(1000);
+			PCIE_STAT_ADD(STAT_WRITE_STALL_POLLS, 1);
+		}
+		PCIE_STAT_RECORD(HIST_WRITE_STALL_NS, stall_start);
+	}
 	
 	outfifo->push(d);
+	PCIE_TRACE(TRACE_WRITE, addr, data, trace_start);
 #else
 
 	pthread_mutex_lock(&write_lock);
-	unsigned int* ummd = (unsigned int*)this->mmap_io;
+	PCIE_STAT_ADD(STAT_WRITE_WORDS, 1);
 	if ( io_wbudget > 0 ) {
 		io_wbudget--;
 
-		ummd[(addr>>2)] = data;
+		ioWrite(addr>>2, data);
 		pthread_mutex_unlock(&write_lock);
+		PCIE_TRACE(TRACE_WRITE, addr, data, trace_start);
 		return;
 	}
-	unsigned int io_wemit = ummd[CONFIG_BUFFER_ISIZE-1];
+	uint64_t stall_start = PCIE_STAT_TIME();
+	unsigned int io_wemit = ioRead(CONFIG_BUFFER_ISIZE-1);
+	bool stalled = ( io_wreq - io_wemit >= IO_QUEUE_SIZE/2 );
+	if ( stalled ) {
+		PCIE_STAT_ADD(STAT_WRITE_STALLS, 1);
+	}
 
 	int waitcount = 0;
 	while ( io_wreq - io_wemit >= IO_QUEUE_SIZE/2 ) {
 		//usleep(50);
-		io_wemit = ummd[CONFIG_BUFFER_ISIZE-1];
+		io_wemit = ioRead(CONFIG_BUFFER_ISIZE-1);
+		PCIE_STAT_ADD(STAT_WRITE_STALL_POLLS, 1);
 
 		if ( waitcount <= 1024*1024*128) {
 			waitcount ++;
@@ -181,11 +222,16 @@ BdbmPcie::writeWord(unsigned int addr, unsigned int data) {
 		}
 	}
 	
+	if ( stalled ) {
+		PCIE_STAT_RECORD(HIST_WRITE_STALL_NS, stall_start);
+	}
+
 	this->io_wbudget = IO_QUEUE_SIZE - ( io_wreq - io_wemit);
 	this->io_wreq += IO_QUEUE_SIZE - ( io_wreq - io_wemit)+1;
 
-	ummd[(addr>>2)] = data;
+	ioWrite(addr>>2, data);
 	pthread_mutex_unlock(&write_lock);
+	PCIE_TRACE(TRACE_WRITE, addr, data, trace_start);
 #endif
 }
 
@@ -196,10 +242,13 @@ BdbmPcie::userReadWord(unsigned int addr) {
 
 uint32_t
 BdbmPcie::readWord(unsigned int addr) {
+	uint64_t trace_start = PCIE_TRACE_TIME();
 #ifdef BLUESIM
 	uint64_t d2 = addr;
 	d2 <<= (32);
 	uint64_t d = d2;
+	uint64_t read_start = PCIE_STAT_TIME();
+	PCIE_STAT_ADD(STAT_READ_WORDS, 1);
 	while ( outfifo->full() ) {usleep(1000);}
 	
 	outfifo->push(d);
@@ -207,40 +256,55 @@ BdbmPcie::readWord(unsigned int addr) {
 	while ( infifo->empty() ) {usleep(1000);}
 	uint64_t data = infifo->tail();
 	infifo->pop();
+	PCIE_STAT_RECORD(HIST_READ_NS, read_start);
 
 	uint32_t rd = data;
+	PCIE_TRACE(TRACE_READ, addr, rd, trace_start);
 	return rd;
 #else
 	pthread_mutex_lock(&read_lock);
-	unsigned int* ummd = (unsigned int*)this->mmap_io;
+	uint64_t read_start = PCIE_STAT_TIME();
+	PCIE_STAT_ADD(STAT_READ_WORDS, 1);
 
 	//TODO lock?
 	if ( io_rbudget > 0 ) {
 		io_rreq = (0xffff & (io_rreq + 1));
 		io_rbudget--;
 
-		unsigned int data = ummd[(addr>>2)];
+		unsigned int data = ioRead(addr>>2);
+		PCIE_STAT_RECORD(HIST_READ_NS, read_start);
 		pthread_mutex_unlock(&read_lock);
+		PCIE_TRACE(TRACE_READ, addr, data, trace_start);
 		return data;
 	}
 
-	unsigned int io_remit = ummd[CONFIG_BUFFER_ISIZE-2];
+	unsigned int io_remit = ioRead(CONFIG_BUFFER_ISIZE-2);
 	io_remit = (io_remit & 0xffff);
 	unsigned int iob = io_rreq;
 	if ( io_remit > iob ) {
 		iob += 0x10000;
 	}
 
+	bool stalled = ( iob >= io_remit + IO_QUEUE_SIZE );
+	if ( stalled ) {
+		PCIE_STAT_ADD(STAT_READ_STALLS, 1);
+	}
 	while ( iob >= io_remit + IO_QUEUE_SIZE ) {
 		usleep(100);
-		io_remit = (ummd[CONFIG_BUFFER_ISIZE-2] & 0xffff);
+		io_remit = (ioRead(CONFIG_BUFFER_ISIZE-2) & 0xffff);
+		PCIE_STAT_ADD(STAT_READ_STALL_POLLS, 1);
+	}
+	if ( stalled ) {
+		PCIE_STAT_RECORD(HIST_READ_WAIT_NS, read_start);
 	}
 
 	this->io_rbudget = io_remit + IO_QUEUE_SIZE - iob;
 
-	unsigned int data = ummd[(addr>>2)];
+	unsigned int data = ioRead(addr>>2);
 	io_rreq = (0xffff & (io_rreq + 1));
+	PCIE_STAT_RECORD(HIST_READ_NS, read_start);
 	pthread_mutex_unlock(&read_lock);
+	PCIE_TRACE(TRACE_READ, addr, data, trace_start);
 	return data;
 #endif
 }
@@ -252,6 +316,7 @@ BdbmPcie::waitInterrupt() {
 
 void
 BdbmPcie::waitInterrupt(int timeout) {
+	uint64_t trace_start = PCIE_TRACE_TIME();
 #ifdef BLUESIM
 
 	//while ( interruptfifo->empty() ) {usleep(1000);}
@@ -261,7 +326,11 @@ BdbmPcie::waitInterrupt(int timeout) {
 		interruptfifo->pop();
 	}
 
+	PCIE_TRACE(TRACE_INTERRUPT, (uint32_t)timeout, 0, trace_start);
 	return;
+#elif defined(BDBM_MOCK)
+	mock->waitInterrupt(timeout);
+	PCIE_TRACE(TRACE_INTERRUPT, (uint32_t)timeout, 0, trace_start);
 #else
 	int bdbmregsfd = this->reg_fd;
 
@@ -271,6 +340,7 @@ BdbmPcie::waitInterrupt(int timeout) {
 
 	poll(&pfd, 1, timeout);
 
+	PCIE_TRACE(TRACE_INTERRUPT, (uint32_t)timeout, 0, trace_start);
 	return;
 #endif
 }
@@ -287,7 +357,7 @@ return mmap_dma;
 
 void 
 BdbmPcie::Ioctl(unsigned int cmd, unsigned long arg) {
-#ifdef BLUESIM
+#if defined(BLUESIM) || defined(BDBM_MOCK)
 #else
 	int res = ioctl(this->reg_fd, cmd, arg);
 #endif
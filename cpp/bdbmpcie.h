@@ -4,11 +4,16 @@
 #include <pthread.h>
 
 #include "ShmFifo.h"
+#ifdef BDBM_MOCK
+#include "PcieMock.h"
+#endif
 
 #ifndef __BDBM_PCIE__H__
 #define __BDBM_PCIE__H__
 
 #define DMA_BUFFER_SIZE (1024*1024*4)
+// The driver only backs the first 1 MB of the DMA_BUFFER_SIZE mapping
+#define DMA_DRIVER_BUFFER_SIZE (1024*1024)
 #define BAR0_SIZE (1024*1024)
 //For BSIM
 #define SHM_SIZE ((1024*8*3) + DMA_BUFFER_SIZE)
@@ -38,6 +43,23 @@ private:
 	BdbmPcie();
 	void Init_Bluesim();
 	void Init_Pcie();
+	void Init_Mock();
+
+	// BAR0 access for the PCIe and mock backends, idx in 32-bit words
+	inline uint32_t ioRead(unsigned int idx) {
+#ifdef BDBM_MOCK
+		return mock->read(idx<<2);
+#else
+		return ((volatile unsigned int*)this->mmap_io)[idx];
+#endif
+	}
+	inline void ioWrite(unsigned int idx, unsigned int data) {
+#ifdef BDBM_MOCK
+		mock->write(idx<<2, data);
+#else
+		((volatile unsigned int*)this->mmap_io)[idx] = data;
+#endif
+	}
 
 	BdbmPcie(BdbmPcie const&) = delete;
 	BdbmPcie& operator=(BdbmPcie const&) = delete;
@@ -65,6 +87,9 @@ private:
 	void* mmap_io;
 	int reg_fd;
 //#endif
+#ifdef BDBM_MOCK
+	PcieMock* mock;
+#endif
 
 	pthread_mutex_t write_lock;
 	pthread_mutex_t read_lock;
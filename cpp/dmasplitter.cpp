@@ -1,4 +1,9 @@
+#include <time.h>
+
 #include "dmasplitter.h"
+#include "PcieCompletion.h"
+#include "PcieStats.h"
+#include "PcieTrace.h"
 
 DMASplitter*
 DMASplitter::m_pInstance = NULL;
@@ -30,6 +35,12 @@ DMASplitter::DMASplitter() {
 	pthread_mutex_init(&recv_lock, NULL);
 	pthread_cond_init(&recv_cond, NULL);
 
+	sendStatus = (volatile uint32_t*)((uint8_t*)dmabuf + SPLITTER_SEND_STATUS_OFFSET);
+	sendEnabled = false;
+	sendCapacity = 0;
+	regWordsSent = 0;
+	ringPosted = 0;
+
 	//init enqReceiveIdx
 	pcie->writeWord((IO_USER_OFFSET+16)*4, 0);
 	//init enqIdx
@@ -39,37 +50,169 @@ DMASplitter::DMASplitter() {
 }
 
 
-void 
+bool 
 DMASplitter::sendWord(PCIeWord word) {
 	BdbmPcie* pcie = BdbmPcie::getInstance();
+	if ( sendEnabled ) {
+		if ( !waitSendCredit(false, 1) ) return false;
+		regWordsSent++;
+	}
 
 	
 	pcie->writeWord((IO_USER_OFFSET+4)*4, word.header);
 	for ( int i = 3; i >= 0; i-- ) {
 		pcie->writeWord((IO_USER_OFFSET+i)*4, word.d[i]);
 	}
+	return true;
 }
 
-void 
+bool 
 DMASplitter::sendWord(uint32_t header, uint32_t d1, uint32_t d2, uint32_t d3, uint32_t d4) {
 	BdbmPcie* pcie = BdbmPcie::getInstance();
+	if ( sendEnabled ) {
+		if ( !waitSendCredit(false, 1) ) return false;
+		regWordsSent++;
+	}
 
 	pcie->writeWord((IO_USER_OFFSET+4)*4, header);
 	pcie->writeWord((IO_USER_OFFSET+3)*4, d4);
 	pcie->writeWord((IO_USER_OFFSET+2)*4, d3);
 	pcie->writeWord((IO_USER_OFFSET+1)*4, d2);
 	pcie->writeWord((IO_USER_OFFSET+0)*4, d1);
+	return true;
 }
 
-void 
+bool 
 DMASplitter::sendWord(uint32_t header, uint32_t d1, uint32_t d2) {
 	BdbmPcie* pcie = BdbmPcie::getInstance();
+	if ( sendEnabled ) {
+		if ( !waitSendCredit(false, 1) ) return false;
+		regWordsSent++;
+	}
 
 	pcie->writeWord((IO_USER_OFFSET+4)*4, header);
 	pcie->writeWord((IO_USER_OFFSET+1)*4, d2);
 	pcie->writeWord((IO_USER_OFFSET+0)*4, d1);
+	return true;
 }
 
+static double sendNow() {
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + (double)t.tv_nsec/1000000000;
+}
+
+bool
+DMASplitter::enableSendRing() {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	if ( sendEnabled ) return true;
+
+	// the answer is a DMA write into the status words, not a register PcieCompletion could
+	// watch, so this polls memory with the same backoff
+	sendStatus[3] = 0;
+	pcie->writeWord((IO_USER_OFFSET+19)*4, 1);
+	double started = sendNow();
+	uint64_t idle = 0;
+	while ( (sendStatus[3] & 0xffffff00) != SPLITTER_SEND_CREDIT_MAGIC ) {
+		idle++;
+		if ( idle >= PCIE_COMPLETION_SPINS && (sendNow() - started)*1000 > SPLITTER_PROBE_TIMEOUT_MS ) break;
+		pcieBackoff(idle);
+	}
+	if ( (sendStatus[3] & 0xffffff00) != SPLITTER_SEND_CREDIT_MAGIC ) {
+		fprintf(stderr, "DMASplitter: design has no send ring, sending through registers\n");
+		return false;
+	}
+
+	// pick up the counts wherever the hardware has them, with nothing of ours queued
+	uint32_t dequeued = sendStatus[1];
+	uint32_t fetched = sendStatus[0];
+	sendCapacity = sendStatus[3] & 0xff;
+	ringPosted = sendStatus[2];
+	regWordsSent = dequeued - fetched;
+	sendEnabled = true;
+	// a previous run's entries have to be fetched before the ring is ours
+	if ( !waitSendCredit(true, SPLITTER_SEND_RING_ENTRIES) ) {
+		sendEnabled = false;
+		return false;
+	}
+	return true;
+}
+
+bool
+DMASplitter::waitSendCredit(bool ring, uint32_t count) {
+	uint64_t idle = 0;
+	uint64_t start = 0;
+	double started = 0;
+	while ( true ) {
+		// dequeued before fetched, so an update landing in between only makes the queue look fuller
+		uint32_t dequeued = sendStatus[1];
+		uint32_t fetched = sendStatus[0];
+		if ( ring ) {
+			if ( ringPosted - fetched + count <= SPLITTER_SEND_RING_ENTRIES ) break;
+		} else {
+			// register words must not pass ring words still waiting to be fetched
+			if ( ringPosted == fetched && regWordsSent + fetched - dequeued + count <= sendCapacity ) break;
+		}
+
+		if ( idle == 0 ) {
+			PCIE_STAT_ADD(STAT_SEND_CREDIT_WAITS, 1);
+			start = PCIE_STAT_TIME();
+			started = sendNow();
+		}
+		idle++;
+		if ( idle >= PCIE_COMPLETION_SPINS && (sendNow() - started)*1000 > SPLITTER_SEND_TIMEOUT_MS ) {
+			fprintf(stderr, "DMASplitter: no send credit for %d ms (%s, posted %u fetched %u, register words %u dequeued %u, depth %u)\n",
+				SPLITTER_SEND_TIMEOUT_MS, ring ? "ring" : "registers", ringPosted, fetched, regWordsSent, dequeued, sendCapacity);
+			PCIE_STAT_RECORD(HIST_SEND_CREDIT_WAIT_NS, start);
+			return false;
+		}
+		pcieBackoff(idle, 10);
+	}
+	if ( idle > 0 ) PCIE_STAT_RECORD(HIST_SEND_CREDIT_WAIT_NS, start);
+	return true;
+}
+
+bool
+DMASplitter::sendWords(const PCIeWord* words, int count, int* sent) {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	int done = 0;
+	if ( sent != NULL ) *sent = 0;
+	if ( !sendEnabled ) {
+		for ( ; done < count; done++ ) {
+			if ( !sendWord(words[done]) ) break;
+		}
+		if ( sent != NULL ) *sent = done;
+		return done == count;
+	}
+
+	uint32_t* ring = (uint32_t*)((uint8_t*)pcie->dmaBuffer() + SPLITTER_SEND_RING_OFFSET);
+	while ( done < count ) {
+		// as much of the rest as the ring has room for, one doorbell each time
+		if ( !waitSendCredit(true, 1) ) return false;
+		uint32_t room = SPLITTER_SEND_RING_ENTRIES - (ringPosted - sendStatus[0]);
+		uint32_t n = (uint32_t)(count - done) < room ? (uint32_t)(count - done) : room;
+		for ( uint32_t i = 0; i < n; i++ ) {
+			uint32_t slot = (ringPosted + i) % SPLITTER_SEND_RING_ENTRIES;
+			uint32_t* e = ring + slot*8;
+			const PCIeWord& w = words[done + i];
+			e[0] = w.d[0];
+			e[1] = w.d[1];
+			e[2] = w.d[2];
+			e[3] = w.d[3];
+			e[4] = w.header;
+			PCIE_TRACE_DMA(true, SPLITTER_SEND_RING_OFFSET + slot*32, 32);
+		}
+		ringPosted += n;
+		done += n;
+		// the entries must be in memory before the hardware hears of them
+		__sync_synchronize();
+		pcie->writeWord((IO_USER_OFFSET+18)*4, ringPosted);
+		PCIE_STAT_ADD(STAT_SEND_RING_WORDS, n);
+		PCIE_STAT_ADD(STAT_SEND_DOORBELLS, 1);
+		if ( sent != NULL ) *sent = done;
+	}
+	return true;
+}
 
 int
 DMASplitter::scanReceive() {
@@ -91,6 +234,7 @@ DMASplitter::scanReceive() {
 			w.d[2] = ubuf[u32off+2];
 			w.d[3] = ubuf[u32off+3];
 			w.header = ubuf[u32off+4];
+			PCIE_TRACE_DMA(false, u32off*sizeof(uint32_t), 32);
 			
 			pthread_mutex_lock(&recv_lock);
 			recvList.push_front(w);
@@ -105,6 +249,13 @@ DMASplitter::scanReceive() {
 		}
 	}
 
+	PCIE_STAT_ADD(STAT_SCAN_CALLS, 1);
+	if ( recvd == 0 ) {
+		PCIE_STAT_ADD(STAT_SCAN_EMPTY, 1);
+	} else {
+		PCIE_STAT_ADD(STAT_SCAN_WORDS, recvd);
+	}
+
 	nextrecvoff = nextrecvoff+recvd;
 	//enqReceiveIdx
 	if ( recvd > 0 ) {
@@ -135,14 +286,31 @@ DMASplitter::recvWord() {
 	return w;
 }
 
+bool
+DMASplitter::tryRecvWord(PCIeWord& word) {
+	pthread_mutex_lock(&recv_lock);
+	bool empty = recvList.empty();
+	pthread_mutex_unlock(&recv_lock);
+	if ( empty ) scanReceive();
+
+	pthread_mutex_lock(&recv_lock);
+	bool found = !recvList.empty();
+	if ( found ) {
+		word = recvList.back();
+		recvList.pop_back();
+	}
+	pthread_mutex_unlock(&recv_lock);
+	return found;
+}
+
 void* 
 DMASplitter::dmaBuffer() {
 	BdbmPcie* pcie = BdbmPcie::getInstance();
 	void* dmabuf = pcie->dmaBuffer();
 	uint8_t* bbuf = (uint8_t*)dmabuf;
 
-	//+1024*4 because of hw->sw queue
-	return (void*)(bbuf+(1024*4));
+	//+64K because of the hw->sw queue and the send ring
+	return (void*)(bbuf+SPLITTER_USER_DMA_OFFSET);
 }
 
 void* dmaSplitterThread(void* arg) {
@@ -11,6 +11,20 @@
 
 #define IO_USER_OFFSET 4096
 
+// DMAWideCtrl owns the first 64 KB of the DMA buffer: the 4 KB hw->sw ring, the send credit
+// status and the send ring (see enableSendRing). User DMA starts after them, at dmaBuffer()
+#define SPLITTER_SEND_STATUS_OFFSET (4*1024)
+#define SPLITTER_SEND_RING_OFFSET (8*1024)
+#define SPLITTER_SEND_RING_ENTRIES 1024
+#define SPLITTER_USER_DMA_OFFSET (64*1024)
+#define SPLITTER_SEND_CREDIT_MAGIC 0xc4ed1700
+// overridable at build time, e.g. by the selftest that waits it out on purpose
+#ifndef SPLITTER_SEND_TIMEOUT_MS
+#define SPLITTER_SEND_TIMEOUT_MS 10000
+#endif
+// how long enableSendRing waits for the design to answer its probe
+#define SPLITTER_PROBE_TIMEOUT_MS 1000
+
 #ifndef __DMA_SPLITTER__H__
 #define __DMA_SPLITTER__H__
 
@@ -25,11 +39,31 @@ class DMASplitter {
 public:
 	static DMASplitter* getInstance();
 
-	//sends 16 bytes (128 bits)
-	void sendWord(uint32_t header, uint32_t d1, uint32_t d2, uint32_t d3, uint32_t d4);
-	void sendWord(uint32_t header, uint32_t d1, uint32_t d2);
-	void sendWord(PCIeWord word);
+	//sends 16 bytes (128 bits). false if the hardware gave no send credit before the timeout
+	bool sendWord(uint32_t header, uint32_t d1, uint32_t d2, uint32_t d3, uint32_t d4);
+	bool sendWord(uint32_t header, uint32_t d1, uint32_t d2);
+	bool sendWord(PCIeWord word);
+	// sends count words, through the send ring with one doorbell per batch once it is enabled.
+	// false if the hardware stopped taking them, with the words that did go out in *sent.
+	// The design then holds part of the batch, so a protocol that spans words (SplitterRpc
+	// messages) is out of step and the link has to be reset before it is used again
+	bool sendWords(const PCIeWord* words, int count, int* sent = NULL);
 	PCIeWord recvWord();
+	// scans once if nothing is queued, false if there is still nothing
+	bool tryRecvWord(PCIeWord& word);
+
+	/****
+	Turns on DMAWideCtrl's send credits and send ring. Returns false, and leaves sends as they
+	were, if the loaded design does not answer or a previous run's ring entries are never fetched.
+	Afterwards sendWord only writes its registers when the hardware has reported room in its
+	receive queue, and sendWords writes words into a ring in the DMA buffer, from where the
+	hardware fetches them with DMA reads after a single doorbell register write.
+	Words keep the order they were sent in, through either path.
+	Sends that find no credit for SPLITTER_SEND_TIMEOUT_MS print the counts to stderr and
+	return false.
+	****/
+	bool enableSendRing();
+	bool sendRingEnabled() { return sendEnabled; }
 	
 	int scanReceive();
 
@@ -47,6 +81,15 @@ private:
 	std::list<PCIeWord> recvList;
 	pthread_mutex_t recv_lock;
 	pthread_cond_t recv_cond;
+
+	// Waits until count more words fit through the register path, or the ring when ring is set.
+	// false after SPLITTER_SEND_TIMEOUT_MS without room
+	bool waitSendCredit(bool ring, uint32_t count);
+	volatile uint32_t* sendStatus;
+	bool sendEnabled;
+	uint32_t sendCapacity;
+	uint32_t regWordsSent;
+	uint32_t ringPosted;
 	
 	pthread_t pollThread;
 };
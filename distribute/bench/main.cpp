@@ -0,0 +1,554 @@
+/****
+bdbm-bench: host library performance benchmark
+
+Modes (selected with -m, comma separated, or "all"):
+	mmio     : MMIO write/read latency and throughput (userWriteWord/userReadWord)
+	splitter : DMASplitter message rate (needs a design with DMAWideCtrl)
+	rpc      : SplitterRpc request rate at 1, 16 and 128 requests in flight
+	           (needs a design with DMAWideCtrl that echoes every word back)
+	cq       : DMACircularQueue streaming bandwidth (needs a design with DMACircularQueue)
+	dram     : DRAMHostDMA upload/download bandwidth (needs a design with DRAMHostDMA)
+
+Results are written as JSON to stdout, or to the file given with -o.
+Build with "make" for PCIe hardware, or "make bsim" for the Bluesim shared memory backend
+(run with BDBM_BSIM_PID set, the same way examples/ run.sh does),
+or "make mock" for the in-process mock device (exits with 2 if the mock saw IO queue overflows)
+****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <pthread.h>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#include "bdbmpcie.h"
+#include "dmasplitter.h"
+#include "SplitterRpc.h"
+#include "PcieCompletion.h"
+#include "dmacircularqueue.h"
+#include "DRAMHostDMA.h"
+
+static inline uint64_t now_ns() {
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((uint64_t)t.tv_sec*1000000000ULL) + t.tv_nsec;
+}
+
+typedef struct BenchResult {
+	std::string mode;
+	int threads;
+	size_t bytes; // bytes per operation
+	size_t ops;
+	double seconds;
+	std::vector<uint64_t> lat; // per-op latency in ns, may be empty
+} BenchResult;
+
+typedef struct BenchConfig {
+	size_t iterations;
+	std::vector<int> threads;
+	std::vector<size_t> sizes;
+	uint32_t addr; // user register used by mmio
+	uint32_t cq_stat; // user register holding the DMACircularQueue write byte count
+	size_t cq_ring; // DMACircularQueue ring size in bytes
+	size_t cq_bytes; // total bytes to stream
+	size_t dram_offset; // FPGA DRAM offset used by dram
+	bool splitter_loopback;
+	bool splitter_ring; // rpc sends through the DMASplitter send ring
+} BenchConfig;
+
+static uint64_t percentile(std::vector<uint64_t>& sorted, double p) {
+	if ( sorted.empty() ) return 0;
+	size_t idx = (size_t)(p*(sorted.size()-1)+0.5);
+	if ( idx >= sorted.size() ) idx = sorted.size()-1;
+	return sorted[idx];
+}
+
+static void printResult(FILE* fout, BenchResult& r, bool last) {
+	double opsps = r.seconds > 0 ? r.ops/r.seconds : 0;
+	double mbps = opsps*r.bytes/(1024*1024);
+	fprintf(fout, "\t\t{\"mode\": \"%s\", \"threads\": %d, \"bytes\": %zu, \"ops\": %zu, "
+		"\"seconds\": %.9f, \"ops_per_sec\": %.3f, \"mb_per_sec\": %.3f",
+		r.mode.c_str(), r.threads, r.bytes, r.ops, r.seconds, opsps, mbps);
+	if ( !r.lat.empty() ) {
+		std::sort(r.lat.begin(), r.lat.end());
+		double mean = 0;
+		for ( size_t i = 0; i < r.lat.size(); i++ ) mean += r.lat[i];
+		mean /= r.lat.size();
+		fprintf(fout, ", \"latency_ns\": {\"samples\": %zu, \"min\": %lu, \"mean\": %.1f, "
+			"\"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"p999\": %lu, \"max\": %lu}",
+			r.lat.size(), r.lat.front(), mean,
+			percentile(r.lat, 0.5), percentile(r.lat, 0.9), percentile(r.lat, 0.99),
+			percentile(r.lat, 0.999), r.lat.back());
+	}
+	fprintf(fout, "}%s\n", last?"":",");
+}
+
+
+
+/**************************************
+** MMIO
+**************************************/
+
+typedef struct MmioArg {
+	bool write;
+	uint32_t addr;
+	size_t iterations;
+	std::vector<uint64_t> lat;
+} MmioArg;
+
+void* mmioThread(void* arg) {
+	MmioArg* a = (MmioArg*)arg;
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	a->lat.resize(a->iterations);
+	for ( size_t i = 0; i < a->iterations; i++ ) {
+		uint64_t s = now_ns();
+		if ( a->write ) pcie->userWriteWord(a->addr, (uint32_t)i);
+		else pcie->userReadWord(a->addr);
+		a->lat[i] = now_ns() - s;
+	}
+	return NULL;
+}
+
+static void benchMmio(BenchConfig& cfg, std::vector<BenchResult>& results) {
+	for ( int w = 1; w >= 0; w-- ) {
+		for ( size_t t = 0; t < cfg.threads.size(); t++ ) {
+			int threads = cfg.threads[t];
+#ifdef BLUESIM
+			// the shared memory fifos have a single producer and consumer
+			if ( threads > 1 ) continue;
+#endif
+			std::vector<MmioArg> args(threads);
+			std::vector<pthread_t> tids(threads);
+			for ( int i = 0; i < threads; i++ ) {
+				args[i].write = (w==1);
+				args[i].addr = cfg.addr;
+				args[i].iterations = cfg.iterations/threads;
+			}
+
+			uint64_t start = now_ns();
+			for ( int i = 0; i < threads; i++ ) pthread_create(&tids[i], NULL, mmioThread, &args[i]);
+			for ( int i = 0; i < threads; i++ ) pthread_join(tids[i], NULL);
+			uint64_t end = now_ns();
+
+			BenchResult r;
+			r.mode = w ? "mmio_write" : "mmio_read";
+			r.threads = threads;
+			r.bytes = sizeof(uint32_t);
+			r.ops = 0;
+			r.seconds = (end-start)/1000000000.0;
+			for ( int i = 0; i < threads; i++ ) {
+				r.ops += args[i].iterations;
+				r.lat.insert(r.lat.end(), args[i].lat.begin(), args[i].lat.end());
+			}
+			results.push_back(r);
+		}
+	}
+}
+
+
+
+/**************************************
+** DMASplitter
+**************************************/
+
+// Echoes left outstanding with loopback, half of the 128 slot hw->sw ring so the card
+// never stalls on a full ring while the host is still sending
+#define BENCH_SPLITTER_OUTSTANDING 64
+
+static void benchSplitter(BenchConfig& cfg, std::vector<BenchResult>& results) {
+	DMASplitter* dma = DMASplitter::getInstance();
+	size_t outstanding = 0;
+
+	BenchResult r;
+	r.mode = "splitter_send";
+	r.threads = 1;
+	r.bytes = 16;
+	r.ops = cfg.iterations;
+	r.lat.resize(cfg.iterations);
+	uint64_t start = now_ns();
+	for ( size_t i = 0; i < cfg.iterations; i++ ) {
+		uint64_t s = now_ns();
+		if ( !dma->sendWord((uint32_t)i, i, i+1, i+2, i+3) ) {
+			fprintf(stderr, "splitter: send failed after %lu words\n", i);
+			return;
+		}
+		r.lat[i] = now_ns() - s;
+		if ( !cfg.splitter_loopback ) continue;
+
+		// drain echoes as they come, and wait for one once too many are outstanding
+		outstanding++;
+		PCIeWord w;
+		while ( outstanding > 0 && dma->tryRecvWord(w) ) outstanding--;
+		if ( outstanding >= BENCH_SPLITTER_OUTSTANDING ) {
+			dma->recvWord();
+			outstanding--;
+		}
+	}
+	r.seconds = (now_ns()-start)/1000000000.0;
+	results.push_back(r);
+
+	if ( !cfg.splitter_loopback ) return;
+
+	// round trip, assumes the hardware echoes every word back
+	BenchResult rt;
+	rt.mode = "splitter_roundtrip";
+	rt.threads = 1;
+	rt.bytes = 16;
+	rt.ops = cfg.iterations;
+	rt.lat.resize(cfg.iterations);
+	// drain the rest of the echoes of the send test
+	for ( ; outstanding > 0; outstanding-- ) dma->recvWord();
+	start = now_ns();
+	for ( size_t i = 0; i < cfg.iterations; i++ ) {
+		uint64_t s = now_ns();
+		if ( !dma->sendWord((uint32_t)i, i, i+1, i+2, i+3) ) {
+			fprintf(stderr, "splitter: round trip send failed after %lu words\n", i);
+			return;
+		}
+		dma->recvWord();
+		rt.lat[i] = now_ns() - s;
+	}
+	rt.seconds = (now_ns()-start)/1000000000.0;
+	results.push_back(rt);
+}
+
+
+
+/**************************************
+** SplitterRpc
+**************************************/
+
+// Waits until fewer than limit requests are in flight, so call() never blocks on a tag.
+// false once no response came in for timeoutMs (0 waits forever)
+static bool rpcWaitInFlight(SplitterRpc& rpc, int limit, int timeoutMs, const char* name) {
+	uint64_t progress = now_ns();
+	uint64_t responses = rpc.responses();
+	uint64_t idle = 0;
+	while ( rpc.inFlight() >= limit ) {
+		if ( rpc.responses() != responses ) {
+			responses = rpc.responses();
+			progress = now_ns();
+			idle = 0;
+		} else if ( timeoutMs > 0 && now_ns() - progress >= (uint64_t)timeoutMs*1000000 ) {
+			fprintf(stderr, "%s: %d requests in flight got no response for %d ms (%lu sent, %lu responses, %lu failures)\n",
+				name, rpc.inFlight(), timeoutMs, rpc.requests(), rpc.responses(), rpc.failures());
+			return false;
+		}
+		pcieBackoff(++idle);
+	}
+	return true;
+}
+
+// false if requests were not sent, or stopped getting responses within the PcieCompletion timeout
+static bool benchRpc(BenchConfig& cfg, std::vector<BenchResult>& results) {
+	const int depths[] = {1, 16, 128};
+	bool ring = cfg.splitter_ring && DMASplitter::getInstance()->enableSendRing();
+	int timeoutMs = pcieCompletionTimeoutMs();
+	for ( size_t d = 0; d < sizeof(depths)/sizeof(depths[0]); d++ ) {
+		char name[32];
+		sprintf(name, "splitter_rpc_depth%d%s", depths[d], ring ? "_ring" : "");
+
+		BenchResult r;
+		r.mode = name;
+		r.threads = 1;
+		r.bytes = 16;
+		r.ops = cfg.iterations;
+		r.lat.resize(cfg.iterations);
+		std::vector<uint64_t>& lat = r.lat;
+		// after r, so its receive thread is joined before the callbacks' lat goes away
+		SplitterRpc rpc(depths[d]);
+		uint64_t start = now_ns();
+		for ( size_t i = 0; i < cfg.iterations; i++ ) {
+			if ( !rpcWaitInFlight(rpc, depths[d], timeoutMs, name) ) return false;
+			uint32_t payload[4] = {(uint32_t)i, (uint32_t)i+1, (uint32_t)i+2, (uint32_t)i+3};
+			uint64_t s = now_ns();
+			rpc.call(0, payload, sizeof(payload), [&lat, i, s](const RpcResponse&) {
+				lat[i] = now_ns() - s;
+			});
+		}
+		if ( !rpcWaitInFlight(rpc, 1, timeoutMs, name) ) return false;
+		r.seconds = (now_ns()-start)/1000000000.0;
+		if ( rpc.strays() > 0 ) fprintf(stderr, "rpc: %lu stray words\n", rpc.strays());
+		if ( rpc.failures() > 0 ) {
+			fprintf(stderr, "rpc: %lu requests could not be sent\n", rpc.failures());
+			return false;
+		}
+		results.push_back(r);
+	}
+	return true;
+}
+
+
+
+/**************************************
+** DMACircularQueue
+**************************************/
+
+// Gives up on the stream when the write count stops moving for this long
+#define BENCH_CQ_TIMEOUT_NS (10*1000000000ULL)
+
+static void benchCircularQueue(BenchConfig& cfg, std::vector<BenchResult>& results) {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	DMACircularQueue* cq = DMACircularQueue::getInstance();
+	uint8_t* ring = (uint8_t*)cq->dmaBuffer();
+	uint8_t* sink = (uint8_t*)malloc(cfg.cq_ring);
+
+	BenchResult r;
+	r.mode = "cq_stream";
+	r.threads = 1;
+	r.bytes = 1;
+	r.ops = 0;
+
+	uint32_t readBytes = 0;
+	uint64_t polls = 0;
+	uint64_t start = now_ns();
+	uint64_t progress = start;
+	while ( r.ops < cfg.cq_bytes ) {
+		uint32_t written = pcie->userReadWord(cfg.cq_stat*4);
+		polls++;
+		uint32_t avail = written - readBytes;
+		if ( avail == 0 ) {
+			if ( now_ns() - progress < BENCH_CQ_TIMEOUT_NS ) continue;
+			fprintf(stderr, "cq_stream: no data for %llu s after %lu bytes, giving up\n",
+				BENCH_CQ_TIMEOUT_NS/1000000000ULL, r.ops);
+			break;
+		}
+
+		uint64_t s = now_ns();
+		uint32_t roff = readBytes % cfg.cq_ring;
+		uint32_t first = avail;
+		if ( roff + first > cfg.cq_ring ) first = cfg.cq_ring - roff;
+		memcpy(sink, ring+roff, first);
+		if ( first < avail ) memcpy(sink+first, ring, avail-first);
+		cq->deq(avail);
+		r.lat.push_back(now_ns()-s);
+
+		readBytes += avail;
+		r.ops += avail;
+		progress = now_ns();
+	}
+	r.seconds = (now_ns()-start)/1000000000.0;
+	free(sink);
+
+	results.push_back(r);
+	fprintf(stderr, "cq_stream: %lu status polls\n", polls);
+}
+
+
+
+/**************************************
+** DRAMHostDMA
+**************************************/
+
+typedef struct DramArg {
+	bool upload;
+	size_t offset;
+	size_t bytes;
+	size_t iterations;
+	uint8_t* buffer;
+	std::vector<uint64_t> lat;
+} DramArg;
+
+void* dramThread(void* arg) {
+	DramArg* a = (DramArg*)arg;
+	DRAMHostDMA* dram = DRAMHostDMA::GetInstance();
+	a->lat.resize(a->iterations);
+	for ( size_t i = 0; i < a->iterations; i++ ) {
+		uint64_t s = now_ns();
+		if ( a->upload ) dram->CopyToFPGA(a->offset, a->buffer, a->bytes);
+		else dram->CopyFromFPGA(a->offset, a->buffer, a->bytes);
+		a->lat[i] = now_ns() - s;
+	}
+	return NULL;
+}
+
+static void benchDram(BenchConfig& cfg, std::vector<BenchResult>& results) {
+	DRAMHostDMA::GetInstance();
+
+	for ( int up = 1; up >= 0; up-- ) {
+		for ( size_t si = 0; si < cfg.sizes.size(); si++ ) {
+			size_t bytes = cfg.sizes[si];
+			// keep total traffic per point roughly constant
+			size_t iterations = (64*1024*1024)/bytes;
+			if ( iterations < 4 ) iterations = 4;
+			if ( iterations > cfg.iterations ) iterations = cfg.iterations;
+
+			for ( size_t t = 0; t < cfg.threads.size(); t++ ) {
+				int threads = cfg.threads[t];
+#ifdef BLUESIM
+				if ( threads > 1 ) continue;
+#endif
+				std::vector<DramArg> args(threads);
+				std::vector<pthread_t> tids(threads);
+				for ( int i = 0; i < threads; i++ ) {
+					args[i].upload = (up==1);
+					// CopyFromFPGA pads the destination up to half the staging buffer
+					args[i].buffer = (uint8_t*)malloc(bytes + 1024*1024);
+					memset(args[i].buffer, i, bytes);
+					// each thread works on its own region
+					args[i].offset = cfg.dram_offset + i*bytes;
+					args[i].bytes = bytes;
+					args[i].iterations = iterations;
+				}
+
+				uint64_t start = now_ns();
+				for ( int i = 0; i < threads; i++ ) pthread_create(&tids[i], NULL, dramThread, &args[i]);
+				for ( int i = 0; i < threads; i++ ) pthread_join(tids[i], NULL);
+				uint64_t end = now_ns();
+
+				BenchResult r;
+				r.mode = up ? "dram_upload" : "dram_download";
+				r.threads = threads;
+				r.bytes = bytes;
+				r.ops = 0;
+				r.seconds = (end-start)/1000000000.0;
+				for ( int i = 0; i < threads; i++ ) {
+					r.ops += args[i].iterations;
+					r.lat.insert(r.lat.end(), args[i].lat.begin(), args[i].lat.end());
+					free(args[i].buffer);
+				}
+				results.push_back(r);
+			}
+		}
+	}
+}
+
+
+
+static void parseList(const char* s, std::vector<size_t>& out) {
+	out.clear();
+	char* str = strdup(s);
+	char* save = NULL;
+	for ( char* tok = strtok_r(str, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save) ) {
+		char* end = NULL;
+		size_t v = strtoull(tok, &end, 0);
+		if ( *end == 'k' || *end == 'K' ) v *= 1024;
+		else if ( *end == 'm' || *end == 'M' ) v *= 1024*1024;
+		out.push_back(v);
+	}
+	free(str);
+}
+
+static void usage(const char* name) {
+	fprintf(stderr,
+		"usage: %s [-m modes] [-n iterations] [-t threads] [-s sizes] [-o out.json]\n"
+		"\t-m  comma separated list of mmio,splitter,rpc,cq,dram or all (default mmio)\n"
+		"\t-n  operations per measurement (default 100000)\n"
+		"\t-t  comma separated thread counts (default 1,2,4)\n"
+		"\t-s  comma separated transfer sizes for dram, k/m suffixes allowed (default 4k..64m)\n"
+		"\t-a  user register byte address used by mmio (default 0)\n"
+		"\t-l  splitter: hardware echoes words back, also measure round trip\n"
+		"\t-c  rpc: send through the DMASplitter send ring instead of registers\n"
+		"\t-q  cq: stat register holding the write byte count (default 1)\n"
+		"\t-r  cq: ring size in bytes (default 512k)\n"
+		"\t-b  cq: total bytes to stream (default 256m)\n"
+		"\t-d  dram: FPGA DRAM byte offset (default 0)\n"
+		"\t-o  write JSON to this file instead of stdout\n", name);
+}
+
+int main(int argc, char** argv) {
+	BenchConfig cfg;
+	cfg.iterations = 100000;
+	cfg.threads.push_back(1);
+	cfg.threads.push_back(2);
+	cfg.threads.push_back(4);
+	for ( size_t s = 4*1024; s <= 64*1024*1024; s *= 4 ) cfg.sizes.push_back(s);
+	cfg.addr = 0;
+	cfg.cq_stat = 1;
+	cfg.cq_ring = 512*1024;
+	cfg.cq_bytes = 256*1024*1024;
+	cfg.dram_offset = 0;
+	cfg.splitter_loopback = false;
+	cfg.splitter_ring = false;
+
+	std::string modes = "mmio";
+	const char* outfile = NULL;
+
+	int c;
+	std::vector<size_t> tl;
+	while ( (c = getopt(argc, argv, "m:n:t:s:a:lcq:r:b:d:o:h")) != -1 ) {
+		switch (c) {
+			case 'm': modes = optarg; break;
+			case 'n': cfg.iterations = strtoull(optarg, NULL, 0); break;
+			case 't':
+				parseList(optarg, tl);
+				cfg.threads.clear();
+				for ( size_t i = 0; i < tl.size(); i++ ) if ( tl[i] > 0 ) cfg.threads.push_back(tl[i]);
+				break;
+			case 's': parseList(optarg, cfg.sizes); break;
+			case 'a': cfg.addr = strtoul(optarg, NULL, 0); break;
+			case 'l': cfg.splitter_loopback = true; break;
+			case 'c': cfg.splitter_ring = true; break;
+			case 'q': cfg.cq_stat = strtoul(optarg, NULL, 0); break;
+			case 'r': parseList(optarg, tl); if ( !tl.empty() ) cfg.cq_ring = tl[0]; break;
+			case 'b': parseList(optarg, tl); if ( !tl.empty() ) cfg.cq_bytes = tl[0]; break;
+			case 'd': cfg.dram_offset = strtoull(optarg, NULL, 0); break;
+			case 'o': outfile = optarg; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if ( modes == "all" ) modes = "mmio,splitter,rpc,cq,dram";
+
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	unsigned int magic = pcie->readWord(0);
+	fprintf(stderr, "Magic: %x\n", magic);
+
+	std::vector<BenchResult> results;
+	char* mstr = strdup(modes.c_str());
+	char* save = NULL;
+	for ( char* m = strtok_r(mstr, ",", &save); m != NULL; m = strtok_r(NULL, ",", &save) ) {
+		fprintf(stderr, "Running %s\n", m);
+		if ( strcmp(m, "mmio") == 0 ) benchMmio(cfg, results);
+		else if ( strcmp(m, "splitter") == 0 ) benchSplitter(cfg, results);
+		else if ( strcmp(m, "rpc") == 0 ) {
+			if ( !benchRpc(cfg, results) ) return 1;
+		}
+		else if ( strcmp(m, "cq") == 0 ) benchCircularQueue(cfg, results);
+		else if ( strcmp(m, "dram") == 0 ) benchDram(cfg, results);
+		else {
+			fprintf(stderr, "Unknown mode %s\n", m);
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	free(mstr);
+
+	FILE* fout = stdout;
+	if ( outfile != NULL ) {
+		fout = fopen(outfile, "w");
+		if ( fout == NULL ) {
+			fprintf(stderr, "Cannot open %s\n", outfile);
+			return 1;
+		}
+	}
+#ifdef BLUESIM
+	const char* backend = "bsim";
+#elif defined(BDBM_MOCK)
+	const char* backend = "mock";
+#else
+	const char* backend = "pcie";
+#endif
+	fprintf(fout, "{\n\t\"tool\": \"bdbm-bench\",\n\t\"backend\": \"%s\",\n\t\"magic\": %u,\n\t\"results\": [\n", backend, magic);
+	for ( size_t i = 0; i < results.size(); i++ ) {
+		printResult(fout, results[i], i+1 == results.size());
+	}
+	fprintf(fout, "\t]\n}\n");
+	if ( fout != stdout ) fclose(fout);
+
+#ifdef BDBM_MOCK
+	uint64_t violations = PcieMock::getInstance()->violations();
+	if ( violations > 0 ) {
+		fprintf(stderr, "mock device saw %lu IO queue overflows\n", violations);
+		return 2;
+	}
+#endif
+	return 0;
+}
@@ -7,6 +7,8 @@
 #include <linux/interrupt.h>
 
 #include <linux/highmem.h>
+#include <linux/dma-mapping.h>
+#include <linux/moduleparam.h>
 
 #include <linux/spinlock.h>
 #include <linux/spinlock_types.h>
@@ -22,6 +24,9 @@
 //must match one in PcieCtrl
 #define DMA_ADDR_OFFSET 32
 
+// Largest physically contiguous chunk allocated when dma_contig is set
+#define DMA_CONTIG_CHUNK_SIZE (2*1024*1024)
+
 
 MODULE_AUTHOR("Sang-Woo Jun");
 MODULE_LICENSE("Dual BSD/GPL");
@@ -47,6 +52,14 @@ static unsigned long bar0_size = 1024*1024;
 static void* bar0_ptr;
 static unsigned int irq;
 
+// When set, the DMA buffer is built from physically contiguous 2 MB (order 9) chunks
+// instead of individual 4 KB pages, with one DMA mapping and one userspace remap per chunk.
+// PcieCtrl still translates per 4 KB page, so the DMA_ADDR_OFFSET table keeps one entry
+// per page; the entries of a chunk form one contiguous bus range
+static int dma_contig = 0;
+module_param(dma_contig, int, S_IRUGO);
+MODULE_PARM_DESC(dma_contig, "Allocate the DMA buffer in physically contiguous 2MB chunks (default 0)");
+
 
 
 
@@ -124,6 +137,76 @@ static int create_dma_buffer(unsigned int bufcount) {
 	return 0;
 }
 
+static struct page** dma_chunks = NULL;
+static dma_addr_t* dma_chunks_bus = NULL;
+static unsigned int dma_chunks_count = 0;
+static unsigned long dma_chunk_size = DMA_CONTIG_CHUNK_SIZE;
+static void free_dma_chunks(void) {
+	unsigned int i;
+	for ( i = 0; i < dma_chunks_count; i++ ) {
+		dma_unmap_page(&pcidev->dev, dma_chunks_bus[i], dma_chunk_size, DMA_BIDIRECTIONAL);
+		__free_pages(dma_chunks[i], get_order(dma_chunk_size));
+	}
+	if ( dma_chunks != NULL ) kfree(dma_chunks);
+	if ( dma_chunks_bus != NULL ) kfree(dma_chunks_bus);
+	dma_chunks = NULL;
+	dma_chunks_bus = NULL;
+	dma_chunks_count = 0;
+}
+static int create_dma_buffer_contig(unsigned int bufcount) {
+	unsigned int i;
+	unsigned int chunkidx = 0;
+	unsigned int chunkcount;
+	unsigned long totalsize = (unsigned long)bufcount*PAGE_SIZE;
+	u8* bar0_data;
+	bar0_data = (u8*)bar0_ptr;
+
+	// whole chunks, the part past totalsize is neither published nor mapped
+	chunkcount = (totalsize+dma_chunk_size-1)/dma_chunk_size;
+
+	printk(KERN_ALERT "BlueDBM DMA contiguous buffer alloc request: %u chunks of %lx bytes\n", chunkcount, dma_chunk_size);
+
+	dma_chunks = kzalloc(sizeof(struct page*)*chunkcount, GFP_KERNEL);
+	dma_chunks_bus = kzalloc(sizeof(dma_addr_t)*chunkcount, GFP_KERNEL);
+	if ( dma_chunks == NULL || dma_chunks_bus == NULL ) {
+		printk(KERN_ERR "BlueDBM DMA dma_chunks alloc failed! \n" );
+		free_dma_chunks();
+		return 1;
+	}
+
+	for ( chunkidx = 0; chunkidx < chunkcount; chunkidx++ ) {
+		dma_addr_t bus_addr;
+		struct page* pages = alloc_pages(GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN, get_order(dma_chunk_size));
+		if ( pages == NULL ) {
+			printk(KERN_ERR "BlueDBM DMA contiguous chunk %u alloc failed! \n", chunkidx );
+			free_dma_chunks();
+			return 1;
+		}
+		bus_addr = dma_map_page(&pcidev->dev, pages, 0, dma_chunk_size, DMA_BIDIRECTIONAL);
+		if ( dma_mapping_error(&pcidev->dev, bus_addr) ) {
+			printk(KERN_ERR "BlueDBM DMA contiguous chunk %u mapping failed! \n", chunkidx );
+			__free_pages(pages, get_order(dma_chunk_size));
+			free_dma_chunks();
+			return 1;
+		}
+		dma_chunks[chunkidx] = pages;
+		dma_chunks_bus[chunkidx] = bus_addr;
+		dma_chunks_count = chunkidx+1;
+
+		// hardware still translates per 4 KB page, but every entry of a chunk
+		// now points into the same contiguous bus range
+		for ( i = 0; i < dma_chunk_size/PAGE_SIZE; i++ ) {
+			unsigned int bufidx = chunkidx*(dma_chunk_size/PAGE_SIZE) + i;
+			if ( bufidx >= bufcount ) break;
+			iowrite32(bus_addr + PAGE_SIZE*i, &bar0_data[DMA_ADDR_OFFSET + 4*bufidx]);
+		}
+		wmb();
+	}
+
+	printk(KERN_ALERT "BlueDBM DMA contiguous buffer alloc successful\n");
+	return 0;
+}
+
 
 
 
@@ -245,7 +328,15 @@ static int __init pcie_probe (struct pci_dev *dev, const struct pci_device_id *i
 	
 	printk(KERN_ALERT "PCIe read: %x @ %x\n", r32, r32n);
 	*/
-	create_dma_buffer(mmap_buffersize/(1024*4)); // 1 MB / 4KB pages
+	if ( dma_contig ) {
+		if ( create_dma_buffer_contig(mmap_buffersize/(1024*4)) ) {
+			printk(KERN_ALERT "BlueDBM falling back to 4 KB DMA pages\n");
+			dma_contig = 0;
+		}
+	}
+	if ( !dma_contig ) {
+		create_dma_buffer(mmap_buffersize/(1024*4)); // 1 MB / 4KB pages
+	}
 
 
 	return 0;
@@ -271,6 +362,7 @@ static void pcie_remove( struct pci_dev *dev) {
 		__free_page(dma_pages[i]);
 	}
 	if (dma_pages != NULL) kfree(dma_pages);
+	free_dma_chunks();
 	printk(KERN_ALERT "Freed DMA pages\n");
 
 	pci_clear_master(dev);
@@ -374,7 +466,7 @@ static int bdbm_mmap(struct file *filp, struct vm_area_struct *vma) {
 	//unsigned long bar0_psize = bar0_size - off; // 1MB - offset
 	unsigned long physical = bar0_addr + off;
 
-	int i = 0;
+	unsigned int i = 0;
 	//vma->vm_flags |= VM_RESERVED;
 
 	/*
@@ -396,8 +488,28 @@ static int bdbm_mmap(struct file *filp, struct vm_area_struct *vma) {
 		printk(KERN_ALERT "BlueDBM character device mmap to bar0 %lx success physical: %lx off: %lx\n", bar0_addr, physical, off);
 	}
 
+	// map contiguous buffer chunks, one remap_pfn_range per chunk
+	if ( off+vsize > bar0_size && dma_contig ) {
+		for ( i = 0; i < dma_chunks_count; i++ ) {
+			// the part of the chunk inside the buffer
+			unsigned long chunkoff = bar0_size + dma_chunk_size*i;
+			unsigned long chunklen = dma_chunk_size;
+			int res;
+			if ( chunkoff + chunklen > bar0_size + mmap_buffersize ) chunklen = bar0_size + mmap_buffersize - chunkoff;
+			if ( chunkoff+chunklen <= off || chunkoff >= off+vsize ) continue;
+			if ( chunkoff < off || chunkoff+chunklen > off+vsize ) {
+				printk(KERN_ALERT "BlueDBM character device mmap covers only part of chunk %u\n", i);
+				return -EINVAL;
+			}
+			res = remap_pfn_range(vma, vma->vm_start + (chunkoff - off), page_to_pfn(dma_chunks[i]), chunklen, vma->vm_page_prot);
+			if ( res ) {
+				printk(KERN_ALERT "BlueDBM character device mmap chunk %u failed %d\n", i, res);
+				return res;
+			}
+		}
+	}
 	// map buffer, if applicable
-	if ( off+vsize > bar0_size ) {
+	else if ( off+vsize > bar0_size ) {
 		unsigned int buffoff = bar0_size - off;
 		for ( i = 0; i < dma_pages_count; i++ ) {
 			unsigned int pageoff = bar0_size + PAGE_SIZE*i;
@@ -0,0 +1,543 @@
+/****
+bdbm-selftest: checks of the host library and the example codecs against the mock device
+
+Tests (all of them by default, or the ones named on the command line):
+	zfp      : pair format round trip for every bit budget, budgets outside 1..ZFP_MAX_BIT_BUDGET
+	           rejected, thread count independence, fixed-rate and fixed-accuracy modes
+	dna      : DnaCodec scalar and AVX2 encode/decode give the same bytes and masks
+	sequence : SequenceReader on a FASTA file and on 2bit files in both byte orders and versions
+	dbscan   : clusters, border and noise points of a small fixed dataset, on both indices
+	splitter : DMASplitter send ring against the splitter mock. Words keep their order across the
+	           ring and register paths, sends stop at the receive credit instead of overflowing it,
+	           a stalled sendWords reports the words that went out, and sending resumes once drained
+
+Runs against the in-process mock device only (BDBM_MOCK_DEVICE is set to splitter here).
+Every failed check prints its file and line. Exits with 1 if any check failed.
+****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include <vector>
+#include <string>
+
+#include "bdbmpcie.h"
+#include "dmasplitter.h"
+#include "PcieMock.h"
+
+#include "Zfp.h"
+#include "DnaCodec.h"
+#include "Dbscan.h"
+#include "SequenceReader.h"
+
+static int g_checks = 0;
+static int g_failures = 0;
+
+#define CHECK(cond) do { \
+	g_checks++; \
+	if ( !(cond) ) { \
+		g_failures++; \
+		printf( "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond ); \
+	} \
+} while (0)
+
+// deterministic, so a failure reproduces
+static uint32_t g_seed = 12345;
+static uint32_t nextRandom() {
+	g_seed ^= g_seed << 13;
+	g_seed ^= g_seed >> 17;
+	g_seed ^= g_seed << 5;
+	return g_seed;
+}
+
+static float randomFloat(float lo, float hi) {
+	return lo + (hi - lo)*(nextRandom() >> 8)/(float)(1<<24);
+}
+
+//--------------------------------------------------------------------------------------------
+// zfp
+//--------------------------------------------------------------------------------------------
+// Largest error of the pair format over (lat, lon) in degrees, per bit budget. The block's
+// common exponent is that of lon (up to 256), the lifting transform adds up to 4 bits of
+// growth, and every budget bit halves what is left. Measured errors sit at about half of it
+static float zfpPairBound(int budget) {
+	return 4096.0f/(float)(1 << budget);
+}
+
+static void testZfp() {
+	const size_t n = 1001; // odd, so the last point is paired with itself
+	std::vector<Point> points(n);
+	for ( size_t i = 0; i < n; i++ ) {
+		points[i].lat = randomFloat(-90, 90);
+		points[i].lon = randomFloat(-180, 180);
+	}
+
+	std::vector<uint8_t> single(zfp_compressed_bytes(n));
+	std::vector<uint8_t> multi(zfp_compressed_bytes(n));
+	std::vector<Point> out(n);
+	CHECK(zfp_compressed_bytes(n) == (n + 1)/2*ZFP_BLOCK_BYTES);
+
+	for ( int budget = 1; budget <= ZFP_MAX_BIT_BUDGET; budget++ ) {
+		CHECK(zfp_bit_budget_valid(budget));
+		size_t bytes = zfp_compress_points(&points[0], n, &single[0], budget, 1);
+		CHECK(bytes == zfp_compressed_bytes(n));
+		CHECK(zfp_compress_points(&points[0], n, &multi[0], budget, 4) == bytes);
+		CHECK(memcmp(&single[0], &multi[0], bytes) == 0);
+
+		CHECK(zfp_decompress_points(&single[0], n, &out[0], budget, 3));
+		float err = 0;
+		for ( size_t i = 0; i < n; i++ ) {
+			err = std::max(err, std::fabs(out[i].lat - points[i].lat));
+			err = std::max(err, std::fabs(out[i].lon - points[i].lon));
+		}
+		CHECK(err <= zfpPairBound(budget));
+
+		// the pair mode of the config API writes the same blocks
+		ZfpConfig config = zfp_config_pair(budget);
+		std::vector<uint8_t> stream(zfp_max_bytes(config, n*2, 1));
+		CHECK(stream.size() >= bytes);
+		size_t streamBytes = zfp_compress(config, &points[0].lat, n*2, 1, &stream[0], stream.size());
+		CHECK(streamBytes == bytes);
+		CHECK(memcmp(&stream[0], &single[0], bytes) == 0);
+	}
+
+	// budgets that do not fit ZFP_BLOCK_BYTES are refused, the output is left alone
+	int invalid[] = {0, -1, ZFP_MAX_BIT_BUDGET + 1, 32};
+	for ( size_t i = 0; i < sizeof(invalid)/sizeof(invalid[0]); i++ ) {
+		int budget = invalid[i];
+		CHECK(!zfp_bit_budget_valid(budget));
+		memset(&single[0], 0xa5, single.size());
+		CHECK(zfp_compress_points(&points[0], n, &single[0], budget, 1) == 0);
+		CHECK(single[0] == 0xa5 && single[single.size() - 1] == 0xa5);
+		CHECK(!zfp_decompress_points(&multi[0], n, &out[0], budget, 1));
+		ZfpConfig config = zfp_config_pair(budget);
+		CHECK(zfp_compress(config, &points[0].lat, n*2, 1, &single[0], single.size()) == 0);
+		CHECK(!zfp_decompress(config, &multi[0], multi.size(), &out[0].lat, n*2, 1));
+	}
+
+	// fixed rate: every block the same size, so the stream size is known up front
+	ZfpConfig rate = zfp_config_fixed_rate(16);
+	std::vector<uint8_t> rateStream(zfp_max_bytes(rate, n*2, 1));
+	size_t rateBytes = zfp_compress(rate, &points[0].lat, n*2, 1, &rateStream[0], rateStream.size());
+	CHECK(rateBytes > 0 && rateBytes <= rateStream.size());
+	CHECK(zfp_decompress(rate, &rateStream[0], rateBytes, &out[0].lat, n*2, 1));
+	// too small an output buffer is refused
+	CHECK(zfp_compress(rate, &points[0].lat, n*2, 1, &rateStream[0], rateBytes - 1) == 0);
+
+	// fixed accuracy keeps every value within the tolerance
+	const double tolerances[] = {1e-1, 1e-3};
+	for ( int t = 0; t < 2; t++ ) {
+		ZfpConfig accuracy = zfp_config_fixed_accuracy(tolerances[t]);
+		std::vector<uint8_t> stream(zfp_max_bytes(accuracy, n*2, 1));
+		size_t bytes = zfp_compress(accuracy, &points[0].lat, n*2, 1, &stream[0], stream.size());
+		CHECK(bytes > 0);
+		CHECK(zfp_decompress(accuracy, &stream[0], bytes, &out[0].lat, n*2, 1));
+		double err = 0;
+		for ( size_t i = 0; i < n; i++ ) {
+			err = std::max(err, (double)std::fabs(out[i].lat - points[i].lat));
+			err = std::max(err, (double)std::fabs(out[i].lon - points[i].lon));
+		}
+		CHECK(err <= tolerances[t]);
+	}
+}
+
+//--------------------------------------------------------------------------------------------
+// dna
+//--------------------------------------------------------------------------------------------
+// What decoding gives back: ACGT in their case, everything else N in its case
+static char dnaExpected(char c) {
+	char upper = (c >= 'a' && c <= 'z') ? c - 0x20 : c;
+	char base = (upper == 'A' || upper == 'C' || upper == 'G' || upper == 'T') ? upper : 'N';
+	return (c >= 'a' && c <= 'z') ? base | 0x20 : base;
+}
+
+static void testDna() {
+	if ( !__builtin_cpu_supports("avx2") ) {
+		printf( "dna: no AVX2 on this CPU, only the scalar round trip is checked\n" );
+	}
+	bool avx2 = __builtin_cpu_supports("avx2");
+	const char alphabet[] = "ACGTACGTacgtNnRy-";
+	const size_t lengths[] = {0, 1, 3, 4, 31, 32, 33, 63, 64, 65, 127, 222, 1000, 4099};
+	const size_t maskPositions[] = {0, 5, 37, 64};
+
+	for ( size_t l = 0; l < sizeof(lengths)/sizeof(lengths[0]); l++ ) {
+		for ( size_t m = 0; m < sizeof(maskPositions)/sizeof(maskPositions[0]); m++ ) {
+			size_t n = lengths[l];
+			size_t maskPos = maskPositions[m];
+			std::string seq(n, 'A');
+			for ( size_t i = 0; i < n; i++ ) seq[i] = alphabet[nextRandom() % (sizeof(alphabet) - 1)];
+
+			size_t bytes = dnaPackedBytes(n);
+			size_t words = dnaMaskWords(maskPos + n) + 1;
+			std::vector<uint8_t> packedScalar(bytes + 1, 0), packedAvx2(bytes + 1, 0);
+			std::vector<uint64_t> nScalar(words, 0), nAvx2(words, 0);
+			std::vector<uint64_t> lowerScalar(words, 0), lowerAvx2(words, 0);
+
+			dnaEncodeScalar(seq.c_str(), n, &packedScalar[0], &nScalar[0], &lowerScalar[0], maskPos);
+			if ( avx2 ) {
+				dnaEncodeAvx2(seq.c_str(), n, &packedAvx2[0], &nAvx2[0], &lowerAvx2[0], maskPos);
+				CHECK(packedScalar == packedAvx2);
+				CHECK(nScalar == nAvx2);
+				CHECK(lowerScalar == lowerAvx2);
+			}
+
+			// the masks only cover [maskPos, maskPos + n)
+			for ( size_t i = 0; i < maskPos; i++ ) {
+				CHECK(!((nScalar[i/64] >> (i%64)) & 1));
+			}
+
+			std::string expected(n, 'A');
+			for ( size_t i = 0; i < n; i++ ) expected[i] = dnaExpected(seq[i]);
+			std::vector<char> decoded(n + 1, 0);
+			dnaDecodeScalar(&packedScalar[0], n, &decoded[0], &nScalar[0], &lowerScalar[0], maskPos);
+			CHECK(std::string(&decoded[0], n) == expected);
+			if ( avx2 ) {
+				std::vector<char> decodedAvx2(n + 1, 0);
+				dnaDecodeAvx2(&packedScalar[0], n, &decodedAvx2[0], &nScalar[0], &lowerScalar[0], maskPos);
+				CHECK(std::string(&decodedAvx2[0], n) == expected);
+			}
+		}
+	}
+
+	// the layout the hardware reads: A=0, C=1, G=2, T=3, first base in the low bits
+	uint8_t packed[2] = {0, 0};
+	dnaEncodeScalar("ACGTT", 5, packed, NULL, NULL, 0);
+	CHECK(packed[0] == 0xe4 && packed[1] == 0x03);
+}
+
+//--------------------------------------------------------------------------------------------
+// sequence
+//--------------------------------------------------------------------------------------------
+// All sequences of a file, read in runs of at most max bases
+static bool readAll(const char* path, size_t max, std::vector<std::string>& names, std::vector<std::string>& seqs) {
+	SequenceReader reader;
+	if ( !reader.open(path) ) return false;
+	std::vector<char> buf(max);
+	uint32_t sequence;
+	size_t n;
+	while ( (n = reader.read(&buf[0], max, sequence)) > 0 ) {
+		if ( seqs.size() <= sequence ) seqs.resize(sequence + 1);
+		seqs[sequence].append(&buf[0], n);
+	}
+	for ( size_t i = 0; i < reader.sequences(); i++ ) names.push_back(reader.name(i));
+	return true;
+}
+
+static std::string tempPath(const char* suffix) {
+	char path[64];
+	snprintf(path, sizeof(path), "/tmp/bdbm-selftest-%d%s", (int)getpid(), suffix);
+	return path;
+}
+
+static void putWord(std::vector<uint8_t>& out, uint32_t v, bool bigEndian) {
+	for ( int i = 0; i < 4; i++ ) {
+		int shift = bigEndian ? 24 - 8*i : 8*i;
+		out.push_back((v >> shift) & 0xff);
+	}
+}
+
+// Blocks [start, start+size) of consecutive positions where f holds
+template <class F>
+static void putBlocks(std::vector<uint8_t>& out, const std::string& seq, F f, bool bigEndian) {
+	std::vector<uint32_t> starts, sizes;
+	for ( size_t i = 0; i < seq.size(); i++ ) {
+		if ( !f(seq[i]) ) continue;
+		if ( starts.empty() || starts.back() + sizes.back() != i ) {
+			starts.push_back(i);
+			sizes.push_back(0);
+		}
+		sizes.back()++;
+	}
+	putWord(out, starts.size(), bigEndian);
+	for ( size_t i = 0; i < starts.size(); i++ ) putWord(out, starts[i], bigEndian);
+	for ( size_t i = 0; i < sizes.size(); i++ ) putWord(out, sizes[i], bigEndian);
+}
+
+static bool isN(char c) { return (c & 0xdf) == 'N'; }
+static bool isLower(char c) { return c >= 'a' && c <= 'z'; }
+
+// A UCSC 2bit file of the given sequences
+static std::vector<uint8_t> twoBitFile(const std::vector<std::string>& names, const std::vector<std::string>& seqs, uint32_t version, bool bigEndian) {
+	std::vector<uint8_t> header, records;
+	size_t headerBytes = 16;
+	for ( size_t i = 0; i < names.size(); i++ ) headerBytes += 1 + names[i].size() + (version == 1 ? 8 : 4);
+
+	putWord(header, 0x1A412743, bigEndian);
+	putWord(header, version, bigEndian);
+	putWord(header, names.size(), bigEndian);
+	putWord(header, 0, bigEndian);
+	for ( size_t i = 0; i < seqs.size(); i++ ) {
+		header.push_back(names[i].size());
+		header.insert(header.end(), names[i].begin(), names[i].end());
+		uint64_t offset = headerBytes + records.size();
+		if ( version == 1 && bigEndian ) putWord(header, offset >> 32, bigEndian);
+		putWord(header, offset & 0xffffffff, bigEndian);
+		if ( version == 1 && !bigEndian ) putWord(header, offset >> 32, bigEndian);
+
+		const std::string& s = seqs[i];
+		putWord(records, s.size(), bigEndian);
+		putBlocks(records, s, isN, bigEndian);
+		putBlocks(records, s, isLower, bigEndian);
+		putWord(records, 0, bigEndian);
+		// T=0, C=1, A=2, G=3, first base in the high bits, N stored as T
+		std::vector<uint8_t> packed((s.size() + 3)/4, 0);
+		for ( size_t p = 0; p < s.size(); p++ ) {
+			uint8_t code = 0;
+			switch ( s[p] & 0xdf ) {
+			case 'C': code = 1; break;
+			case 'A': code = 2; break;
+			case 'G': code = 3; break;
+			}
+			packed[p/4] |= code << (6 - 2*(p%4));
+		}
+		records.insert(records.end(), packed.begin(), packed.end());
+	}
+	header.insert(header.end(), records.begin(), records.end());
+	return header;
+}
+
+static bool writeFile(const std::string& path, const void* data, size_t bytes) {
+	FILE* f = fopen(path.c_str(), "wb");
+	if ( f == NULL ) return false;
+	bool ok = fwrite(data, 1, bytes, f) == bytes;
+	return fclose(f) == 0 && ok;
+}
+
+static void testSequence() {
+	// a headerless start, a description after the name, CRLF, blank and wrapped lines
+	const char fasta[] =
+		"ACGT\nac\n"
+		">seq1 some description\n"
+		"ACGTN\r\nnnGG\n\n"
+		">seq2\n"
+		"TTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTT\nGATTACA";
+	std::string fastaPath = tempPath(".fa");
+	CHECK(writeFile(fastaPath, fasta, strlen(fasta)));
+	const size_t runs[] = {1, 3, 7, 1024};
+	for ( size_t r = 0; r < sizeof(runs)/sizeof(runs[0]); r++ ) {
+		std::vector<std::string> names, seqs;
+		CHECK(readAll(fastaPath.c_str(), runs[r], names, seqs));
+		CHECK(names.size() == 3 && seqs.size() == 3);
+		if ( names.size() != 3 || seqs.size() != 3 ) continue;
+		CHECK(names[0] == "" && names[1] == "seq1" && names[2] == "seq2");
+		CHECK(seqs[0] == "ACGTac");
+		CHECK(seqs[1] == "ACGTNnnGG");
+		CHECK(seqs[2] == std::string(40, 'T') + "GATTACA");
+	}
+	unlink(fastaPath.c_str());
+
+	std::vector<std::string> names, seqs;
+	names.push_back("chr1");
+	seqs.push_back("ACGTNNNNacgtTTGCAnnAC");
+	names.push_back("chrM");
+	seqs.push_back("GATTACA");
+	names.push_back("chrLong");
+	std::string longSeq;
+	for ( int i = 0; i < 5000; i++ ) longSeq += "ACGTNacgtn"[nextRandom() % 10];
+	seqs.push_back(longSeq);
+
+	std::string twoBitPath = tempPath(".2bit");
+	for ( uint32_t version = 0; version <= 1; version++ ) {
+		for ( int bigEndian = 0; bigEndian <= 1; bigEndian++ ) {
+			std::vector<uint8_t> file = twoBitFile(names, seqs, version, bigEndian);
+			CHECK(writeFile(twoBitPath, &file[0], file.size()));
+			for ( size_t r = 0; r < sizeof(runs)/sizeof(runs[0]); r++ ) {
+				std::vector<std::string> readNames, readSeqs;
+				CHECK(readAll(twoBitPath.c_str(), runs[r], readNames, readSeqs));
+				CHECK(readNames == names);
+				CHECK(readSeqs == seqs);
+			}
+		}
+	}
+
+	// an unknown version is refused
+	std::vector<uint8_t> file = twoBitFile(names, seqs, 2, false);
+	CHECK(writeFile(twoBitPath, &file[0], file.size()));
+	SequenceReader reader;
+	CHECK(!reader.open(twoBitPath.c_str()));
+	unlink(twoBitPath.c_str());
+}
+
+//--------------------------------------------------------------------------------------------
+// dbscan
+//--------------------------------------------------------------------------------------------
+static void testDbscan() {
+	const float cores[3][2] = {{10, 10}, {20, 20}, {30, -30}};
+	std::vector<Point> points;
+	std::vector<int32_t> expected;
+	// noise first, so cluster ids follow the first core point of each cluster
+	Point noiseFirst = {50, 50};
+	points.push_back(noiseFirst);
+	expected.push_back(DBSCAN_NOISE);
+	for ( int c = 0; c < 3; c++ ) {
+		// a 3x2 grid 0.01 apart: every point has all 6 within epsilon, so all are core
+		for ( int i = 0; i < 6; i++ ) {
+			Point p = {cores[c][0] + 0.01f*(i%3), cores[c][1] + 0.01f*(i/3)};
+			points.push_back(p);
+			expected.push_back(c);
+		}
+	}
+	// within epsilon of two points of cluster 1 only: a border point
+	Point border = {20.06f, 20};
+	points.push_back(border);
+	expected.push_back(1);
+	// two points close to each other but below minPts together
+	Point pairA = {-40, 100}, pairB = {-40.02f, 100};
+	points.push_back(pairA);
+	expected.push_back(DBSCAN_NOISE);
+	points.push_back(pairB);
+	expected.push_back(DBSCAN_NOISE);
+
+	const float epsilon = 0.045f;
+	const int minPts = 6;
+	GridIndex grid(0.1f);
+	QuadTreeIndex quad(4);
+	SpatialIndex* indices[2] = {&grid, &quad};
+	for ( int x = 0; x < 2; x++ ) {
+		indices[x]->build(&points[0], points.size());
+		for ( int threads = 1; threads <= 4; threads *= 2 ) {
+			Dbscan<EuclideanMetric> dbscan(*indices[x], EuclideanMetric(), epsilon, minPts, threads);
+			CHECK(dbscan.run() == 3);
+			CHECK(dbscan.clusters() == 3);
+			CHECK(dbscan.corePoints() == 18);
+			CHECK(dbscan.noisePoints() == 3);
+			CHECK(dbscan.labels() == expected);
+
+			std::vector<uint32_t> neighbors;
+			dbscan.neighbors(points.size() - 3, neighbors);
+			CHECK(neighbors.size() == 3);
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------
+// splitter
+//--------------------------------------------------------------------------------------------
+static PCIeWord splitterWord(uint32_t i) {
+	PCIeWord w;
+	w.d[0] = i;
+	w.d[1] = ~i;
+	w.d[2] = i*2654435761u;
+	w.d[3] = 0x5e1f0000 | (i & 0xffff);
+	w.header = i & 0xff;
+	return w;
+}
+
+static bool sameWord(const PCIeWord& a, const PCIeWord& b) {
+	return memcmp(a.d, b.d, sizeof(a.d)) == 0 && a.header == b.header;
+}
+
+// Receives count words and checks they are first, first+1, ... in order
+static void splitterExpect(DMASplitter* dma, uint32_t first, uint32_t count) {
+	uint32_t wrong = 0;
+	for ( uint32_t i = 0; i < count; i++ ) {
+		if ( !sameWord(dma->recvWord(), splitterWord(first + i)) ) wrong++;
+	}
+	CHECK(wrong == 0);
+}
+
+static void testSplitter() {
+	DMASplitter* dma = DMASplitter::getInstance();
+	CHECK(dma->enableSendRing());
+	CHECK(dma->sendRingEnabled());
+	if ( !dma->sendRingEnabled() ) return;
+
+	// batches far deeper than the 8 word receive queue go out through the ring, drained each time
+	const int batch = 100;
+	std::vector<PCIeWord> words(SPLITTER_SEND_RING_ENTRIES*2);
+	uint32_t next = 0;
+	for ( int b = 0; b < 5; b++ ) {
+		for ( int i = 0; i < batch; i++ ) words[i] = splitterWord(next + i);
+		int sent = -1;
+		CHECK(dma->sendWords(&words[0], batch, &sent));
+		CHECK(sent == batch);
+		splitterExpect(dma, next, batch);
+		next += batch;
+	}
+
+	// register words queue behind ring words still waiting to be fetched
+	for ( int i = 0; i < 20; i++ ) words[i] = splitterWord(next + i);
+	CHECK(dma->sendWords(&words[0], 10));
+	for ( int i = 10; i < 20; i++ ) CHECK(dma->sendWord(words[i]));
+	splitterExpect(dma, next, 20);
+	next += 20;
+
+	// nobody receives: the ring fills, the hardware stops at its credit, and the send that
+	// cannot finish reports how far it got
+	uint32_t stallFirst = next;
+	uint32_t accepted = 0;
+	bool stalled = false;
+	for ( int b = 0; b < 64 && !stalled; b++ ) {
+		for ( int i = 0; i < batch; i++ ) words[i] = splitterWord(next + i);
+		int sent = -1;
+		stalled = !dma->sendWords(&words[0], batch, &sent);
+		CHECK(sent >= 0 && sent <= batch);
+		if ( stalled ) CHECK(sent < batch);
+		accepted += sent;
+		next += sent;
+	}
+	CHECK(stalled);
+	CHECK(accepted >= SPLITTER_SEND_RING_ENTRIES);
+	// the receive queue was never pushed past its depth
+	CHECK(PcieMock::getInstance()->violations() == 0);
+
+	// everything accepted arrives, in order, and credits come back
+	splitterExpect(dma, stallFirst, accepted);
+	for ( int i = 0; i < batch; i++ ) words[i] = splitterWord(next + i);
+	CHECK(dma->sendWords(&words[0], batch));
+	splitterExpect(dma, next, batch);
+	PCIeWord extra;
+	CHECK(!dma->tryRecvWord(extra));
+	CHECK(PcieMock::getInstance()->violations() == 0);
+}
+
+//--------------------------------------------------------------------------------------------
+typedef struct SelfTest {
+	const char* name;
+	void (*run)();
+} SelfTest;
+
+static const SelfTest g_tests[] = {
+	{"zfp", testZfp},
+	{"dna", testDna},
+	{"sequence", testSequence},
+	{"dbscan", testDbscan},
+	{"splitter", testSplitter},
+};
+
+int main(int argc, char** argv) {
+	// before the first BdbmPcie::getInstance()
+	setenv("BDBM_MOCK_DEVICE", "splitter", 1);
+
+	const int count = sizeof(g_tests)/sizeof(g_tests[0]);
+	for ( int a = 1; a < argc; a++ ) {
+		bool known = false;
+		for ( int t = 0; t < count; t++ ) known |= strcmp(argv[a], g_tests[t].name) == 0;
+		if ( !known ) {
+			printf( "Usage: %s [zfp] [dna] [sequence] [dbscan] [splitter]\n", argv[0] );
+			return 1;
+		}
+	}
+
+	int failedTests = 0;
+	for ( int t = 0; t < count; t++ ) {
+		bool selected = argc == 1;
+		for ( int a = 1; a < argc; a++ ) selected |= strcmp(argv[a], g_tests[t].name) == 0;
+		if ( !selected ) continue;
+
+		int failures = g_failures;
+		int checks = g_checks;
+		g_tests[t].run();
+		bool ok = g_failures == failures;
+		if ( !ok ) failedTests++;
+		printf( "%s %s (%d checks)\n", ok ? "ok  " : "FAIL", g_tests[t].name, g_checks - checks );
+		fflush(stdout);
+	}
+
+	printf( "%d checks, %d failed\n", g_checks, g_failures );
+	return failedTests > 0 ? 1 : 0;
+}
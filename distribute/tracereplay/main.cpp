@@ -0,0 +1,306 @@
+/****
+bdbm-trace: print, analyze and replay host library traces (see cpp/PcieTrace.h)
+
+	-p : print every record as text
+	-s : summary (default). Call counts and latencies per type, the busiest registers,
+	     polling loops and the longest blocking calls and host-side gaps
+	-r : replay the trace against the backend this binary was built for
+	     ("make mock" or "make bsim"; "make" replays against the FPGA)
+	-t : with -r, keep the original spacing between calls instead of issuing them back to back
+	-x : with -t, time scale (2 replays at half speed)
+	-n : number of entries shown in the top lists (default 10)
+
+Multi-threaded traces are replayed from one thread, in start time order.
+****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <vector>
+#include <map>
+#include <algorithm>
+
+#include "bdbmpcie.h"
+#include "PcieTrace.h"
+
+static const char* typeName(int t) {
+	switch (t) {
+		case TRACE_WRITE: return "write";
+		case TRACE_READ: return "read";
+		case TRACE_INTERRUPT: return "interrupt";
+		case TRACE_DMA_READ: return "dma_read";
+		case TRACE_DMA_WRITE: return "dma_write";
+	}
+	return "unknown";
+}
+
+static const char* backendName(uint32_t b) {
+	switch (b) {
+		case 0: return "pcie";
+		case 1: return "bsim";
+		case 2: return "mock";
+	}
+	return "unknown";
+}
+
+static bool loadTrace(const char* path, PcieTraceHeader& h, std::vector<PcieTraceRecord>& recs) {
+	FILE* fin = fopen(path, "rb");
+	if ( fin == NULL ) {
+		fprintf(stderr, "Cannot open %s\n", path);
+		return false;
+	}
+	if ( fread(&h, sizeof(h), 1, fin) != 1 || memcmp(h.magic, PCIE_TRACE_MAGIC, 8) != 0 ) {
+		fprintf(stderr, "%s is not a bdbm trace\n", path);
+		fclose(fin);
+		return false;
+	}
+	if ( h.record_bytes != sizeof(PcieTraceRecord) ) {
+		fprintf(stderr, "%s has %u byte records, expected %zu\n", path, h.record_bytes, sizeof(PcieTraceRecord));
+		fclose(fin);
+		return false;
+	}
+	PcieTraceRecord r;
+	while ( fread(&r, sizeof(r), 1, fin) == 1 ) recs.push_back(r);
+	fclose(fin);
+
+	// records from different threads are appended when each call returns
+	std::stable_sort(recs.begin(), recs.end(),
+		[](const PcieTraceRecord& a, const PcieTraceRecord& b) { return a.time_ns < b.time_ns; });
+	return true;
+}
+
+static uint64_t percentile(std::vector<uint64_t>& sorted, double p) {
+	if ( sorted.empty() ) return 0;
+	size_t idx = (size_t)(p*(sorted.size()-1)+0.5);
+	if ( idx >= sorted.size() ) idx = sorted.size()-1;
+	return sorted[idx];
+}
+
+static void printRecords(std::vector<PcieTraceRecord>& recs) {
+	printf( "%14s %6s %-10s %10s %10s %10s\n", "time_ns", "thread", "type", "addr", "data", "dur_ns" );
+	for ( size_t i = 0; i < recs.size(); i++ ) {
+		PcieTraceRecord& r = recs[i];
+		printf( "%14lu %6u %-10s %10x %10x %10u\n", r.time_ns, r.thread, typeName(r.type), r.addr, r.data, r.duration_ns );
+	}
+}
+
+static void printLatency(const char* name, std::vector<uint64_t>& v) {
+	if ( v.empty() ) return;
+	std::sort(v.begin(), v.end());
+	uint64_t sum = 0;
+	for ( size_t i = 0; i < v.size(); i++ ) sum += v[i];
+	printf( "  %-10s %10zu calls, total %12lu ns, p50 %8lu p99 %8lu max %10lu ns\n", name, v.size(), sum,
+		percentile(v, 0.5), percentile(v, 0.99), v.back() );
+}
+
+static void summarize(PcieTraceHeader& h, std::vector<PcieTraceRecord>& recs, int top) {
+	if ( recs.empty() ) {
+		printf( "empty trace\n" );
+		return;
+	}
+	PcieTraceRecord& last = recs.back();
+	uint64_t span = last.time_ns + last.duration_ns - recs[0].time_ns;
+	printf( "backend %s, %zu records, %.6f s\n", backendName(h.backend), recs.size(), span/1000000000.0 );
+
+	printf( "\nper type:\n" );
+	std::vector<uint64_t> lat[TRACE_DMA_WRITE+1];
+	uint64_t dma_bytes[2] = {0,0};
+	uint64_t busy = 0;
+	for ( size_t i = 0; i < recs.size(); i++ ) {
+		PcieTraceRecord& r = recs[i];
+		if ( r.type > TRACE_DMA_WRITE ) continue;
+		lat[r.type].push_back(r.duration_ns);
+		busy += r.duration_ns;
+		if ( r.type == TRACE_DMA_READ ) dma_bytes[0] += r.data;
+		if ( r.type == TRACE_DMA_WRITE ) dma_bytes[1] += r.data;
+	}
+	for ( int t = TRACE_WRITE; t <= TRACE_DMA_WRITE; t++ ) printLatency(typeName(t), lat[t]);
+	printf( "  dma buffer bytes read %lu, written %lu\n", dma_bytes[0], dma_bytes[1] );
+	printf( "  time inside library calls: %.1f%%\n", span ? 100.0*busy/span : 0.0 );
+
+	// busiest registers
+	std::map<uint64_t, std::pair<uint64_t,uint64_t> > regs; // (type<<32|addr) -> (count, total ns)
+	for ( size_t i = 0; i < recs.size(); i++ ) {
+		PcieTraceRecord& r = recs[i];
+		if ( r.type != TRACE_WRITE && r.type != TRACE_READ ) continue;
+		std::pair<uint64_t,uint64_t>& e = regs[((uint64_t)r.type<<32)|r.addr];
+		e.first++;
+		e.second += r.duration_ns;
+	}
+	std::vector<std::pair<uint64_t,uint64_t> > byTime;
+	for ( std::map<uint64_t, std::pair<uint64_t,uint64_t> >::iterator it = regs.begin(); it != regs.end(); it++ ) {
+		byTime.push_back(std::make_pair(it->second.second, it->first));
+	}
+	std::sort(byTime.rbegin(), byTime.rend());
+	printf( "\nregisters by total time:\n" );
+	for ( int i = 0; i < top && i < (int)byTime.size(); i++ ) {
+		uint64_t key = byTime[i].second;
+		uint32_t addr = (uint32_t)key;
+		printf( "  %-5s %8x (user %5d) %10lu calls %12lu ns\n", typeName(key>>32), addr,
+			addr >= CONFIG_BUFFER_SIZE ? (int)((addr-CONFIG_BUFFER_SIZE)/4) : -1, regs[key].first, byTime[i].first );
+	}
+
+	// polling loops: runs of reads of the same register from the same thread
+	typedef struct { uint64_t start; uint64_t ns; uint32_t addr; uint64_t reads; } PollRun;
+	std::vector<PollRun> polls;
+	std::map<uint16_t, PollRun> cur;
+	for ( size_t i = 0; i < recs.size(); i++ ) {
+		PcieTraceRecord& r = recs[i];
+		if ( r.type == TRACE_DMA_READ || r.type == TRACE_DMA_WRITE ) continue;
+		std::map<uint16_t, PollRun>::iterator it = cur.find(r.thread);
+		if ( it != cur.end() && r.type == TRACE_READ && it->second.addr == r.addr ) {
+			it->second.reads++;
+			it->second.ns = r.time_ns + r.duration_ns - it->second.start;
+			continue;
+		}
+		if ( it != cur.end() ) {
+			if ( it->second.reads > 2 ) polls.push_back(it->second);
+			cur.erase(it);
+		}
+		if ( r.type == TRACE_READ ) {
+			PollRun p = {r.time_ns, r.duration_ns, r.addr, 1};
+			cur[r.thread] = p;
+		}
+	}
+	for ( std::map<uint16_t, PollRun>::iterator it = cur.begin(); it != cur.end(); it++ ) {
+		if ( it->second.reads > 2 ) polls.push_back(it->second);
+	}
+	uint64_t poll_ns = 0;
+	for ( size_t i = 0; i < polls.size(); i++ ) poll_ns += polls[i].ns;
+	std::sort(polls.begin(), polls.end(), [](const PollRun& a, const PollRun& b) { return a.ns > b.ns; });
+	printf( "\npolling loops (3+ back to back reads of one register): %zu, %lu ns total\n", polls.size(), poll_ns );
+	for ( int i = 0; i < top && i < (int)polls.size(); i++ ) {
+		printf( "  @%14lu ns addr %8x %8lu reads %12lu ns\n", polls[i].start, polls[i].addr, polls[i].reads, polls[i].ns );
+	}
+
+	// the longest single calls are where the host waited on the device
+	std::vector<size_t> idx(recs.size());
+	for ( size_t i = 0; i < idx.size(); i++ ) idx[i] = i;
+	std::sort(idx.begin(), idx.end(), [&](size_t a, size_t b) { return recs[a].duration_ns > recs[b].duration_ns; });
+	printf( "\nlongest calls:\n" );
+	for ( int i = 0; i < top && i < (int)idx.size(); i++ ) {
+		PcieTraceRecord& r = recs[idx[i]];
+		printf( "  @%14lu ns thread %u %-10s addr %8x data %8x %10u ns\n", r.time_ns, r.thread, typeName(r.type), r.addr, r.data, r.duration_ns );
+	}
+
+	// gaps between calls on one thread are host-side work
+	typedef struct { uint64_t at; uint64_t ns; uint16_t thread; } Gap;
+	std::vector<Gap> gaps;
+	std::map<uint16_t, uint64_t> lastEnd;
+	for ( size_t i = 0; i < recs.size(); i++ ) {
+		PcieTraceRecord& r = recs[i];
+		std::map<uint16_t, uint64_t>::iterator it = lastEnd.find(r.thread);
+		if ( it != lastEnd.end() && r.time_ns > it->second ) {
+			Gap g = {it->second, r.time_ns - it->second, r.thread};
+			gaps.push_back(g);
+		}
+		lastEnd[r.thread] = r.time_ns + r.duration_ns;
+	}
+	std::sort(gaps.begin(), gaps.end(), [](const Gap& a, const Gap& b) { return a.ns > b.ns; });
+	printf( "\nlongest gaps between calls:\n" );
+	for ( int i = 0; i < top && i < (int)gaps.size(); i++ ) {
+		printf( "  @%14lu ns thread %u %12lu ns\n", gaps[i].at, gaps[i].thread, gaps[i].ns );
+	}
+}
+
+static inline uint64_t now_ns() {
+	return PcieTrace::now();
+}
+
+static int replay(std::vector<PcieTraceRecord>& recs, bool timed, double scale) {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	uint8_t* dmabuf = (uint8_t*)pcie->dmaBuffer();
+
+	std::vector<uint64_t> lat[TRACE_DMA_WRITE+1];
+	uint64_t orig[TRACE_DMA_WRITE+1] = {0};
+	uint64_t mismatches = 0;
+	volatile uint64_t sink = 0;
+
+	uint64_t base = recs.empty() ? 0 : recs[0].time_ns;
+	uint64_t start = now_ns();
+	for ( size_t i = 0; i < recs.size(); i++ ) {
+		PcieTraceRecord& r = recs[i];
+		if ( r.type > TRACE_DMA_WRITE ) continue;
+		if ( timed ) {
+			uint64_t due = start + (uint64_t)((r.time_ns-base)*scale);
+			while ( now_ns() < due );
+		}
+
+		uint64_t t = now_ns();
+		switch (r.type) {
+			case TRACE_WRITE:
+				pcie->writeWord(r.addr, r.data);
+				break;
+			case TRACE_READ:
+				if ( pcie->readWord(r.addr) != r.data ) mismatches++;
+				break;
+			case TRACE_INTERRUPT:
+				pcie->waitInterrupt((int)r.addr);
+				break;
+			case TRACE_DMA_READ:
+				if ( (uint64_t)r.addr + r.data <= DMA_DRIVER_BUFFER_SIZE ) {
+					for ( uint32_t j = 0; j < r.data; j += 64 ) sink += dmabuf[r.addr+j];
+				}
+				break;
+			case TRACE_DMA_WRITE:
+				if ( (uint64_t)r.addr + r.data <= DMA_DRIVER_BUFFER_SIZE ) memset(dmabuf+r.addr, 0, r.data);
+				break;
+		}
+		lat[r.type].push_back(now_ns()-t);
+		orig[r.type] += r.duration_ns;
+	}
+	uint64_t elapsed = now_ns() - start;
+
+	uint64_t span = 0;
+	if ( !recs.empty() ) span = recs.back().time_ns + recs.back().duration_ns - base;
+	printf( "replayed %zu records in %.6f s (original %.6f s)\n", recs.size(), elapsed/1000000000.0, span/1000000000.0 );
+	for ( int t = TRACE_WRITE; t <= TRACE_DMA_WRITE; t++ ) {
+		if ( lat[t].empty() ) continue;
+		printLatency(typeName(t), lat[t]);
+		printf( "  %-10s original total %12lu ns\n", "", orig[t] );
+	}
+	printf( "  reads returning a different value than recorded: %lu\n", mismatches );
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	bool print = false;
+	bool summary = false;
+	bool doReplay = false;
+	bool timed = false;
+	double scale = 1.0;
+	int top = 10;
+
+	int opt;
+	while ( (opt = getopt(argc, argv, "psrtx:n:h")) != -1 ) {
+		switch (opt) {
+			case 'p': print = true; break;
+			case 's': summary = true; break;
+			case 'r': doReplay = true; break;
+			case 't': timed = true; break;
+			case 'x': scale = atof(optarg); break;
+			case 'n': top = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-p] [-s] [-r [-t [-x scale]]] [-n top] trace.bin\n", argv[0]);
+				return 1;
+		}
+	}
+	if ( optind >= argc ) {
+		fprintf(stderr, "usage: %s [-p] [-s] [-r [-t [-x scale]]] [-n top] trace.bin\n", argv[0]);
+		return 1;
+	}
+	if ( !print && !doReplay ) summary = true;
+
+	PcieTraceHeader h;
+	std::vector<PcieTraceRecord> recs;
+	if ( !loadTrace(argv[optind], h, recs) ) return 1;
+
+	if ( print ) printRecords(recs);
+	if ( summary ) summarize(h, recs, top);
+	if ( doReplay ) return replay(recs, timed, scale);
+	return 0;
+}
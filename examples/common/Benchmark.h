@@ -0,0 +1,79 @@
+#ifndef __EXAMPLES_BENCHMARK__H__
+#define __EXAMPLES_BENCHMARK__H__
+
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+#include "DistanceMetric.h"
+#include "PointFile.h"
+
+/****
+Shared harness of the distance examples: dataset reader (see PointFile.h), timers, and a one-to-many benchmark
+that runs the same workload through every DistanceMetric.h backend of a metric
+****/
+
+// Elapsed time checker
+static inline double timeCheckerCPU(void) {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        return (double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec / 1000000;
+}
+
+// Wall clock, for the multithreaded DBSCAN
+static inline double timeCheckerWall(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000;
+}
+
+// Function for reading benchmark file: one copy out of the mapped file
+static inline void readBenchmarkData(std::vector<Point> &cities, const char* filename, int length) {
+	PointFile file;
+	if ( !file.open(filename, length) ) exit(1);
+	if ( cities.size() < (size_t)length ) cities.resize(length);
+	if ( length > 0 ) memcpy(&cities[0], file.points(), length*sizeof(Point));
+}
+
+// Distances from `rounds` core cities to all n cities, once per backend, checked against scalar
+template <class M>
+static inline void distanceBenchmark(const Point* cities, size_t n, int rounds) {
+	std::vector<float> lat(n), lon(n), ref(n), out(n);
+	for ( size_t i = 0; i < n; i++ ) {
+		lat[i] = cities[i].lat;
+		lon[i] = cities[i].lon;
+	}
+
+	DistanceIsa isas[] = {DISTANCE_SCALAR, DISTANCE_SSE, DISTANCE_AVX2, DISTANCE_AVX512, DISTANCE_FPGA};
+	printf( "%s, %d x %lu pairs per backend\n", Metric<M>::name(), rounds, n );
+	for ( int k = 0; k < 5; k++ ) {
+		DistanceIsa isa = distanceResolveIsa<M>(isas[k]);
+		if ( isa != isas[k] ) continue;
+		for ( int threads = 1; threads <= 2; threads++ ) {
+			DistanceDriver<M> driver(isa, threads == 1 ? 1 : 0);
+			if ( threads == 2 && driver.threads() == 1 ) continue;
+
+			float maxDiff = 0;
+			double start = timeCheckerWall();
+			for ( int r = 0; r < rounds; r++ ) {
+				Point core = cities[(size_t)r % n];
+				driver.oneToMany(core, &lat[0], &lon[0], &out[0], n);
+				if ( r != 0 ) continue;
+				Metric<M>::batchScalar(core, &lat[0], &lon[0], &ref[0], n);
+				for ( size_t i = 0; i < n; i++ ) {
+					float d = fabsf(out[i] - ref[i]);
+					if ( d > maxDiff ) maxDiff = d;
+				}
+			}
+			double elapsed = timeCheckerWall() - start;
+			printf( "  %-6s %2d thread(s): %.6f s, %.1f Mpairs/s, max diff %g\n", distanceIsaName(isa), driver.threads(),
+				elapsed, (double)rounds*n/elapsed/1000000, maxDiff );
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef __EXAMPLES_BOUNDED_QUEUE__H__
+#define __EXAMPLES_BOUNDED_QUEUE__H__
+
+#include <stddef.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/****
+Blocking FIFO of at most capacity items, between the stages of a host pipeline
+
+push() waits while the queue is full, so a fast stage can only run capacity items ahead of the
+next one. pop() waits while it is empty. close() ends the stream: pushes are dropped and pop()
+returns false once the remaining items are gone. reopen() takes pushes again, for a pipeline
+that runs more than once.
+****/
+
+template <class T>
+class BoundedQueue {
+public:
+	BoundedQueue(size_t capacity) {
+		m_capacity = capacity > 0 ? capacity : 1;
+		m_closed = false;
+	}
+
+	// false if the queue was closed
+	bool push(const T& item) {
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_not_full.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+		if ( m_closed ) return false;
+		m_items.push_back(item);
+		m_not_empty.notify_one();
+		return true;
+	}
+
+	// false if the queue is closed and empty
+	bool pop(T& item) {
+		std::unique_lock<std::mutex> lock(m_lock);
+		m_not_empty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+		if ( m_items.empty() ) return false;
+		item = m_items.front();
+		m_items.pop_front();
+		m_not_full.notify_one();
+		return true;
+	}
+
+	void close() {
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_closed = true;
+		m_not_full.notify_all();
+		m_not_empty.notify_all();
+	}
+
+	void reopen() {
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_closed = false;
+	}
+
+	size_t size() {
+		std::lock_guard<std::mutex> lock(m_lock);
+		return m_items.size();
+	}
+
+private:
+	BoundedQueue(const BoundedQueue&);
+	BoundedQueue& operator=(const BoundedQueue&);
+
+	std::mutex m_lock;
+	std::condition_variable m_not_full;
+	std::condition_variable m_not_empty;
+	std::deque<T> m_items;
+	size_t m_capacity;
+	bool m_closed;
+};
+
+#endif
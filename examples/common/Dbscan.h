@@ -0,0 +1,401 @@
+#ifndef __DBSCAN__H__
+#define __DBSCAN__H__
+
+#include <math.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "DistanceMetric.h"
+#include "EpsilonBox.h"
+#include "SpatialIndex.h"
+
+/****
+Parallel DBSCAN over a SpatialIndex, parameterized by distance metric and epsilon
+
+A metric is any class with
+	float distance(Point a, Point b) const;
+	void distances(Point core, const float* lat, const float* lon, float* out, size_t n) const;
+	bool within(float d, float epsilon) const;
+	// boxes (at most 2) covering every point within epsilon of core. Returns how many
+	int boxes(Point core, float epsilon, const SpatialBox& bounds, SpatialBox* out) const;
+distances() gets the contiguous candidate runs of the index, so a SIMD batch kernel plugs in
+by deriving from one of the metrics below and replacing it (see haversine/c/haversine.cpp).
+Euclidean, Manhattan and Cosine evaluate through the kernels of DistanceMetric.h.
+
+The run is the union-find formulation of DBSCAN, in two parallel passes over all points:
+	1. count the epsilon neighbors of every point, core points have at least minPts (itself included)
+	2. for every core point, union it with its core neighbors, and claim its border neighbors
+A pair of core points is united from both ends, not only from the larger position. The batch
+kernels evaluate d(core, target) with the core fixed, so d(p, q) and d(q, p) can round to
+opposite sides of epsilon; the pair is then connected if either direction is within it.
+Core point clusters do not depend on the thread count. A border point reachable from two clusters
+goes to whichever core claims it first, which standard DBSCAN leaves to visit order too.
+Cluster ids are numbered in the order of their first point in the input, noise is -1.
+****/
+
+#define DBSCAN_NOISE (-1)
+#define DBSCAN_TO_RADIAN (3.14159265358979323846 / 180)
+#define DBSCAN_TO_DEGREE (180 / 3.14159265358979323846)
+#define DBSCAN_EARTH_RADIUS EPSILON_BOX_EARTH_RADIUS
+
+struct EuclideanMetric {
+	float distance(Point a, Point b) const {
+		return Metric<Euclidean>::scalar(a, b);
+	}
+	void distances(Point core, const float* lat, const float* lon, float* out, size_t n) const {
+		distanceOneToMany<Euclidean>(distanceBestIsa(), core, lat, lon, out, n);
+	}
+	bool within(float d, float epsilon) const { return d <= epsilon; }
+	int boxes(Point core, float epsilon, const SpatialBox& bounds, SpatialBox* out) const {
+		float e = (float)EPSILON_BOX_MARGIN(epsilon);
+		SpatialBox b = {core.lat - e, core.lat + e, core.lon - e, core.lon + e};
+		out[0] = b;
+		return 1;
+	}
+};
+
+struct ManhattanMetric {
+	float distance(Point a, Point b) const {
+		return Metric<Manhattan>::scalar(a, b);
+	}
+	void distances(Point core, const float* lat, const float* lon, float* out, size_t n) const {
+		distanceOneToMany<Manhattan>(distanceBestIsa(), core, lat, lon, out, n);
+	}
+	bool within(float d, float epsilon) const { return d <= epsilon; }
+	int boxes(Point core, float epsilon, const SpatialBox& bounds, SpatialBox* out) const {
+		float e = (float)EPSILON_BOX_MARGIN(epsilon);
+		SpatialBox b = {core.lat - e, core.lat + e, core.lon - e, core.lon + e};
+		out[0] = b;
+		return 1;
+	}
+};
+
+// Great circle distance in km, epsilon in km. Evaluated in double; the boxes are the
+// inverse haversine box of EpsilonBox.h, split at the antimeridian, all longitudes near a pole
+struct HaversineMetric {
+	float distance(Point a, Point b) const {
+		double dlat = ((double)b.lat - a.lat)*DBSCAN_TO_RADIAN;
+		double dlon = ((double)b.lon - a.lon)*DBSCAN_TO_RADIAN;
+		double s = sin(dlat/2);
+		double t = sin(dlon/2);
+		double f = s*s + t*t*cos(a.lat*DBSCAN_TO_RADIAN)*cos(b.lat*DBSCAN_TO_RADIAN);
+		if ( f > 1 ) f = 1;
+		return (float)(2*DBSCAN_EARTH_RADIUS*asin(sqrt(f)));
+	}
+	void distances(Point core, const float* lat, const float* lon, float* out, size_t n) const {
+		for ( size_t i = 0; i < n; i++ ) {
+			Point p = {lat[i], lon[i]};
+			out[i] = distance(core, p);
+		}
+	}
+	bool within(float d, float epsilon) const { return d <= epsilon; }
+	int boxes(Point core, float epsilon, const SpatialBox& bounds, SpatialBox* out) const {
+		float dlat, dlon;
+		haversineBoxSize(core.lat, epsilon, &dlat, &dlon);
+		float lo[2], hi[2];
+		int count = haversineBoxLonRanges(core.lon, dlon, lo, hi);
+		for ( int i = 0; i < count; i++ ) {
+			SpatialBox b = {core.lat - dlat, core.lat + dlat, lo[i], hi[i]};
+			out[i] = b;
+		}
+		return count;
+	}
+};
+
+// Cosine similarity of (lat, lon) as a 2D vector, like cosinesimilarity.cpp. Neighbors have a
+// similarity of at least epsilon, i.e. lie in the cone of half angle acos(epsilon) around the core.
+// The box is the bounding box of that cone clipped to the data bounds
+struct CosineMetric {
+	float distance(Point a, Point b) const {
+		return Metric<Cosine>::scalar(a, b);
+	}
+	void distances(Point core, const float* lat, const float* lon, float* out, size_t n) const {
+		distanceOneToMany<Cosine>(distanceBestIsa(), core, lat, lon, out, n);
+	}
+	bool within(float d, float epsilon) const { return d >= epsilon; }
+	int boxes(Point core, float epsilon, const SpatialBox& bounds, SpatialBox* out) const {
+		out[0] = bounds;
+		// the cone is not convex past 90 degrees, and a zero vector has no direction
+		if ( epsilon <= 0 || (core.lat == 0 && core.lon == 0) ) return 1;
+		if ( epsilon > 1 ) epsilon = 1;
+
+		double angle = atan2((double)core.lon, (double)core.lat);
+		double half = acos((double)epsilon) + 1e-5;
+		double xs[12], ys[12];
+		int count = 0;
+		if ( bounds.latLo <= 0 && bounds.latHi >= 0 && bounds.lonLo <= 0 && bounds.lonHi >= 0 ) {
+			xs[count] = 0; ys[count] = 0; count++;
+		}
+		// corners of the bounds inside the cone
+		double cx[4] = {bounds.latLo, bounds.latHi, bounds.latLo, bounds.latHi};
+		double cy[4] = {bounds.lonLo, bounds.lonLo, bounds.lonHi, bounds.lonHi};
+		for ( int i = 0; i < 4; i++ ) {
+			double d = fabs(remainder(atan2(cy[i], cx[i]) - angle, 2*M_PI));
+			if ( d <= half ) { xs[count] = cx[i]; ys[count] = cy[i]; count++; }
+		}
+		// where the two edges of the cone cross the bounds
+		for ( int side = -1; side <= 1; side += 2 ) {
+			double dx = cos(angle + side*half);
+			double dy = sin(angle + side*half);
+			double edge[4] = {bounds.latLo, bounds.latHi, bounds.lonLo, bounds.lonHi};
+			for ( int e = 0; e < 4; e++ ) {
+				double dir = e < 2 ? dx : dy;
+				if ( dir == 0 ) continue;
+				double t = edge[e]/dir;
+				if ( t < 0 ) continue;
+				double x = e < 2 ? edge[e] : t*dx;
+				double y = e < 2 ? t*dy : edge[e];
+				if ( x < bounds.latLo || x > bounds.latHi || y < bounds.lonLo || y > bounds.lonHi ) continue;
+				xs[count] = x; ys[count] = y; count++;
+			}
+		}
+		if ( count == 0 ) return 0;
+
+		SpatialBox b = {INFINITY, -INFINITY, INFINITY, -INFINITY};
+		for ( int i = 0; i < count; i++ ) {
+			if ( xs[i] < b.latLo ) b.latLo = (float)xs[i];
+			if ( xs[i] > b.latHi ) b.latHi = (float)xs[i];
+			if ( ys[i] < b.lonLo ) b.lonLo = (float)ys[i];
+			if ( ys[i] > b.lonHi ) b.lonHi = (float)ys[i];
+		}
+		float m = (float)EPSILON_BOX_MARGIN(1e-4*(bounds.latHi - bounds.latLo + bounds.lonHi - bounds.lonLo));
+		b.latLo -= m; b.latHi += m; b.lonLo -= m; b.lonHi += m;
+		out[0] = b;
+		return 1;
+	}
+};
+
+template <class Metric>
+class Dbscan {
+public:
+	// threads 0 uses every hardware thread
+	Dbscan(const SpatialIndex& index, const Metric& metric, float epsilon, int minPts, int threads = 0)
+		: m_index(index), m_metric(metric) {
+		m_epsilon = epsilon;
+		m_min_pts = minPts;
+		m_threads = threads > 0 ? threads : (int)std::thread::hardware_concurrency();
+		if ( m_threads < 1 ) m_threads = 1;
+		m_clusters = 0;
+		m_core = 0;
+		m_noise = 0;
+		m_exact = 0;
+	}
+
+	// Clusters every point of the index. Returns the number of clusters
+	int run();
+
+	// Cluster of each point, in the order given to the index's build(). DBSCAN_NOISE for noise
+	const std::vector<int32_t>& labels() const { return m_labels; }
+	int clusters() const { return m_clusters; }
+	size_t corePoints() const { return m_core; }
+	size_t noisePoints() const { return m_noise; }
+	// Exact distance evaluations of the last run, against size()^2*2 for brute force
+	uint64_t exactEvaluations() const { return m_exact; }
+
+	// Region query of one point (position in the build() input): appends the build() positions
+	// of its neighbors, itself included. Returns the exact evaluations it took
+	size_t neighbors(size_t point, std::vector<uint32_t>& out) const;
+	// Candidate pairs of one point's region query in the FPGA input layout,
+	// the batch the card would evaluate instead of distances()
+	size_t candidatePairs(size_t point, std::vector<PointPair>& out) const;
+
+private:
+	// Calls f(sorted position) for every neighbor of sorted position p. Returns exact evaluations
+	template <class F>
+	size_t regionQuery(uint32_t p, std::vector<IndexRange>& ranges, std::vector<float>& dist, F f) const;
+	// Runs f(begin, end, thread) over blocks of sorted positions on all threads
+	template <class F>
+	void parallel(F f);
+
+	uint32_t find(uint32_t x);
+	void unite(uint32_t a, uint32_t b);
+
+	const SpatialIndex& m_index;
+	Metric m_metric;
+	float m_epsilon;
+	int m_min_pts;
+	int m_threads;
+
+	std::vector<int32_t> m_labels;
+	int m_clusters;
+	size_t m_core;
+	size_t m_noise;
+	uint64_t m_exact;
+
+	// per sorted position
+	std::vector<uint8_t> m_is_core;
+	std::unique_ptr<std::atomic<uint32_t>[]> m_parent;
+	std::unique_ptr<std::atomic<uint32_t>[]> m_owner;
+};
+
+template <class Metric>
+template <class F>
+size_t
+Dbscan<Metric>::regionQuery(uint32_t p, std::vector<IndexRange>& ranges, std::vector<float>& dist, F f) const {
+	const float* lat = m_index.lat();
+	const float* lon = m_index.lon();
+	Point core = {lat[p], lon[p]};
+	SpatialBox boxes[2];
+	int count = m_metric.boxes(core, m_epsilon, m_index.bounds(), boxes);
+	ranges.clear();
+	for ( int b = 0; b < count; b++ ) m_index.candidateRanges(boxes[b], ranges);
+	if ( count > 1 ) SpatialIndex::mergeRanges(ranges);
+
+	size_t exact = 0;
+	for ( size_t r = 0; r < ranges.size(); r++ ) {
+		uint32_t begin = ranges[r].begin;
+		size_t n = ranges[r].end - begin;
+		if ( dist.size() < n ) dist.resize(n);
+		m_metric.distances(core, lat + begin, lon + begin, &dist[0], n);
+		exact += n;
+		for ( size_t i = 0; i < n; i++ ) {
+			if ( m_metric.within(dist[i], m_epsilon) ) f((uint32_t)(begin + i));
+		}
+	}
+	return exact;
+}
+
+template <class Metric>
+template <class F>
+void
+Dbscan<Metric>::parallel(F f) {
+	const uint32_t block = 1024;
+	uint32_t n = (uint32_t)m_index.size();
+	std::atomic<uint32_t> next(0);
+	auto worker = [&](int t) {
+		while (true) {
+			uint32_t begin = next.fetch_add(block);
+			if ( begin >= n ) break;
+			f(begin, (n - begin < block) ? n : begin + block, t);
+		}
+	};
+	std::vector<std::thread> threads;
+	for ( int t = 1; t < m_threads; t++ ) threads.push_back(std::thread(worker, t));
+	worker(0);
+	for ( size_t t = 0; t < threads.size(); t++ ) threads[t].join();
+}
+
+template <class Metric>
+uint32_t
+Dbscan<Metric>::find(uint32_t x) {
+	while (true) {
+		uint32_t p = m_parent[x].load(std::memory_order_relaxed);
+		if ( p == x ) return x;
+		uint32_t g = m_parent[p].load(std::memory_order_relaxed);
+		// path halving, losing the race only means a longer path next time
+		if ( g != p ) m_parent[x].compare_exchange_weak(p, g, std::memory_order_relaxed);
+		x = g;
+	}
+}
+
+template <class Metric>
+void
+Dbscan<Metric>::unite(uint32_t a, uint32_t b) {
+	while (true) {
+		a = find(a);
+		b = find(b);
+		if ( a == b ) return;
+		// the larger root always links under the smaller one, so there are no cycles
+		if ( a < b ) { uint32_t t = a; a = b; b = t; }
+		uint32_t expected = a;
+		if ( m_parent[a].compare_exchange_strong(expected, b) ) return;
+	}
+}
+
+template <class Metric>
+int
+Dbscan<Metric>::run() {
+	size_t n = m_index.size();
+	std::vector<uint64_t> exact(m_threads, 0);
+	std::vector<std::vector<IndexRange> > ranges(m_threads);
+	std::vector<std::vector<float> > dist(m_threads);
+
+	m_is_core.assign(n, 0);
+	m_parent.reset(new std::atomic<uint32_t>[n]);
+	m_owner.reset(new std::atomic<uint32_t>[n]);
+	for ( size_t i = 0; i < n; i++ ) {
+		m_parent[i].store((uint32_t)i, std::memory_order_relaxed);
+		m_owner[i].store(UINT32_MAX, std::memory_order_relaxed);
+	}
+
+	// 1. core points
+	parallel([&](uint32_t begin, uint32_t end, int t) {
+		for ( uint32_t p = begin; p < end; p++ ) {
+			int count = 0;
+			exact[t] += regionQuery(p, ranges[t], dist[t], [&](uint32_t) { count++; });
+			m_is_core[p] = count >= m_min_pts;
+		}
+	});
+
+	// 2. connect core points, claim border points
+	parallel([&](uint32_t begin, uint32_t end, int t) {
+		for ( uint32_t p = begin; p < end; p++ ) {
+			if ( !m_is_core[p] ) continue;
+			exact[t] += regionQuery(p, ranges[t], dist[t], [&](uint32_t q) {
+				if ( m_is_core[q] ) {
+					// from both ends of the pair, see the comment at the top
+					if ( q != p ) unite(p, q);
+				} else {
+					uint32_t none = UINT32_MAX;
+					m_owner[q].compare_exchange_strong(none, p, std::memory_order_relaxed);
+				}
+			});
+		}
+	});
+
+	// 3. number the clusters in input order
+	std::vector<int32_t> clusterOf(n, DBSCAN_NOISE);
+	m_labels.assign(n, DBSCAN_NOISE);
+	m_clusters = 0;
+	m_core = 0;
+	m_noise = 0;
+	for ( size_t i = 0; i < n; i++ ) {
+		uint32_t p = m_index.position(i);
+		uint32_t root;
+		if ( m_is_core[p] ) {
+			root = find(p);
+			m_core++;
+		} else {
+			uint32_t owner = m_owner[p].load(std::memory_order_relaxed);
+			if ( owner == UINT32_MAX ) {
+				m_noise++;
+				continue;
+			}
+			root = find(owner);
+		}
+		if ( clusterOf[root] == DBSCAN_NOISE ) clusterOf[root] = m_clusters++;
+		m_labels[i] = clusterOf[root];
+	}
+
+	m_exact = 0;
+	for ( int t = 0; t < m_threads; t++ ) m_exact += exact[t];
+	return m_clusters;
+}
+
+template <class Metric>
+size_t
+Dbscan<Metric>::neighbors(size_t point, std::vector<uint32_t>& out) const {
+	std::vector<IndexRange> ranges;
+	std::vector<float> dist;
+	return regionQuery(m_index.position(point), ranges, dist, [&](uint32_t q) { out.push_back(m_index.index(q)); });
+}
+
+template <class Metric>
+size_t
+Dbscan<Metric>::candidatePairs(size_t point, std::vector<PointPair>& out) const {
+	uint32_t p = m_index.position(point);
+	Point core = {m_index.lat()[p], m_index.lon()[p]};
+	SpatialBox boxes[2];
+	std::vector<IndexRange> ranges;
+	int count = m_metric.boxes(core, m_epsilon, m_index.bounds(), boxes);
+	for ( int b = 0; b < count; b++ ) m_index.candidateRanges(boxes[b], ranges);
+	if ( count > 1 ) SpatialIndex::mergeRanges(ranges);
+	return m_index.candidatePairs(core, ranges, out);
+}
+
+#endif
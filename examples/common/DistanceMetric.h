@@ -0,0 +1,419 @@
+#ifndef __DISTANCE_METRIC__H__
+#define __DISTANCE_METRIC__H__
+
+#include <math.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "HaversineBatch.h"
+#include "Point.h"
+
+/****
+Header-only distance metric framework for the distance examples
+
+Metric<M> is specialized at compile time for the tags Euclidean, Manhattan, Haversine and Cosine.
+Every specialization has
+	scalar(a, b)                                                        one pair
+	batchScalar/batchSse/batchAvx2/batchAvx512(core, lat, lon, out, n)  one core against n targets (SoA)
+with the formulas of the c/ programs: euclidean and manhattan in degrees, haversine in km
+(EARTH_RADIUS 6371), cosine is the similarity of (lat, lon) as a 2D vector.
+SSE is the x86-64 baseline (SSE2). AVX2 and AVX-512 kernels carry their own target attribute
+and are only called when the CPU has AVX2 and FMA, or AVX512F, so they need no -m flags.
+
+Build with -ffp-contract=off, as the Makefiles of the distance programs do. Otherwise
+GCC fuses the mul/add pairs into FMA only where FMA is enabled, i.e. in the AVX2/AVX-512 kernels
+and the scalar tails inlined into them, and the ISAs round differently. With it, euclidean,
+manhattan and cosine give bit-identical results on every ISA. Haversine's AVX2 and AVX-512
+kernels use explicit FMA and the scalar and SSE ones do not, so they differ from scalar by a few
+ulp: measured within 6e-7 relative and 0.004 km absolute (one float ulp at 20000 km) over 5M
+random pairs. HaversineBatch.h has the accuracy against double precision.
+
+distanceOneToMany<M>(isa, ...) and distanceManyToMany<M>(isa, ...) dispatch on a DistanceIsa.
+DISTANCE_FPGA calls the hook registered with distanceSetOffload<M>(), e.g. a DMA streaming
+driver for the card, and falls back to the best CPU kernel when there is none.
+DistanceDriver<M> splits the same calls over std::thread workers. The FPGA hook is always
+called from one thread, since it owns the card.
+
+Haversine calls the kernels of HaversineBatch.cpp (float polynomials for sin, cos and asin,
+1-f without cancellation). It is not header-only: programs that use Metric<Haversine> also
+compile examples/common/HaversineBatch.cpp, as haversine/c/Makefile does. The other metrics
+need nothing else.
+****/
+
+typedef enum {
+	DISTANCE_SCALAR,
+	DISTANCE_SSE,
+	DISTANCE_AVX2,
+	DISTANCE_AVX512,
+	DISTANCE_FPGA
+} DistanceIsa;
+
+struct Euclidean {};
+struct Manhattan {};
+struct Haversine {};
+struct Cosine {};
+
+template <class M> struct Metric;
+
+// Lanes of the AVX-512 tail, which runs as one masked iteration
+static inline __mmask16 distanceTailMask(size_t left) {
+	return (__mmask16)((1u << left) - 1);
+}
+
+// GCC 12 reports _mm512_undefined_ps() inside the unmasked intrinsics as maybe-uninitialized
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+static inline DistanceIsa distanceBestIsa() {
+	static DistanceIsa best = __builtin_cpu_supports("avx512f") ? DISTANCE_AVX512
+		: (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) ? DISTANCE_AVX2 : DISTANCE_SSE;
+	return best;
+}
+
+static inline const char* distanceIsaName(DistanceIsa isa) {
+	switch (isa) {
+		case DISTANCE_FPGA: return "fpga";
+		case DISTANCE_AVX512: return "avx512";
+		case DISTANCE_AVX2: return "avx2";
+		case DISTANCE_SSE: return "sse";
+		default: return "scalar";
+	}
+}
+
+/****
+Euclidean
+****/
+template <> struct Metric<Euclidean> {
+	static const char* name() { return "euclidean"; }
+
+	static float scalar(Point a, Point b) {
+		float dlat = a.lat - b.lat;
+		float dlon = a.lon - b.lon;
+		return sqrtf(dlat*dlat + dlon*dlon);
+	}
+	static void batchScalar(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		for ( size_t i = 0; i < n; i++ ) {
+			Point p = {lat[i], lon[i]};
+			out[i] = scalar(core, p);
+		}
+	}
+	static void batchSse(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		const __m128 vlat = _mm_set1_ps(core.lat);
+		const __m128 vlon = _mm_set1_ps(core.lon);
+		size_t i = 0;
+		for ( ; i+4 <= n; i += 4 ) {
+			__m128 dlat = _mm_sub_ps(vlat, _mm_loadu_ps(lat+i));
+			__m128 dlon = _mm_sub_ps(vlon, _mm_loadu_ps(lon+i));
+			_mm_storeu_ps(out+i, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dlat, dlat), _mm_mul_ps(dlon, dlon))));
+		}
+		batchScalar(core, lat+i, lon+i, out+i, n-i);
+	}
+	__attribute__((target("avx2,fma")))
+	static void batchAvx2(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		const __m256 vlat = _mm256_set1_ps(core.lat);
+		const __m256 vlon = _mm256_set1_ps(core.lon);
+		size_t i = 0;
+		for ( ; i+8 <= n; i += 8 ) {
+			__m256 dlat = _mm256_sub_ps(vlat, _mm256_loadu_ps(lat+i));
+			__m256 dlon = _mm256_sub_ps(vlon, _mm256_loadu_ps(lon+i));
+			_mm256_storeu_ps(out+i, _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dlat, dlat), _mm256_mul_ps(dlon, dlon))));
+		}
+		batchScalar(core, lat+i, lon+i, out+i, n-i);
+	}
+	__attribute__((target("avx512f")))
+	static inline __m512 kernel16(__m512 vlat, __m512 vlon, __m512 la, __m512 lo) {
+		__m512 dlat = _mm512_sub_ps(vlat, la);
+		__m512 dlon = _mm512_sub_ps(vlon, lo);
+		return _mm512_sqrt_ps(_mm512_add_ps(_mm512_mul_ps(dlat, dlat), _mm512_mul_ps(dlon, dlon)));
+	}
+	__attribute__((target("avx512f")))
+	static void batchAvx512(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		const __m512 vlat = _mm512_set1_ps(core.lat);
+		const __m512 vlon = _mm512_set1_ps(core.lon);
+		size_t i = 0;
+		for ( ; i+16 <= n; i += 16 ) {
+			_mm512_storeu_ps(out+i, kernel16(vlat, vlon, _mm512_loadu_ps(lat+i), _mm512_loadu_ps(lon+i)));
+		}
+		if ( i < n ) {
+			__mmask16 m = distanceTailMask(n-i);
+			_mm512_mask_storeu_ps(out+i, m, kernel16(vlat, vlon, _mm512_maskz_loadu_ps(m, lat+i), _mm512_maskz_loadu_ps(m, lon+i)));
+		}
+	}
+};
+
+/****
+Manhattan
+****/
+template <> struct Metric<Manhattan> {
+	static const char* name() { return "manhattan"; }
+
+	static float scalar(Point a, Point b) {
+		return fabsf(a.lat - b.lat) + fabsf(a.lon - b.lon);
+	}
+	static void batchScalar(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		for ( size_t i = 0; i < n; i++ ) {
+			Point p = {lat[i], lon[i]};
+			out[i] = scalar(core, p);
+		}
+	}
+	static void batchSse(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		const __m128 vlat = _mm_set1_ps(core.lat);
+		const __m128 vlon = _mm_set1_ps(core.lon);
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+		size_t i = 0;
+		for ( ; i+4 <= n; i += 4 ) {
+			__m128 dlat = _mm_and_ps(_mm_sub_ps(vlat, _mm_loadu_ps(lat+i)), absMask);
+			__m128 dlon = _mm_and_ps(_mm_sub_ps(vlon, _mm_loadu_ps(lon+i)), absMask);
+			_mm_storeu_ps(out+i, _mm_add_ps(dlat, dlon));
+		}
+		batchScalar(core, lat+i, lon+i, out+i, n-i);
+	}
+	__attribute__((target("avx2,fma")))
+	static void batchAvx2(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		const __m256 vlat = _mm256_set1_ps(core.lat);
+		const __m256 vlon = _mm256_set1_ps(core.lon);
+		const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+		size_t i = 0;
+		for ( ; i+8 <= n; i += 8 ) {
+			__m256 dlat = _mm256_and_ps(_mm256_sub_ps(vlat, _mm256_loadu_ps(lat+i)), absMask);
+			__m256 dlon = _mm256_and_ps(_mm256_sub_ps(vlon, _mm256_loadu_ps(lon+i)), absMask);
+			_mm256_storeu_ps(out+i, _mm256_add_ps(dlat, dlon));
+		}
+		batchScalar(core, lat+i, lon+i, out+i, n-i);
+	}
+	__attribute__((target("avx512f")))
+	static inline __m512 kernel16(__m512 vlat, __m512 vlon, __m512 la, __m512 lo) {
+		return _mm512_add_ps(_mm512_abs_ps(_mm512_sub_ps(vlat, la)), _mm512_abs_ps(_mm512_sub_ps(vlon, lo)));
+	}
+	__attribute__((target("avx512f")))
+	static void batchAvx512(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		const __m512 vlat = _mm512_set1_ps(core.lat);
+		const __m512 vlon = _mm512_set1_ps(core.lon);
+		size_t i = 0;
+		for ( ; i+16 <= n; i += 16 ) {
+			_mm512_storeu_ps(out+i, kernel16(vlat, vlon, _mm512_loadu_ps(lat+i), _mm512_loadu_ps(lon+i)));
+		}
+		if ( i < n ) {
+			__mmask16 m = distanceTailMask(n-i);
+			_mm512_mask_storeu_ps(out+i, m, kernel16(vlat, vlon, _mm512_maskz_loadu_ps(m, lat+i), _mm512_maskz_loadu_ps(m, lon+i)));
+		}
+	}
+};
+
+/****
+Cosine similarity
+****/
+template <> struct Metric<Cosine> {
+	static const char* name() { return "cosine"; }
+
+	static float scalar(Point a, Point b) {
+		float xy = a.lat*b.lat + a.lon*b.lon;
+		return xy / (sqrtf(a.lat*a.lat + a.lon*a.lon) * sqrtf(b.lat*b.lat + b.lon*b.lon));
+	}
+	static void batchScalar(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		float magCore = sqrtf(core.lat*core.lat + core.lon*core.lon);
+		for ( size_t i = 0; i < n; i++ ) {
+			float xy = core.lat*lat[i] + core.lon*lon[i];
+			out[i] = xy / (magCore * sqrtf(lat[i]*lat[i] + lon[i]*lon[i]));
+		}
+	}
+	static void batchSse(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		const __m128 vlat = _mm_set1_ps(core.lat);
+		const __m128 vlon = _mm_set1_ps(core.lon);
+		const __m128 magCore = _mm_set1_ps(sqrtf(core.lat*core.lat + core.lon*core.lon));
+		size_t i = 0;
+		for ( ; i+4 <= n; i += 4 ) {
+			__m128 la = _mm_loadu_ps(lat+i);
+			__m128 lo = _mm_loadu_ps(lon+i);
+			__m128 xy = _mm_add_ps(_mm_mul_ps(vlat, la), _mm_mul_ps(vlon, lo));
+			__m128 mag = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(la, la), _mm_mul_ps(lo, lo)));
+			_mm_storeu_ps(out+i, _mm_div_ps(xy, _mm_mul_ps(magCore, mag)));
+		}
+		batchScalar(core, lat+i, lon+i, out+i, n-i);
+	}
+	__attribute__((target("avx2,fma")))
+	static void batchAvx2(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		const __m256 vlat = _mm256_set1_ps(core.lat);
+		const __m256 vlon = _mm256_set1_ps(core.lon);
+		const __m256 magCore = _mm256_set1_ps(sqrtf(core.lat*core.lat + core.lon*core.lon));
+		size_t i = 0;
+		for ( ; i+8 <= n; i += 8 ) {
+			__m256 la = _mm256_loadu_ps(lat+i);
+			__m256 lo = _mm256_loadu_ps(lon+i);
+			__m256 xy = _mm256_add_ps(_mm256_mul_ps(vlat, la), _mm256_mul_ps(vlon, lo));
+			__m256 mag = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(la, la), _mm256_mul_ps(lo, lo)));
+			_mm256_storeu_ps(out+i, _mm256_div_ps(xy, _mm256_mul_ps(magCore, mag)));
+		}
+		batchScalar(core, lat+i, lon+i, out+i, n-i);
+	}
+	__attribute__((target("avx512f")))
+	static inline __m512 kernel16(__m512 vlat, __m512 vlon, __m512 magCore, __m512 la, __m512 lo) {
+		__m512 xy = _mm512_add_ps(_mm512_mul_ps(vlat, la), _mm512_mul_ps(vlon, lo));
+		__m512 mag = _mm512_sqrt_ps(_mm512_add_ps(_mm512_mul_ps(la, la), _mm512_mul_ps(lo, lo)));
+		return _mm512_div_ps(xy, _mm512_mul_ps(magCore, mag));
+	}
+	__attribute__((target("avx512f")))
+	static void batchAvx512(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		const __m512 vlat = _mm512_set1_ps(core.lat);
+		const __m512 vlon = _mm512_set1_ps(core.lon);
+		const __m512 magCore = _mm512_set1_ps(sqrtf(core.lat*core.lat + core.lon*core.lon));
+		size_t i = 0;
+		for ( ; i+16 <= n; i += 16 ) {
+			_mm512_storeu_ps(out+i, kernel16(vlat, vlon, magCore, _mm512_loadu_ps(lat+i), _mm512_loadu_ps(lon+i)));
+		}
+		if ( i < n ) {
+			__mmask16 m = distanceTailMask(n-i);
+			_mm512_mask_storeu_ps(out+i, m, kernel16(vlat, vlon, magCore, _mm512_maskz_loadu_ps(m, lat+i), _mm512_maskz_loadu_ps(m, lon+i)));
+		}
+	}
+};
+
+/****
+Haversine
+The kernels are those of HaversineBatch.cpp, one per DistanceIsa
+****/
+template <> struct Metric<Haversine> {
+	static const char* name() { return "haversine"; }
+
+	static float scalar(Point a, Point b) {
+		float out;
+		batchScalar(a, &b.lat, &b.lon, &out, 1);
+		return out;
+	}
+	static void batchScalar(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		haversineBatchIsa(HAVERSINE_SCALAR, core.lat, core.lon, lat, lon, out, n);
+	}
+	static void batchSse(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		haversineBatchIsa(HAVERSINE_SSE, core.lat, core.lon, lat, lon, out, n);
+	}
+	static void batchAvx2(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		haversineBatchIsa(HAVERSINE_AVX2, core.lat, core.lon, lat, lon, out, n);
+	}
+	static void batchAvx512(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		haversineBatchIsa(HAVERSINE_AVX512, core.lat, core.lon, lat, lon, out, n);
+	}
+};
+#pragma GCC diagnostic pop
+
+/****
+Dispatch
+****/
+typedef void (*DistanceOffloadFn)(Point core, const float* lat, const float* lon, float* out, size_t n, void* arg);
+
+template <class M> struct DistanceOffload {
+	static DistanceOffloadFn fn;
+	static void* arg;
+};
+template <class M> DistanceOffloadFn DistanceOffload<M>::fn = NULL;
+template <class M> void* DistanceOffload<M>::arg = NULL;
+
+// Registers the FPGA backend of metric M, NULL removes it
+template <class M>
+inline void distanceSetOffload(DistanceOffloadFn fn, void* arg) {
+	DistanceOffload<M>::fn = fn;
+	DistanceOffload<M>::arg = arg;
+}
+
+// The isa that will actually run when isa is asked for
+template <class M>
+inline DistanceIsa distanceResolveIsa(DistanceIsa isa) {
+	if ( isa == DISTANCE_FPGA && DistanceOffload<M>::fn == NULL ) return distanceBestIsa();
+	if ( isa == DISTANCE_AVX512 && distanceBestIsa() != DISTANCE_AVX512 ) isa = DISTANCE_AVX2;
+	if ( isa == DISTANCE_AVX2 && distanceBestIsa() == DISTANCE_SSE ) return DISTANCE_SSE;
+	return isa;
+}
+
+// out[i] = distance(core, (lat[i], lon[i]))
+template <class M>
+inline void distanceOneToMany(DistanceIsa isa, Point core, const float* lat, const float* lon, float* out, size_t n) {
+	switch (distanceResolveIsa<M>(isa)) {
+		case DISTANCE_FPGA:
+			DistanceOffload<M>::fn(core, lat, lon, out, n, DistanceOffload<M>::arg);
+			break;
+		case DISTANCE_AVX512:
+			Metric<M>::batchAvx512(core, lat, lon, out, n);
+			break;
+		case DISTANCE_AVX2:
+			Metric<M>::batchAvx2(core, lat, lon, out, n);
+			break;
+		case DISTANCE_SSE:
+			Metric<M>::batchSse(core, lat, lon, out, n);
+			break;
+		default:
+			Metric<M>::batchScalar(core, lat, lon, out, n);
+			break;
+	}
+}
+
+// out[i*nb + j] = distance((aLat[i], aLon[i]), (bLat[j], bLon[j]))
+template <class M>
+inline void distanceManyToMany(DistanceIsa isa, const float* aLat, const float* aLon, size_t na,
+	const float* bLat, const float* bLon, size_t nb, float* out) {
+	for ( size_t i = 0; i < na; i++ ) {
+		Point core = {aLat[i], aLon[i]};
+		distanceOneToMany<M>(isa, core, bLat, bLon, out + i*nb, nb);
+	}
+}
+
+/****
+Threaded driver
+****/
+template <class M>
+class DistanceDriver {
+public:
+	// threads 0 uses every hardware thread. Work is split in chunks of grain targets (or rows)
+	DistanceDriver(DistanceIsa isa = distanceBestIsa(), int threads = 0, size_t grain = 16*1024) {
+		m_isa = distanceResolveIsa<M>(isa);
+		m_threads = threads > 0 ? threads : (int)std::thread::hardware_concurrency();
+		if ( m_threads < 1 || m_isa == DISTANCE_FPGA ) m_threads = 1;
+		m_grain = grain > 0 ? grain : 1;
+	}
+
+	DistanceIsa isa() const { return m_isa; }
+	int threads() const { return m_threads; }
+
+	void oneToMany(Point core, const float* lat, const float* lon, float* out, size_t n) {
+		if ( m_threads == 1 ) {
+			distanceOneToMany<M>(m_isa, core, lat, lon, out, n);
+			return;
+		}
+		parallel(n, m_grain, [&](size_t begin, size_t end) {
+			distanceOneToMany<M>(m_isa, core, lat + begin, lon + begin, out + begin, end - begin);
+		});
+	}
+
+	void manyToMany(const float* aLat, const float* aLon, size_t na, const float* bLat, const float* bLon, size_t nb, float* out) {
+		size_t rows = (m_grain + nb - 1) / (nb ? nb : 1);
+		parallel(na, rows ? rows : 1, [&](size_t begin, size_t end) {
+			distanceManyToMany<M>(m_isa, aLat + begin, aLon + begin, end - begin, bLat, bLon, nb, out + begin*nb);
+		});
+	}
+
+private:
+	template <class F>
+	void parallel(size_t count, size_t grain, F f) {
+		std::atomic<size_t> next(0);
+		auto worker = [&]() {
+			while (true) {
+				size_t begin = next.fetch_add(grain);
+				if ( begin >= count ) break;
+				f(begin, (count - begin < grain) ? count : begin + grain);
+			}
+		};
+		std::vector<std::thread> threads;
+		for ( int t = 1; t < m_threads; t++ ) threads.push_back(std::thread(worker));
+		worker();
+		for ( size_t t = 0; t < threads.size(); t++ ) threads[t].join();
+	}
+
+	DistanceIsa m_isa;
+	int m_threads;
+	size_t m_grain;
+};
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef __EXAMPLES_DNA_CODEC__H__
+#define __EXAMPLES_DNA_CODEC__H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <immintrin.h>
+
+/****
+2-bit DNA codec of the bram/dram motif examples
+
+A=0, C=1, G=2, T=3, four bases per byte, first base in the low bits: the layout the hardware
+reads. Packing goes through a 256 entry table, or with AVX2 32 bases at a time: PSHUFB on the
+low nibble gives the code (A, C, G and T differ there), and two multiply-adds squeeze four
+codes into each byte. Unpacking spreads 8 bytes over 32 lanes and maps them back with PSHUFB.
+
+Other characters are stored as A. Side masks keep one bit per base so they can be restored:
+nMask marks bases that are not ACGT, lowerMask marks lowercase (soft-masked) bases. Either
+mask may be NULL when it is not wanted. Decoding writes 'N' for every nMask base, so IUPAC
+codes other than N come back as N.
+
+Records are the 512 bit DRAM words of HwMain.bsv: perRecord sequences of length bases each,
+packed back to back from bit 0 and zero padded. The examples use 2 x 111 bases (444 bits).
+Mask bit i belongs to base i of the input, whatever record it lands in.
+****/
+
+#define DNA_RECORD_BYTES 64
+
+// 64 bit mask words for n bases
+static inline size_t dnaMaskWords(size_t n) {
+	return (n + 63) / 64;
+}
+
+static inline size_t dnaPackedBytes(size_t n) {
+	return (n + 3) / 4;
+}
+
+// Records for count sequences, perRecord to a record
+static inline size_t dnaRecordCount(size_t count, size_t perRecord) {
+	return (count + perRecord - 1) / perRecord;
+}
+
+// Code, N flag (bit 2) and lowercase flag (bit 3) of every character
+typedef struct {
+	uint8_t code[256];
+	char base[4];
+} DnaTables;
+
+static inline DnaTables dnaBuildTables() {
+	DnaTables tables;
+	for ( int c = 0; c < 256; c++ ) {
+		uint8_t v = 4;
+		switch ( c & 0xdf ) {
+		case 'A': v = 0; break;
+		case 'C': v = 1; break;
+		case 'G': v = 2; break;
+		case 'T': v = 3; break;
+		}
+		if ( c >= 'a' && c <= 'z' ) v |= 8;
+		tables.code[c] = v;
+	}
+	memcpy(tables.base, "ACGT", 4);
+	return tables;
+}
+
+static inline const DnaTables& dnaTables() {
+	static const DnaTables tables = dnaBuildTables();
+	return tables;
+}
+
+static inline void dnaSetMaskBits(uint64_t* mask, size_t pos, uint64_t bits, int count) {
+	if ( mask == NULL || bits == 0 ) return;
+	if ( count < 64 ) bits &= ((uint64_t)1 << count) - 1;
+	mask[pos/64] |= bits << (pos%64);
+	if ( pos%64 && pos%64 + count > 64 ) mask[pos/64 + 1] |= bits >> (64 - pos%64);
+}
+
+static inline uint32_t dnaMaskBits32(const uint64_t* mask, size_t pos) {
+	if ( mask == NULL ) return 0;
+	uint64_t bits = mask[pos/64] >> (pos%64);
+	if ( pos%64 > 32 ) bits |= mask[pos/64 + 1] << (64 - pos%64);
+	return (uint32_t)bits;
+}
+
+// n bases of seq into packed, masks from bit maskPos. Bits of a partial last byte are zero
+static inline void dnaEncodeScalar(const char* seq, size_t n, uint8_t* packed, uint64_t* nMask, uint64_t* lowerMask, size_t maskPos) {
+	const DnaTables& t = dnaTables();
+	for ( size_t i = 0; i < n; i += 4 ) {
+		uint8_t unit = 0;
+		for ( size_t k = 0; k < 4 && i + k < n; k++ ) {
+			uint8_t v = t.code[(uint8_t)seq[i+k]];
+			unit |= (v & 3) << 2*k;
+			if ( v & 4 ) dnaSetMaskBits(nMask, maskPos + i + k, 1, 1);
+			if ( v & 8 ) dnaSetMaskBits(lowerMask, maskPos + i + k, 1, 1);
+		}
+		packed[i/4] = unit;
+	}
+}
+
+__attribute__((target("avx2")))
+static inline void dnaEncodeAvx2(const char* seq, size_t n, uint8_t* packed, uint64_t* nMask, uint64_t* lowerMask, size_t maskPos) {
+	// low nibble of A, C, G, T is 1, 3, 7, 4
+	const __m256i codes = _mm256_setr_epi8(0,0,0,1,3,0,0,2,0,0,0,0,0,0,0,0, 0,0,0,1,3,0,0,2,0,0,0,0,0,0,0,0);
+	const __m256i upper = _mm256_set1_epi8((char)0xdf);
+	const __m256i pairs = _mm256_set1_epi16(0x0401);
+	const __m256i quads = _mm256_set1_epi32(0x00100001);
+	// byte 0 of each 32 bit lane to the low 4 bytes of each 128 bit lane
+	const __m256i gather = _mm256_setr_epi8(0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, 0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+	size_t i = 0;
+	for ( ; i + 32 <= n; i += 32 ) {
+		__m256i c = _mm256_loadu_si256((const __m256i*)(seq + i));
+		__m256i u = _mm256_and_si256(c, upper);
+		__m256i v = _mm256_shuffle_epi8(codes, _mm256_and_si256(c, _mm256_set1_epi8(0x0f)));
+		__m256i valid = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(u, _mm256_set1_epi8('A')), _mm256_cmpeq_epi8(u, _mm256_set1_epi8('C'))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(u, _mm256_set1_epi8('G')), _mm256_cmpeq_epi8(u, _mm256_set1_epi8('T'))));
+		v = _mm256_and_si256(v, valid);
+
+		// b0 + 4 b1 per 16 bits, then (b0 + 4 b1) + 16 (b2 + 4 b3) per 32 bits
+		__m256i p = _mm256_madd_epi16(_mm256_maddubs_epi16(v, pairs), quads);
+		__m256i g = _mm256_shuffle_epi8(p, gather);
+		uint64_t out = (uint64_t)(uint32_t)_mm256_extract_epi32(g, 0) | (uint64_t)(uint32_t)_mm256_extract_epi32(g, 4) << 32;
+		memcpy(packed + i/4, &out, 8);
+
+		if ( nMask ) dnaSetMaskBits(nMask, maskPos + i, (uint32_t)~_mm256_movemask_epi8(valid), 32);
+		if ( lowerMask ) {
+			__m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a'-1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z'+1), c));
+			dnaSetMaskBits(lowerMask, maskPos + i, (uint32_t)_mm256_movemask_epi8(lower), 32);
+		}
+	}
+	dnaEncodeScalar(seq + i, n - i, packed + i/4, nMask, lowerMask, maskPos + i);
+}
+
+// Masks are ORed into, so clear them first
+static inline void dnaEncode(const char* seq, size_t n, uint8_t* packed, uint64_t* nMask = NULL, uint64_t* lowerMask = NULL, size_t maskPos = 0) {
+	static bool avx2 = __builtin_cpu_supports("avx2");
+	if ( avx2 ) dnaEncodeAvx2(seq, n, packed, nMask, lowerMask, maskPos);
+	else dnaEncodeScalar(seq, n, packed, nMask, lowerMask, maskPos);
+}
+
+static inline void dnaDecodeScalar(const uint8_t* packed, size_t n, char* seq, const uint64_t* nMask, const uint64_t* lowerMask, size_t maskPos) {
+	const DnaTables& t = dnaTables();
+	for ( size_t i = 0; i < n; i++ ) {
+		char c = t.base[(packed[i/4] >> 2*(i%4)) & 3];
+		size_t m = maskPos + i;
+		if ( nMask && (nMask[m/64] >> (m%64)) & 1 ) c = 'N';
+		if ( lowerMask && (lowerMask[m/64] >> (m%64)) & 1 ) c |= 0x20;
+		seq[i] = c;
+	}
+}
+
+// 32 lanes of 0xff where bit i of bits is set
+__attribute__((target("avx2")))
+static inline __m256i dnaMaskLanes(uint32_t bits) {
+	const __m256i spread = _mm256_setr_epi8(0,0,0,0,0,0,0,0,1,1,1,1,1,1,1,1, 2,2,2,2,2,2,2,2,3,3,3,3,3,3,3,3);
+	const __m256i select = _mm256_set1_epi64x((long long)0x8040201008040201ULL);
+	__m256i b = _mm256_shuffle_epi8(_mm256_set1_epi32((int)bits), spread);
+	return _mm256_cmpeq_epi8(_mm256_and_si256(b, select), select);
+}
+
+__attribute__((target("avx2")))
+static inline void dnaDecodeAvx2(const uint8_t* packed, size_t n, char* seq, const uint64_t* nMask, const uint64_t* lowerMask, size_t maskPos) {
+	// lane i takes byte i/4; lanes 2, 3 of every 4 the high nibble; odd lanes the upper code of it
+	const __m256i expand = _mm256_setr_epi8(0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3, 4,4,4,4,5,5,5,5,6,6,6,6,7,7,7,7);
+	const __m256i highNibble = _mm256_set1_epi32((int)0xffff0000);
+	const __m256i odd = _mm256_set1_epi16((short)0xff00);
+	const __m256i even = _mm256_setr_epi8('A','C','G','T','A','C','G','T','A','C','G','T','A','C','G','T',
+		'A','C','G','T','A','C','G','T','A','C','G','T','A','C','G','T');
+	const __m256i upperCode = _mm256_setr_epi8('A','A','A','A','C','C','C','C','G','G','G','G','T','T','T','T',
+		'A','A','A','A','C','C','C','C','G','G','G','G','T','T','T','T');
+	const __m256i nibble = _mm256_set1_epi8(0x0f);
+	size_t i = 0;
+	for ( ; i + 32 <= n; i += 32 ) {
+		uint64_t word;
+		memcpy(&word, packed + i/4, 8);
+		__m256i e = _mm256_shuffle_epi8(_mm256_set1_epi64x((long long)word), expand);
+		__m256i lo = _mm256_and_si256(e, nibble);
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi16(e, 4), nibble);
+		__m256i nib = _mm256_blendv_epi8(lo, hi, highNibble);
+		__m256i c = _mm256_blendv_epi8(_mm256_shuffle_epi8(even, nib), _mm256_shuffle_epi8(upperCode, nib), odd);
+		if ( nMask ) c = _mm256_blendv_epi8(c, _mm256_set1_epi8('N'), dnaMaskLanes(dnaMaskBits32(nMask, maskPos + i)));
+		if ( lowerMask ) c = _mm256_or_si256(c, _mm256_and_si256(dnaMaskLanes(dnaMaskBits32(lowerMask, maskPos + i)), _mm256_set1_epi8(0x20)));
+		_mm256_storeu_si256((__m256i*)(seq + i), c);
+	}
+	dnaDecodeScalar(packed + i/4, n - i, seq + i, nMask, lowerMask, maskPos + i);
+}
+
+static inline void dnaDecode(const uint8_t* packed, size_t n, char* seq, const uint64_t* nMask = NULL, const uint64_t* lowerMask = NULL, size_t maskPos = 0) {
+	static bool avx2 = __builtin_cpu_supports("avx2");
+	if ( avx2 ) dnaDecodeAvx2(packed, n, seq, nMask, lowerMask, maskPos);
+	else dnaDecodeScalar(packed, n, seq, nMask, lowerMask, maskPos);
+}
+
+// count sequences of length bases, back to back in seqs, into dnaRecordCount() records at out.
+// Returns the bytes written, 0 if perRecord sequences do not fit in a record
+static inline size_t dnaPackRecords(const char* seqs, size_t count, size_t length, size_t perRecord, uint8_t* out, uint64_t* nMask = NULL, uint64_t* lowerMask = NULL) {
+	if ( perRecord == 0 || perRecord*length > DNA_RECORD_BYTES*4 ) return 0;
+	size_t records = dnaRecordCount(count, perRecord);
+	for ( size_t r = 0; r < records; r++ ) {
+		size_t first = r*perRecord;
+		size_t seqsIn = (count - first < perRecord) ? count - first : perRecord;
+		size_t bases = seqsIn*length;
+		uint8_t* record = out + r*DNA_RECORD_BYTES;
+		dnaEncode(seqs + first*length, bases, record, nMask, lowerMask, first*length);
+		memset(record + dnaPackedBytes(bases), 0, DNA_RECORD_BYTES - dnaPackedBytes(bases));
+	}
+	return records*DNA_RECORD_BYTES;
+}
+
+static inline void dnaUnpackRecords(const uint8_t* in, size_t count, size_t length, size_t perRecord, char* seqs, const uint64_t* nMask = NULL, const uint64_t* lowerMask = NULL) {
+	if ( perRecord == 0 || perRecord*length > DNA_RECORD_BYTES*4 ) return;
+	for ( size_t first = 0; first < count; first += perRecord ) {
+		size_t seqsIn = (count - first < perRecord) ? count - first : perRecord;
+		dnaDecode(in + first/perRecord*DNA_RECORD_BYTES, seqsIn*length, seqs + first*length, nMask, lowerMask, first*length);
+	}
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef __EPSILON_BOX__H__
+#define __EPSILON_BOX__H__
+
+#include <math.h>
+
+/****
+Bounding boxes of an epsilon neighborhood, for the region queries of HaversineNeighbors
+(haversine/c) and the metrics of Dbscan.h
+
+On the sphere the box is the inverse haversine box of haversine.cpp (inverseHaversineLat/Lon):
+	dlat = epsilon/R, dlon = asin(sin(epsilon/R)/cos(lat))
+with every longitude in range (dlon 180) when the circle reaches a pole.
+EPSILON_BOX_MARGIN widens a box a little so float rounding of the inputs never drops a true neighbor.
+****/
+
+#define EPSILON_BOX_MARGIN(x) ((x)*(1+1e-5) + 1e-5)
+#define EPSILON_BOX_EARTH_RADIUS 6371.0
+#define EPSILON_BOX_TO_RADIAN (3.14159265358979323846 / 180)
+#define EPSILON_BOX_TO_DEGREE (180 / 3.14159265358979323846)
+
+// Half height and half width in degrees of the box around lat holding every point within
+// epsilon km. dlon is 180 when all longitudes are in range
+static inline void haversineBoxSize(float lat, double epsilon, float* dlat, float* dlon) {
+	double delta = epsilon/EPSILON_BOX_EARTH_RADIUS;
+	*dlat = (float)EPSILON_BOX_MARGIN(delta*EPSILON_BOX_TO_DEGREE);
+	*dlon = 180;
+	if ( fabsf(lat) + *dlat < 90 ) {
+		double s = sin(delta)/cos(lat*EPSILON_BOX_TO_RADIAN);
+		if ( s < 1 ) *dlon = (float)EPSILON_BOX_MARGIN(asin(s)*EPSILON_BOX_TO_DEGREE);
+	}
+	if ( *dlon > 180 ) *dlon = 180;
+}
+
+// Longitude ranges [lo[i], hi[i]] inside [-180, 180] covering lon-dlon .. lon+dlon,
+// split in two where it crosses the antimeridian. Returns how many (1 or 2)
+static inline int haversineBoxLonRanges(float lon, float dlon, float* lo, float* hi) {
+	if ( dlon >= 180 ) {
+		lo[0] = -180; hi[0] = 180;
+		return 1;
+	}
+	float l = lon - dlon;
+	float h = lon + dlon;
+	if ( l < -180 ) {
+		lo[0] = -180; hi[0] = h;
+		lo[1] = l + 360; hi[1] = 180;
+		return 2;
+	}
+	if ( h > 180 ) {
+		lo[0] = l; hi[0] = 180;
+		lo[1] = -180; hi[1] = h - 360;
+		return 2;
+	}
+	lo[0] = l; hi[0] = h;
+	return 1;
+}
+
+#endif
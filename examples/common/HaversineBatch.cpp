@@ -0,0 +1,342 @@
+#include <math.h>
+#include <immintrin.h>
+
+#include "HaversineBatch.h"
+
+#define HB_EARTH_RADIUS 6371.0f
+#define HB_HALF_RADIAN (3.1415926536f / 360)
+#define HB_PI_HI 3.14159274101257324f // float(pi)
+#define HB_PI_LO -8.74227766e-8f // pi - float(pi)
+#define HB_HALF_PI 1.57079637050628662f
+#define HB_INV_PI 0.318309886f
+
+// sin(x) on [-pi/2, pi/2], odd minimax polynomial
+#define HB_S3 -1.66666672e-1f
+#define HB_S5 8.33332818e-3f
+#define HB_S7 -1.98409332e-4f
+#define HB_S9 2.75261802e-6f
+#define HB_S11 -2.38683364e-8f
+
+// asin(x) on [0, 0.5] as x + x^3*P(x^2) (Cephes asinf)
+#define HB_A1 1.6666752422e-1f
+#define HB_A3 7.4953002686e-2f
+#define HB_A5 4.5470025998e-2f
+#define HB_A7 2.4181311049e-2f
+#define HB_A9 4.2163199048e-2f
+
+#define HB_HALF_PI_LO (HB_PI_LO*0.5f)
+
+/****
+The textbook form asin(sqrt(f)) loses up to ~5 km near antipodal pairs in float,
+because 1-f cancels. The kernels also compute g = 1-f directly from
+	g = sin^2((lat1+lat2)/2) + cos^2(dlon/2)*cos(lat1)*cos(lat2)
+which has no cancellation, and use it in the asin(h) = pi/2 - 2*asin(sqrt((1-h)/2)) branch
+with 1-h = g/(1+h).
+****/
+
+/****
+Scalar
+****/
+static inline float hbSin(float x) {
+	float z = x*x;
+	float p = (((HB_S11*z + HB_S9)*z + HB_S7)*z + HB_S5)*z + HB_S3;
+	return x + x*z*p;
+}
+
+// cos(x) on [-pi/2, pi/2]
+static inline float hbCos(float x) {
+	return hbSin((HB_HALF_PI - fabsf(x)) + HB_HALF_PI_LO);
+}
+
+// asin(sqrt(f)) with g = 1-f
+static inline float hbAsinFG(float f, float g) {
+	float h = sqrtf(f);
+	bool big = h > 0.5f;
+	float z = big ? g/(2.0f*(1.0f+h)) : f;
+	float x = big ? sqrtf(z) : h;
+	float p = ((((HB_A9*z + HB_A7)*z + HB_A5)*z + HB_A3)*z + HB_A1)*z*x + x;
+	return big ? (HB_HALF_PI - 2.0f*p) + HB_HALF_PI_LO : p;
+}
+
+static void haversineBatchScalar(float coreLat, float coreLon, const float* lat, const float* lon, float* dist, size_t n, size_t start) {
+	float cosCore = hbCos(coreLat*2*HB_HALF_RADIAN);
+	for ( size_t i = start; i < n; i++ ) {
+		float dlat = (lat[i]-coreLat)*HB_HALF_RADIAN;
+		float dlon = (lon[i]-coreLon)*HB_HALF_RADIAN;
+		// only squares are used, so reducing by multiples of pi is enough
+		float k = rintf(dlon*HB_INV_PI);
+		dlon = dlon - k*HB_PI_HI - k*HB_PI_LO;
+
+		float s1 = hbSin(dlat);
+		float s2 = hbSin(dlon);
+		float c2 = hbCos(dlon);
+		float sm = hbSin((lat[i]+coreLat)*HB_HALF_RADIAN);
+		float cc = cosCore*hbCos(lat[i]*2*HB_HALF_RADIAN);
+		float f = s1*s1 + s2*s2*cc;
+		float g = sm*sm + c2*c2*cc;
+		dist[i] = hbAsinFG(f, g) * (2*HB_EARTH_RADIUS);
+	}
+}
+
+/****
+SSE2, 4 lanes. The x86-64 baseline, so it needs no target attribute
+****/
+static inline __m128 hbSin4(__m128 x) {
+	__m128 z = _mm_mul_ps(x, x);
+	__m128 p = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(HB_S11), z), _mm_set1_ps(HB_S9));
+	p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(HB_S7));
+	p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(HB_S5));
+	p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(HB_S3));
+	return _mm_add_ps(_mm_mul_ps(_mm_mul_ps(x, z), p), x);
+}
+
+static inline __m128 hbCos4(__m128 x) {
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 r = _mm_sub_ps(_mm_set1_ps(HB_HALF_PI), _mm_and_ps(x, absMask));
+	return hbSin4(_mm_add_ps(r, _mm_set1_ps(HB_HALF_PI_LO)));
+}
+
+static inline __m128 hbSelect4(__m128 mask, __m128 a, __m128 b) {
+	return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+}
+
+static inline __m128 hbAsinFG4(__m128 f, __m128 g) {
+	__m128 h = _mm_sqrt_ps(f);
+	__m128 big = _mm_cmpgt_ps(h, _mm_set1_ps(0.5f));
+	__m128 zbig = _mm_div_ps(g, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.0f), h), _mm_set1_ps(2.0f)));
+	__m128 z = hbSelect4(big, f, zbig);
+	__m128 x = hbSelect4(big, h, _mm_sqrt_ps(zbig));
+	__m128 p = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(HB_A9), z), _mm_set1_ps(HB_A7));
+	p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(HB_A5));
+	p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(HB_A3));
+	p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(HB_A1));
+	p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, z), x), x);
+	__m128 r = _mm_sub_ps(_mm_set1_ps(HB_HALF_PI), _mm_mul_ps(_mm_set1_ps(2.0f), p));
+	r = _mm_add_ps(r, _mm_set1_ps(HB_HALF_PI_LO));
+	return hbSelect4(big, p, r);
+}
+
+static void haversineBatchSSE(float coreLat, float coreLon, const float* lat, const float* lon, float* dist, size_t n) {
+	const __m128 vlat0 = _mm_set1_ps(coreLat);
+	const __m128 vlon0 = _mm_set1_ps(coreLon);
+	const __m128 halfRad = _mm_set1_ps(HB_HALF_RADIAN);
+	const __m128 cosCore = _mm_set1_ps(hbCos(coreLat*2*HB_HALF_RADIAN));
+	const __m128 scale = _mm_set1_ps(2*HB_EARTH_RADIUS);
+
+	size_t i = 0;
+	for ( ; i+4 <= n; i += 4 ) {
+		__m128 la = _mm_loadu_ps(lat+i);
+		__m128 lo = _mm_loadu_ps(lon+i);
+		__m128 dlat = _mm_mul_ps(_mm_sub_ps(la, vlat0), halfRad);
+		__m128 dlon = _mm_mul_ps(_mm_sub_ps(lo, vlon0), halfRad);
+		// round to nearest through the default MXCSR mode
+		__m128 k = _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(dlon, _mm_set1_ps(HB_INV_PI))));
+		dlon = _mm_sub_ps(dlon, _mm_mul_ps(k, _mm_set1_ps(HB_PI_HI)));
+		dlon = _mm_sub_ps(dlon, _mm_mul_ps(k, _mm_set1_ps(HB_PI_LO)));
+
+		__m128 s1 = hbSin4(dlat);
+		__m128 s2 = hbSin4(dlon);
+		__m128 c2 = hbCos4(dlon);
+		__m128 sm = hbSin4(_mm_mul_ps(_mm_add_ps(la, vlat0), halfRad));
+		__m128 cc = _mm_mul_ps(cosCore, hbCos4(_mm_mul_ps(la, _mm_add_ps(halfRad, halfRad))));
+		__m128 f = _mm_add_ps(_mm_mul_ps(s1, s1), _mm_mul_ps(_mm_mul_ps(s2, s2), cc));
+		__m128 g = _mm_add_ps(_mm_mul_ps(sm, sm), _mm_mul_ps(_mm_mul_ps(c2, c2), cc));
+		_mm_storeu_ps(dist+i, _mm_mul_ps(hbAsinFG4(f, g), scale));
+	}
+	haversineBatchScalar(coreLat, coreLon, lat, lon, dist, n, i);
+}
+
+/****
+AVX2 + FMA, 8 lanes
+****/
+__attribute__((target("avx2,fma")))
+static inline __m256 hbSin8(__m256 x) {
+	__m256 z = _mm256_mul_ps(x, x);
+	__m256 p = _mm256_fmadd_ps(_mm256_set1_ps(HB_S11), z, _mm256_set1_ps(HB_S9));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(HB_S7));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(HB_S5));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(HB_S3));
+	return _mm256_fmadd_ps(_mm256_mul_ps(x, z), p, x);
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 hbCos8(__m256 x) {
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256 r = _mm256_sub_ps(_mm256_set1_ps(HB_HALF_PI), _mm256_and_ps(x, absMask));
+	return hbSin8(_mm256_add_ps(r, _mm256_set1_ps(HB_HALF_PI_LO)));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 hbAsinFG8(__m256 f, __m256 g) {
+	__m256 h = _mm256_sqrt_ps(f);
+	__m256 big = _mm256_cmp_ps(h, _mm256_set1_ps(0.5f), _CMP_GT_OQ);
+	__m256 zbig = _mm256_div_ps(g, _mm256_fmadd_ps(_mm256_set1_ps(2.0f), h, _mm256_set1_ps(2.0f)));
+	__m256 z = _mm256_blendv_ps(f, zbig, big);
+	__m256 x = _mm256_blendv_ps(h, _mm256_sqrt_ps(zbig), big);
+	__m256 p = _mm256_fmadd_ps(_mm256_set1_ps(HB_A9), z, _mm256_set1_ps(HB_A7));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(HB_A5));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(HB_A3));
+	p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(HB_A1));
+	p = _mm256_fmadd_ps(_mm256_mul_ps(p, z), x, x);
+	__m256 r = _mm256_fnmadd_ps(_mm256_set1_ps(2.0f), p, _mm256_set1_ps(HB_HALF_PI));
+	r = _mm256_add_ps(r, _mm256_set1_ps(HB_HALF_PI_LO));
+	return _mm256_blendv_ps(p, r, big);
+}
+
+__attribute__((target("avx2,fma")))
+static void haversineBatchAVX2(float coreLat, float coreLon, const float* lat, const float* lon, float* dist, size_t n) {
+	const __m256 vlat0 = _mm256_set1_ps(coreLat);
+	const __m256 vlon0 = _mm256_set1_ps(coreLon);
+	const __m256 halfRad = _mm256_set1_ps(HB_HALF_RADIAN);
+	const __m256 cosCore = _mm256_set1_ps(hbCos(coreLat*2*HB_HALF_RADIAN));
+	const __m256 scale = _mm256_set1_ps(2*HB_EARTH_RADIUS);
+
+	size_t i = 0;
+	for ( ; i+8 <= n; i += 8 ) {
+		__m256 la = _mm256_loadu_ps(lat+i);
+		__m256 lo = _mm256_loadu_ps(lon+i);
+		__m256 dlat = _mm256_mul_ps(_mm256_sub_ps(la, vlat0), halfRad);
+		__m256 dlon = _mm256_mul_ps(_mm256_sub_ps(lo, vlon0), halfRad);
+		__m256 k = _mm256_round_ps(_mm256_mul_ps(dlon, _mm256_set1_ps(HB_INV_PI)), _MM_FROUND_TO_NEAREST_INT|_MM_FROUND_NO_EXC);
+		dlon = _mm256_fnmadd_ps(k, _mm256_set1_ps(HB_PI_HI), dlon);
+		dlon = _mm256_fnmadd_ps(k, _mm256_set1_ps(HB_PI_LO), dlon);
+
+		__m256 s1 = hbSin8(dlat);
+		__m256 s2 = hbSin8(dlon);
+		__m256 c2 = hbCos8(dlon);
+		__m256 sm = hbSin8(_mm256_mul_ps(_mm256_add_ps(la, vlat0), halfRad));
+		__m256 cc = _mm256_mul_ps(cosCore, hbCos8(_mm256_mul_ps(la, _mm256_add_ps(halfRad, halfRad))));
+		__m256 f = _mm256_fmadd_ps(s1, s1, _mm256_mul_ps(_mm256_mul_ps(s2, s2), cc));
+		__m256 g = _mm256_fmadd_ps(sm, sm, _mm256_mul_ps(_mm256_mul_ps(c2, c2), cc));
+		_mm256_storeu_ps(dist+i, _mm256_mul_ps(hbAsinFG8(f, g), scale));
+	}
+	haversineBatchScalar(coreLat, coreLon, lat, lon, dist, n, i);
+}
+
+/****
+AVX-512, 16 lanes. The tail is done with a masked iteration.
+GCC 12 reports _mm512_undefined_ps() inside the unmasked intrinsics as maybe-uninitialized
+****/
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+__attribute__((target("avx512f")))
+static inline __m512 hbSin16(__m512 x) {
+	__m512 z = _mm512_mul_ps(x, x);
+	__m512 p = _mm512_fmadd_ps(_mm512_set1_ps(HB_S11), z, _mm512_set1_ps(HB_S9));
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(HB_S7));
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(HB_S5));
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(HB_S3));
+	return _mm512_fmadd_ps(_mm512_mul_ps(x, z), p, x);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 hbCos16(__m512 x) {
+	__m512 r = _mm512_sub_ps(_mm512_set1_ps(HB_HALF_PI), _mm512_abs_ps(x));
+	return hbSin16(_mm512_add_ps(r, _mm512_set1_ps(HB_HALF_PI_LO)));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 hbAsinFG16(__m512 f, __m512 g) {
+	__m512 h = _mm512_sqrt_ps(f);
+	__mmask16 big = _mm512_cmp_ps_mask(h, _mm512_set1_ps(0.5f), _CMP_GT_OQ);
+	__m512 zbig = _mm512_div_ps(g, _mm512_fmadd_ps(_mm512_set1_ps(2.0f), h, _mm512_set1_ps(2.0f)));
+	__m512 z = _mm512_mask_blend_ps(big, f, zbig);
+	__m512 x = _mm512_mask_blend_ps(big, h, _mm512_sqrt_ps(zbig));
+	__m512 p = _mm512_fmadd_ps(_mm512_set1_ps(HB_A9), z, _mm512_set1_ps(HB_A7));
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(HB_A5));
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(HB_A3));
+	p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(HB_A1));
+	p = _mm512_fmadd_ps(_mm512_mul_ps(p, z), x, x);
+	__m512 r = _mm512_fnmadd_ps(_mm512_set1_ps(2.0f), p, _mm512_set1_ps(HB_HALF_PI));
+	r = _mm512_add_ps(r, _mm512_set1_ps(HB_HALF_PI_LO));
+	return _mm512_mask_blend_ps(big, p, r);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 hbKernel16(__m512 la, __m512 lo, __m512 vlat0, __m512 vlon0, __m512 cosCore) {
+	const __m512 halfRad = _mm512_set1_ps(HB_HALF_RADIAN);
+	__m512 dlat = _mm512_mul_ps(_mm512_sub_ps(la, vlat0), halfRad);
+	__m512 dlon = _mm512_mul_ps(_mm512_sub_ps(lo, vlon0), halfRad);
+	__m512 k = _mm512_roundscale_ps(_mm512_mul_ps(dlon, _mm512_set1_ps(HB_INV_PI)), _MM_FROUND_TO_NEAREST_INT|_MM_FROUND_NO_EXC);
+	dlon = _mm512_fnmadd_ps(k, _mm512_set1_ps(HB_PI_HI), dlon);
+	dlon = _mm512_fnmadd_ps(k, _mm512_set1_ps(HB_PI_LO), dlon);
+
+	__m512 s1 = hbSin16(dlat);
+	__m512 s2 = hbSin16(dlon);
+	__m512 c2 = hbCos16(dlon);
+	__m512 sm = hbSin16(_mm512_mul_ps(_mm512_add_ps(la, vlat0), halfRad));
+	__m512 cc = _mm512_mul_ps(cosCore, hbCos16(_mm512_mul_ps(la, _mm512_add_ps(halfRad, halfRad))));
+	__m512 f = _mm512_fmadd_ps(s1, s1, _mm512_mul_ps(_mm512_mul_ps(s2, s2), cc));
+	__m512 g = _mm512_fmadd_ps(sm, sm, _mm512_mul_ps(_mm512_mul_ps(c2, c2), cc));
+	return _mm512_mul_ps(hbAsinFG16(f, g), _mm512_set1_ps(2*HB_EARTH_RADIUS));
+}
+
+__attribute__((target("avx512f")))
+static void haversineBatchAVX512(float coreLat, float coreLon, const float* lat, const float* lon, float* dist, size_t n) {
+	const __m512 vlat0 = _mm512_set1_ps(coreLat);
+	const __m512 vlon0 = _mm512_set1_ps(coreLon);
+	const __m512 cosCore = _mm512_set1_ps(hbCos(coreLat*2*HB_HALF_RADIAN));
+
+	size_t i = 0;
+	for ( ; i+16 <= n; i += 16 ) {
+		__m512 la = _mm512_loadu_ps(lat+i);
+		__m512 lo = _mm512_loadu_ps(lon+i);
+		_mm512_storeu_ps(dist+i, hbKernel16(la, lo, vlat0, vlon0, cosCore));
+	}
+	if ( i < n ) {
+		__mmask16 m = (__mmask16)((1u<<(n-i))-1);
+		__m512 la = _mm512_maskz_loadu_ps(m, lat+i);
+		__m512 lo = _mm512_maskz_loadu_ps(m, lon+i);
+		_mm512_mask_storeu_ps(dist+i, m, hbKernel16(la, lo, vlat0, vlon0, cosCore));
+	}
+}
+#pragma GCC diagnostic pop
+
+/****
+Dispatch
+****/
+HaversineIsa
+haversineBatchBestIsa() {
+	static int best = -1;
+	if ( best < 0 ) {
+		__builtin_cpu_init();
+		if ( __builtin_cpu_supports("avx512f") ) best = HAVERSINE_AVX512;
+		else if ( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ) best = HAVERSINE_AVX2;
+		else best = HAVERSINE_SSE;
+	}
+	return (HaversineIsa)best;
+}
+
+const char*
+haversineBatchIsaName(HaversineIsa isa) {
+	switch (isa) {
+		case HAVERSINE_AVX512: return "avx512";
+		case HAVERSINE_AVX2: return "avx2";
+		case HAVERSINE_SSE: return "sse";
+		default: return "scalar";
+	}
+}
+
+void
+haversineBatchIsa(HaversineIsa isa, float coreLat, float coreLon, const float* lat, const float* lon, float* dist, size_t n) {
+	if ( isa > haversineBatchBestIsa() ) isa = HAVERSINE_SCALAR;
+	switch (isa) {
+		case HAVERSINE_AVX512:
+			haversineBatchAVX512(coreLat, coreLon, lat, lon, dist, n);
+			break;
+		case HAVERSINE_AVX2:
+			haversineBatchAVX2(coreLat, coreLon, lat, lon, dist, n);
+			break;
+		case HAVERSINE_SSE:
+			haversineBatchSSE(coreLat, coreLon, lat, lon, dist, n);
+			break;
+		default:
+			haversineBatchScalar(coreLat, coreLon, lat, lon, dist, n, 0);
+			break;
+	}
+}
+
+void
+haversineBatch(float coreLat, float coreLon, const float* lat, const float* lon, float* dist, size_t n) {
+	haversineBatchIsa(haversineBatchBestIsa(), coreLat, coreLon, lat, lon, dist, n);
+}
@@ -0,0 +1,44 @@
+#ifndef __HAVERSINE_BATCH__H__
+#define __HAVERSINE_BATCH__H__
+
+#include <stddef.h>
+
+/****
+Batch haversine kernel: one core point against a structure-of-arrays block of targets
+Inputs are in degrees, like worldcities.bin. Results are in km (EARTH_RADIUS 6371).
+
+sin, cos and asin are float polynomial approximations evaluated in AVX-512, AVX2+FMA or SSE2,
+with a scalar fallback using the same polynomials. The best ISA is picked at runtime.
+This is the one haversine kernel of the examples: Metric<Haversine> in DistanceMetric.h calls it too.
+
+Accuracy, measured against a double precision haversine of the same float coordinates
+(every third worldcities.bin city as core, against all 44691 cities):
+	absolute error below 0.006 km, relative error below 2.5e-6 for distances over 1 km.
+	The float haversine() in haversine/c/haversine.cpp is off by up to 2 km near antipodal pairs,
+	because 1-f cancels in asin(sqrt(f)); the kernel computes 1-f without cancellation.
+The FPGA Haversine.bsv feeds sin/cos through 16 bit fixed point CORDIC and returns asin
+as 16 bit fixed point with 14 fraction bits, so even with an exact float conversion its result
+moves in steps of 2*6371*2^-14 = 0.78 km, i.e. about +/-0.4 km plus CORDIC error.
+The CPU kernel is roughly 100x tighter than that; comparisons between the two should allow
+for the FPGA's 0.78 km step. Note that mkFixedToFloat2Int in TypeConverter.bsv currently only
+shifts the integer bits into place without building an exponent, so the card's raw output
+is not yet comparable to any float reference.
+****/
+
+typedef enum {
+	HAVERSINE_SCALAR,
+	HAVERSINE_SSE,
+	HAVERSINE_AVX2,
+	HAVERSINE_AVX512
+} HaversineIsa;
+
+// Best ISA the running CPU supports
+HaversineIsa haversineBatchBestIsa();
+const char* haversineBatchIsaName(HaversineIsa isa);
+
+// dist[i] = haversine((coreLat, coreLon), (lat[i], lon[i])), using the best ISA
+void haversineBatch(float coreLat, float coreLon, const float* lat, const float* lon, float* dist, size_t n);
+// Same, with a fixed ISA. Falls back to scalar if the CPU does not support it
+void haversineBatchIsa(HaversineIsa isa, float coreLat, float coreLon, const float* lat, const float* lon, float* dist, size_t n);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef __EXAMPLES_POINT__H__
+#define __EXAMPLES_POINT__H__
+
+// One city of worldcities.bin: two floats, latitude then longitude, in degrees
+typedef struct Point {
+	float lat;
+	float lon;
+}Point;
+
+#endif
@@ -0,0 +1,192 @@
+#ifndef __EXAMPLES_POINT_FILE__H__
+#define __EXAMPLES_POINT_FILE__H__
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+#include "Point.h"
+
+/****
+Memory-mapped worldcities*.bin reader
+
+The benchmark files are raw arrays of (float lat, float lon), so open() maps the file read-only
+and points() is the data itself: no parsing and no copy. open() checks that the file is a whole
+number of points and holds at least the requested count.
+
+prefault() touches every page from several threads, so the first pass of the benchmark does not
+pay for page faults.
+toSoA() converts to separate lat and lon arrays, which the SIMD kernels want. The arrays are
+backed by 2 MB huge pages when hugepages are reserved (MAP_HUGETLB), and otherwise by
+transparent huge pages where the kernel allows it. Each array starts 64 byte aligned.
+****/
+
+#define POINT_FILE_PAGE 4096
+#define POINT_FILE_HUGE_PAGE (2*1024*1024)
+
+class PointFile {
+public:
+	PointFile() {
+		m_map = NULL;
+		m_map_bytes = 0;
+		m_size = 0;
+		m_soa = NULL;
+		m_soa_bytes = 0;
+		m_stride = 0;
+		m_soa_huge = false;
+	}
+	~PointFile() { close(); }
+
+	// Maps the first length points of filename, all of them if length is 0.
+	// Prints the reason and returns false on failure
+	bool open(const char* filename, size_t length = 0) {
+		close();
+		int fd = ::open(filename, O_RDONLY);
+		if ( fd < 0 ) {
+			printf("File not found: %s\n", filename);
+			return false;
+		}
+		struct stat st;
+		if ( fstat(fd, &st) != 0 || st.st_size % sizeof(Point) != 0 ) {
+			printf("%s is not a whole number of points (%lld bytes)\n", filename, (long long)st.st_size);
+			::close(fd);
+			return false;
+		}
+		size_t count = st.st_size / sizeof(Point);
+		if ( length > count ) {
+			printf("%s holds %lu points, %lu requested\n", filename, count, length);
+			::close(fd);
+			return false;
+		}
+		if ( length == 0 ) length = count;
+
+		if ( length > 0 ) {
+			m_map_bytes = length*sizeof(Point);
+			void* map = mmap(NULL, m_map_bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+			if ( map == MAP_FAILED ) {
+				printf("mmap of %s failed\n", filename);
+				m_map_bytes = 0;
+				::close(fd);
+				return false;
+			}
+			madvise(map, m_map_bytes, MADV_SEQUENTIAL);
+			m_map = (const Point*)map;
+		}
+		// the mapping keeps the file
+		::close(fd);
+		m_size = length;
+		return true;
+	}
+
+	void close() {
+		if ( m_map ) munmap((void*)m_map, m_map_bytes);
+		if ( m_soa ) munmap(m_soa, m_soa_bytes);
+		m_map = NULL;
+		m_map_bytes = 0;
+		m_size = 0;
+		m_soa = NULL;
+		m_soa_bytes = 0;
+		m_stride = 0;
+		m_soa_huge = false;
+	}
+
+	size_t size() const { return m_size; }
+	const Point* points() const { return m_map; }
+	const Point& operator[](size_t i) const { return m_map[i]; }
+
+	// threads 0 uses every hardware thread
+	void prefault(int threads = 0) {
+		if ( m_map == NULL ) return;
+		madvise((void*)m_map, m_map_bytes, MADV_WILLNEED);
+		const volatile uint8_t* bytes = (const volatile uint8_t*)m_map;
+		size_t pages = (m_map_bytes + POINT_FILE_PAGE - 1) / POINT_FILE_PAGE;
+		parallel(pages, threads, [bytes](size_t begin, size_t end) {
+			uint8_t sum = 0;
+			for ( size_t p = begin; p < end; p++ ) sum += bytes[p*POINT_FILE_PAGE];
+			(void)sum;
+		});
+	}
+
+	// Builds lat() and lon(). Returns false if no memory could be mapped
+	bool toSoA(bool hugepages = true, int threads = 0) {
+		if ( m_soa ) munmap(m_soa, m_soa_bytes);
+		m_soa = NULL;
+		m_soa_huge = false;
+		if ( m_size == 0 ) return true;
+
+		size_t stride = (m_size + 15) / 16 * 16;
+		m_soa_bytes = (2*stride*sizeof(float) + POINT_FILE_HUGE_PAGE - 1) / POINT_FILE_HUGE_PAGE * POINT_FILE_HUGE_PAGE;
+		void* mem = MAP_FAILED;
+		if ( hugepages ) {
+			mem = mmap(NULL, m_soa_bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+			m_soa_huge = mem != MAP_FAILED;
+		}
+		if ( mem == MAP_FAILED ) {
+			mem = mmap(NULL, m_soa_bytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+			if ( mem == MAP_FAILED ) {
+				printf("Could not map %lu bytes for the lat/lon arrays\n", m_soa_bytes);
+				m_soa_bytes = 0;
+				return false;
+			}
+			if ( hugepages ) madvise(mem, m_soa_bytes, MADV_HUGEPAGE);
+		}
+		m_soa = (float*)mem;
+		m_stride = stride;
+
+		// every thread converts and first-touches its own range
+		float* lat = m_soa;
+		float* lon = m_soa + stride;
+		const Point* src = m_map;
+		parallel(m_size, threads, [=](size_t begin, size_t end) {
+			for ( size_t i = begin; i < end; i++ ) {
+				lat[i] = src[i].lat;
+				lon[i] = src[i].lon;
+			}
+		});
+		return true;
+	}
+
+	const float* lat() const { return m_soa; }
+	const float* lon() const { return m_soa ? m_soa + m_stride : NULL; }
+	// lat()/lon() live in reserved huge pages
+	bool hugepages() const { return m_soa_huge; }
+
+private:
+	PointFile(const PointFile&);
+	PointFile& operator=(const PointFile&);
+
+	// Splits [0, count) into one contiguous range per thread
+	template <class F>
+	static void parallel(size_t count, int threads, F f) {
+		if ( threads <= 0 ) threads = (int)std::thread::hardware_concurrency();
+		if ( threads < 1 ) threads = 1;
+		if ( (size_t)threads > count ) threads = count > 0 ? (int)count : 1;
+		size_t chunk = (count + threads - 1) / threads;
+		std::vector<std::thread> workers;
+		for ( int t = 1; t < threads; t++ ) {
+			size_t begin = t*chunk;
+			size_t end = (begin + chunk < count) ? begin + chunk : count;
+			if ( begin < end ) workers.push_back(std::thread(f, begin, end));
+		}
+		f(0, chunk < count ? chunk : count);
+		for ( size_t t = 0; t < workers.size(); t++ ) workers[t].join();
+	}
+
+	const Point* m_map;
+	size_t m_map_bytes;
+	size_t m_size;
+
+	float* m_soa;
+	size_t m_soa_bytes;
+	size_t m_stride;
+	bool m_soa_huge;
+};
+
+#endif
@@ -0,0 +1,376 @@
+#ifndef __EXAMPLES_POINT_STORE__H__
+#define __EXAMPLES_POINT_STORE__H__
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include <vector>
+
+#include "Point.h"
+
+/****
+Columnar point store for DMA transfers and FPGA DRAM
+
+Points are kept as structure-of-arrays in blocks of blockPoints points:
+	block b: lat[blockPoints], then lon[blockPoints]
+Every column of a block is a whole number of 512 bit DRAM words (DRAMArbiterUserIfc), so it is
+also whole 128 bit PCIe words (DMAWord). The buffer is 64 byte aligned, so one block can be
+DMAed as is and stored in DRAM without repacking. Unused entries of the last block are zero.
+
+Encodings, bytes per point, and what they cost:
+	POINT_FP32   8  exact
+	POINT_FP16   4  IEEE half. 10 bit mantissa: 0.125 degree steps near 180, so coarse
+	POINT_INT16  4  fixed point over the data range of each column, range/65534 steps
+	POINT_INT32  8  fixed point over the data range, errors below 1e-7 degree
+Fixed point stores q = rint((x - offset) / step) with offset the middle of the column's range.
+The scalar and the AVX2/F16C kernels produce the same bytes. The AVX2 kernels do not use FMA,
+so their rounding matches scalar.
+****/
+
+typedef enum {
+	POINT_FP32,
+	POINT_FP16,
+	POINT_INT16,
+	POINT_INT32
+} PointEncoding;
+
+// DRAMArbiterUserIfc read/write width, and DMAWord
+#define POINT_STORE_DRAM_WORD 64
+#define POINT_STORE_DMA_WORD 16
+
+typedef struct PointColumnScale {
+	double offset;
+	double step;
+	double inv; // 1/step
+} PointColumnScale;
+
+class PointStore {
+public:
+	// blockPoints is rounded up to whole DRAM words
+	PointStore(PointEncoding encoding = POINT_FP32, size_t blockPoints = 4096) {
+		m_encoding = encoding;
+		size_t perWord = POINT_STORE_DRAM_WORD / bytesPerValue(encoding);
+		if ( blockPoints < perWord ) blockPoints = perWord;
+		m_block_points = (blockPoints + perWord - 1) / perWord * perWord;
+		m_size = 0;
+		m_blocks = 0;
+		m_data = NULL;
+		m_bytes = 0;
+		m_simd = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+		PointColumnScale unit = {0, 1, 1};
+		m_lat_scale = unit;
+		m_lon_scale = unit;
+	}
+	~PointStore() { free(m_data); }
+
+	static size_t bytesPerValue(PointEncoding encoding) {
+		return (encoding == POINT_FP16 || encoding == POINT_INT16) ? 2 : 4;
+	}
+	static const char* encodingName(PointEncoding encoding) {
+		switch (encoding) {
+			case POINT_FP16: return "fp16";
+			case POINT_INT16: return "int16";
+			case POINT_INT32: return "int32";
+			default: return "fp32";
+		}
+	}
+
+	void encode(const Point* points, size_t n) {
+		std::vector<float> lat(m_block_points), lon(m_block_points);
+		if ( !prepare(n) ) return;
+		scan(points, n);
+		for ( size_t b = 0; b < m_blocks; b++ ) {
+			size_t count = blockCount(b);
+			const Point* p = points + b*m_block_points;
+			for ( size_t i = 0; i < count; i++ ) {
+				lat[i] = p[i].lat;
+				lon[i] = p[i].lon;
+			}
+			encodeBlock(b, &lat[0], &lon[0], count);
+		}
+	}
+	void encode(const float* lat, const float* lon, size_t n) {
+		if ( !prepare(n) ) return;
+		m_lat_scale = scaleOf(lat, n);
+		m_lon_scale = scaleOf(lon, n);
+		for ( size_t b = 0; b < m_blocks; b++ ) {
+			encodeBlock(b, lat + b*m_block_points, lon + b*m_block_points, blockCount(b));
+		}
+	}
+
+	// lat and lon get blockCount(b) values
+	void decodeBlock(size_t b, float* lat, float* lon) const {
+		size_t count = blockCount(b);
+		decodeColumn(blockLat(b), lat, count, m_lat_scale);
+		decodeColumn(blockLat(b) + m_block_points*bytesPerValue(m_encoding), lon, count, m_lon_scale);
+	}
+	// lat and lon get size() values
+	void decode(float* lat, float* lon) const {
+		for ( size_t b = 0; b < m_blocks; b++ ) {
+			decodeBlock(b, lat + b*m_block_points, lon + b*m_block_points);
+		}
+	}
+	Point point(size_t i) const {
+		size_t b = i / m_block_points;
+		size_t o = i % m_block_points;
+		const uint8_t* lat = blockLat(b);
+		const uint8_t* lon = lat + m_block_points*bytesPerValue(m_encoding);
+		Point p;
+		decodeScalar(lat, &p.lat, o, o+1, m_lat_scale);
+		decodeScalar(lon, &p.lon, o, o+1, m_lon_scale);
+		return p;
+	}
+
+	PointEncoding encoding() const { return m_encoding; }
+	size_t size() const { return m_size; }
+	size_t blocks() const { return m_blocks; }
+	size_t blockPoints() const { return m_block_points; }
+	size_t blockBytes() const { return 2*m_block_points*bytesPerValue(m_encoding); }
+	size_t blockCount(size_t b) const {
+		size_t begin = b*m_block_points;
+		return (m_size - begin < m_block_points) ? m_size - begin : m_block_points;
+	}
+	const uint8_t* block(size_t b) const { return m_data + b*blockBytes(); }
+	const uint8_t* data() const { return m_data; }
+	size_t bytes() const { return m_bytes; }
+	// Fixed point parameters, {0, 1, 1} for the float encodings
+	const PointColumnScale& latScale() const { return m_lat_scale; }
+	const PointColumnScale& lonScale() const { return m_lon_scale; }
+
+private:
+	PointStore(const PointStore&);
+	PointStore& operator=(const PointStore&);
+
+	bool prepare(size_t n) {
+		free(m_data);
+		m_data = NULL;
+		m_size = n;
+		m_blocks = (n + m_block_points - 1) / m_block_points;
+		m_bytes = m_blocks*blockBytes();
+		if ( m_bytes == 0 ) return false;
+		void* mem = NULL;
+		if ( posix_memalign(&mem, POINT_STORE_DRAM_WORD, m_bytes) != 0 ) {
+			printf("PointStore: could not allocate %lu bytes\n", m_bytes);
+			m_size = m_blocks = m_bytes = 0;
+			return false;
+		}
+		m_data = (uint8_t*)mem;
+		memset(m_data, 0, m_bytes);
+		return true;
+	}
+
+	uint8_t* blockLat(size_t b) const { return m_data + b*blockBytes(); }
+
+	void scan(const Point* points, size_t n) {
+		float latLo = INFINITY, latHi = -INFINITY, lonLo = INFINITY, lonHi = -INFINITY;
+		for ( size_t i = 0; i < n; i++ ) {
+			if ( points[i].lat < latLo ) latLo = points[i].lat;
+			if ( points[i].lat > latHi ) latHi = points[i].lat;
+			if ( points[i].lon < lonLo ) lonLo = points[i].lon;
+			if ( points[i].lon > lonHi ) lonHi = points[i].lon;
+		}
+		m_lat_scale = scaleOf(latLo, latHi);
+		m_lon_scale = scaleOf(lonLo, lonHi);
+	}
+	PointColumnScale scaleOf(const float* v, size_t n) const {
+		float lo = INFINITY, hi = -INFINITY;
+		for ( size_t i = 0; i < n; i++ ) {
+			if ( v[i] < lo ) lo = v[i];
+			if ( v[i] > hi ) hi = v[i];
+		}
+		return scaleOf(lo, hi);
+	}
+	PointColumnScale scaleOf(float lo, float hi) const {
+		PointColumnScale s = {0, 1, 1};
+		if ( m_encoding != POINT_INT16 && m_encoding != POINT_INT32 ) return s;
+		double half = ((double)hi - lo)/2;
+		if ( !(half > 0) ) half = 1;
+		double qmax = (m_encoding == POINT_INT16) ? 32767 : 2147483647;
+		s.offset = (double)lo + half;
+		s.step = half/qmax;
+		s.inv = qmax/half;
+		// int16 works in float, the scale is what float computes with
+		if ( m_encoding == POINT_INT16 ) {
+			s.offset = (float)s.offset;
+			s.step = (float)s.step;
+			s.inv = (float)s.inv;
+		}
+		return s;
+	}
+
+	void encodeBlock(size_t b, const float* lat, const float* lon, size_t count) {
+		uint8_t* dst = blockLat(b);
+		encodeColumn(lat, dst, count, m_lat_scale);
+		encodeColumn(lon, dst + m_block_points*bytesPerValue(m_encoding), count, m_lon_scale);
+	}
+	void encodeColumn(const float* src, uint8_t* dst, size_t n, const PointColumnScale& s) const {
+		size_t done = m_simd ? encodeAvx2(m_encoding, src, dst, n, s) : 0;
+		encodeScalar(src, dst, done, n, s);
+	}
+	void decodeColumn(const uint8_t* src, float* dst, size_t n, const PointColumnScale& s) const {
+		size_t done = m_simd ? decodeAvx2(m_encoding, src, dst, n, s) : 0;
+		decodeScalar(src, dst + done, done, n, s);
+	}
+
+	// Values [begin, end) of src into the same slots of dst
+	void encodeScalar(const float* src, uint8_t* dst, size_t begin, size_t end, const PointColumnScale& s) const {
+		for ( size_t i = begin; i < end; i++ ) {
+			switch (m_encoding) {
+				case POINT_FP16:
+					((uint16_t*)dst)[i] = halfFromFloat(src[i]);
+					break;
+				case POINT_INT16: {
+					float q = (src[i] - (float)s.offset) * (float)s.inv;
+					q = q < -32767.0f ? -32767.0f : (q > 32767.0f ? 32767.0f : q);
+					((int16_t*)dst)[i] = (int16_t)lrintf(q);
+					break;
+				}
+				case POINT_INT32: {
+					double q = ((double)src[i] - s.offset) * s.inv;
+					q = q < -2147483647.0 ? -2147483647.0 : (q > 2147483647.0 ? 2147483647.0 : q);
+					((int32_t*)dst)[i] = (int32_t)lrint(q);
+					break;
+				}
+				default:
+					((float*)dst)[i] = src[i];
+					break;
+			}
+		}
+	}
+	// Values [begin, end) of src into dst[0 .. end-begin)
+	void decodeScalar(const uint8_t* src, float* dst, size_t begin, size_t end, const PointColumnScale& s) const {
+		for ( size_t i = begin; i < end; i++ ) {
+			switch (m_encoding) {
+				case POINT_FP16:
+					dst[i-begin] = floatFromHalf(((const uint16_t*)src)[i]);
+					break;
+				case POINT_INT16:
+					dst[i-begin] = (float)((const int16_t*)src)[i] * (float)s.step + (float)s.offset;
+					break;
+				case POINT_INT32:
+					dst[i-begin] = (float)((double)((const int32_t*)src)[i] * s.step + s.offset);
+					break;
+				default:
+					dst[i-begin] = ((const float*)src)[i];
+					break;
+			}
+		}
+	}
+
+	// Return how many values they did, the scalar code does the rest
+	__attribute__((target("avx2,f16c")))
+	static size_t encodeAvx2(PointEncoding encoding, const float* src, uint8_t* dst, size_t n, const PointColumnScale& s) {
+		size_t i = 0;
+		if ( encoding == POINT_FP16 ) {
+			for ( ; i+8 <= n; i += 8 ) {
+				__m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src+i), _MM_FROUND_TO_NEAREST_INT);
+				_mm_storeu_si128((__m128i*)(dst + i*2), h);
+			}
+		} else if ( encoding == POINT_INT16 ) {
+			const __m256 off = _mm256_set1_ps((float)s.offset);
+			const __m256 inv = _mm256_set1_ps((float)s.inv);
+			const __m256 lo = _mm256_set1_ps(-32767.0f);
+			const __m256 hi = _mm256_set1_ps(32767.0f);
+			for ( ; i+16 <= n; i += 16 ) {
+				__m256 a = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(src+i), off), inv);
+				__m256 b = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(src+i+8), off), inv);
+				__m256i qa = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(a, lo), hi));
+				__m256i qb = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(b, lo), hi));
+				// packs works per 128 bit lane, the permute puts the quarters back in order
+				__m256i q = _mm256_permute4x64_epi64(_mm256_packs_epi32(qa, qb), 0xd8);
+				_mm256_storeu_si256((__m256i*)(dst + i*2), q);
+			}
+		} else if ( encoding == POINT_INT32 ) {
+			const __m256d off = _mm256_set1_pd(s.offset);
+			const __m256d inv = _mm256_set1_pd(s.inv);
+			const __m256d lo = _mm256_set1_pd(-2147483647.0);
+			const __m256d hi = _mm256_set1_pd(2147483647.0);
+			for ( ; i+4 <= n; i += 4 ) {
+				__m256d a = _mm256_mul_pd(_mm256_sub_pd(_mm256_cvtps_pd(_mm_loadu_ps(src+i)), off), inv);
+				__m128i q = _mm256_cvtpd_epi32(_mm256_min_pd(_mm256_max_pd(a, lo), hi));
+				_mm_storeu_si128((__m128i*)(dst + i*4), q);
+			}
+		} else {
+			memcpy(dst, src, n*sizeof(float));
+			i = n;
+		}
+		return i;
+	}
+	__attribute__((target("avx2,f16c")))
+	static size_t decodeAvx2(PointEncoding encoding, const uint8_t* src, float* dst, size_t n, const PointColumnScale& s) {
+		size_t i = 0;
+		if ( encoding == POINT_FP16 ) {
+			for ( ; i+8 <= n; i += 8 ) {
+				__m128i h = _mm_loadu_si128((const __m128i*)(src + i*2));
+				_mm256_storeu_ps(dst+i, _mm256_cvtph_ps(h));
+			}
+		} else if ( encoding == POINT_INT16 ) {
+			const __m256 off = _mm256_set1_ps((float)s.offset);
+			const __m256 step = _mm256_set1_ps((float)s.step);
+			for ( ; i+8 <= n; i += 8 ) {
+				__m256i q = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(src + i*2)));
+				_mm256_storeu_ps(dst+i, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(q), step), off));
+			}
+		} else if ( encoding == POINT_INT32 ) {
+			const __m256d off = _mm256_set1_pd(s.offset);
+			const __m256d step = _mm256_set1_pd(s.step);
+			for ( ; i+4 <= n; i += 4 ) {
+				__m256d q = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i*)(src + i*4)));
+				_mm_storeu_ps(dst+i, _mm256_cvtpd_ps(_mm256_add_pd(_mm256_mul_pd(q, step), off)));
+			}
+		} else {
+			memcpy(dst, src, n*sizeof(float));
+			i = n;
+		}
+		return i;
+	}
+
+	// IEEE half, round to nearest even like F16C
+	static uint16_t halfFromFloat(float f) {
+		uint32_t x;
+		memcpy(&x, &f, 4);
+		uint16_t sign = (x >> 16) & 0x8000;
+		uint32_t a = x & 0x7fffffff;
+		if ( a > 0x7f800000 ) return sign | 0x7e00 | ((a >> 13) & 0x3ff); // NaN stays NaN
+		if ( a >= 0x477ff000 ) return sign | 0x7c00; // rounds past 65504
+		if ( a < 0x38800000 ) {
+			// subnormal half: a multiple of 2^-24
+			float v;
+			memcpy(&v, &a, 4);
+			return sign | (uint16_t)lrintf(v * 16777216.0f);
+		}
+		uint32_t h = (a - 0x38000000) >> 13;
+		uint32_t rest = a & 0x1fff;
+		if ( rest > 0x1000 || (rest == 0x1000 && (h & 1)) ) h++;
+		return sign | (uint16_t)h;
+	}
+	static float floatFromHalf(uint16_t h) {
+		uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+		uint32_t exp = (h >> 10) & 0x1f;
+		uint32_t mant = h & 0x3ff;
+		float f;
+		if ( exp == 0 ) {
+			f = mant / 16777216.0f;
+			return sign ? -f : f;
+		}
+		uint32_t x = sign | (exp == 31 ? 0x7f800000 | (mant << 13) : ((exp + 112) << 23) | (mant << 13));
+		memcpy(&f, &x, 4);
+		return f;
+	}
+
+	PointEncoding m_encoding;
+	size_t m_block_points;
+	size_t m_size;
+	size_t m_blocks;
+	uint8_t* m_data;
+	size_t m_bytes;
+	bool m_simd;
+	PointColumnScale m_lat_scale;
+	PointColumnScale m_lon_scale;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include <math.h>
+
+#include <algorithm>
+
+#include "SpatialIndex.h"
+
+#define QT_MAX_DEPTH 32
+
+static inline bool boxOverlaps(const SpatialBox& a, const SpatialBox& b) {
+	return a.latLo <= b.latHi && b.latLo <= a.latHi && a.lonLo <= b.lonHi && b.lonLo <= a.lonHi;
+}
+
+// inner lies completely inside outer
+static inline bool boxInside(const SpatialBox& inner, const SpatialBox& outer) {
+	return inner.latLo >= outer.latLo && inner.latHi <= outer.latHi && inner.lonLo >= outer.lonLo && inner.lonHi <= outer.lonHi;
+}
+
+// Appends [begin, end), merged into the previous run when they touch
+static inline void appendRange(std::vector<IndexRange>& out, uint32_t begin, uint32_t end) {
+	if ( begin >= end ) return;
+	if ( !out.empty() && out.back().end == begin ) {
+		out.back().end = end;
+		return;
+	}
+	IndexRange r = {begin, end};
+	out.push_back(r);
+}
+
+SpatialBox
+SpatialIndex::boundsOf(const Point* points, size_t n) {
+	SpatialBox b = {INFINITY, -INFINITY, INFINITY, -INFINITY};
+	for ( size_t i = 0; i < n; i++ ) {
+		if ( points[i].lat < b.latLo ) b.latLo = points[i].lat;
+		if ( points[i].lat > b.latHi ) b.latHi = points[i].lat;
+		if ( points[i].lon < b.lonLo ) b.lonLo = points[i].lon;
+		if ( points[i].lon > b.lonHi ) b.lonHi = points[i].lon;
+	}
+	return b;
+}
+
+void
+SpatialIndex::store(const Point* points, const std::vector<uint32_t>& order) {
+	size_t n = order.size();
+	m_lat.resize(n);
+	m_lon.resize(n);
+	m_index.resize(n);
+	m_position.resize(n);
+	for ( size_t i = 0; i < n; i++ ) {
+		uint32_t src = order[i];
+		m_lat[i] = points[src].lat;
+		m_lon[i] = points[src].lon;
+		m_index[i] = src;
+		m_position[src] = (uint32_t)i;
+	}
+}
+
+void
+SpatialIndex::mergeRanges(std::vector<IndexRange>& ranges) {
+	if ( ranges.size() < 2 ) return;
+	std::sort(ranges.begin(), ranges.end(), [](const IndexRange& a, const IndexRange& b) { return a.begin < b.begin; });
+	size_t last = 0;
+	for ( size_t i = 1; i < ranges.size(); i++ ) {
+		if ( ranges[i].begin <= ranges[last].end ) {
+			if ( ranges[i].end > ranges[last].end ) ranges[last].end = ranges[i].end;
+		} else {
+			ranges[++last] = ranges[i];
+		}
+	}
+	ranges.resize(last+1);
+}
+
+size_t
+SpatialIndex::candidatePairs(const Point& core, const std::vector<IndexRange>& ranges, std::vector<PointPair>& out) const {
+	size_t before = out.size();
+	for ( size_t r = 0; r < ranges.size(); r++ ) {
+		for ( uint32_t i = ranges[r].begin; i < ranges[r].end; i++ ) {
+			PointPair p = {core.lat, core.lon, m_lat[i], m_lon[i]};
+			out.push_back(p);
+		}
+	}
+	return out.size() - before;
+}
+
+
+GridIndex::GridIndex(float cellSize, size_t maxCells) {
+	m_cell_request = cellSize;
+	m_max_cells = maxCells < 1 ? 1 : maxCells;
+	m_cell = cellSize;
+	m_rows = 0;
+	m_cols = 0;
+}
+
+int
+GridIndex::rowOf(float lat) const {
+	int r = (int)floorf((lat - m_bounds.latLo)/m_cell);
+	if ( r < 0 ) r = 0;
+	if ( r >= m_rows ) r = m_rows-1;
+	return r;
+}
+
+int
+GridIndex::colOf(float lon) const {
+	int c = (int)floorf((lon - m_bounds.lonLo)/m_cell);
+	if ( c < 0 ) c = 0;
+	if ( c >= m_cols ) c = m_cols-1;
+	return c;
+}
+
+void
+GridIndex::build(const Point* points, size_t n) {
+	m_bounds = boundsOf(points, n);
+	if ( n == 0 ) {
+		m_rows = m_cols = 0;
+		m_cell_start.assign(1, 0);
+		store(points, std::vector<uint32_t>());
+		return;
+	}
+
+	m_cell = m_cell_request > 0 ? m_cell_request : 1;
+	while (true) {
+		double rows = floor((m_bounds.latHi - m_bounds.latLo)/m_cell) + 1;
+		double cols = floor((m_bounds.lonHi - m_bounds.lonLo)/m_cell) + 1;
+		if ( rows*cols <= (double)m_max_cells ) {
+			m_rows = (int)rows;
+			m_cols = (int)cols;
+			break;
+		}
+		m_cell *= 2;
+	}
+
+	// counting sort by cell, row-major
+	size_t cells = (size_t)m_rows*m_cols;
+	std::vector<uint32_t> cell(n);
+	m_cell_start.assign(cells+1, 0);
+	for ( size_t i = 0; i < n; i++ ) {
+		cell[i] = (uint32_t)((size_t)rowOf(points[i].lat)*m_cols + colOf(points[i].lon));
+		m_cell_start[cell[i]+1]++;
+	}
+	for ( size_t c = 0; c < cells; c++ ) m_cell_start[c+1] += m_cell_start[c];
+
+	std::vector<uint32_t> order(n);
+	std::vector<uint32_t> next(m_cell_start.begin(), m_cell_start.end()-1);
+	for ( size_t i = 0; i < n; i++ ) order[next[cell[i]]++] = (uint32_t)i;
+	store(points, order);
+}
+
+void
+GridIndex::candidateRanges(const SpatialBox& box, std::vector<IndexRange>& out) const {
+	if ( m_rows == 0 || !boxOverlaps(box, m_bounds) ) return;
+
+	int r0 = rowOf(box.latLo);
+	int r1 = rowOf(box.latHi);
+	int c0 = colOf(box.lonLo);
+	int c1 = colOf(box.lonHi);
+	for ( int r = r0; r <= r1; r++ ) {
+		size_t base = (size_t)r*m_cols;
+		appendRange(out, m_cell_start[base+c0], m_cell_start[base+c1+1]);
+	}
+}
+
+
+QuadTreeIndex::QuadTreeIndex(int leafSize) {
+	m_leaf_size = leafSize < 1 ? 1 : leafSize;
+	m_depth = 0;
+}
+
+void
+QuadTreeIndex::buildNode(size_t node, const Point* points, std::vector<uint32_t>& order, uint32_t begin, uint32_t end, int depth) {
+	SpatialBox b = {INFINITY, -INFINITY, INFINITY, -INFINITY};
+	for ( uint32_t i = begin; i < end; i++ ) {
+		const Point& p = points[order[i]];
+		if ( p.lat < b.latLo ) b.latLo = p.lat;
+		if ( p.lat > b.latHi ) b.latHi = p.lat;
+		if ( p.lon < b.lonLo ) b.lonLo = p.lon;
+		if ( p.lon > b.lonHi ) b.lonHi = p.lon;
+	}
+	m_nodes[node].box = b;
+	m_nodes[node].begin = begin;
+	m_nodes[node].end = end;
+	m_nodes[node].child = -1;
+	if ( depth > m_depth ) m_depth = depth;
+
+	// duplicates cannot be split, the depth limit stops them
+	if ( end - begin <= (uint32_t)m_leaf_size || depth >= QT_MAX_DEPTH ) return;
+	if ( b.latLo == b.latHi && b.lonLo == b.lonHi ) return;
+
+	float midLat = b.latLo + (b.latHi - b.latLo)/2;
+	float midLon = b.lonLo + (b.lonHi - b.lonLo)/2;
+	uint32_t* o = &order[0];
+	uint32_t* south = std::partition(o+begin, o+end, [&](uint32_t i) { return points[i].lat < midLat; });
+	uint32_t* sw = std::partition(o+begin, south, [&](uint32_t i) { return points[i].lon < midLon; });
+	uint32_t* nw = std::partition(south, o+end, [&](uint32_t i) { return points[i].lon < midLon; });
+	uint32_t bounds[5] = {begin, (uint32_t)(sw-o), (uint32_t)(south-o), (uint32_t)(nw-o), end};
+
+	// children are consecutive, so reserve them before recursing
+	size_t child = m_nodes.size();
+	m_nodes.resize(child+4);
+	m_nodes[node].child = (int32_t)child;
+	for ( int q = 0; q < 4; q++ ) {
+		buildNode(child+q, points, order, bounds[q], bounds[q+1], depth+1);
+	}
+}
+
+void
+QuadTreeIndex::build(const Point* points, size_t n) {
+	m_bounds = boundsOf(points, n);
+	m_depth = 0;
+	m_nodes.clear();
+
+	std::vector<uint32_t> order(n);
+	for ( size_t i = 0; i < n; i++ ) order[i] = (uint32_t)i;
+	m_nodes.resize(1);
+	buildNode(0, points, order, 0, (uint32_t)n, 0);
+	store(points, order);
+}
+
+void
+QuadTreeIndex::candidateRanges(const SpatialBox& box, std::vector<IndexRange>& out) const {
+	if ( m_nodes.empty() ) return;
+
+	int32_t stack[QT_MAX_DEPTH*3+4];
+	int top = 0;
+	stack[top++] = 0;
+	while ( top > 0 ) {
+		const Node& n = m_nodes[stack[--top]];
+		if ( n.begin == n.end || !boxOverlaps(n.box, box) ) continue;
+		if ( n.child < 0 || boxInside(n.box, box) ) {
+			appendRange(out, n.begin, n.end);
+			continue;
+		}
+		// pushed in reverse so runs come out in memory order and merge
+		for ( int q = 3; q >= 0; q-- ) stack[top++] = n.child + q;
+	}
+}
@@ -0,0 +1,136 @@
+#ifndef __SPATIAL_INDEX__H__
+#define __SPATIAL_INDEX__H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "Point.h"
+
+/****
+Spatial indices over the (lat, lon) plane for the region queries of the distance examples
+
+Both indices copy the points into structure-of-arrays order sorted by their own layout
+(grid cell, or quadtree leaf), so every candidate they return is a contiguous run
+[begin, end) of lat()/lon() that can go to a batch distance kernel without a gather.
+index(i) maps a sorted position back to the position in the array given to build().
+
+GridIndex: uniform cells, row-major. All cells of one row inside a box are adjacent in memory,
+	so a query returns at most one run per cell row.
+QuadTreeIndex: splits at the midpoint until a node holds leafSize points. Node boxes are the
+	tight bounds of their points, so skewed data (cities) prunes better than with the grid.
+
+candidateRanges() is const and keeps no state, so any number of threads can query one index.
+****/
+
+typedef struct SpatialBox {
+	float latLo;
+	float latHi;
+	float lonLo;
+	float lonHi;
+}SpatialBox;
+
+typedef struct IndexRange {
+	uint32_t begin;
+	uint32_t end;
+}IndexRange;
+
+// One (core, target) pair as the FPGA distance kernels take it: HwMain's getCmd
+// reads user words 0..3 as point A lat, A lon, point B lat, B lon. 16 bytes, one 128 bit DMA word
+typedef struct PointPair {
+	float coreLat;
+	float coreLon;
+	float targetLat;
+	float targetLon;
+}PointPair;
+
+class SpatialIndex {
+public:
+	virtual ~SpatialIndex() {}
+
+	// Copies and reorders the points
+	virtual void build(const Point* points, size_t n) = 0;
+	// Appends the runs of sorted positions whose points may lie inside box.
+	// Every point inside the box is covered; points outside may be too
+	virtual void candidateRanges(const SpatialBox& box, std::vector<IndexRange>& out) const = 0;
+	virtual const char* name() const = 0;
+
+	size_t size() const { return m_lat.size(); }
+	const float* lat() const { return m_lat.empty() ? NULL : &m_lat[0]; }
+	const float* lon() const { return m_lon.empty() ? NULL : &m_lon[0]; }
+	uint32_t index(size_t sorted) const { return m_index[sorted]; }
+	// Sorted position of the point given to build() at original
+	uint32_t position(size_t original) const { return m_position[original]; }
+	// Bounds of all points
+	const SpatialBox& bounds() const { return m_bounds; }
+
+	// Sorts runs and merges overlapping ones, for the union of several boxes' candidates
+	static void mergeRanges(std::vector<IndexRange>& ranges);
+	// Appends one PointPair per candidate in ranges, core first, in the FPGA input layout
+	size_t candidatePairs(const Point& core, const std::vector<IndexRange>& ranges, std::vector<PointPair>& out) const;
+
+protected:
+	// Fills the sorted arrays from points in the given order
+	void store(const Point* points, const std::vector<uint32_t>& order);
+	static SpatialBox boundsOf(const Point* points, size_t n);
+
+	std::vector<float> m_lat;
+	std::vector<float> m_lon;
+	std::vector<uint32_t> m_index;
+	std::vector<uint32_t> m_position;
+	SpatialBox m_bounds;
+};
+
+class GridIndex : public SpatialIndex {
+public:
+	// cellSize in degrees; grown if the grid would need more than maxCells
+	GridIndex(float cellSize, size_t maxCells = 1<<22);
+
+	void build(const Point* points, size_t n);
+	void candidateRanges(const SpatialBox& box, std::vector<IndexRange>& out) const;
+	const char* name() const { return "grid"; }
+
+	float cellSize() const { return m_cell; }
+	size_t cells() const { return (size_t)m_rows*m_cols; }
+
+private:
+	int rowOf(float lat) const;
+	int colOf(float lon) const;
+
+	float m_cell_request;
+	size_t m_max_cells;
+	float m_cell;
+	int m_rows;
+	int m_cols;
+	std::vector<uint32_t> m_cell_start; // rows*cols+1 entries
+};
+
+class QuadTreeIndex : public SpatialIndex {
+public:
+	QuadTreeIndex(int leafSize = 64);
+
+	void build(const Point* points, size_t n);
+	void candidateRanges(const SpatialBox& box, std::vector<IndexRange>& out) const;
+	const char* name() const { return "quadtree"; }
+
+	size_t nodes() const { return m_nodes.size(); }
+	int depth() const { return m_depth; }
+
+private:
+	typedef struct Node {
+		SpatialBox box;
+		uint32_t begin;
+		uint32_t end;
+		int32_t child; // first of four consecutive children, -1 for a leaf
+	}Node;
+
+	// Fills m_nodes[node] with order[begin, end) and splits it at the midpoint of its bounds
+	void buildNode(size_t node, const Point* points, std::vector<uint32_t>& order, uint32_t begin, uint32_t end, int depth);
+
+	int m_leaf_size;
+	int m_depth;
+	std::vector<Node> m_nodes;
+};
+
+#endif
@@ -0,0 +1,790 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "Zfp.h"
+
+// Convert negabinary uint to int
+static inline int32_t uint2int_uint32(uint32_t x) {
+	return (int32_t)((x ^ 0xaaaaaaaa) - 0xaaaaaaaa);
+}
+
+// Convert int to negabinary uint
+static inline uint32_t int2uint_int32(int32_t x) {
+	return ((uint32_t)x + 0xaaaaaaaa) ^ 0xaaaaaaaa;
+}
+
+// Forward lifting of p[0], p[s], p[2s], p[3s]
+static inline void fwd_lift_int32(int32_t* p, int s = 1) {
+	int32_t x = p[0], y = p[s], z = p[2*s], w = p[3*s];
+
+	x += w; x >>= 1; w -= x;
+	z += y; z >>= 1; y -= z;
+	x += z; x >>= 1; z -= x;
+	w += y; w >>= 1; y -= w;
+	w += y >> 1; y -= w >> 1;
+
+	p[0] = x; p[s] = y; p[2*s] = z; p[3*s] = w;
+}
+
+// Inverse lifting of p[0], p[s], p[2s], p[3s]. Truncated coefficients may wrap around,
+// so the sums are done unsigned
+static inline void inv_lift_int32(int32_t* p, int s = 1) {
+	uint32_t x = p[0], y = p[s], z = p[2*s], w = p[3*s];
+
+	y += (int32_t)w >> 1; w -= (int32_t)y >> 1;
+	y += w; w <<= 1; w -= y;
+	z += x; x <<= 1; x -= z;
+	y += z; z <<= 1; z -= y;
+	w += x; x <<= 1; x -= w;
+
+	p[0] = x; p[s] = y; p[2*s] = z; p[3*s] = w;
+}
+
+// std::frexp exponent, read from the float bits for normal numbers
+static inline int exponent_of(float f) {
+	uint32_t bits;
+	memcpy(&bits, &f, 4);
+	int biased = (bits >> 23) & 0xff;
+	if ( biased != 0 ) return biased - 126;
+	int exp = 0;
+	frexpf(f, &exp);
+	return exp;
+}
+
+// 2^k as a double, for -1022 <= k <= 1023
+static inline double pow2_double(int k) {
+	uint64_t bits = (uint64_t)(1023 + k) << 52;
+	double d;
+	memcpy(&d, &bits, 8);
+	return d;
+}
+
+// 2^k rounded to float, what (float)pow(2, k) gives
+static inline float pow2_float(int k) {
+	if ( k < -126 || k > 127 ) return ldexpf(1.0f, k);
+	uint32_t bits = (uint32_t)(127 + k) << 23;
+	float f;
+	memcpy(&f, &bits, 4);
+	return f;
+}
+
+void
+zfp_compress_block(const float origin[4], ZfpBitWriter& out, int bit_budget) {
+	int exp_max = -EXP_MAX;
+	for ( int i = 0; i < 4; i++ ) {
+		if ( origin[i] != 0 ) {
+			int exp = exponent_of(origin[i]);
+			if ( exp > exp_max ) exp_max = exp;
+		}
+	}
+	int dimension = 1;
+	int precision_max = std::min(ZFP_MAX_PREC, std::max(0, exp_max - ZFP_MIN_EXP + (2*(dimension+1))));
+	if ( precision_max == 0 ) return;
+
+	int e = exp_max + EXP_MAX;
+	double scale = pow2_double(32-2 - exp_max);
+	int32_t idata[4];
+	for ( int i = 0; i < 4; i++ ) idata[i] = (int32_t)(origin[i]*scale);
+
+	fwd_lift_int32(idata);
+
+	out.write(e, EBITS);
+	// flag, then the bit_budget bits below the leading 4 when those are zero
+	for ( int i = 0; i < 4; i++ ) {
+		uint32_t u = int2uint_int32(idata[i]);
+		if ( (u>>28) == 0 ) {
+			out.write((uint64_t)(u>>(32-bit_budget-4)) << 1, bit_budget + 1);
+		} else {
+			out.write(((uint64_t)(u>>(32-bit_budget)) << 1) | 1, bit_budget + 1);
+		}
+	}
+}
+
+void
+zfp_decompress_block(ZfpBitReader& in, float output[4], int bit_budget) {
+	uint32_t e = (uint32_t)in.read(EBITS);
+	int exp_max = ((int)e) - EXP_MAX;
+
+	int32_t idata[4];
+	for ( int i = 0; i < 4; i++ ) {
+		uint32_t word = (uint32_t)in.read(bit_budget + 1);
+		uint32_t bits = word >> 1;
+		uint32_t u = (word & 1) ? bits<<(32-bit_budget) : bits<<(32-bit_budget-4);
+		idata[i] = uint2int_uint32(u);
+	}
+
+	inv_lift_int32(idata);
+
+	float q = pow2_float(exp_max-(32-2));
+	for ( int i = 0; i < 4; i++ ) output[i] = (float)idata[i]*q;
+}
+
+size_t
+zfp_compressed_bytes(size_t n) {
+	return (n + 1) / 2 * ZFP_BLOCK_BYTES;
+}
+
+// Runs f(begin, end) over contiguous chunks of [0, blocks)
+template <class F>
+static void zfp_parallel(size_t blocks, int threads, F f) {
+	if ( threads <= 0 ) threads = (int)std::thread::hardware_concurrency();
+	if ( threads < 1 ) threads = 1;
+	if ( (size_t)threads > blocks ) threads = blocks > 0 ? (int)blocks : 1;
+	if ( threads == 1 ) {
+		f(0, blocks);
+		return;
+	}
+	size_t chunk = (blocks + threads - 1) / threads;
+	std::vector<std::thread> workers;
+	for ( int t = 1; t < threads; t++ ) {
+		size_t begin = t*chunk;
+		size_t end = std::min(begin + chunk, blocks);
+		if ( begin < end ) workers.push_back(std::thread(f, begin, end));
+	}
+	f(0, std::min(chunk, blocks));
+	for ( size_t t = 0; t < workers.size(); t++ ) workers[t].join();
+}
+
+/****
+SIMD transform over 8 (AVX2) or 16 (AVX-512) blocks
+
+The group's 4 registers are transposed in 128 bit lanes, so register k holds value k of every
+block, and exponent search, fixed point conversion, lifting and negabinary run on all blocks at
+once. The fixed point step is done in integers: |x| * 2^(30-exp_max) is the float mantissa
+shifted left or right, truncated like the (int32_t) cast of the double product in the scalar
+code. Groups with subnormal, infinite or NaN values go to the scalar code, so the output is
+bit-exact with it, and with ZfpCompress.bsv/ZfpDecompress.bsv.
+****/
+
+// After the in-lane transpose, lane l of an 8 or 16 block group holds block zfp_lane_block(l)
+static inline size_t zfp_lane_block(int lane, int blocks) {
+	return (lane%4)*(blocks/4) + lane/4;
+}
+
+static inline void zfp_pack_lanes(const int32_t* emax, uint32_t words[4][16], int blocks, uint8_t* out, int bit_budget) {
+	for ( int l = 0; l < blocks; l++ ) {
+		uint64_t b = (uint64_t)(emax[l] + EXP_MAX);
+		for ( int i = 0; i < 4; i++ ) b |= (uint64_t)words[i][l] << (EBITS + i*(bit_budget+1));
+		memcpy(out + zfp_lane_block(l, blocks)*ZFP_BLOCK_BYTES, &b, 8);
+	}
+}
+
+static inline void zfp_unpack_lanes(const uint8_t* in, int blocks, int bit_budget, uint32_t words[4][16], float* q) {
+	uint64_t mask = ((uint64_t)1 << (bit_budget+1)) - 1;
+	for ( int l = 0; l < blocks; l++ ) {
+		uint64_t b;
+		memcpy(&b, in + zfp_lane_block(l, blocks)*ZFP_BLOCK_BYTES, 8);
+		q[l] = pow2_float((int)(b & ((1<<EBITS)-1)) - EXP_MAX - (32-2));
+		for ( int i = 0; i < 4; i++ ) words[i][l] = (uint32_t)((b >> (EBITS + i*(bit_budget+1))) & mask);
+	}
+}
+
+__attribute__((target("avx2")))
+static inline void zfp_transpose8(__m256& r0, __m256& r1, __m256& r2, __m256& r3) {
+	__m256 t0 = _mm256_unpacklo_ps(r0, r1);
+	__m256 t1 = _mm256_unpackhi_ps(r0, r1);
+	__m256 t2 = _mm256_unpacklo_ps(r2, r3);
+	__m256 t3 = _mm256_unpackhi_ps(r2, r3);
+	r0 = _mm256_shuffle_ps(t0, t2, 0x44);
+	r1 = _mm256_shuffle_ps(t0, t2, 0xee);
+	r2 = _mm256_shuffle_ps(t1, t3, 0x44);
+	r3 = _mm256_shuffle_ps(t1, t3, 0xee);
+}
+
+// 8 blocks from in (32 floats) to out. False, with nothing written, if the scalar code must do it
+__attribute__((target("avx2")))
+static bool zfp_compress8(const float* in, uint8_t* out, int bit_budget) {
+	__m256 r[4] = {_mm256_loadu_ps(in), _mm256_loadu_ps(in+8), _mm256_loadu_ps(in+16), _mm256_loadu_ps(in+24)};
+	zfp_transpose8(r[0], r[1], r[2], r[3]);
+
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i v[4], biased[4], mant[4];
+	__m256i emax = _mm256_set1_epi32(-EXP_MAX);
+	__m256i bad = zero;
+	for ( int k = 0; k < 4; k++ ) {
+		v[k] = _mm256_castps_si256(r[k]);
+		biased[k] = _mm256_and_si256(_mm256_srli_epi32(v[k], 23), _mm256_set1_epi32(0xff));
+		mant[k] = _mm256_and_si256(v[k], _mm256_set1_epi32(0x7fffff));
+		__m256i biasedZero = _mm256_cmpeq_epi32(biased[k], zero);
+		bad = _mm256_or_si256(bad, _mm256_andnot_si256(_mm256_cmpeq_epi32(mant[k], zero), biasedZero));
+		bad = _mm256_or_si256(bad, _mm256_cmpeq_epi32(biased[k], _mm256_set1_epi32(0xff)));
+		// zeros (only biased 0 is left) do not count
+		__m256i e = _mm256_sub_epi32(biased[k], _mm256_set1_epi32(126));
+		e = _mm256_blendv_epi8(e, _mm256_set1_epi32(-EXP_MAX), biasedZero);
+		emax = _mm256_max_epi32(emax, e);
+	}
+	if ( !_mm256_testz_si256(bad, bad) ) return false;
+
+	for ( int k = 0; k < 4; k++ ) {
+		__m256i implicit = _mm256_andnot_si256(_mm256_cmpeq_epi32(biased[k], zero), _mm256_set1_epi32(0x800000));
+		__m256i m = _mm256_or_si256(mant[k], implicit);
+		// |x| * 2^(30-exp_max) = m * 2^(biased - 150 + 30 - exp_max), s <= 6
+		__m256i s = _mm256_sub_epi32(_mm256_sub_epi32(biased[k], _mm256_set1_epi32(120)), emax);
+		__m256i left = _mm256_sllv_epi32(m, _mm256_max_epi32(s, zero));
+		__m256i right = _mm256_srlv_epi32(m, _mm256_max_epi32(_mm256_sub_epi32(zero, s), zero));
+		__m256i mag = _mm256_blendv_epi8(right, left, _mm256_cmpgt_epi32(s, _mm256_set1_epi32(-1)));
+		__m256i sign = _mm256_srai_epi32(v[k], 31);
+		v[k] = _mm256_sub_epi32(_mm256_xor_si256(mag, sign), sign);
+	}
+
+	// fwd_lift_int32
+	__m256i x = v[0], y = v[1], z = v[2], w = v[3];
+	x = _mm256_add_epi32(x, w); x = _mm256_srai_epi32(x, 1); w = _mm256_sub_epi32(w, x);
+	z = _mm256_add_epi32(z, y); z = _mm256_srai_epi32(z, 1); y = _mm256_sub_epi32(y, z);
+	x = _mm256_add_epi32(x, z); x = _mm256_srai_epi32(x, 1); z = _mm256_sub_epi32(z, x);
+	w = _mm256_add_epi32(w, y); w = _mm256_srai_epi32(w, 1); y = _mm256_sub_epi32(y, w);
+	w = _mm256_add_epi32(w, _mm256_srai_epi32(y, 1)); y = _mm256_sub_epi32(y, _mm256_srai_epi32(w, 1));
+	v[0] = x; v[1] = y; v[2] = z; v[3] = w;
+
+	const __m256i nb = _mm256_set1_epi32((int)0xaaaaaaaa);
+	const __m256i shiftSmall = _mm256_set1_epi32(32-bit_budget-4);
+	const __m256i shiftLarge = _mm256_set1_epi32(32-bit_budget);
+	int32_t emaxLanes[16];
+	uint32_t words[4][16];
+	_mm256_storeu_si256((__m256i*)emaxLanes, emax);
+	for ( int k = 0; k < 4; k++ ) {
+		__m256i u = _mm256_xor_si256(_mm256_add_epi32(v[k], nb), nb);
+		__m256i small = _mm256_cmpeq_epi32(_mm256_srli_epi32(u, 28), zero);
+		__m256i bits = _mm256_blendv_epi8(_mm256_srlv_epi32(u, shiftLarge), _mm256_srlv_epi32(u, shiftSmall), small);
+		__m256i flag = _mm256_andnot_si256(small, _mm256_set1_epi32(1));
+		_mm256_storeu_si256((__m256i*)words[k], _mm256_or_si256(_mm256_slli_epi32(bits, 1), flag));
+	}
+	zfp_pack_lanes(emaxLanes, words, 8, out, bit_budget);
+	return true;
+}
+
+// 8 blocks from in to out (32 floats)
+__attribute__((target("avx2")))
+static void zfp_decompress8(const uint8_t* in, float* out, int bit_budget) {
+	uint32_t words[4][16];
+	float q[16];
+	zfp_unpack_lanes(in, 8, bit_budget, words, q);
+
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i nb = _mm256_set1_epi32((int)0xaaaaaaaa);
+	const __m256i shiftSmall = _mm256_set1_epi32(32-bit_budget-4);
+	const __m256i shiftLarge = _mm256_set1_epi32(32-bit_budget);
+	__m256i v[4];
+	for ( int k = 0; k < 4; k++ ) {
+		__m256i word = _mm256_loadu_si256((const __m256i*)words[k]);
+		__m256i large = _mm256_cmpeq_epi32(_mm256_and_si256(word, one), one);
+		__m256i u = _mm256_sllv_epi32(_mm256_srli_epi32(word, 1), _mm256_blendv_epi8(shiftSmall, shiftLarge, large));
+		v[k] = _mm256_sub_epi32(_mm256_xor_si256(u, nb), nb);
+	}
+
+	// inv_lift_int32
+	__m256i x = v[0], y = v[1], z = v[2], w = v[3];
+	y = _mm256_add_epi32(y, _mm256_srai_epi32(w, 1)); w = _mm256_sub_epi32(w, _mm256_srai_epi32(y, 1));
+	y = _mm256_add_epi32(y, w); w = _mm256_slli_epi32(w, 1); w = _mm256_sub_epi32(w, y);
+	z = _mm256_add_epi32(z, x); x = _mm256_slli_epi32(x, 1); x = _mm256_sub_epi32(x, z);
+	y = _mm256_add_epi32(y, z); z = _mm256_slli_epi32(z, 1); z = _mm256_sub_epi32(z, y);
+	w = _mm256_add_epi32(w, x); x = _mm256_slli_epi32(x, 1); x = _mm256_sub_epi32(x, w);
+
+	__m256 scale = _mm256_loadu_ps(q);
+	__m256 r0 = _mm256_mul_ps(_mm256_cvtepi32_ps(x), scale);
+	__m256 r1 = _mm256_mul_ps(_mm256_cvtepi32_ps(y), scale);
+	__m256 r2 = _mm256_mul_ps(_mm256_cvtepi32_ps(z), scale);
+	__m256 r3 = _mm256_mul_ps(_mm256_cvtepi32_ps(w), scale);
+	zfp_transpose8(r0, r1, r2, r3);
+	_mm256_storeu_ps(out, r0);
+	_mm256_storeu_ps(out+8, r1);
+	_mm256_storeu_ps(out+16, r2);
+	_mm256_storeu_ps(out+24, r3);
+}
+
+// GCC 12 headers warn on the _mm512_undefined_* inside the intrinsics under target("avx512f")
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f")))
+static inline void zfp_transpose16(__m512& r0, __m512& r1, __m512& r2, __m512& r3) {
+	__m512 t0 = _mm512_unpacklo_ps(r0, r1);
+	__m512 t1 = _mm512_unpackhi_ps(r0, r1);
+	__m512 t2 = _mm512_unpacklo_ps(r2, r3);
+	__m512 t3 = _mm512_unpackhi_ps(r2, r3);
+	r0 = _mm512_shuffle_ps(t0, t2, 0x44);
+	r1 = _mm512_shuffle_ps(t0, t2, 0xee);
+	r2 = _mm512_shuffle_ps(t1, t3, 0x44);
+	r3 = _mm512_shuffle_ps(t1, t3, 0xee);
+}
+
+// zfp_compress8 over 16 blocks (64 floats)
+__attribute__((target("avx512f")))
+static bool zfp_compress16(const float* in, uint8_t* out, int bit_budget) {
+	__m512 r[4] = {_mm512_loadu_ps(in), _mm512_loadu_ps(in+16), _mm512_loadu_ps(in+32), _mm512_loadu_ps(in+48)};
+	zfp_transpose16(r[0], r[1], r[2], r[3]);
+
+	const __m512i zero = _mm512_setzero_si512();
+	__m512i v[4], biased[4], mant[4];
+	__m512i emax = _mm512_set1_epi32(-EXP_MAX);
+	__mmask16 bad = 0;
+	for ( int k = 0; k < 4; k++ ) {
+		v[k] = _mm512_castps_si512(r[k]);
+		biased[k] = _mm512_and_si512(_mm512_srli_epi32(v[k], 23), _mm512_set1_epi32(0xff));
+		mant[k] = _mm512_and_si512(v[k], _mm512_set1_epi32(0x7fffff));
+		__mmask16 biasedZero = _mm512_cmpeq_epi32_mask(biased[k], zero);
+		bad |= biasedZero & _mm512_cmpneq_epi32_mask(mant[k], zero);
+		bad |= _mm512_cmpeq_epi32_mask(biased[k], _mm512_set1_epi32(0xff));
+		__m512i e = _mm512_sub_epi32(biased[k], _mm512_set1_epi32(126));
+		e = _mm512_mask_blend_epi32(biasedZero, e, _mm512_set1_epi32(-EXP_MAX));
+		emax = _mm512_max_epi32(emax, e);
+	}
+	if ( bad ) return false;
+
+	for ( int k = 0; k < 4; k++ ) {
+		__m512i m = _mm512_mask_or_epi32(mant[k], _mm512_cmpneq_epi32_mask(biased[k], zero), mant[k], _mm512_set1_epi32(0x800000));
+		__m512i s = _mm512_sub_epi32(_mm512_sub_epi32(biased[k], _mm512_set1_epi32(120)), emax);
+		__m512i left = _mm512_sllv_epi32(m, _mm512_max_epi32(s, zero));
+		__m512i right = _mm512_srlv_epi32(m, _mm512_max_epi32(_mm512_sub_epi32(zero, s), zero));
+		__m512i mag = _mm512_mask_blend_epi32(_mm512_cmpgt_epi32_mask(s, _mm512_set1_epi32(-1)), right, left);
+		__m512i sign = _mm512_srai_epi32(v[k], 31);
+		v[k] = _mm512_sub_epi32(_mm512_xor_si512(mag, sign), sign);
+	}
+
+	__m512i x = v[0], y = v[1], z = v[2], w = v[3];
+	x = _mm512_add_epi32(x, w); x = _mm512_srai_epi32(x, 1); w = _mm512_sub_epi32(w, x);
+	z = _mm512_add_epi32(z, y); z = _mm512_srai_epi32(z, 1); y = _mm512_sub_epi32(y, z);
+	x = _mm512_add_epi32(x, z); x = _mm512_srai_epi32(x, 1); z = _mm512_sub_epi32(z, x);
+	w = _mm512_add_epi32(w, y); w = _mm512_srai_epi32(w, 1); y = _mm512_sub_epi32(y, w);
+	w = _mm512_add_epi32(w, _mm512_srai_epi32(y, 1)); y = _mm512_sub_epi32(y, _mm512_srai_epi32(w, 1));
+	v[0] = x; v[1] = y; v[2] = z; v[3] = w;
+
+	const __m512i nb = _mm512_set1_epi32((int)0xaaaaaaaa);
+	const __m512i shiftSmall = _mm512_set1_epi32(32-bit_budget-4);
+	const __m512i shiftLarge = _mm512_set1_epi32(32-bit_budget);
+	int32_t emaxLanes[16];
+	uint32_t words[4][16];
+	_mm512_storeu_si512((void*)emaxLanes, emax);
+	for ( int k = 0; k < 4; k++ ) {
+		__m512i u = _mm512_xor_si512(_mm512_add_epi32(v[k], nb), nb);
+		__mmask16 small = _mm512_cmpeq_epi32_mask(_mm512_srli_epi32(u, 28), zero);
+		__m512i bits = _mm512_mask_blend_epi32(small, _mm512_srlv_epi32(u, shiftLarge), _mm512_srlv_epi32(u, shiftSmall));
+		__m512i word = _mm512_mask_or_epi32(_mm512_slli_epi32(bits, 1), ~small, _mm512_slli_epi32(bits, 1), _mm512_set1_epi32(1));
+		_mm512_storeu_si512((void*)words[k], word);
+	}
+	zfp_pack_lanes(emaxLanes, words, 16, out, bit_budget);
+	return true;
+}
+
+// zfp_decompress8 over 16 blocks (64 floats)
+__attribute__((target("avx512f")))
+static void zfp_decompress16(const uint8_t* in, float* out, int bit_budget) {
+	uint32_t words[4][16];
+	float q[16];
+	zfp_unpack_lanes(in, 16, bit_budget, words, q);
+
+	const __m512i one = _mm512_set1_epi32(1);
+	const __m512i nb = _mm512_set1_epi32((int)0xaaaaaaaa);
+	const __m512i shiftSmall = _mm512_set1_epi32(32-bit_budget-4);
+	const __m512i shiftLarge = _mm512_set1_epi32(32-bit_budget);
+	__m512i v[4];
+	for ( int k = 0; k < 4; k++ ) {
+		__m512i word = _mm512_loadu_si512((const void*)words[k]);
+		__mmask16 large = _mm512_test_epi32_mask(word, one);
+		__m512i u = _mm512_sllv_epi32(_mm512_srli_epi32(word, 1), _mm512_mask_blend_epi32(large, shiftSmall, shiftLarge));
+		v[k] = _mm512_sub_epi32(_mm512_xor_si512(u, nb), nb);
+	}
+
+	__m512i x = v[0], y = v[1], z = v[2], w = v[3];
+	y = _mm512_add_epi32(y, _mm512_srai_epi32(w, 1)); w = _mm512_sub_epi32(w, _mm512_srai_epi32(y, 1));
+	y = _mm512_add_epi32(y, w); w = _mm512_slli_epi32(w, 1); w = _mm512_sub_epi32(w, y);
+	z = _mm512_add_epi32(z, x); x = _mm512_slli_epi32(x, 1); x = _mm512_sub_epi32(x, z);
+	y = _mm512_add_epi32(y, z); z = _mm512_slli_epi32(z, 1); z = _mm512_sub_epi32(z, y);
+	w = _mm512_add_epi32(w, x); x = _mm512_slli_epi32(x, 1); x = _mm512_sub_epi32(x, w);
+
+	__m512 scale = _mm512_loadu_ps(q);
+	__m512 r0 = _mm512_mul_ps(_mm512_cvtepi32_ps(x), scale);
+	__m512 r1 = _mm512_mul_ps(_mm512_cvtepi32_ps(y), scale);
+	__m512 r2 = _mm512_mul_ps(_mm512_cvtepi32_ps(z), scale);
+	__m512 r3 = _mm512_mul_ps(_mm512_cvtepi32_ps(w), scale);
+	zfp_transpose16(r0, r1, r2, r3);
+	_mm512_storeu_ps(out, r0);
+	_mm512_storeu_ps(out+16, r1);
+	_mm512_storeu_ps(out+32, r2);
+	_mm512_storeu_ps(out+48, r3);
+}
+
+#pragma GCC diagnostic pop
+
+typedef enum {
+	ZFP_SCALAR,
+	ZFP_AVX2,
+	ZFP_AVX512
+} ZfpIsa;
+
+static ZfpIsa zfp_best_isa() {
+	static ZfpIsa best = __builtin_cpu_supports("avx512f") ? ZFP_AVX512 : (__builtin_cpu_supports("avx2") ? ZFP_AVX2 : ZFP_SCALAR);
+	return best;
+}
+
+static void zfp_compress_scalar(const Point* points, size_t n, uint8_t* out, int bit_budget, size_t b) {
+	const Point& p0 = points[2*b];
+	const Point& p1 = (2*b+1 < n) ? points[2*b+1] : p0;
+	float origin[4] = {p0.lat, p0.lon, p1.lat, p1.lon};
+	uint8_t* block = out + b*ZFP_BLOCK_BYTES;
+	ZfpBitWriter writer(block, ZFP_BLOCK_BYTES);
+	memset(block, 0, ZFP_BLOCK_BYTES);
+	zfp_compress_block(origin, writer, bit_budget);
+	writer.flush();
+}
+
+static void zfp_compress_range(const Point* points, size_t n, uint8_t* out, int bit_budget, size_t begin, size_t end) {
+	// groups only take blocks with two real points
+	size_t full = std::min(end, n/2);
+	ZfpIsa isa = zfp_best_isa();
+	size_t b = begin;
+	while ( b < end ) {
+		if ( isa == ZFP_AVX512 && b+16 <= full && zfp_compress16((const float*)(points + 2*b), out + b*ZFP_BLOCK_BYTES, bit_budget) ) {
+			b += 16;
+		} else if ( isa != ZFP_SCALAR && b+8 <= full && zfp_compress8((const float*)(points + 2*b), out + b*ZFP_BLOCK_BYTES, bit_budget) ) {
+			b += 8;
+		} else {
+			zfp_compress_scalar(points, n, out, bit_budget, b);
+			b++;
+		}
+	}
+}
+
+static void zfp_decompress_range(const uint8_t* in, size_t n, Point* out, int bit_budget, size_t begin, size_t end) {
+	size_t full = std::min(end, n/2);
+	ZfpIsa isa = zfp_best_isa();
+	size_t b = begin;
+	if ( isa == ZFP_AVX512 ) {
+		for ( ; b+16 <= full; b += 16 ) zfp_decompress16(in + b*ZFP_BLOCK_BYTES, (float*)(out + 2*b), bit_budget);
+	}
+	if ( isa != ZFP_SCALAR ) {
+		for ( ; b+8 <= full; b += 8 ) zfp_decompress8(in + b*ZFP_BLOCK_BYTES, (float*)(out + 2*b), bit_budget);
+	}
+	for ( ; b < end; b++ ) {
+		float output[4];
+		ZfpBitReader reader(in + b*ZFP_BLOCK_BYTES, ZFP_BLOCK_BYTES);
+		zfp_decompress_block(reader, output, bit_budget);
+		out[2*b].lat = output[0];
+		out[2*b].lon = output[1];
+		if ( 2*b+1 < n ) {
+			out[2*b+1].lat = output[2];
+			out[2*b+1].lon = output[3];
+		}
+	}
+}
+
+size_t
+zfp_compress_points(const Point* points, size_t n, uint8_t* out, int bit_budget, int threads) {
+	if ( !zfp_bit_budget_valid(bit_budget) ) {
+		printf( "zfp_compress_points: bit budget %d is outside 1..%d\n", bit_budget, ZFP_MAX_BIT_BUDGET );
+		return 0;
+	}
+	size_t blocks = (n + 1) / 2;
+	zfp_parallel(blocks, threads, [=](size_t begin, size_t end) {
+		zfp_compress_range(points, n, out, bit_budget, begin, end);
+	});
+	return blocks*ZFP_BLOCK_BYTES;
+}
+
+bool
+zfp_decompress_points(const uint8_t* in, size_t n, Point* out, int bit_budget, int threads) {
+	if ( !zfp_bit_budget_valid(bit_budget) ) {
+		printf( "zfp_decompress_points: bit budget %d is outside 1..%d\n", bit_budget, ZFP_MAX_BIT_BUDGET );
+		return false;
+	}
+	size_t blocks = (n + 1) / 2;
+	zfp_parallel(blocks, threads, [=](size_t begin, size_t end) {
+		zfp_decompress_range(in, n, out, bit_budget, begin, end);
+	});
+	return true;
+}
+
+/****
+Variable-rate codec
+
+The embedded coding of zfp: after the transform, the negabinary coefficients are put in
+sequency order and written one bit plane at a time, most significant first. Each plane is the
+bits of the coefficients already found significant, then a unary run-length code up to the next
+one that becomes significant. Stopping anywhere still decodes, so the modes only set where a
+block stops: after maxbits bits, after maxprec planes, or at the plane of 2^minexp.
+
+A block header is a nonzero flag and the 8 bit biased common exponent. All-zero blocks, and in
+fixed-accuracy mode blocks below the tolerance, are the flag alone.
+****/
+
+// 2D coefficients in order of sequency, index x + 4*y
+static const uint8_t zfp_perm_2d[16] = {
+	0, 1, 4, 5, 2, 8, 6, 9, 3, 12, 10, 7, 13, 11, 14, 15
+};
+
+// Per-block limits derived from a ZfpConfig
+typedef struct {
+	int maxbits;
+	int minbits;
+	int maxprec;
+	int minexp;
+} ZfpLimits;
+
+ZfpConfig
+zfp_config_pair(int bit_budget) {
+	if ( !zfp_bit_budget_valid(bit_budget) ) {
+		printf( "zfp_config_pair: bit budget %d is outside 1..%d\n", bit_budget, ZFP_MAX_BIT_BUDGET );
+	}
+	ZfpConfig config = {ZFP_MODE_PAIR, bit_budget, 0, 0, 0};
+	return config;
+}
+
+ZfpConfig
+zfp_config_fixed_rate(double rate) {
+	ZfpConfig config = {ZFP_MODE_FIXED_RATE, 0, rate, 0, 0};
+	return config;
+}
+
+ZfpConfig
+zfp_config_fixed_precision(int precision) {
+	ZfpConfig config = {ZFP_MODE_FIXED_PRECISION, 0, 0, precision, 0};
+	return config;
+}
+
+ZfpConfig
+zfp_config_fixed_accuracy(double tolerance) {
+	ZfpConfig config = {ZFP_MODE_FIXED_ACCURACY, 0, 0, 0, tolerance};
+	return config;
+}
+
+// Worst case: every plane written in full with a run-length bit per coefficient
+static inline int zfp_block_max_bits(int size) {
+	return EBITS + ZFP_MAX_PREC*2*size;
+}
+
+static ZfpLimits zfp_limits(const ZfpConfig& config, int size) {
+	ZfpLimits limits = {zfp_block_max_bits(size), 0, ZFP_MAX_PREC, ZFP_MIN_EXP};
+	switch ( config.mode ) {
+	case ZFP_MODE_FIXED_RATE: {
+		int bits = (int)(config.rate*size + 0.5);
+		bits = std::max(EBITS, std::min(bits, zfp_block_max_bits(size)));
+		limits.maxbits = bits;
+		limits.minbits = bits;
+		break;
+	}
+	case ZFP_MODE_FIXED_PRECISION:
+		limits.maxprec = std::max(1, std::min(config.precision, ZFP_MAX_PREC));
+		break;
+	case ZFP_MODE_FIXED_ACCURACY:
+		if ( config.tolerance > 0 ) {
+			int exp;
+			frexp(config.tolerance, &exp);
+			limits.minexp = std::max(exp - 1, ZFP_MIN_EXP);
+		}
+		break;
+	default:
+		break;
+	}
+	return limits;
+}
+
+// Bit planes kept for a block with common exponent emax
+static inline int zfp_precision(int emax, const ZfpLimits& limits, int dims) {
+	return std::min(limits.maxprec, std::max(0, emax - limits.minexp + 2*(dims+1)));
+}
+
+static int zfp_encode_ints(ZfpBitWriter& out, int maxbits, int maxprec, const uint32_t* data, int size) {
+	int kmin = 32 - maxprec;
+	int bits = maxbits;
+	int n = 0;
+	for ( int k = 32; bits && k-- > kmin; ) {
+		// bit plane k
+		uint64_t x = 0;
+		for ( int i = 0; i < size; i++ ) x |= (uint64_t)((data[i] >> k) & 1) << i;
+		// coefficients already significant
+		int m = std::min(n, bits);
+		bits -= m;
+		out.write(x, m);
+		x >>= m;
+		// unary run-length code of the rest
+		for ( ; n < size && bits; x >>= 1, n++ ) {
+			bits--;
+			out.writeBit(x != 0);
+			if ( x == 0 ) break;
+			for ( ; n < size-1 && bits; x >>= 1, n++ ) {
+				bits--;
+				out.writeBit(x & 1);
+				if ( x & 1 ) break;
+			}
+		}
+	}
+	return maxbits - bits;
+}
+
+static int zfp_decode_ints(ZfpBitReader& in, int maxbits, int maxprec, uint32_t* data, int size) {
+	int kmin = 32 - maxprec;
+	int bits = maxbits;
+	int n = 0;
+	for ( int i = 0; i < size; i++ ) data[i] = 0;
+	for ( int k = 32; bits && k-- > kmin; ) {
+		int m = std::min(n, bits);
+		bits -= m;
+		uint64_t x = in.read(m);
+		for ( ; n < size && bits; n++ ) {
+			bits--;
+			if ( !in.readBit() ) break;
+			for ( ; n < size-1 && bits; n++ ) {
+				bits--;
+				if ( in.readBit() ) break;
+			}
+			x += (uint64_t)1 << n;
+		}
+		for ( int i = 0; x; i++, x >>= 1 ) data[i] += (uint32_t)(x & 1) << k;
+	}
+	return maxbits - bits;
+}
+
+// One block of 4 (dims 1) or 16 (dims 2) values. Returns the bits written
+static int zfp_encode_block(ZfpBitWriter& out, const float* block, int dims, const ZfpLimits& limits) {
+	int size = dims == 1 ? 4 : 16;
+	float fmax = 0;
+	for ( int i = 0; i < size; i++ ) fmax = std::max(fmax, std::fabs(block[i]));
+	int emax = fmax > 0 ? std::max(exponent_of(fmax), 1 - EXP_MAX) : -EXP_MAX;
+	int maxprec = zfp_precision(emax, limits, dims);
+	int e = maxprec ? emax + EXP_MAX : 0;
+	int bits = 1;
+	if ( e ) {
+		out.write(2*e + 1, EBITS);
+		bits = EBITS;
+
+		double scale = pow2_double(32-2 - emax);
+		int32_t idata[16];
+		for ( int i = 0; i < size; i++ ) idata[i] = (int32_t)(block[i]*scale);
+		uint32_t udata[16];
+		if ( dims == 1 ) {
+			fwd_lift_int32(idata);
+			for ( int i = 0; i < 4; i++ ) udata[i] = int2uint_int32(idata[i]);
+		} else {
+			for ( int y = 0; y < 4; y++ ) fwd_lift_int32(idata + 4*y, 1);
+			for ( int x = 0; x < 4; x++ ) fwd_lift_int32(idata + x, 4);
+			for ( int i = 0; i < 16; i++ ) udata[i] = int2uint_int32(idata[zfp_perm_2d[i]]);
+		}
+		bits += zfp_encode_ints(out, limits.maxbits - bits, maxprec, udata, size);
+	} else {
+		out.writeBit(0);
+	}
+	if ( bits < limits.minbits ) {
+		out.pad(limits.minbits - bits);
+		bits = limits.minbits;
+	}
+	return bits;
+}
+
+static int zfp_decode_block(ZfpBitReader& in, float* block, int dims, const ZfpLimits& limits) {
+	int size = dims == 1 ? 4 : 16;
+	int bits = 1;
+	if ( in.readBit() ) {
+		int e = (int)in.read(EBITS - 1);
+		bits = EBITS;
+		int emax = e - EXP_MAX;
+		int maxprec = zfp_precision(emax, limits, dims);
+
+		uint32_t udata[16];
+		bits += zfp_decode_ints(in, limits.maxbits - bits, maxprec, udata, size);
+		int32_t idata[16];
+		if ( dims == 1 ) {
+			for ( int i = 0; i < 4; i++ ) idata[i] = uint2int_uint32(udata[i]);
+			inv_lift_int32(idata);
+		} else {
+			for ( int i = 0; i < 16; i++ ) idata[zfp_perm_2d[i]] = uint2int_uint32(udata[i]);
+			for ( int x = 0; x < 4; x++ ) inv_lift_int32(idata + x, 4);
+			for ( int y = 0; y < 4; y++ ) inv_lift_int32(idata + 4*y, 1);
+		}
+		float q = pow2_float(emax - (32-2));
+		for ( int i = 0; i < size; i++ ) block[i] = (float)idata[i]*q;
+	} else {
+		for ( int i = 0; i < size; i++ ) block[i] = 0;
+	}
+	if ( bits < limits.minbits ) {
+		in.skip(limits.minbits - bits);
+		bits = limits.minbits;
+	}
+	return bits;
+}
+
+size_t
+zfp_max_bytes(const ZfpConfig& config, size_t nx, size_t ny) {
+	if ( config.mode == ZFP_MODE_PAIR ) return zfp_compressed_bytes(nx / 2);
+	int dims = ny > 1 ? 2 : 1;
+	int size = dims == 1 ? 4 : 16;
+	size_t blocks = (nx + 3) / 4 * (dims == 1 ? 1 : (ny + 3) / 4);
+	ZfpLimits limits = zfp_limits(config, size);
+	return (blocks*limits.maxbits + 7) / 8;
+}
+
+// Partial blocks at the right and bottom edges repeat the last row and column
+size_t
+zfp_compress(const ZfpConfig& config, const float* data, size_t nx, size_t ny, uint8_t* out, size_t capacity) {
+	if ( config.mode == ZFP_MODE_PAIR ) {
+		if ( ny > 1 || nx % 2 || capacity < zfp_compressed_bytes(nx / 2) ) {
+			printf( "zfp_compress: pair mode takes (lat, lon) pairs, and %lu bytes\n", zfp_compressed_bytes(nx / 2) );
+			return 0;
+		}
+		if ( !zfp_bit_budget_valid(config.bit_budget) ) {
+			printf( "zfp_compress: pair mode takes bit budgets 1..%d, not %d\n", ZFP_MAX_BIT_BUDGET, config.bit_budget );
+			return 0;
+		}
+		return zfp_compress_points((const Point*)data, nx / 2, out, config.bit_budget);
+	}
+	int dims = ny > 1 ? 2 : 1;
+	ZfpLimits limits = zfp_limits(config, dims == 1 ? 4 : 16);
+	ZfpBitWriter writer(out, capacity);
+	float block[16];
+	if ( dims == 1 ) {
+		for ( size_t x = 0; x < nx; x += 4 ) {
+			for ( size_t i = 0; i < 4; i++ ) block[i] = data[std::min(x + i, nx - 1)];
+			zfp_encode_block(writer, block, 1, limits);
+		}
+	} else {
+		for ( size_t y = 0; y < ny; y += 4 ) {
+			for ( size_t x = 0; x < nx; x += 4 ) {
+				for ( size_t j = 0; j < 4; j++ ) {
+					const float* row = data + std::min(y + j, ny - 1)*nx;
+					for ( size_t i = 0; i < 4; i++ ) block[4*j + i] = row[std::min(x + i, nx - 1)];
+				}
+				zfp_encode_block(writer, block, 2, limits);
+			}
+		}
+	}
+	size_t bytes = writer.flush();
+	if ( writer.overflow() ) {
+		printf( "zfp_compress: output does not fit in %lu bytes\n", capacity );
+		return 0;
+	}
+	return bytes;
+}
+
+bool
+zfp_decompress(const ZfpConfig& config, const uint8_t* in, size_t bytes, float* data, size_t nx, size_t ny) {
+	if ( config.mode == ZFP_MODE_PAIR ) {
+		if ( ny > 1 || nx % 2 || bytes < zfp_compressed_bytes(nx / 2) ) return false;
+		return zfp_decompress_points(in, nx / 2, (Point*)data, config.bit_budget);
+	}
+	int dims = ny > 1 ? 2 : 1;
+	ZfpLimits limits = zfp_limits(config, dims == 1 ? 4 : 16);
+	ZfpBitReader reader(in, bytes);
+	float block[16];
+	if ( dims == 1 ) {
+		for ( size_t x = 0; x < nx; x += 4 ) {
+			zfp_decode_block(reader, block, 1, limits);
+			for ( size_t i = 0; i < 4 && x + i < nx; i++ ) data[x + i] = block[i];
+		}
+	} else {
+		for ( size_t y = 0; y < ny; y += 4 ) {
+			for ( size_t x = 0; x < nx; x += 4 ) {
+				zfp_decode_block(reader, block, 2, limits);
+				for ( size_t j = 0; j < 4 && y + j < ny; j++ ) {
+					for ( size_t i = 0; i < 4 && x + i < nx; i++ ) data[(y + j)*nx + x + i] = block[4*j + i];
+				}
+			}
+		}
+	}
+	return reader.tell() <= bytes*8;
+}
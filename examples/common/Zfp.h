@@ -0,0 +1,86 @@
+#ifndef __EXAMPLES_ZFP__H__
+#define __EXAMPLES_ZFP__H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Point.h"
+#include "ZfpBitStream.h"
+
+/****
+Host ZFP codec of the zfpcompressor/zfpdecompressor examples
+
+A block is 4 floats, one (lat, lon, lat, lon) pair of points, transformed like ZfpCompress.bsv:
+common exponent, fixed point, forward lifting, negabinary, then per value a flag and
+bit_budget bits. 9 + 4*(bit_budget+1) bits fit in ZFP_BLOCK_BYTES for bit budgets up to 12,
+so the pair format takes bit budgets 1 to ZFP_MAX_BIT_BUDGET and rejects anything else.
+
+zfp_compress_points() packs point 2k and 2k+1 into block k (an odd last point is paired with
+itself) and writes ZFP_BLOCK_BYTES per block into the caller's buffer. Nothing is allocated.
+The power-of-two scaling is built from the exponent bits instead of calling pow per value,
+with the same result. Blocks are independent, so threads > 1 splits them into contiguous
+chunks, one std::thread each. Within a chunk, runs of 16 (AVX-512) or 8 (AVX2) blocks go
+through a vectorized transform, picked at run time, whose output is bit-exact with
+zfp_compress_block()/zfp_decompress_block().
+
+zfp_compress()/zfp_decompress() pick the mode at run time from a ZfpConfig. Besides the pair
+format, they code 1D or 2D (4x4 block) arrays with zfp's embedded bit-plane coding in
+fixed-rate, fixed-precision or fixed-accuracy mode, so smooth or low-range data takes fewer
+bits. Only fixed-rate blocks have a fixed size; the other modes are a sequential stream.
+****/
+
+// Exponent of single is 8 bit signed integer (-126 to +127)
+#define EXP_MAX ((1<<(8-1))-1)
+// Exponent of the minimum granularity value expressible via single
+#define ZFP_MIN_EXP -149
+#define ZFP_MAX_PREC 32
+#define EBITS (8+1)
+
+#define ZFP_BLOCK_BYTES 8
+#define ZFP_MAX_BIT_BUDGET 12
+
+static inline bool zfp_bit_budget_valid(int bit_budget) {
+	return bit_budget >= 1 && bit_budget <= ZFP_MAX_BIT_BUDGET;
+}
+
+typedef enum {
+	ZFP_MODE_PAIR,            // the 8 byte pair blocks of zfp_compress_points(), bit_budget
+	ZFP_MODE_FIXED_RATE,      // rate bits per value, every block the same size
+	ZFP_MODE_FIXED_PRECISION, // precision bit planes per block
+	ZFP_MODE_FIXED_ACCURACY   // absolute error at most tolerance
+} ZfpMode;
+
+typedef struct {
+	ZfpMode mode;
+	int bit_budget;
+	double rate;
+	int precision;
+	double tolerance;
+} ZfpConfig;
+
+// One block through a stream: the compress_1d/decompress_1d of zfp.cpp. bit_budget must be valid
+void zfp_compress_block(const float origin[4], ZfpBitWriter& out, int bit_budget);
+void zfp_decompress_block(ZfpBitReader& in, float output[4], int bit_budget);
+
+// Output bytes for n points
+size_t zfp_compressed_bytes(size_t n);
+
+// threads 0 uses every hardware thread. Returns the bytes written, 0 (false) for a bit budget
+// outside 1..ZFP_MAX_BIT_BUDGET
+size_t zfp_compress_points(const Point* points, size_t n, uint8_t* out, int bit_budget, int threads = 0);
+bool zfp_decompress_points(const uint8_t* in, size_t n, Point* out, int bit_budget, int threads = 0);
+
+// An invalid bit budget is reported here, and zfp_compress()/zfp_decompress() reject the config
+ZfpConfig zfp_config_pair(int bit_budget);
+ZfpConfig zfp_config_fixed_rate(double rate);
+ZfpConfig zfp_config_fixed_precision(int precision);
+ZfpConfig zfp_config_fixed_accuracy(double tolerance);
+
+// An nx wide, ny high row-major array: 1D blocks of 4 if ny is 1, 4x4 blocks otherwise.
+// Pair mode takes nx/2 (lat, lon) points, ny 1.
+// zfp_compress() returns the bytes written, 0 if config does not apply or out is too small
+size_t zfp_max_bytes(const ZfpConfig& config, size_t nx, size_t ny);
+size_t zfp_compress(const ZfpConfig& config, const float* data, size_t nx, size_t ny, uint8_t* out, size_t capacity);
+bool zfp_decompress(const ZfpConfig& config, const uint8_t* in, size_t bytes, float* data, size_t nx, size_t ny);
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef __ZFP_BIT_STREAM__H__
+#define __ZFP_BIT_STREAM__H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/****
+Word-level bit stream for the ZFP examples
+
+Bits are packed least significant first, the order of BitBuffer in zfp.cpp and of the FPGA
+compressor, so 8 byte blocks come out identical. Both sides keep a 64 bit accumulator:
+write() and read() move up to 64 bits per call with a few shifts, and memory is touched one
+64 bit word at a time instead of one byte per bit.
+
+A writer or reader spans a whole caller buffer, so many blocks stream back to back without any
+per-block setup. tell() and seek() give the bit position, for fixed-rate random access.
+Writes past the end of the buffer are dropped and flagged by overflow(). Reads past the end
+return zeros.
+****/
+
+class ZfpBitWriter {
+public:
+	ZfpBitWriter() { begin(NULL, 0); }
+	ZfpBitWriter(uint8_t* buffer, size_t bytes) { begin(buffer, bytes); }
+
+	void begin(uint8_t* buffer, size_t bytes) {
+		m_base = buffer;
+		m_ptr = buffer;
+		m_end = buffer + bytes;
+		m_acc = 0;
+		m_count = 0;
+		m_overflow = false;
+	}
+
+	// Low n bits of value, 0 <= n <= 64
+	void write(uint64_t value, int n) {
+		if ( n < 64 ) value &= ((uint64_t)1 << n) - 1;
+		m_acc |= value << m_count;
+		m_count += n;
+		if ( m_count >= 64 ) {
+			store(m_acc);
+			m_count -= 64;
+			// bits of value that went out with the word
+			int used = n - m_count;
+			m_acc = used < 64 ? value >> used : 0;
+		}
+	}
+	void writeBit(uint32_t bit) { write(bit & 1, 1); }
+	void pad(size_t n) {
+		for ( ; n >= 64; n -= 64 ) write(0, 64);
+		write(0, (int)n);
+	}
+
+	// Writes out the buffered bits, zero padded to a whole byte. Returns the bytes written
+	size_t flush() {
+		size_t bytes = (m_count + 7) / 8;
+		if ( m_ptr + bytes > m_end ) {
+			m_overflow = true;
+			bytes = m_end - m_ptr;
+		}
+		memcpy(m_ptr, &m_acc, bytes);
+		m_ptr += bytes;
+		m_acc = 0;
+		m_count = 0;
+		return m_ptr - m_base;
+	}
+
+	size_t tell() const { return (m_ptr - m_base)*8 + m_count; }
+	bool overflow() const { return m_overflow; }
+
+private:
+	void store(uint64_t word) {
+		if ( m_ptr + 8 > m_end ) {
+			m_overflow = true;
+			return;
+		}
+		memcpy(m_ptr, &word, 8);
+		m_ptr += 8;
+	}
+
+	uint8_t* m_base;
+	uint8_t* m_ptr;
+	uint8_t* m_end;
+	uint64_t m_acc;
+	int m_count; // buffered bits, < 64
+	bool m_overflow;
+};
+
+class ZfpBitReader {
+public:
+	ZfpBitReader() { begin(NULL, 0); }
+	ZfpBitReader(const uint8_t* buffer, size_t bytes) { begin(buffer, bytes); }
+
+	void begin(const uint8_t* buffer, size_t bytes) {
+		m_base = buffer;
+		m_ptr = buffer;
+		m_end = buffer + bytes;
+		m_acc = 0;
+		m_count = 0;
+	}
+
+	// Next n bits, 0 <= n <= 64
+	uint64_t read(int n) {
+		uint64_t value = m_acc;
+		if ( m_count < n ) {
+			uint64_t word = load();
+			value |= word << m_count;
+			// bits taken from word
+			int need = n - m_count;
+			m_acc = need < 64 ? word >> need : 0;
+			m_count = 64 - need;
+		} else {
+			m_acc = n < 64 ? m_acc >> n : 0;
+			m_count -= n;
+		}
+		return n < 64 ? value & (((uint64_t)1 << n) - 1) : value;
+	}
+	uint32_t readBit() { return (uint32_t)read(1); }
+	void skip(size_t n) { seek(tell() + n); }
+
+	size_t tell() const { return (m_ptr - m_base)*8 - m_count; }
+	void seek(size_t bit) {
+		m_ptr = m_base + bit/64*8;
+		m_acc = 0;
+		m_count = 0;
+		int off = bit % 64;
+		if ( off ) {
+			m_acc = load() >> off;
+			m_count = 64 - off;
+		}
+	}
+
+private:
+	uint64_t load() {
+		uint64_t word = 0;
+		if ( m_ptr + 8 <= m_end ) {
+			memcpy(&word, m_ptr, 8);
+		} else if ( m_ptr < m_end ) {
+			memcpy(&word, m_ptr, m_end - m_ptr);
+		}
+		m_ptr += 8;
+		return word;
+	}
+
+	const uint8_t* m_base;
+	const uint8_t* m_ptr;
+	const uint8_t* m_end;
+	uint64_t m_acc;
+	int m_count; // buffered bits, < 64 after a read
+};
+
+#endif
@@ -0,0 +1,188 @@
+#include <math.h>
+#include <immintrin.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "CosineEngine.h"
+
+// similarities computed per block, so topK stays in a small stack buffer
+#define CE_BLOCK 4096
+
+static inline void unitOf(Point p, float& ux, float& uy) {
+	double mag = sqrt((double)p.lat*p.lat + (double)p.lon*p.lon);
+	if ( mag == 0 ) {
+		ux = uy = 0;
+		return;
+	}
+	ux = (float)(p.lat/mag);
+	uy = (float)(p.lon/mag);
+}
+
+// a ranks before b
+static inline bool better(const CosineMatch& a, const CosineMatch& b) {
+	return a.similarity > b.similarity || (a.similarity == b.similarity && a.index < b.index);
+}
+
+static void dotScalar(float qx, float qy, const float* ux, const float* uy, float* out, size_t n) {
+	for ( size_t i = 0; i < n; i++ ) out[i] = qx*ux[i] + qy*uy[i];
+}
+
+__attribute__((target("avx2,fma")))
+static void dotAvx2(float qx, float qy, const float* ux, const float* uy, float* out, size_t n) {
+	const __m256 vx = _mm256_set1_ps(qx);
+	const __m256 vy = _mm256_set1_ps(qy);
+	size_t i = 0;
+	for ( ; i+8 <= n; i += 8 ) {
+		__m256 s = _mm256_fmadd_ps(vx, _mm256_loadu_ps(ux+i), _mm256_mul_ps(vy, _mm256_loadu_ps(uy+i)));
+		_mm256_storeu_ps(out+i, s);
+	}
+	dotScalar(qx, qy, ux+i, uy+i, out+i, n-i);
+}
+
+static size_t filterScalar(float qx, float qy, const float* ux, const float* uy, size_t n, float threshold, std::vector<uint32_t>& out) {
+	size_t before = out.size();
+	for ( size_t i = 0; i < n; i++ ) {
+		if ( qx*ux[i] + qy*uy[i] >= threshold ) out.push_back((uint32_t)i);
+	}
+	return out.size() - before;
+}
+
+// The compare mask picks out the matches, so non-matching targets cost no branch
+__attribute__((target("avx2,fma")))
+static size_t filterAvx2(float qx, float qy, const float* ux, const float* uy, size_t n, float threshold, std::vector<uint32_t>& out) {
+	size_t before = out.size();
+	const __m256 vx = _mm256_set1_ps(qx);
+	const __m256 vy = _mm256_set1_ps(qy);
+	const __m256 vt = _mm256_set1_ps(threshold);
+	size_t i = 0;
+	for ( ; i+8 <= n; i += 8 ) {
+		__m256 s = _mm256_fmadd_ps(vx, _mm256_loadu_ps(ux+i), _mm256_mul_ps(vy, _mm256_loadu_ps(uy+i)));
+		unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(s, vt, _CMP_GE_OQ));
+		while ( mask ) {
+			out.push_back((uint32_t)(i + __builtin_ctz(mask)));
+			mask &= mask - 1;
+		}
+	}
+	for ( ; i < n; i++ ) {
+		if ( qx*ux[i] + qy*uy[i] >= threshold ) out.push_back((uint32_t)i);
+	}
+	return out.size() - before;
+}
+
+CosineEngine::CosineEngine(int threads) {
+	m_threads = threads > 0 ? threads : (int)std::thread::hardware_concurrency();
+	if ( m_threads < 1 ) m_threads = 1;
+	m_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+void
+CosineEngine::build(const Point* points, size_t n) {
+	m_ux.resize(n);
+	m_uy.resize(n);
+	for ( size_t i = 0; i < n; i++ ) unitOf(points[i], m_ux[i], m_uy[i]);
+}
+
+void
+CosineEngine::similarities(Point query, float* out) {
+	float qx, qy;
+	unitOf(query, qx, qy);
+	if ( m_ux.empty() ) return;
+	if ( m_avx2 ) dotAvx2(qx, qy, &m_ux[0], &m_uy[0], out, m_ux.size());
+	else dotScalar(qx, qy, &m_ux[0], &m_uy[0], out, m_ux.size());
+}
+
+size_t
+CosineEngine::threshold(Point query, float threshold, std::vector<uint32_t>& out) {
+	float qx, qy;
+	unitOf(query, qx, qy);
+	if ( m_ux.empty() ) return 0;
+	if ( m_avx2 ) return filterAvx2(qx, qy, &m_ux[0], &m_uy[0], m_ux.size(), threshold, out);
+	return filterScalar(qx, qy, &m_ux[0], &m_uy[0], m_ux.size(), threshold, out);
+}
+
+void
+CosineEngine::topK(Point query, int k, std::vector<CosineMatch>& out) {
+	out.clear();
+	if ( k <= 0 ) return;
+	float qx, qy;
+	unitOf(query, qx, qy);
+
+	// out is a heap with the worst kept match in front
+	float sim[CE_BLOCK];
+	size_t n = m_ux.size();
+	for ( size_t base = 0; base < n; base += CE_BLOCK ) {
+		size_t count = (n - base < CE_BLOCK) ? n - base : CE_BLOCK;
+		if ( m_avx2 ) dotAvx2(qx, qy, &m_ux[base], &m_uy[base], sim, count);
+		else dotScalar(qx, qy, &m_ux[base], &m_uy[base], sim, count);
+
+		size_t i = 0;
+		for ( ; i < count && out.size() < (size_t)k; i++ ) {
+			CosineMatch m = {(uint32_t)(base+i), sim[i]};
+			out.push_back(m);
+			std::push_heap(out.begin(), out.end(), better);
+		}
+		// targets come in index order, so a tie with the worst never replaces it
+		float worst = out.front().similarity;
+		for ( ; i < count; i++ ) {
+			if ( !(sim[i] > worst) ) continue;
+			std::pop_heap(out.begin(), out.end(), better);
+			out.back().index = (uint32_t)(base+i);
+			out.back().similarity = sim[i];
+			std::push_heap(out.begin(), out.end(), better);
+			worst = out.front().similarity;
+		}
+	}
+	std::sort_heap(out.begin(), out.end(), better);
+}
+
+template <class F>
+void
+CosineEngine::parallel(size_t count, F f) {
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		while (true) {
+			size_t i = next.fetch_add(1);
+			if ( i >= count ) break;
+			f(i);
+		}
+	};
+	std::vector<std::thread> threads;
+	for ( int t = 1; t < m_threads && (size_t)t < count; t++ ) threads.push_back(std::thread(worker));
+	worker();
+	for ( size_t t = 0; t < threads.size(); t++ ) threads[t].join();
+}
+
+void
+CosineEngine::thresholdBatch(const Point* queries, size_t count, float threshold,
+	std::vector<uint32_t>& offsets, std::vector<uint32_t>& matches) {
+
+	std::vector<std::vector<uint32_t> > perQuery(count);
+	parallel(count, [&](size_t q) {
+		this->threshold(queries[q], threshold, perQuery[q]);
+	});
+
+	offsets.resize(count+1);
+	offsets[0] = 0;
+	for ( size_t q = 0; q < count; q++ ) offsets[q+1] = offsets[q] + (uint32_t)perQuery[q].size();
+	matches.resize(offsets[count]);
+	for ( size_t q = 0; q < count; q++ ) {
+		std::copy(perQuery[q].begin(), perQuery[q].end(), matches.begin() + offsets[q]);
+	}
+}
+
+void
+CosineEngine::topKBatch(const Point* queries, size_t count, int k, std::vector<CosineMatch>& out) {
+	if ( k <= 0 ) {
+		out.clear();
+		return;
+	}
+	CosineMatch none = {UINT32_MAX, -INFINITY};
+	out.assign(count*k, none);
+	parallel(count, [&](size_t q) {
+		std::vector<CosineMatch> best;
+		topK(queries[q], k, best);
+		std::copy(best.begin(), best.end(), out.begin() + q*k);
+	});
+}
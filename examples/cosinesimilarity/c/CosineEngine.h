@@ -0,0 +1,68 @@
+#ifndef __COSINE_ENGINE__H__
+#define __COSINE_ENGINE__H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "Point.h"
+
+/****
+Cosine similarity against a fixed target set
+
+cosineSimilarity() in cosinesimilarity.cpp recomputes both magnitudes for every pair. The
+targets never change, so build() normalizes them once into unit vectors (structure-of-arrays),
+and a query is normalized once too. A pair is then one 2D dot product, two multiply-adds,
+evaluated 8 at a time with AVX2 when the CPU has it.
+
+Zero vectors have no direction, their similarity to anything is 0.
+
+threshold() keeps every target with similarity >= threshold, like the EPSILON test of the
+example. topK() keeps the k most similar in a min-heap, so a target costs one compare unless it
+beats the current k-th best. The batch versions split the queries over threads.
+****/
+
+typedef struct CosineMatch {
+	uint32_t index;
+	float similarity;
+} CosineMatch;
+
+class CosineEngine {
+public:
+	// threads 0 uses every hardware thread
+	CosineEngine(int threads = 0);
+
+	// Copies and normalizes the targets
+	void build(const Point* points, size_t n);
+
+	size_t size() { return m_ux.size(); }
+	int threads() { return m_threads; }
+
+	// out[i] = similarity of query and target i, for all targets
+	void similarities(Point query, float* out);
+
+	// Indices of all targets with similarity >= threshold, in index order, appended to out.
+	// Returns the number appended
+	size_t threshold(Point query, float threshold, std::vector<uint32_t>& out);
+
+	// The min(k, size()) most similar targets, most similar first (ties by lower index).
+	// out is replaced
+	void topK(Point query, int k, std::vector<CosineMatch>& out);
+
+	// Matches of query i are matches[offsets[i] .. offsets[i+1])
+	void thresholdBatch(const Point* queries, size_t count, float threshold,
+		std::vector<uint32_t>& offsets, std::vector<uint32_t>& matches);
+	// Top k of query i are out[i*k .. i*k+k), padded with {UINT32_MAX, -INFINITY} past size()
+	void topKBatch(const Point* queries, size_t count, int k, std::vector<CosineMatch>& out);
+
+private:
+	template <class F> void parallel(size_t count, F f);
+
+	int m_threads;
+	bool m_avx2;
+	std::vector<float> m_ux;
+	std::vector<float> m_uy;
+};
+
+#endif
@@ -3,42 +3,19 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <vector>
 
+#include "Benchmark.h"
+#include "CosineEngine.h"
+#include "Dbscan.h"
 
-#define EPSILON 0.97
-
-
-typedef struct Point {
-	float lat;
-	float lon;
-}Point;
-
-
-// Elapsed time checker
-static inline double timeCheckerCPU(void) {
-        struct rusage ru;
-        getrusage(RUSAGE_SELF, &ru);
-        return (double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec / 1000000;
-}
-
-// Function for reading benchmark file
-void readBenchmarkData(std::vector<Point> &cities, char* filename, int length) {
-	FILE* f_data = fopen(filename, "rb");
-	if (f_data == NULL ) {
-		printf("File not found: %s\n", filename);
-		exit(1);
-	}
 
-	for ( int i = 0; i < length; i ++ ) {
-		int numPoints = cities.size();
-		cities.resize(numPoints+1);
-		fread(&cities[i].lat, sizeof(float), 1, f_data);
-		fread(&cities[i].lon, sizeof(float), 1, f_data);
-	}
+#define EPSILON 0.97
+#define MIN_POINTS 4
+#define JOIN_QUERIES 256
+#define TOP_K 8
 
-	fclose(f_data);
-}
 
 // Cosine Similarity
 float cosineSimilarity(const Point pointCore, const Point pointTarget) {
@@ -142,6 +119,45 @@ int main(int argc, char **argv)
 	double processFinish = timeCheckerCPU();
 	double processTime = processFinish - processStart;
 	printf( "Elapsed Time (CPU): %.8f\n", processTime );
-	
+
+	// Quadtree-based DBSCAN over all cities, the clustering the loops above stand in for
+	double dbscanStart = timeCheckerWall();
+	QuadTreeIndex index;
+	index.build(&cities[0], numCities);
+	Dbscan<CosineMetric> dbscan(index, CosineMetric(), EPSILON, MIN_POINTS);
+	dbscan.run();
+	double dbscanFinish = timeCheckerWall();
+	printf( "DBSCAN (eps %f, minPts %d): %d clusters, %lu core points, %lu noise points\n",
+		(double)EPSILON, MIN_POINTS, dbscan.clusters(), dbscan.corePoints(), dbscan.noisePoints() );
+	printf( "Exact evaluations: %lu (%.1fx fewer than all pairs)\n", dbscan.exactEvaluations(),
+		(double)numCities*numCities*2/(dbscan.exactEvaluations() ? dbscan.exactEvaluations() : 1) );
+	std::vector<PointPair> fpgaBatch;
+	dbscan.candidatePairs(0, fpgaBatch);
+	printf( "FPGA candidate batch of city 0: %lu pairs, %lu bytes\n", fpgaBatch.size(), fpgaBatch.size()*sizeof(PointPair) );
+	printf( "Elapsed Time (wall, DBSCAN): %.8f\n", dbscanFinish - dbscanStart );
+
+	// Similarity join of the first JOIN_QUERIES cities against all, with precomputed norms
+	CosineEngine engine;
+	double joinStart = timeCheckerWall();
+	engine.build(&cities[0], numCities);
+	std::vector<uint32_t> offsets, matches;
+	engine.thresholdBatch(&cities[0], JOIN_QUERIES, EPSILON, offsets, matches);
+	double joinFinish = timeCheckerWall();
+	std::vector<CosineMatch> top;
+	engine.topKBatch(&cities[0], JOIN_QUERIES, TOP_K, top);
+	double topFinish = timeCheckerWall();
+	int direct = 0;
+	for ( int j = 0; j < numCities; j ++ ) {
+		if ( cosineSimilarity(cities[0], cities[j]) >= EPSILON ) direct ++;
+	}
+	printf( "Similarity join (%d queries, %d threads): %u matches, city 0 has %u (%d with cosineSimilarity)\n",
+		JOIN_QUERIES, engine.threads(), offsets[JOIN_QUERIES], offsets[1], direct );
+	printf( "Top %d of city 0: city %u (%f) .. city %u (%f)\n", TOP_K, top[0].index, top[0].similarity,
+		top[TOP_K-1].index, top[TOP_K-1].similarity );
+	printf( "Elapsed Time (wall, join): %.8f, top-k: %.8f\n", joinFinish - joinStart, topFinish - joinFinish );
+
+	// The same one-to-many workload through every DistanceMetric.h backend
+	distanceBenchmark<Cosine>(&cities[0], numCities, 16);
+
 	return 0;
 }
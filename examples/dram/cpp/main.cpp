@@ -10,6 +10,8 @@
 
 #include "bdbmpcie.h"
 #include "dmasplitter.h"
+#include "PcieCompletion.h"
+#include "DnaCodec.h"
 
 
 // Parameter setting
@@ -38,62 +40,6 @@ void readfromfile( char* data, char* filename, uint32_t length ) {
 	fclose(f_data);
 }
 
-// Function for representing sequences as 2-bit
-void convertCharTo2Bits( uint8_t* sequences2Bits, char* sequences, uint32_t num, uint32_t length ) {
-	uint32_t idx = 0;
-	uint8_t cnt = 0;
-	uint8_t unit = 0;
-	for ( uint32_t i = 0; i < num; i ++ ) {
-		for ( uint32_t j = 0; j < length; j ++ ) {
-			if ( sequences[length*i+j] == 'A' ) unit = (0 << 2*cnt) | unit;
-			else if ( sequences[length*i+j] == 'C' ) unit = (1 << 2*cnt) | unit;
-			else if ( sequences[length*i+j] == 'G' ) unit = (2 << 2*cnt) | unit;
-			else if ( sequences[length*i+j] == 'T' ) unit = (3 << 2*cnt) | unit;
-			
-			if ( cnt == 3 ) {
-				sequences2Bits[idx++] = unit;
-				cnt = 0;
-				unit = 0;
-			} else cnt ++;
-		}
-		
-		sequences2Bits[idx++] = unit;
-		cnt = 0;
-		unit = 0;
-		
-		for ( uint32_t k = 0; k < 8; k ++ ) {
-			sequences2Bits[idx++] = unit;
-		}
-	}
-}
-
-// Function for representing 2-bit encoded sequences to original form
-void convert2BitsToChar( char* sequences, uint8_t* sequences2Bits, uint32_t length, uint32_t remainder ) {
-	uint32_t idx = 0;
-	for ( uint32_t i = 0; i < length; i ++ ) {
-		uint8_t fourChar = sequences2Bits[i];
-		if ( i == length - 1 ) {
-			for ( uint32_t k = 0; k < remainder; k ++ ) {
-				uint8_t oneChar = fourChar << 2*(4-k-1);
-				oneChar = oneChar >> 6;
-				if ( oneChar == 0 ) sequences[idx++] = 'A';
-				else if ( oneChar == 1 ) sequences[idx++] = 'C';
-				else if ( oneChar == 2 ) sequences[idx++] = 'G';
-				else if ( oneChar == 3 ) sequences[idx++] = 'T';
-			}
-		} else {
-			for ( uint32_t k = 0; k < 4; k ++ ) {
-				uint8_t oneChar = fourChar << 2*(4-k-1);
-				oneChar = oneChar >> 6;
-				if ( oneChar == 0 ) sequences[idx++] = 'A';
-				else if ( oneChar == 1 ) sequences[idx++] = 'C';
-				else if ( oneChar == 2 ) sequences[idx++] = 'G';
-				else if ( oneChar == 3 ) sequences[idx++] = 'T';
-			}
-		}
-	}
-}
-
 
 // Main
 int main(int argc, char** argv) {
@@ -115,17 +61,14 @@ int main(int argc, char** argv) {
 	// For fitting DRAM interface (512bits),
 	// 2 sequences (444bits) and zero padding (68bits) are needed
 	//-------------------------------------------------------------------------------
-	uint32_t sequences2BitsSize = 64 * 13;
-	uint8_t* sequences2Bits = (uint8_t*)malloc(sizeof(uint8_t)*sequences2BitsSize);
-	convertCharTo2Bits(&sequences2Bits[0], &sequences[0], 13, 222);
+	// The records are packed straight into the DMA buffer
+	//-------------------------------------------------------------------------------
+	uint32_t sequences2BitsSize = dnaPackRecords(&sequences[0], SEQNUM, SEQLENGTH, 2, &dmabuf[0]);
 	//-------------------------------------------------------------------------------
 	// Stage3: Send the sequences to FPGA through DMA
 	// 832 x 1B(8bits) = 52 x 16B(128bits)
 	//-------------------------------------------------------------------------------
-	for ( uint32_t i = 0; i < sequences2BitsSize; i ++ ) {
-		dmabuf[i] = sequences2Bits[i];
-	}
-	pcie->userWriteWord(0, 52);
+	pcie->userWriteWord(0, sequences2BitsSize/16);
 	//-------------------------------------------------------------------------------
 	// Stage4: Make a set of answer
 	//-------------------------------------------------------------------------------
@@ -144,22 +87,20 @@ int main(int argc, char** argv) {
 	// 5 128bits are stored in DMA buffer
 	//-------------------------------------------------------------------------------
 	uint32_t lsb11Chars2BitsSize = 72;
-	uint32_t lsb11Chars2BitsRmdr = 2;
 	uint8_t* lsb11Chars2Bits = (uint8_t*)malloc(sizeof(uint8_t)*lsb11Chars2BitsSize);
 	char* lsb11Chars = (char*)malloc(sizeof(char)*sizeAnswer);
 	// Send we want to read 5 128bits buffers
 	pcie->userWriteWord(4, 5);
-	// For wait
-	for ( int z = 0; z < 1024*1024*32; z ++ ) {
-		pcie->userWriteWord(8, 0);
-	}
+	// Wait for the DMA write, the status read returns 1 once it is done and 7777 until then
+	PcieCompletion writeDone("motif DMA write", 4);
+	if ( !writeDone.waitEqual(1) ) return 1;
 	for ( uint32_t i = 0; i < lsb11Chars2BitsSize; i ++ ) {
 		lsb11Chars2Bits[i] = dmabuf[i];
 	}
 	//-------------------------------------------------------------------------------
 	// Stage6: Decode received 2-bit encoded 11 LSB characters
 	//-------------------------------------------------------------------------------
-	convert2BitsToChar(&lsb11Chars[0], &lsb11Chars2Bits[0], lsb11Chars2BitsSize, lsb11Chars2BitsRmdr);
+	dnaDecode(&lsb11Chars2Bits[0], sizeAnswer, &lsb11Chars[0]);
 	//-------------------------------------------------------------------------------
 	// Stage7: Print 11 LSB characters and compare with answers
 	//-------------------------------------------------------------------------------
@@ -182,7 +123,6 @@ int main(int argc, char** argv) {
 	}
 
 	free(sequences);
-	free(sequences2Bits);
 	free(lsb11Chars);
 	free(lsb11Chars2Bits);
 	free(answers);
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bdbmpcie.h"
+#include "EuclideanStream.h"
+
+EuclideanStream::EuclideanStream() : m_ring("euclidean result ring", ES_RING_OFFSET, ES_RING_BYTES, 2*4, 6*4) {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	m_dmabuf = (uint8_t*)pcie->dmaBuffer();
+
+	// resume from wherever a previous run left the card's ring
+	m_ring.resume();
+
+	m_blocks = 0;
+	m_bytes_sent = 0;
+	m_bytes_received = 0;
+}
+
+size_t
+EuclideanStream::packBlock(int buf, float coreLat, float coreLon, const float* lat, const float* lon, size_t n) {
+	size_t padded = (n + ES_BURST_POINTS - 1) / ES_BURST_POINTS * ES_BURST_POINTS;
+	float* block = (float*)(m_dmabuf + ES_BLOCK_OFFSET + buf*ES_BLOCK_BYTES);
+
+	block[0] = coreLat;
+	block[1] = coreLon;
+	((uint32_t*)block)[2] = (uint32_t)n;
+	((uint32_t*)block)[3] = 0;
+
+	float* group = block + 4;
+	for ( size_t i = 0; i < padded; i += 4 ) {
+		for ( size_t l = 0; l < 4; l++ ) {
+			bool real = i + l < n;
+			group[l] = real ? lat[i+l] : coreLat;
+			group[4+l] = real ? lon[i+l] : coreLon;
+		}
+		group += 8;
+	}
+	return padded;
+}
+
+void
+EuclideanStream::sendBlock(int buf, size_t padded) {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	uint32_t words = 1 + padded/2;
+	pcie->userWriteWord(4*4, ES_BLOCK_OFFSET + buf*ES_BLOCK_BYTES);
+	pcie->userWriteWord(5*4, words);
+	m_blocks++;
+	m_bytes_sent += words*16;
+}
+
+void
+EuclideanStream::collect(float* dist, size_t n, size_t padded) {
+	uint32_t bytes = padded*sizeof(float);
+	// copy the real results, then hand the whole padded range back to the card
+	if ( !m_ring.take(dist, n*sizeof(float), bytes) ) exit(1);
+	m_bytes_received += bytes;
+}
+
+void
+EuclideanStream::distances(float coreLat, float coreLon, const float* lat, const float* lon, float* dist, size_t n) {
+	size_t prevStart = 0, prevCount = 0, prevPadded = 0;
+	bool inFlight = false;
+	int buf = 0;
+
+	for ( size_t start = 0; start < n; start += ES_BLOCK_POINTS ) {
+		size_t count = (n - start < ES_BLOCK_POINTS) ? n - start : ES_BLOCK_POINTS;
+		size_t padded = packBlock(buf, coreLat, coreLon, lat + start, lon + start, count);
+		sendBlock(buf, padded);
+
+		if ( inFlight ) collect(dist + prevStart, prevCount, prevPadded);
+		prevStart = start;
+		prevCount = count;
+		prevPadded = padded;
+		inFlight = true;
+		buf ^= 1;
+	}
+	if ( inFlight ) collect(dist + prevStart, prevCount, prevPadded);
+}
@@ -0,0 +1,81 @@
+#ifndef __EUCLIDEAN_STREAM__H__
+#define __EUCLIDEAN_STREAM__H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "DMAResultRing.h"
+
+/****
+Streaming host driver for the Euclidean kernel (HwMain.bsv)
+
+Targets are packed into structure-of-arrays blocks in the DMA buffer and the kernel is
+triggered once per block with two register writes, instead of four writes per pair.
+Results come back through a ring in the DMA buffer in 128 byte bursts.
+
+DMA buffer layout:
+	[0, 256 KB)      result ring, one float per target
+	[256 KB, 512 KB) block buffer 0
+	[512 KB, 768 KB) block buffer 1
+The driver backs only the first 1 MB of the buffer, so everything stays inside it.
+Block layout, in 16 byte words:
+	word 0: core lat, core lon, target count, 0
+	then 4 target lats, 4 target lons, 4 lats, 4 lons, ...
+Blocks are padded with the core point to whole 32 target (128 byte) result bursts.
+
+Two blocks are in flight: while the card works on block k the host collects the results
+of block k-1 and packs block k+1 into the buffer block k-1 used. Results of k-1 having
+arrived means the card has read all of block k-1, so its buffer is free again.
+
+User registers:
+	write 4 : block offset in the DMA buffer, write 5 : block size in words (starts it)
+	write 6 : result ring bytes consumed, read 2 : result ring bytes written
+****/
+
+#define ES_RING_OFFSET 0
+#define ES_RING_BYTES (256*1024)
+#define ES_BLOCK_OFFSET (256*1024)
+#define ES_BLOCK_BYTES (256*1024)
+#define ES_BURST_POINTS 32
+// A block is a 16 byte header and 8 bytes per target, and the ring holds the results of
+// the two blocks in flight at 4 bytes per target
+#define ES_BLOCK_POINTS (1024*16)
+
+#if 16 + ES_BLOCK_POINTS*8 > ES_BLOCK_BYTES
+#error "ES_BLOCK_POINTS targets do not fit a block buffer"
+#endif
+#if 2*ES_BLOCK_POINTS*4 > ES_RING_BYTES
+#error "the results of two blocks do not fit the result ring"
+#endif
+#if ES_BLOCK_OFFSET + 2*ES_BLOCK_BYTES > 1024*1024
+#error "block buffers beyond the 1 MB the driver maps"
+#endif
+
+class EuclideanStream {
+public:
+	EuclideanStream();
+
+	// dist[i] = euclidean((coreLat, coreLon), (lat[i], lon[i])), computed by the card
+	void distances(float coreLat, float coreLon, const float* lat, const float* lon, float* dist, size_t n);
+
+	uint64_t blocks() { return m_blocks; }
+	// DMA bytes host->card (blocks) and card->host (results, padding included)
+	uint64_t bytesSent() { return m_bytes_sent; }
+	uint64_t bytesReceived() { return m_bytes_received; }
+
+private:
+	// Packs up to ES_BLOCK_POINTS targets into block buffer buf. Returns the padded target count
+	size_t packBlock(int buf, float coreLat, float coreLon, const float* lat, const float* lon, size_t n);
+	void sendBlock(int buf, size_t padded);
+	// Waits for the results of the oldest block in flight and copies the first n out
+	void collect(float* dist, size_t n, size_t padded);
+
+	uint8_t* m_dmabuf;
+	DMAResultRing m_ring;
+
+	uint64_t m_blocks;
+	uint64_t m_bytes_sent;
+	uint64_t m_bytes_received;
+};
+
+#endif
@@ -1,9 +1,13 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <time.h>
+#include <math.h>
 
 #include "bdbmpcie.h"
 #include "dmasplitter.h"
+#include "PcieCompletion.h"
+#include "EuclideanStream.h"
+#include "DistanceMetric.h"
 
 
 #define NumCities 44691
@@ -30,6 +34,11 @@ void readfromfile(float* data, char* filename, size_t length) {
 	fclose(f_data);
 }
 
+// FPGA backend of Euclidean in DistanceMetric.h
+void euclideanOffload(Point core, const float* lat, const float* lon, float* out, size_t n, void* arg) {
+	((EuclideanStream*)arg)->distances(core.lat, core.lon, lat, lon, out, n);
+}
+
 // Main
 int main(int argc, char** argv) {
 	BdbmPcie* pcie = BdbmPcie::getInstance();
@@ -58,17 +67,53 @@ int main(int argc, char** argv) {
 		pcie->userWriteWord(12, cities_uint32[17]);
 	}
 
-	sleep(1);
-
-	// Get result
+	// Get result, a read pops one and returns 0xffffffff until it is there
+	PcieCompletion resultDone("result", 0);
+	PcieCompletion cycleDone("cycle", 4);
 	uint32_t result[4];
 	uint32_t cycle[4];
 	for ( int i = 0; i < 4; i ++ ) {
-		result[i] = pcie->userReadWord(0);
-		cycle[i] = pcie->userReadWord(4);
+		if ( !resultDone.waitNotEqual(0xffffffff) || !cycleDone.waitNotEqual(0xffffffff) ) return 1;
+		result[i] = resultDone.value();
+		cycle[i] = cycleDone.value();
 		printf( "Result: %f\n", *(float*)&result[i] );
 		printf( "Cycle: %d\n", cycle[i] );
 	}
 
+	// Stream every city against city 8 through DMA blocks
+	float* lat = (float*)malloc(sizeof(float)*NumCities);
+	float* lon = (float*)malloc(sizeof(float)*NumCities);
+	float* dist = (float*)malloc(sizeof(float)*NumCities);
+	for ( int i = 0; i < NumCities; i ++ ) {
+		lat[i] = cities_float[i*Dimension];
+		lon[i] = cities_float[i*Dimension+1];
+	}
+	EuclideanStream stream;
+	distanceSetOffload<Euclidean>(euclideanOffload, &stream);
+	DistanceDriver<Euclidean> fpga(DISTANCE_FPGA);
+	DistanceDriver<Euclidean> cpu;
+	Point core = {lat[8], lon[8]};
+
+	timespec start, finish;
+	clock_gettime(CLOCK_REALTIME, &start);
+	fpga.oneToMany(core, lat, lon, dist, NumCities);
+	clock_gettime(CLOCK_REALTIME, &finish);
+	double elapsed = timespec_diff_sec(start, finish);
+
+	float* ref = (float*)malloc(sizeof(float)*NumCities);
+	clock_gettime(CLOCK_REALTIME, &start);
+	cpu.oneToMany(core, lat, lon, ref, NumCities);
+	clock_gettime(CLOCK_REALTIME, &finish);
+	double cpuElapsed = timespec_diff_sec(start, finish);
+
+	float maxDiff = 0;
+	for ( int i = 0; i < NumCities; i ++ ) {
+		float diff = fabs(dist[i] - ref[i]);
+		if ( diff > maxDiff ) maxDiff = diff;
+	}
+	printf( "Streamed %d pairs in %lu blocks: %f s, %.2f Mpairs/s\n", NumCities, stream.blocks(), elapsed, NumCities/elapsed/1000000 );
+	printf( "DMA bytes sent %lu received %lu, max difference to CPU: %f\n", stream.bytesSent(), stream.bytesReceived(), maxDiff );
+	printf( "CPU (%s, %d threads): %f s\n", distanceIsaName(cpu.isa()), cpu.threads(), cpuElapsed );
+
 	return 0;	
 }
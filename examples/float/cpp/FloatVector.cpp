@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <immintrin.h>
+
+#include "bdbmpcie.h"
+#include "FloatVector.h"
+
+const char*
+floatVectorOpName(FloatVectorOp op) {
+	switch (op) {
+		case FV_ADD: return "add";
+		case FV_SUB: return "sub";
+		case FV_MUL: return "mul";
+		case FV_DIV: return "div";
+		case FV_SQRT: return "sqrt";
+		case FV_MAX: return "max";
+		default: return "uint2float";
+	}
+}
+
+//--------------------------------------------------------------------------------------------
+// CPU
+//--------------------------------------------------------------------------------------------
+// keeps the top 24 significant bits, so the conversion itself is exact
+static inline float uintToFloatTruncated(uint32_t u) {
+	if ( u < (1 << 24) ) return (float)u;
+	int shift = 8 - __builtin_clz(u);
+	return (float)(u & ~((1u << shift) - 1));
+}
+
+static inline float maxBySign(float a, float b) {
+	return signbit(a - b) ? b : a;
+}
+
+static void floatVectorScalar(FloatVectorOp op, const float* a, const float* b, float* out, size_t from, size_t n) {
+	for ( size_t i = from; i < n; i++ ) {
+		switch (op) {
+			case FV_ADD: out[i] = a[i] + b[i]; break;
+			case FV_SUB: out[i] = a[i] - b[i]; break;
+			case FV_MUL: out[i] = a[i] * b[i]; break;
+			case FV_DIV: out[i] = a[i] / b[i]; break;
+			case FV_SQRT: out[i] = sqrtf(a[i]); break;
+			case FV_MAX: out[i] = maxBySign(a[i], b[i]); break;
+			default: out[i] = uintToFloatTruncated(((const uint32_t*)a)[i]); break;
+		}
+	}
+}
+
+// Returns how many elements it did, the scalar loop does the tail
+__attribute__((target("avx2")))
+static size_t floatVectorAvx2(FloatVectorOp op, const float* a, const float* b, float* out, size_t n) {
+	size_t i = 0;
+	if ( op == FV_UINT_TO_FLOAT ) return 0;
+	for ( ; i + 8 <= n; i += 8 ) {
+		__m256 x = _mm256_loadu_ps(a + i);
+		__m256 y = floatVectorUnary(op) ? x : _mm256_loadu_ps(b + i);
+		__m256 r;
+		switch (op) {
+			case FV_ADD: r = _mm256_add_ps(x, y); break;
+			case FV_SUB: r = _mm256_sub_ps(x, y); break;
+			case FV_MUL: r = _mm256_mul_ps(x, y); break;
+			case FV_DIV: r = _mm256_div_ps(x, y); break;
+			case FV_SQRT: r = _mm256_sqrt_ps(x); break;
+			// blendv takes y where the sign bit of x - y is set
+			default: r = _mm256_blendv_ps(x, y, _mm256_sub_ps(x, y)); break;
+		}
+		_mm256_storeu_ps(out + i, r);
+	}
+	return i;
+}
+
+void
+floatVectorCpu(FloatVectorOp op, const float* a, const float* b, float* out, size_t n) {
+	static bool avx2 = __builtin_cpu_supports("avx2");
+	size_t done = avx2 ? floatVectorAvx2(op, a, b, out, n) : 0;
+	floatVectorScalar(op, a, b, out, done, n);
+}
+
+//--------------------------------------------------------------------------------------------
+// Card
+//--------------------------------------------------------------------------------------------
+FloatVector::FloatVector() : m_ring("float vector result ring", FV_RING_OFFSET, FV_RING_BYTES, 9*4, 6*4) {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	m_dmabuf = (uint8_t*)pcie->dmaBuffer();
+
+	// resume from wherever a previous run left the card's ring
+	m_ring.resume();
+
+	m_blocks = 0;
+	m_bytes_sent = 0;
+	m_bytes_received = 0;
+}
+
+size_t
+FloatVector::packBlock(int buf, FloatVectorOp op, const float* a, const float* b, size_t n) {
+	size_t padded = (n + FV_BURST_ELEMENTS - 1) / FV_BURST_ELEMENTS * FV_BURST_ELEMENTS;
+	uint32_t* block = (uint32_t*)(m_dmabuf + FV_BLOCK_OFFSET + buf*FV_BLOCK_BYTES);
+	const uint32_t* ua = (const uint32_t*)a;
+	const uint32_t* ub = (const uint32_t*)b;
+	// 1.0f pads float ops, 1 pads the conversion, which never sees a 0 it has to walk through
+	uint32_t pad = (op == FV_UINT_TO_FLOAT) ? 1 : 0x3f800000;
+
+	block[0] = op;
+	block[1] = (uint32_t)n;
+	block[2] = 0;
+	block[3] = 0;
+
+	uint32_t* group = block + 4;
+	bool unary = floatVectorUnary(op);
+	for ( size_t i = 0; i < padded; i += 4 ) {
+		if ( i + 4 <= n ) {
+			memcpy(group, ua + i, 16);
+			if ( !unary ) memcpy(group + 4, ub + i, 16);
+		} else {
+			for ( size_t l = 0; l < 4; l++ ) {
+				bool real = i + l < n;
+				group[l] = real ? ua[i+l] : pad;
+				if ( !unary ) group[4+l] = real ? ub[i+l] : pad;
+			}
+		}
+		group += unary ? 4 : 8;
+	}
+	return padded;
+}
+
+void
+FloatVector::sendBlock(int buf, FloatVectorOp op, size_t padded) {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	uint32_t words = 1 + padded/4*(floatVectorUnary(op) ? 1 : 2);
+	pcie->userWriteWord(4*4, FV_BLOCK_OFFSET + buf*FV_BLOCK_BYTES);
+	pcie->userWriteWord(5*4, words);
+	m_blocks++;
+	m_bytes_sent += words*16;
+}
+
+void
+FloatVector::collect(float* out, size_t n, size_t padded) {
+	uint32_t bytes = padded*sizeof(float);
+	// copy the real results, then hand the whole padded range back to the card
+	if ( !m_ring.take(out, n*sizeof(float), bytes) ) exit(1);
+	m_bytes_received += bytes;
+}
+
+void
+FloatVector::compute(FloatVectorOp op, const float* a, const float* b, float* out, size_t n) {
+	size_t prevStart = 0, prevCount = 0, prevPadded = 0;
+	bool inFlight = false;
+	int buf = 0;
+
+	for ( size_t start = 0; start < n; start += FV_BLOCK_ELEMENTS ) {
+		size_t count = (n - start < FV_BLOCK_ELEMENTS) ? n - start : FV_BLOCK_ELEMENTS;
+		size_t padded = packBlock(buf, op, a + start, b ? b + start : NULL, count);
+		sendBlock(buf, op, padded);
+
+		if ( inFlight ) collect(out + prevStart, prevCount, prevPadded);
+		prevStart = start;
+		prevCount = count;
+		prevPadded = padded;
+		inFlight = true;
+		buf ^= 1;
+	}
+	if ( inFlight ) collect(out + prevStart, prevCount, prevPadded);
+}
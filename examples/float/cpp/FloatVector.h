@@ -0,0 +1,105 @@
+#ifndef __FLOAT_VECTOR__H__
+#define __FLOAT_VECTOR__H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "DMAResultRing.h"
+
+/****
+Array host driver for the float example's vector mode (HwMain.bsv)
+
+The register interface computes one pair at a time. Here whole arrays go to a second set of
+pipelined FP units through DMA, one opcode per block, and the results come back through a
+ring in the DMA buffer in 128 byte bursts, as in the euclidean example's EuclideanStream.
+
+DMA buffer layout:
+	[0, 256 KB)      result ring, one 32 bit result per element
+	[256 KB, 512 KB) block buffer 0
+	[512 KB, 768 KB) block buffer 1
+The driver backs only the first 1 MB of the buffer, so everything stays inside it.
+Block layout, in 16 byte words:
+	word 0: opcode, element count, 0, 0
+	then 4 a's and, for binary ops, 4 b's, 4 a's, 4 b's, ...
+Blocks are padded to whole 32 element (128 byte) result bursts. Two blocks are in flight:
+the host packs block k+1 while the card works on block k.
+
+floatVectorCpu is the CPU version of every op, in AVX2 where the CPU has it. It is the
+reference the card is checked against, and the fallback without a card. The card's units
+round like IEEE 754 single precision, except that FV_UINT_TO_FLOAT truncates to 24
+significant bits, as mkUINTtoFLOAT does; floatVectorCpu does the same.
+FV_MAX returns a when a - b has a clear sign bit and b otherwise, as the card does.
+
+User registers:
+	write 4 : block offset in the DMA buffer, write 5 : block size in words (starts it)
+	write 6 : result ring bytes consumed, read 9 : result ring bytes written
+****/
+
+#define FV_RING_OFFSET 0
+#define FV_RING_BYTES (256*1024)
+#define FV_BLOCK_OFFSET (256*1024)
+#define FV_BLOCK_BYTES (256*1024)
+#define FV_BURST_ELEMENTS 32
+// A block is a 16 byte header and up to 8 bytes per element (a and b), and the ring holds
+// the results of the two blocks in flight at 4 bytes per element
+#define FV_BLOCK_ELEMENTS (1024*16)
+
+#if 16 + FV_BLOCK_ELEMENTS*8 > FV_BLOCK_BYTES
+#error "FV_BLOCK_ELEMENTS elements do not fit a block buffer"
+#endif
+#if 2*FV_BLOCK_ELEMENTS*4 > FV_RING_BYTES
+#error "the results of two blocks do not fit the result ring"
+#endif
+#if FV_BLOCK_OFFSET + 2*FV_BLOCK_BYTES > 1024*1024
+#error "block buffers beyond the 1 MB the driver maps"
+#endif
+
+// The card's opcodes
+typedef enum {
+	FV_ADD = 0,
+	FV_SUB = 1,
+	FV_MUL = 2,
+	FV_DIV = 3,
+	FV_SQRT = 4, // sqrt(a), b unused
+	FV_MAX = 5,
+	FV_UINT_TO_FLOAT = 6 // a holds uint32_t, b unused
+} FloatVectorOp;
+
+const char* floatVectorOpName(FloatVectorOp op);
+static inline bool floatVectorUnary(FloatVectorOp op) {
+	return op == FV_SQRT || op == FV_UINT_TO_FLOAT;
+}
+
+void floatVectorCpu(FloatVectorOp op, const float* a, const float* b, float* out, size_t n);
+
+class FloatVector {
+public:
+	FloatVector();
+
+	// out[i] = a[i] op b[i], computed by the card. b may be NULL for unary ops
+	void compute(FloatVectorOp op, const float* a, const float* b, float* out, size_t n);
+	void toFloat(const uint32_t* a, float* out, size_t n) {
+		compute(FV_UINT_TO_FLOAT, (const float*)a, NULL, out, n);
+	}
+
+	uint64_t blocks() { return m_blocks; }
+	// DMA bytes host->card (blocks) and card->host (results, padding included)
+	uint64_t bytesSent() { return m_bytes_sent; }
+	uint64_t bytesReceived() { return m_bytes_received; }
+
+private:
+	// Packs up to FV_BLOCK_ELEMENTS elements into block buffer buf. Returns the padded count
+	size_t packBlock(int buf, FloatVectorOp op, const float* a, const float* b, size_t n);
+	void sendBlock(int buf, FloatVectorOp op, size_t padded);
+	// Waits for the results of the oldest block in flight and copies the first n out
+	void collect(float* out, size_t n, size_t padded);
+
+	uint8_t* m_dmabuf;
+	DMAResultRing m_ring;
+
+	uint64_t m_blocks;
+	uint64_t m_bytes_sent;
+	uint64_t m_bytes_received;
+};
+
+#endif
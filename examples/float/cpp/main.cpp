@@ -1,9 +1,14 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <math.h>
 
 #include "bdbmpcie.h"
 #include "dmasplitter.h"
+#include "PcieCompletion.h"
+#include "FloatVector.h"
 
 
 double timespec_diff_sec( timespec start, timespec end ) {
@@ -25,10 +30,16 @@ int main(int argc, char** argv) {
 	uint32_t xv = *(uint32_t*)&x;
 	uint32_t yv = *(uint32_t*)&y;
 
+	// user register 7 counts finished operations, 8 finished conversions
+	PcieCompletion opDone("fp operation", 7*4);
+	PcieCompletion convDone("type conversion", 8*4);
+	uint32_t opBase = pcie->userReadWord(7*4);
+	uint32_t convBase = pcie->userReadWord(8*4);
+
 	pcie->userWriteWord(0, xv);
 	pcie->userWriteWord(4, yv);
 
-	sleep(1);
+	if ( !opDone.waitCount(opBase, 1) ) return 1;
 	
 	printf( "Floating-Point Operation Result\n" );
 	printf( "x:10.00, y:5.00\n" );
@@ -50,12 +61,64 @@ int main(int argc, char** argv) {
 
 	pcie->userWriteWord(8, u);
 
-	sleep(1);
+	if ( !convDone.waitCount(convBase, 1) ) return 1;
 
 	printf( "Type Conversion Result (Unsigned 32-bit Integer to Float)\n" );
 	printf( "Unsigned 32-bit Integer: %d\n", u );
 	uint32_t f = pcie->userReadWord(24);
 	printf( "Float:                   %f\n", *(float*)&f );
 
+	// 3rd: whole arrays through DMA, checked against the CPU
+	size_t n = (argc > 1) ? strtoul(argv[1], NULL, 10) : 4*1024*1024;
+	float* va = (float*)malloc(sizeof(float)*n);
+	float* vb = (float*)malloc(sizeof(float)*n);
+	float* card = (float*)malloc(sizeof(float)*n);
+	float* cpu = (float*)malloc(sizeof(float)*n);
+	srand(1);
+	for ( size_t i = 0; i < n; i ++ ) {
+		va[i] = (float)rand()/RAND_MAX*2000 - 1000;
+		vb[i] = (float)rand()/RAND_MAX*2000 - 1000;
+	}
+	uint32_t* vu = (uint32_t*)malloc(sizeof(uint32_t)*n);
+	for ( size_t i = 0; i < n; i ++ ) vu[i] = ((uint32_t)rand() << 16) ^ rand();
+	float* va_abs = (float*)malloc(sizeof(float)*n);
+	for ( size_t i = 0; i < n; i ++ ) va_abs[i] = fabsf(va[i]);
+
+	FloatVector vec;
+	printf( "Vector Operation Result (%lu elements)\n", n );
+	for ( int o = FV_ADD; o <= FV_UINT_TO_FLOAT; o ++ ) {
+		FloatVectorOp op = (FloatVectorOp)o;
+		const float* a = (op == FV_SQRT) ? va_abs : (op == FV_UINT_TO_FLOAT) ? (const float*)vu : va;
+		const float* b = floatVectorUnary(op) ? NULL : vb;
+
+		timespec start, finish;
+		clock_gettime(CLOCK_REALTIME, &start);
+		vec.compute(op, a, b, card, n);
+		clock_gettime(CLOCK_REALTIME, &finish);
+		double cardElapsed = timespec_diff_sec(start, finish);
+
+		clock_gettime(CLOCK_REALTIME, &start);
+		floatVectorCpu(op, a, b, cpu, n);
+		clock_gettime(CLOCK_REALTIME, &finish);
+		double cpuElapsed = timespec_diff_sec(start, finish);
+
+		// results within one ulp of the CPU, the card flushes denormals
+		size_t differ = 0;
+		for ( size_t i = 0; i < n; i ++ ) {
+			int32_t x = *(int32_t*)&card[i];
+			int32_t y = *(int32_t*)&cpu[i];
+			if ( x != y && (x - y > 1 || y - x > 1) ) differ ++;
+		}
+		printf( "%-10s card %f s (%.2f M/s), cpu %f s (%.2f M/s), %lu differ\n", floatVectorOpName(op),
+			cardElapsed, n/cardElapsed/1000000, cpuElapsed, n/cpuElapsed/1000000, differ );
+	}
+	printf( "DMA bytes sent %lu received %lu in %lu blocks\n", vec.bytesSent(), vec.bytesReceived(), vec.blocks() );
+
+	free(va);
+	free(vb);
+	free(va_abs);
+	free(vu);
+	free(card);
+	free(cpu);
 	return 0;
 }
@@ -0,0 +1,130 @@
+#include <math.h>
+
+#include <algorithm>
+
+#include "EpsilonBox.h"
+#include "HaversineBatch.h"
+#include "HaversineNeighbors.h"
+
+#define HN_MAX_BANDS (1<<20)
+
+HaversineNeighbors::HaversineNeighbors() {
+	m_epsilon = 0;
+	m_band_height = 180;
+	m_bands = 1;
+	m_exact = 0;
+	m_queries = 0;
+}
+
+int
+HaversineNeighbors::bandOf(float lat) {
+	int b = (int)floor((lat + 90.0f)/m_band_height);
+	if ( b < 0 ) b = 0;
+	if ( b >= m_bands ) b = m_bands-1;
+	return b;
+}
+
+void
+HaversineNeighbors::build(const float* lat, const float* lon, size_t n, float epsilon) {
+	m_epsilon = epsilon;
+	m_band_height = (float)(epsilon/EPSILON_BOX_EARTH_RADIUS*EPSILON_BOX_TO_DEGREE);
+	if ( m_band_height*HN_MAX_BANDS < 180 ) m_band_height = 180.0f/HN_MAX_BANDS;
+	if ( m_band_height > 180 ) m_band_height = 180;
+	m_bands = (int)ceil(180.0f/m_band_height);
+	if ( m_bands < 1 ) m_bands = 1;
+
+	std::vector<uint32_t> keys(n);
+	std::vector<int> band(n);
+	for ( size_t i = 0; i < n; i++ ) {
+		keys[i] = (uint32_t)i;
+		band[i] = bandOf(lat[i]);
+	}
+	std::sort(keys.begin(), keys.end(), [&](uint32_t a, uint32_t b) {
+		if ( band[a] != band[b] ) return band[a] < band[b];
+		return lon[a] < lon[b];
+	});
+
+	m_lat.resize(n);
+	m_lon.resize(n);
+	m_index.resize(n);
+	m_band_start.assign(m_bands+1, 0);
+	for ( size_t i = 0; i < n; i++ ) {
+		size_t src = keys[i];
+		m_lat[i] = lat[src];
+		m_lon[i] = lon[src];
+		m_index[i] = (uint32_t)src;
+		m_band_start[band[src]+1]++;
+	}
+	for ( int b = 0; b < m_bands; b++ ) m_band_start[b+1] += m_band_start[b];
+
+	resetStats();
+}
+
+void
+HaversineNeighbors::scanBand(int band, float lonLo, float lonHi, float lat, float lon, std::vector<uint32_t>& out) {
+	const float* begin = &m_lon[0] + m_band_start[band];
+	const float* end = &m_lon[0] + m_band_start[band+1];
+	size_t first = std::lower_bound(begin, end, lonLo) - &m_lon[0];
+	size_t last = std::upper_bound(begin, end, lonHi) - &m_lon[0];
+	if ( first >= last ) return;
+
+	size_t n = last - first;
+	if ( m_dist.size() < n ) m_dist.resize(n);
+	haversineBatch(lat, lon, &m_lat[first], &m_lon[first], &m_dist[0], n);
+	m_exact += n;
+	for ( size_t i = 0; i < n; i++ ) {
+		if ( m_dist[i] <= m_epsilon ) out.push_back(m_index[first+i]);
+	}
+}
+
+size_t
+HaversineNeighbors::query(float lat, float lon, std::vector<uint32_t>& out) {
+	size_t before = out.size();
+	m_queries++;
+	if ( m_lat.empty() ) return 0;
+
+	float dlat, dlon;
+	haversineBoxSize(lat, m_epsilon, &dlat, &dlon);
+	float lo[2], hi[2];
+	int ranges = haversineBoxLonRanges(lon, dlon, lo, hi);
+
+	int bandLo = bandOf(lat - dlat);
+	int bandHi = bandOf(lat + dlat);
+	for ( int b = bandLo; b <= bandHi; b++ ) {
+		for ( int r = 0; r < ranges; r++ ) scanBand(b, lo[r], hi[r], lat, lon, out);
+	}
+	return out.size() - before;
+}
+
+void
+HaversineNeighbors::queryBatch(const float* lat, const float* lon, size_t count,
+	std::vector<uint32_t>& offsets, std::vector<uint32_t>& neighbors) {
+
+	std::vector<uint32_t> order(count);
+	std::vector<int> band(count);
+	for ( size_t i = 0; i < count; i++ ) {
+		order[i] = (uint32_t)i;
+		band[i] = bandOf(lat[i]);
+	}
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		if ( band[a] != band[b] ) return band[a] < band[b];
+		return lon[a] < lon[b];
+	});
+
+	// run in band order, then lay the results out in query order
+	std::vector<uint32_t> scratch;
+	std::vector<size_t> start(count), found(count);
+	for ( size_t i = 0; i < count; i++ ) {
+		uint32_t q = order[i];
+		start[q] = scratch.size();
+		found[q] = query(lat[q], lon[q], scratch);
+	}
+
+	offsets.resize(count+1);
+	offsets[0] = 0;
+	for ( size_t q = 0; q < count; q++ ) offsets[q+1] = offsets[q] + (uint32_t)found[q];
+	neighbors.resize(offsets[count]);
+	for ( size_t q = 0; q < count; q++ ) {
+		std::copy(scratch.begin() + start[q], scratch.begin() + start[q] + found[q], neighbors.begin() + offsets[q]);
+	}
+}
@@ -0,0 +1,65 @@
+#ifndef __HAVERSINE_NEIGHBORS__H__
+#define __HAVERSINE_NEIGHBORS__H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+/****
+Epsilon neighbor search on the sphere, for the DBSCAN-style region queries of this example
+
+Points are bucketed into latitude bands one epsilon high and sorted by longitude inside each band,
+stored as structure-of-arrays. A query only visits the bands its inverse-haversine box overlaps
+and binary searches the box's longitude range in each, so every candidate run is contiguous and
+goes straight to haversineBatch() without a gather. Only candidates get the exact haversine.
+
+The box is the inverse haversine box of common/EpsilonBox.h, the same one Dbscan's
+HaversineMetric uses, split in two when it crosses the antimeridian.
+****/
+
+class HaversineNeighbors {
+public:
+	HaversineNeighbors();
+
+	// Copies the points. epsilon in km
+	void build(const float* lat, const float* lon, size_t n, float epsilon);
+
+	// Indices (into the arrays given to build) of all points within epsilon of the query,
+	// appended to out. Returns the number appended
+	size_t query(float lat, float lon, std::vector<uint32_t>& out);
+
+	// Many queries at once, processed in band order for locality.
+	// Neighbors of query i are neighbors[offsets[i] .. offsets[i+1])
+	void queryBatch(const float* lat, const float* lon, size_t count,
+		std::vector<uint32_t>& offsets, std::vector<uint32_t>& neighbors);
+
+	size_t size() { return m_lat.size(); }
+	float epsilon() { return m_epsilon; }
+
+	// Exact haversine evaluations and queries since build or resetStats
+	uint64_t exactEvaluations() { return m_exact; }
+	uint64_t queries() { return m_queries; }
+	void resetStats() { m_exact = 0; m_queries = 0; }
+
+private:
+	int bandOf(float lat);
+	void scanBand(int band, float lonLo, float lonHi, float lat, float lon, std::vector<uint32_t>& out);
+
+	float m_epsilon;
+	float m_band_height; // degrees
+	int m_bands;
+
+	// sorted by (band, lon)
+	std::vector<float> m_lat;
+	std::vector<float> m_lon;
+	std::vector<uint32_t> m_index;
+	std::vector<uint32_t> m_band_start; // m_bands+1 entries
+
+	std::vector<float> m_dist;
+
+	uint64_t m_exact;
+	uint64_t m_queries;
+};
+
+#endif
@@ -3,46 +3,25 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <vector>
 
+#include "Benchmark.h"
+#include "Dbscan.h"
+#include "HaversineBatch.h"
+#include "HaversineNeighbors.h"
+
 
 #define EARTH_RADIUS 6371
 #define TO_RADIAN (3.1415926536 / 180)
 #define TO_DEGREE (180 / 3.1415926536)
 #define EPSILON 5
+#define MIN_POINTS 4
+#define BATCH_BLOCK (64*1024)
+#define REGION_QUERIES (1024*1024)
+#define DBSCAN_POINTS 700968
 
 
-typedef struct Point {
-	float lat;
-	float lon;
-}Point;
-
-
-// Elapsed time checker
-static inline double timeCheckerCPU(void) {
-        struct rusage ru;
-        getrusage(RUSAGE_SELF, &ru);
-        return (double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec / 1000000;
-}
-
-// Function for reading benchmark file
-void readBenchmarkData(std::vector<Point> &cities, char* filename, int length) {
-	FILE* f_data = fopen(filename, "rb");
-	if (f_data == NULL ) {
-		printf("File not found: %s\n", filename);
-		exit(1);
-	}
-
-	for ( int i = 0; i < length; i ++ ) {
-		int numPoints = cities.size();
-		cities.resize(numPoints+1);
-		fread(&cities[i].lat, sizeof(float), 1, f_data);
-		fread(&cities[i].lon, sizeof(float), 1, f_data);
-	}
-
-	fclose(f_data);
-}
-
 // Haversine
 float haversine(const Point pointCore, const Point pointTarget) {
 	// Distance between latitudes and longitudes
@@ -58,6 +37,13 @@ float haversine(const Point pointCore, const Point pointTarget) {
 	return asin(sqrt(f)) * 2 * EARTH_RADIUS;
 }
 
+// DBSCAN metric: the exact haversine of the region queries goes through the SIMD batch kernel
+struct HaversineBatchMetric : public HaversineMetric {
+	void distances(Point core, const float* lat, const float* lon, float* out, size_t n) const {
+		haversineBatch(core.lat, core.lon, lat, lon, out, n);
+	}
+};
+
 // Inverse haversine for latitude
 float inverseHaversineLat(const Point pointCore) {
 	float dlat_1km = 0.008992;
@@ -77,11 +63,16 @@ int main(int argc, char **argv)
 {
 	int numCities = 700968*160;
 
-	std::vector<Point> cities(1);
-
-	// Read point data
+	// Map point data, zero-copy, and build the structure-of-arrays copy the batch kernels read
 	char benchmark_filename[] = "../worldcities_augmented.bin";
-	readBenchmarkData(cities, benchmark_filename, numCities);
+	double loadStart = timeCheckerWall();
+	PointFile cities;
+	if ( !cities.open(benchmark_filename, numCities) ) return 1;
+	cities.prefault();
+	if ( !cities.toSoA() ) return 1;
+	const float* lat = cities.lat();
+	const float* lon = cities.lon();
+	printf( "Elapsed Time (wall, load): %.8f (%s pages)\n", timeCheckerWall() - loadStart, cities.hugepages() ? "huge" : "normal" );
 
 	// Inverse Haversine
 	Point newPoint;
@@ -106,6 +97,72 @@ int main(int argc, char **argv)
 	double processFinish = timeCheckerCPU();
 	double processTime = processFinish - processStart;
 	printf( "Elapsed Time (CPU): %.8f\n", processTime );
-	
+
+	// Same workload with the SIMD batch kernel on structure-of-arrays blocks
+	std::vector<float> dist(BATCH_BLOCK);
+	float maxDiff = 0;
+	haversineBatch(cities[0].lat, cities[0].lon, lat, lon, &dist[0], 1024);
+	for ( int i = 0; i < 1024; i ++ ) {
+		float diff = fabs(dist[i] - haversine(cities[0], cities[i]));
+		if ( diff > maxDiff ) maxDiff = diff;
+	}
+	printf( "Batch kernel (%s) max difference to haversine(): %f km\n", haversineBatchIsaName(haversineBatchBestIsa()), maxDiff );
+
+	uint64_t neighbors = 0;
+	double batchStart = timeCheckerCPU();
+	for ( int i = 0; i < 414; i ++ ) {
+		int total = (i < 413) ? numCities : 42931018;
+		for ( int j = 0; j < total; j += BATCH_BLOCK ) {
+			int n = (total - j < BATCH_BLOCK) ? total - j : BATCH_BLOCK;
+			haversineBatch(cities[0].lat, cities[0].lon, &lat[j], &lon[j], &dist[0], n);
+			for ( int k = 0; k < n; k ++ ) {
+				if ( dist[k] <= EPSILON ) neighbors ++;
+			}
+		}
+	}
+	double batchFinish = timeCheckerCPU();
+	printf( "Neighbors within %d km: %lu\n", EPSILON, neighbors );
+	printf( "Elapsed Time (CPU, batch): %.8f\n", batchFinish - batchStart );
+
+	// DBSCAN region queries, pruned with the inverse haversine box
+	printf( "Inverse haversine box at core: dlat %f dlon %f\n", dlat, dlon );
+	double pruneStart = timeCheckerCPU();
+	HaversineNeighbors regions;
+	regions.build(lat, lon, numCities, EPSILON);
+	double buildFinish = timeCheckerCPU();
+	int numQueries = (numCities < REGION_QUERIES) ? numCities : REGION_QUERIES;
+	uint64_t regionNeighbors = 0;
+	std::vector<uint32_t> offsets, neighborIdx;
+	for ( int i = 0; i < numQueries; i += BATCH_BLOCK ) {
+		int n = (numQueries - i < BATCH_BLOCK) ? numQueries - i : BATCH_BLOCK;
+		regions.queryBatch(&lat[i], &lon[i], n, offsets, neighborIdx);
+		regionNeighbors += neighborIdx.size();
+	}
+	double pruneFinish = timeCheckerCPU();
+	printf( "Region queries: %d, neighbors: %lu, exact evaluations: %lu (%.1fx fewer than all pairs)\n",
+		numQueries, regionNeighbors, regions.exactEvaluations(),
+		(double)numQueries*numCities/(regions.exactEvaluations() ? regions.exactEvaluations() : 1) );
+	printf( "Elapsed Time (CPU, pruned): build %.8f query %.8f\n", buildFinish - pruneStart, pruneFinish - buildFinish );
+
+	// Quadtree-based DBSCAN, the clustering the loops above stand in for, over the unaugmented city count
+	int numDbscan = (numCities < DBSCAN_POINTS) ? numCities : DBSCAN_POINTS;
+	double dbscanStart = timeCheckerWall();
+	QuadTreeIndex index;
+	index.build(cities.points(), numDbscan);
+	Dbscan<HaversineBatchMetric> dbscan(index, HaversineBatchMetric(), EPSILON, MIN_POINTS);
+	dbscan.run();
+	double dbscanFinish = timeCheckerWall();
+	printf( "DBSCAN (eps %d km, minPts %d): %d clusters, %lu core points, %lu noise points\n",
+		EPSILON, MIN_POINTS, dbscan.clusters(), dbscan.corePoints(), dbscan.noisePoints() );
+	printf( "Exact evaluations: %lu (%.1fx fewer than all pairs)\n", dbscan.exactEvaluations(),
+		(double)numDbscan*numDbscan*2/(dbscan.exactEvaluations() ? dbscan.exactEvaluations() : 1) );
+	std::vector<PointPair> fpgaBatch;
+	dbscan.candidatePairs(0, fpgaBatch);
+	printf( "FPGA candidate batch of city 0: %lu pairs, %lu bytes\n", fpgaBatch.size(), fpgaBatch.size()*sizeof(PointPair) );
+	printf( "Elapsed Time (wall, DBSCAN): %.8f\n", dbscanFinish - dbscanStart );
+
+	// The same one-to-many workload through every DistanceMetric.h backend
+	distanceBenchmark<Haversine>(cities.points(), numDbscan, 16);
+
 	return 0;
 }
@@ -4,6 +4,7 @@
 
 #include "bdbmpcie.h"
 #include "dmasplitter.h"
+#include "PcieCompletion.h"
 
 
 #define NumCities 44691
@@ -58,14 +59,15 @@ int main(int argc, char** argv) {
 		pcie->userWriteWord(12, cities_uint32[17]);
 	}
 
-	sleep(1);
-
-	// Get result
+	// Get result, a read pops one and returns 0xffffffff until it is there
+	PcieCompletion resultDone("result", 0);
+	PcieCompletion cycleDone("cycle", 4);
 	uint32_t result[4];
 	uint32_t cycle[4];
 	for ( int i = 0; i < 4; i ++ ) {
-		result[i] = pcie->userReadWord(0);
-		cycle[i] = pcie->userReadWord(4);
+		if ( !resultDone.waitNotEqual(0xffffffff) || !cycleDone.waitNotEqual(0xffffffff) ) return 1;
+		result[i] = resultDone.value();
+		cycle[i] = cycleDone.value();
 		printf( "Result: %f\n", *(float*)&result[i] );
 		printf( "Cycle: %d\n", cycle[i] );
 	}
@@ -3,42 +3,16 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <vector>
 
+#include "Benchmark.h"
+#include "Dbscan.h"
 
-#define EPSILON 1
-
-
-typedef struct Point {
-	float lat;
-	float lon;
-}Point;
-
-
-// Elapsed time checker
-static inline double timeCheckerCPU(void) {
-        struct rusage ru;
-        getrusage(RUSAGE_SELF, &ru);
-        return (double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec / 1000000;
-}
 
-// Function for reading benchmark file
-void readBenchmarkData(std::vector<Point> &cities, char* filename, int length) {
-	FILE* f_data = fopen(filename, "rb");
-	if (f_data == NULL ) {
-		printf("File not found: %s\n", filename);
-		exit(1);
-	}
-
-	for ( int i = 0; i < length; i ++ ) {
-		int numPoints = cities.size();
-		cities.resize(numPoints+1);
-		fread(&cities[i].lat, sizeof(float), 1, f_data);
-		fread(&cities[i].lon, sizeof(float), 1, f_data);
-	}
+#define EPSILON 1
+#define MIN_POINTS 4
 
-	fclose(f_data);
-}
 
 // Manhattan
 float manhattan(const Point pointCore, const Point pointTarget) {
@@ -86,5 +60,24 @@ int main(int argc, char **argv)
 	double processTime = processFinish - processStart;
 	printf( "Elapsed Time (CPU): %.8f\n", processTime );
 */
+	// Quadtree-based DBSCAN over all cities, the clustering the loops above stand in for
+	double dbscanStart = timeCheckerWall();
+	QuadTreeIndex index;
+	index.build(&cities[0], numCities);
+	Dbscan<ManhattanMetric> dbscan(index, ManhattanMetric(), EPSILON, MIN_POINTS);
+	dbscan.run();
+	double dbscanFinish = timeCheckerWall();
+	printf( "DBSCAN (eps %f, minPts %d): %d clusters, %lu core points, %lu noise points\n",
+		(double)EPSILON, MIN_POINTS, dbscan.clusters(), dbscan.corePoints(), dbscan.noisePoints() );
+	printf( "Exact evaluations: %lu (%.1fx fewer than all pairs)\n", dbscan.exactEvaluations(),
+		(double)numCities*numCities*2/(dbscan.exactEvaluations() ? dbscan.exactEvaluations() : 1) );
+	std::vector<PointPair> fpgaBatch;
+	dbscan.candidatePairs(0, fpgaBatch);
+	printf( "FPGA candidate batch of city 0: %lu pairs, %lu bytes\n", fpgaBatch.size(), fpgaBatch.size()*sizeof(PointPair) );
+	printf( "Elapsed Time (wall, DBSCAN): %.8f\n", dbscanFinish - dbscanStart );
+
+	// The same one-to-many workload through every DistanceMetric.h backend
+	distanceBenchmark<Manhattan>(&cities[0], numCities, 16);
+
 	return 0;
 }
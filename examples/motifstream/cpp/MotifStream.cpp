@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <thread>
+
+#include "bdbmpcie.h"
+#include "DRAMHostDMA.h"
+#include "Benchmark.h"
+#include "DnaCodec.h"
+#include "MotifStream.h"
+
+#define MS_BATCH_WINDOWS (MS_BATCH_RECORDS*MS_SEQ_PER_RECORD)
+#define MS_MOTIF_BITS ((1 << MS_MOTIF_LENGTH) - 1)
+
+MotifStream::MotifStream() : m_free(MS_BATCHES), m_full(MS_BATCHES), m_batch_done("motif batches", 1*4) {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	DRAMHostDMA::GetInstance();
+
+	for ( int i = 0; i < MS_BATCHES; i++ ) {
+		m_batches[i].records.resize(MS_BATCH_RECORDS*DNA_RECORD_BYTES);
+		m_batches[i].windows.resize(MS_BATCH_WINDOWS);
+		m_batches[i].nBits.resize(MS_BATCH_WINDOWS);
+		m_batches[i].lowerBits.resize(MS_BATCH_WINDOWS);
+		m_batches[i].count = 0;
+		m_batches[i].region = 0;
+		m_free.push(&m_batches[i]);
+	}
+	m_stage.resize(MS_STAGE_WINDOWS*MS_SEQ_LENGTH);
+	m_n_mask.resize(dnaMaskWords(MS_STAGE_WINDOWS*MS_SEQ_LENGTH));
+	m_lower_mask.resize(dnaMaskWords(MS_STAGE_WINDOWS*MS_SEQ_LENGTH));
+	// CopyFromFPGA fills whole 512 KB halves of its DMA buffer
+	m_motif_words.resize(MS_MOTIF_REGION_BYTES);
+	m_motifs.resize(MS_BATCH_WINDOWS*MS_MOTIF_LENGTH);
+
+	m_batches_done = pcie->userReadWord(1*4);
+	m_batch_count = 0;
+	m_window_count = 0;
+	m_bytes_sent = 0;
+	m_bytes_received = 0;
+	m_encode_time = 0;
+	m_load_time = 0;
+	m_finish_time = 0;
+}
+
+// Packs the staged windows into b, and keeps the mask bits of their motif bases
+void
+MotifStream::flushStage(Batch* b, size_t staged) {
+	size_t words = dnaMaskWords(staged*MS_SEQ_LENGTH);
+	memset(&m_n_mask[0], 0, words*sizeof(uint64_t));
+	memset(&m_lower_mask[0], 0, words*sizeof(uint64_t));
+	// b->count is a multiple of MS_SEQ_PER_RECORD, stages only end early with the batch
+	uint8_t* out = &b->records[b->count/MS_SEQ_PER_RECORD*DNA_RECORD_BYTES];
+	dnaPackRecords(&m_stage[0], staged, MS_SEQ_LENGTH, MS_SEQ_PER_RECORD, out, &m_n_mask[0], &m_lower_mask[0]);
+	for ( size_t w = 0; w < staged; w++ ) {
+		b->nBits[b->count + w] = dnaMaskBits32(&m_n_mask[0], w*MS_SEQ_LENGTH) & MS_MOTIF_BITS;
+		b->lowerBits[b->count + w] = dnaMaskBits32(&m_lower_mask[0], w*MS_SEQ_LENGTH) & MS_MOTIF_BITS;
+	}
+	b->count += staged;
+}
+
+void
+MotifStream::closeWindow(Batch*& b, size_t& staged, uint32_t sequence, uint64_t position) {
+	MotifWindow& w = b->windows[b->count + staged];
+	w.sequence = sequence;
+	w.position = position;
+	staged++;
+
+	if ( staged == MS_STAGE_WINDOWS || b->count + staged == MS_BATCH_WINDOWS ) {
+		flushStage(b, staged);
+		staged = 0;
+	}
+	if ( b->count == MS_BATCH_WINDOWS ) {
+		m_full.push(b);
+		b = NULL;
+	}
+}
+
+void
+MotifStream::encodeStage(SequenceReader* reader) {
+	std::vector<char> run(MS_STAGE_WINDOWS*MS_SEQ_LENGTH);
+	Batch* b = NULL;
+	size_t staged = 0;
+	size_t fill = 0;
+	uint32_t sequence = 0;
+	uint64_t position = 0;
+	uint64_t windowStart = 0;
+
+	while ( true ) {
+		uint32_t s = sequence;
+		size_t n = reader->read(&run[0], run.size(), s);
+		double begin = timeCheckerWall();
+
+		// a sequence ended inside a window, pad it
+		if ( fill > 0 && (n == 0 || s != sequence) ) {
+			memset(&m_stage[staged*MS_SEQ_LENGTH + fill], 'N', MS_SEQ_LENGTH - fill);
+			fill = 0;
+			closeWindow(b, staged, sequence, windowStart);
+		}
+		if ( n == 0 ) break;
+		if ( s != sequence ) {
+			sequence = s;
+			position = 0;
+		}
+
+		for ( size_t i = 0; i < n; ) {
+			if ( b == NULL ) {
+				m_encode_time += timeCheckerWall() - begin;
+				m_free.pop(b);
+				begin = timeCheckerWall();
+				b->count = 0;
+			}
+			if ( fill == 0 ) windowStart = position;
+			size_t take = (MS_SEQ_LENGTH - fill < n - i) ? MS_SEQ_LENGTH - fill : n - i;
+			memcpy(&m_stage[staged*MS_SEQ_LENGTH + fill], &run[i], take);
+			fill += take;
+			i += take;
+			position += take;
+			if ( fill == MS_SEQ_LENGTH ) {
+				fill = 0;
+				closeWindow(b, staged, sequence, windowStart);
+			}
+		}
+		m_encode_time += timeCheckerWall() - begin;
+	}
+
+	if ( b != NULL ) {
+		if ( staged > 0 ) flushStage(b, staged);
+		if ( b->count > 0 ) m_full.push(b);
+		else m_free.push(b);
+	}
+	m_full.push(NULL);
+}
+
+void
+MotifStream::load(Batch* b) {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	DRAMHostDMA* dma = DRAMHostDMA::GetInstance();
+	double begin = timeCheckerWall();
+
+	size_t records = dnaRecordCount(b->count, MS_SEQ_PER_RECORD);
+	size_t recordOffset = MS_RECORD_OFFSET + (size_t)b->region*MS_BATCH_RECORDS*DNA_RECORD_BYTES;
+	size_t motifOffset = MS_MOTIF_OFFSET + (size_t)b->region*MS_MOTIF_REGION_BYTES;
+	dma->CopyToFPGA(recordOffset, &b->records[0], records*DNA_RECORD_BYTES);
+	m_bytes_sent += records*DNA_RECORD_BYTES;
+
+	pcie->userWriteWord(2*4, recordOffset/MS_PAGE_BYTES);
+	pcie->userWriteWord(3*4, motifOffset/MS_PAGE_BYTES);
+	pcie->userWriteWord(0*4, records);
+	m_load_time += timeCheckerWall() - begin;
+}
+
+void
+MotifStream::finish(Batch* b, MotifSink& sink) {
+	DRAMHostDMA* dma = DRAMHostDMA::GetInstance();
+
+	// batches finish in order, the count moving past ours means it is done
+	if ( !m_batch_done.waitCount(m_batches_done, 1) ) exit(1);
+	m_batches_done++;
+
+	double begin = timeCheckerWall();
+	size_t words = (b->count + MS_MOTIFS_PER_WORD - 1)/MS_MOTIFS_PER_WORD;
+	size_t motifOffset = MS_MOTIF_OFFSET + (size_t)b->region*MS_MOTIF_REGION_BYTES;
+	dma->CopyFromFPGA(motifOffset, &m_motif_words[0], words*DNA_RECORD_BYTES);
+	m_bytes_received += words*DNA_RECORD_BYTES;
+
+	// a slot is the motif's 2-bit codes, first base lowest
+	for ( size_t w = 0; w < b->count; w++ ) {
+		uint64_t nBits = b->nBits[w];
+		uint64_t lowerBits = b->lowerBits[w];
+		dnaDecode(&m_motif_words[w*4], MS_MOTIF_LENGTH, &m_motifs[w*MS_MOTIF_LENGTH], &nBits, &lowerBits);
+	}
+	m_finish_time += timeCheckerWall() - begin;
+
+	sink.motifs(&b->windows[0], &m_motifs[0], b->count);
+	m_batch_count++;
+	m_window_count += b->count;
+	m_free.push(b);
+}
+
+void
+MotifStream::extract(SequenceReader& reader, MotifSink& sink) {
+	m_encode_time = 0;
+	m_load_time = 0;
+	m_finish_time = 0;
+	std::thread encoder(&MotifStream::encodeStage, this, &reader);
+
+	// batch k+1 is loaded and queued on the card before batch k is collected
+	Batch* running = NULL;
+	Batch* b;
+	int region = 0;
+	while ( m_full.pop(b) && b != NULL ) {
+		b->region = region;
+		load(b);
+		if ( running ) finish(running, sink);
+		running = b;
+		region ^= 1;
+	}
+	if ( running ) finish(running, sink);
+	encoder.join();
+}
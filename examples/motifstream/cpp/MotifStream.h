@@ -0,0 +1,126 @@
+#ifndef __MOTIF_STREAM__H__
+#define __MOTIF_STREAM__H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "BoundedQueue.h"
+#include "PcieCompletion.h"
+#include "SequenceReader.h"
+
+/****
+Genome-scale host driver for the motifstream design (HwMain.bsv)
+
+Every sequence of a FASTA or 2bit file is cut into windows of MS_SEQ_LENGTH bases (the last one
+of a sequence padded with N), and the card returns the first MS_MOTIF_LENGTH bases of each, as
+the bram and dram examples do for the 26 windows of their dataset.
+
+Windows are 2-bit packed by DnaCodec.h, MS_SEQ_PER_RECORD to a 512 bit record, into batches of
+up to MS_BATCH_RECORDS records. Batches go to card DRAM through DRAMHostDMA in 512 KB DMA
+transfers, and the motifs come back the same way, so input of any size streams through a few
+batches of host memory and two DRAM regions:
+	encode : SequenceReader -> windows -> records, in its own thread, one batch ahead
+	load   : CopyToFPGA of batch k+1 into one record region while the card works on batch k
+	finish : waits for batch k's done count, CopyFromFPGA of its motifs, restores N and
+	         lowercase from the side masks, hands them to the MotifSink
+The card reports progress as a count of finished batches, so the host waits on that instead
+of a fixed delay.
+
+Card DRAM layout:
+	[0, 2 x batch records)       record regions 0 and 1
+	[512 MB, 512 MB + 2 x 4 MB)  motif regions 0 and 1, a 32 bit slot per window
+
+User registers:
+	write 2 : record region page, write 3 : motif region page, write 0 : records (starts a batch)
+	read 1  : batches finished
+	256-259 : DRAMHostDMA
+****/
+
+#define MS_SEQ_LENGTH 111
+#define MS_SEQ_PER_RECORD 2
+#define MS_MOTIF_LENGTH 11
+#define MS_MOTIFS_PER_WORD 16
+#define MS_PAGE_BYTES 4096
+
+// 16 MB of records, 512K windows or 57M bases, per batch
+#define MS_BATCH_RECORDS (256*1024)
+#define MS_BATCHES 3
+#define MS_RECORD_OFFSET 0
+#define MS_MOTIF_OFFSET (512*1024*1024)
+#define MS_MOTIF_REGION_BYTES (4*1024*1024)
+// Windows encoded at once, the side masks only cover these
+#define MS_STAGE_WINDOWS 8192
+
+typedef struct {
+	uint32_t sequence;
+	uint64_t position;
+} MotifWindow;
+
+class MotifSink {
+public:
+	virtual ~MotifSink() {}
+	// count windows in input order, and their motifs, MS_MOTIF_LENGTH characters each
+	virtual void motifs(const MotifWindow* windows, const char* motifs, size_t count) = 0;
+};
+
+class MotifStream {
+public:
+	MotifStream();
+
+	// Every window of every sequence of reader through the card, into sink
+	void extract(SequenceReader& reader, MotifSink& sink);
+
+	uint64_t batches() { return m_batch_count; }
+	uint64_t windows() { return m_window_count; }
+	// DRAM bytes host->card (records) and card->host (motif words)
+	uint64_t bytesSent() { return m_bytes_sent; }
+	uint64_t bytesReceived() { return m_bytes_received; }
+	// Seconds each stage spent working, not waiting, in the last extract()
+	double encodeTime() { return m_encode_time; }
+	double loadTime() { return m_load_time; }
+	double finishTime() { return m_finish_time; }
+
+private:
+	typedef struct {
+		std::vector<uint8_t> records;
+		std::vector<MotifWindow> windows;
+		// N and lowercase bits of the motif bases of each window
+		std::vector<uint16_t> nBits;
+		std::vector<uint16_t> lowerBits;
+		size_t count;
+		int region;
+	} Batch;
+
+	void encodeStage(SequenceReader* reader);
+	void closeWindow(Batch*& b, size_t& staged, uint32_t sequence, uint64_t position);
+	void flushStage(Batch* b, size_t staged);
+	void load(Batch* b);
+	void finish(Batch* b, MotifSink& sink);
+
+	Batch m_batches[MS_BATCHES];
+	BoundedQueue<Batch*> m_free;
+	BoundedQueue<Batch*> m_full;
+
+	// encode stage
+	std::vector<char> m_stage;
+	std::vector<uint64_t> m_n_mask;
+	std::vector<uint64_t> m_lower_mask;
+
+	// finish stage
+	std::vector<uint8_t> m_motif_words;
+	std::vector<char> m_motifs;
+
+	uint32_t m_batches_done;
+	PcieCompletion m_batch_done;
+	uint64_t m_batch_count;
+	uint64_t m_window_count;
+	uint64_t m_bytes_sent;
+	uint64_t m_bytes_received;
+	double m_encode_time;
+	double m_load_time;
+	double m_finish_time;
+};
+
+#endif
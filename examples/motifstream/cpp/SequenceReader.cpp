@@ -0,0 +1,254 @@
+#include <string.h>
+
+#include "SequenceReader.h"
+
+#define SR_BUFFER_BYTES (1024*1024)
+#define SR_TWO_BIT_SIGNATURE 0x1A412743
+#define SR_TWO_BIT_SIGNATURE_SWAPPED 0x4327411A
+
+SequenceReader::SequenceReader() {
+	m_file = NULL;
+	m_two_bit = false;
+	m_bytes_read = 0;
+	m_pos = 0;
+	m_len = 0;
+	m_line_start = true;
+	m_swap = false;
+	m_sequence = (uint32_t)-1;
+	m_size = 0;
+	m_base = 0;
+	m_data_offset = 0;
+	m_n_cursor = 0;
+	m_mask_cursor = 0;
+}
+
+SequenceReader::~SequenceReader() {
+	close();
+}
+
+bool
+SequenceReader::open(const char* filename) {
+	close();
+	m_file = fopen(filename, "rb");
+	if ( m_file == NULL ) {
+		printf("File not found: %s\n", filename);
+		return false;
+	}
+
+	uint32_t signature = 0;
+	m_two_bit = fread(&signature, sizeof(uint32_t), 1, m_file) == 1
+		&& (signature == SR_TWO_BIT_SIGNATURE || signature == SR_TWO_BIT_SIGNATURE_SWAPPED);
+	if ( m_two_bit ) {
+		m_swap = (signature == SR_TWO_BIT_SIGNATURE_SWAPPED);
+		if ( !openTwoBit() ) {
+			printf("Broken 2bit header: %s\n", filename);
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	rewind(m_file);
+	m_buf.resize(SR_BUFFER_BYTES);
+	return true;
+}
+
+void
+SequenceReader::close() {
+	if ( m_file ) fclose(m_file);
+	m_file = NULL;
+	m_names.clear();
+	m_offsets.clear();
+	m_bytes_read = 0;
+	m_pos = 0;
+	m_len = 0;
+	m_line_start = true;
+	m_sequence = (uint32_t)-1;
+	m_size = 0;
+	m_base = 0;
+}
+
+size_t
+SequenceReader::read(char* buf, size_t max, uint32_t& sequence) {
+	if ( m_file == NULL || max == 0 ) return 0;
+	if ( m_two_bit ) return readTwoBit(buf, max, sequence);
+	return readFasta(buf, max, sequence);
+}
+
+//--------------------------------------------------------------------------------------------
+// FASTA
+//--------------------------------------------------------------------------------------------
+bool
+SequenceReader::refill() {
+	m_pos = 0;
+	m_len = fread(&m_buf[0], 1, m_buf.size(), m_file);
+	m_bytes_read += m_len;
+	return m_len > 0;
+}
+
+// '>' up to the end of the line, named by the text before the first blank
+void
+SequenceReader::parseHeader() {
+	std::string name;
+	bool inName = true;
+	m_pos++;
+	while ( m_pos < m_len || refill() ) {
+		char c = m_buf[m_pos++];
+		if ( c == '\n' ) break;
+		if ( c == ' ' || c == '\t' || c == '\r' ) inName = false;
+		else if ( inName ) name += c;
+	}
+	m_names.push_back(name);
+	m_line_start = true;
+}
+
+size_t
+SequenceReader::readFasta(char* buf, size_t max, uint32_t& sequence) {
+	size_t n = 0;
+	while ( n < max && (m_pos < m_len || refill()) ) {
+		if ( m_line_start && m_buf[m_pos] == '>' ) {
+			// a run never spans two sequences
+			if ( n > 0 ) break;
+			parseHeader();
+			continue;
+		}
+		if ( m_names.empty() ) m_names.push_back("");
+
+		const char* start = &m_buf[m_pos];
+		size_t avail = m_len - m_pos;
+		const char* nl = (const char*)memchr(start, '\n', avail);
+		size_t line = nl ? (size_t)(nl - start) : avail;
+		size_t take = (line < max - n) ? line : max - n;
+		for ( size_t i = 0; i < take; i++ ) {
+			if ( start[i] > ' ' ) buf[n++] = start[i];
+		}
+		m_pos += take;
+		m_line_start = false;
+		if ( nl && take == line ) {
+			m_pos++;
+			m_line_start = true;
+		}
+	}
+	sequence = m_names.empty() ? 0 : m_names.size() - 1;
+	return n;
+}
+
+//--------------------------------------------------------------------------------------------
+// 2bit
+//--------------------------------------------------------------------------------------------
+bool
+SequenceReader::readWord(uint32_t& v) {
+	if ( fread(&v, sizeof(uint32_t), 1, m_file) != 1 ) return false;
+	if ( m_swap ) v = __builtin_bswap32(v);
+	m_bytes_read += sizeof(uint32_t);
+	return true;
+}
+
+// A count, then the starts, then the sizes
+bool
+SequenceReader::readBlocks(std::vector<Block>& blocks) {
+	uint32_t count;
+	if ( !readWord(count) ) return false;
+	blocks.resize(count);
+	for ( uint32_t i = 0; i < count; i++ ) {
+		if ( !readWord(blocks[i].start) ) return false;
+	}
+	for ( uint32_t i = 0; i < count; i++ ) {
+		if ( !readWord(blocks[i].size) ) return false;
+	}
+	return true;
+}
+
+// version, sequence count, reserved, then a name and offset per sequence
+bool
+SequenceReader::openTwoBit() {
+	uint32_t version, count, reserved;
+	if ( !readWord(version) || !readWord(count) || !readWord(reserved) ) return false;
+	if ( version > 1 ) return false;
+
+	for ( uint32_t i = 0; i < count; i++ ) {
+		uint8_t nameSize;
+		char name[256];
+		if ( fread(&nameSize, 1, 1, m_file) != 1 ) return false;
+		if ( fread(name, 1, nameSize, m_file) != nameSize ) return false;
+		m_names.push_back(std::string(name, nameSize));
+
+		// version 1 offsets are 64 bit, in the file's byte order
+		uint32_t first, second = 0;
+		if ( !readWord(first) ) return false;
+		if ( version == 1 && !readWord(second) ) return false;
+		if ( version == 0 ) m_offsets.push_back(first);
+		else if ( m_swap ) m_offsets.push_back(((uint64_t)first << 32) | second);
+		else m_offsets.push_back(((uint64_t)second << 32) | first);
+	}
+	return true;
+}
+
+// size, N blocks, mask blocks, reserved, then the packed bases
+bool
+SequenceReader::loadTwoBitSequence(uint32_t sequence) {
+	uint32_t reserved;
+	if ( fseek(m_file, (long)m_offsets[sequence], SEEK_SET) != 0 ) return false;
+	if ( !readWord(m_size) ) return false;
+	if ( !readBlocks(m_n_blocks) || !readBlocks(m_mask_blocks) ) return false;
+	if ( !readWord(reserved) ) return false;
+	m_data_offset = ftell(m_file);
+	m_sequence = sequence;
+	m_base = 0;
+	m_n_cursor = 0;
+	m_mask_cursor = 0;
+	return true;
+}
+
+size_t
+SequenceReader::readTwoBit(char* buf, size_t max, uint32_t& sequence) {
+	// T, C, A, G, first base in the high bits
+	static const char bases[4] = {'T', 'C', 'A', 'G'};
+
+	while ( m_base == m_size ) {
+		if ( m_sequence + 1 >= m_offsets.size() ) return 0;
+		if ( !loadTwoBitSequence(m_sequence + 1) ) {
+			printf("Broken 2bit sequence %s\n", m_names[m_sequence + 1].c_str());
+			m_sequence = m_offsets.size();
+			return 0;
+		}
+	}
+
+	size_t take = (m_size - m_base < max) ? m_size - m_base : max;
+	size_t first = m_base/4;
+	size_t bytes = (m_base + take - 1)/4 - first + 1;
+	m_packed.resize(bytes);
+	if ( fseek(m_file, m_data_offset + (long)first, SEEK_SET) != 0
+		|| fread(&m_packed[0], 1, bytes, m_file) != bytes ) {
+		printf("Truncated 2bit sequence %s\n", m_names[m_sequence].c_str());
+		m_base = m_size;
+		return 0;
+	}
+	m_bytes_read += bytes;
+
+	for ( size_t i = 0; i < take; i++ ) {
+		size_t p = m_base + i;
+		buf[i] = bases[(m_packed[p/4 - first] >> (6 - 2*(p%4))) & 3];
+	}
+
+	// blocks are sorted, so the cursors only move forward
+	uint64_t end = (uint64_t)m_base + take;
+	while ( m_n_cursor < m_n_blocks.size() && (uint64_t)m_n_blocks[m_n_cursor].start + m_n_blocks[m_n_cursor].size <= m_base ) m_n_cursor++;
+	for ( size_t b = m_n_cursor; b < m_n_blocks.size() && m_n_blocks[b].start < end; b++ ) {
+		uint64_t from = m_n_blocks[b].start > m_base ? m_n_blocks[b].start : m_base;
+		uint64_t to = (uint64_t)m_n_blocks[b].start + m_n_blocks[b].size;
+		if ( to > end ) to = end;
+		if ( to > from ) memset(buf + (from - m_base), 'N', to - from);
+	}
+	while ( m_mask_cursor < m_mask_blocks.size() && (uint64_t)m_mask_blocks[m_mask_cursor].start + m_mask_blocks[m_mask_cursor].size <= m_base ) m_mask_cursor++;
+	for ( size_t b = m_mask_cursor; b < m_mask_blocks.size() && m_mask_blocks[b].start < end; b++ ) {
+		uint64_t from = m_mask_blocks[b].start > m_base ? m_mask_blocks[b].start : m_base;
+		uint64_t to = (uint64_t)m_mask_blocks[b].start + m_mask_blocks[b].size;
+		if ( to > end ) to = end;
+		for ( uint64_t p = from; p < to; p++ ) buf[p - m_base] |= 0x20;
+	}
+
+	m_base += take;
+	sequence = m_sequence;
+	return take;
+}
@@ -0,0 +1,83 @@
+#ifndef __SEQUENCE_READER__H__
+#define __SEQUENCE_READER__H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+/****
+Streaming reader of FASTA and UCSC 2bit files
+
+The whole input is never in memory: read() hands out the bases of one sequence at a time in
+runs of at most max, so a genome goes through a buffer of a few MB.
+
+FASTA: '>' lines start a sequence, named by the header up to the first blank. Line breaks and
+blanks inside sequences are dropped, everything else is passed on as it is (lowercase, N,
+IUPAC codes). Bases before the first header belong to an unnamed sequence, so headerless files
+such as the mm9Gata4 dataset of the dram example work too.
+2bit: the packed bases are expanded back to characters, N blocks as 'N' and soft-masked
+blocks in lowercase, as twoBitToFa prints them. Both byte orders and versions 0 and 1.
+****/
+
+class SequenceReader {
+public:
+	SequenceReader();
+	~SequenceReader();
+
+	// false if the file cannot be opened or its 2bit header is broken
+	bool open(const char* filename);
+	void close();
+
+	// Up to max bases of one sequence into buf, and the sequence's index. 0 at the end of the input
+	size_t read(char* buf, size_t max, uint32_t& sequence);
+
+	// Sequences seen so far, all of them for 2bit
+	size_t sequences() { return m_names.size(); }
+	const char* name(uint32_t sequence) { return m_names[sequence].c_str(); }
+	uint64_t bytesRead() { return m_bytes_read; }
+
+private:
+	typedef struct {
+		uint32_t start;
+		uint32_t size;
+	} Block;
+
+	bool refill();
+	void parseHeader();
+	size_t readFasta(char* buf, size_t max, uint32_t& sequence);
+
+	bool readWord(uint32_t& v);
+	bool readBlocks(std::vector<Block>& blocks);
+	bool openTwoBit();
+	bool loadTwoBitSequence(uint32_t sequence);
+	size_t readTwoBit(char* buf, size_t max, uint32_t& sequence);
+
+	FILE* m_file;
+	bool m_two_bit;
+	std::vector<std::string> m_names;
+	uint64_t m_bytes_read;
+
+	// FASTA
+	std::vector<char> m_buf;
+	size_t m_pos;
+	size_t m_len;
+	bool m_line_start;
+
+	// 2bit
+	bool m_swap;
+	std::vector<uint64_t> m_offsets;
+	uint32_t m_sequence;
+	uint32_t m_size;
+	uint32_t m_base;
+	long m_data_offset;
+	std::vector<Block> m_n_blocks;
+	std::vector<Block> m_mask_blocks;
+	size_t m_n_cursor;
+	size_t m_mask_cursor;
+	std::vector<uint8_t> m_packed;
+};
+
+#endif
@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "bdbmpcie.h"
+#include "Benchmark.h"
+#include "SequenceReader.h"
+#include "MotifStream.h"
+
+
+// What the card and MotifStream give back for an input base
+static inline char motifBase(char c) {
+	char u = c & 0xdf;
+	if ( u == 'A' || u == 'C' || u == 'G' || u == 'T' ) return c;
+	return (c >= 'a' && c <= 'z') ? 'n' : 'N';
+}
+
+// Checks every motif against a second, CPU-side pass over the input, and writes them out
+class MotifCheck : public MotifSink {
+public:
+	MotifCheck(const char* filename, FILE* out) : m_run(1024*1024) {
+		m_reader.open(filename);
+		m_out = out;
+		m_len = 0;
+		m_pos = 0;
+		m_eof = false;
+		m_run_sequence = 0;
+		m_sequence = 0;
+		m_position = 0;
+		m_window_start = 0;
+		m_have = 0;
+		m_mismatches = 0;
+	}
+
+	void motifs(const MotifWindow* windows, const char* motifs, size_t count) {
+		for ( size_t i = 0; i < count; i ++ ) {
+			char expect[MS_MOTIF_LENGTH];
+			uint32_t sequence;
+			uint64_t position;
+			const char* motif = motifs + i*MS_MOTIF_LENGTH;
+			if ( !nextWindow(expect, sequence, position) || sequence != windows[i].sequence
+				|| position != windows[i].position || memcmp(expect, motif, MS_MOTIF_LENGTH) != 0 ) {
+				m_mismatches ++;
+			}
+			if ( m_out ) {
+				fprintf( m_out, "%s\t%lu\t%.*s\n", m_reader.name(windows[i].sequence), windows[i].position, MS_MOTIF_LENGTH, motif );
+			}
+		}
+	}
+
+	uint64_t mismatches() { return m_mismatches; }
+
+private:
+	// The first MS_MOTIF_LENGTH bases of the next MS_SEQ_LENGTH window, N padded at sequence ends
+	bool nextWindow(char* motif, uint32_t& sequence, uint64_t& position) {
+		while ( true ) {
+			if ( m_pos == m_len && !m_eof ) {
+				m_len = m_reader.read(&m_run[0], m_run.size(), m_run_sequence);
+				m_pos = 0;
+				m_eof = (m_len == 0);
+			}
+			if ( (m_eof || m_run_sequence != m_sequence) && m_position % MS_SEQ_LENGTH != 0 ) {
+				memset(m_motif + m_have, 'N', MS_MOTIF_LENGTH - m_have);
+				m_position = 0;
+				break;
+			}
+			if ( m_eof ) return false;
+			if ( m_run_sequence != m_sequence ) {
+				m_sequence = m_run_sequence;
+				m_position = 0;
+			}
+
+			if ( m_position % MS_SEQ_LENGTH == 0 ) {
+				m_window_start = m_position;
+				m_have = 0;
+			}
+			char c = m_run[m_pos ++];
+			if ( m_have < MS_MOTIF_LENGTH ) m_motif[m_have ++] = motifBase(c);
+			m_position ++;
+			if ( m_position % MS_SEQ_LENGTH == 0 ) break;
+		}
+		memcpy(motif, m_motif, MS_MOTIF_LENGTH);
+		sequence = m_sequence;
+		position = m_window_start;
+		return true;
+	}
+
+	SequenceReader m_reader;
+	FILE* m_out;
+	std::vector<char> m_run;
+	size_t m_len;
+	size_t m_pos;
+	bool m_eof;
+	uint32_t m_run_sequence;
+	uint32_t m_sequence;
+	uint64_t m_position;
+	uint64_t m_window_start;
+	char m_motif[MS_MOTIF_LENGTH];
+	size_t m_have;
+	uint64_t m_mismatches;
+};
+
+
+// Main
+// sw [input.fa|input.2bit] [motifs.tsv]
+int main(int argc, char** argv) {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+
+	unsigned int d = pcie->readWord(0);
+	printf( "Magic: %x\n", d );
+	fflush( stdout );
+
+	// The 26 windows of the dram example by default
+	const char* filename = (argc > 1) ? argv[1] : "../dram/cpp/dataset/mm9Gata4MotifCollection.bin";
+	FILE* out = NULL;
+	if ( argc > 2 ) {
+		out = fopen(argv[2], "w");
+		if ( out == NULL ) {
+			printf( "Cannot write %s\n", argv[2] );
+			return 1;
+		}
+	}
+
+	SequenceReader reader;
+	if ( !reader.open(filename) ) return 1;
+	MotifCheck check(filename, out);
+
+	MotifStream stream;
+	double start = timeCheckerWall();
+	stream.extract(reader, check);
+	double elapsed = timeCheckerWall() - start;
+
+	printf( "%lu sequences, %lu windows in %lu batches: %f s, %.2f Mbases/s\n", reader.sequences(), stream.windows(),
+		stream.batches(), elapsed, stream.windows()*MS_SEQ_LENGTH/elapsed/1000000 );
+	printf( "Input bytes %lu, DRAM bytes sent %lu received %lu\n", reader.bytesRead(), stream.bytesSent(), stream.bytesReceived() );
+	printf( "Stage busy time: encode %f s, load %f s, finish %f s\n", stream.encodeTime(), stream.loadTime(), stream.finishTime() );
+	printf( "Motifs different from the CPU: %lu\n", check.mismatches() );
+
+	if ( out ) fclose(out);
+	return check.mismatches() == 0 ? 0 : 1;
+}
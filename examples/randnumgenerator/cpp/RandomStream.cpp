@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bdbmpcie.h"
+#include "PcieCompletion.h"
+#include "RandomStream.h"
+
+#define RS_SLEEP_MAX_US 100
+
+static double streamNow() {
+	timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + (double)t.tv_nsec/1000000000;
+}
+
+RandomStream::RandomStream(RandomKind kind) : m_written(0), m_consumed(0), m_stop(false), m_failed(false) {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	m_kind = kind;
+	m_ring = (uint8_t*)pcie->dmaBuffer() + RS_RING_OFFSET;
+
+	// resume from wherever a previous stream left the card's ring
+	uint32_t written = pcie->userReadWord(2*4);
+	pcie->userWriteWord(3*4, written);
+	m_cursor = written;
+	m_limit = written;
+	m_released = written;
+	m_numbers_base = written;
+	m_numbers = 0;
+	m_waits = 0;
+	m_written.store(written);
+	m_consumed.store(written);
+
+	pcie->userWriteWord(2*4, kind);
+	m_refill = std::thread(&RandomStream::refillThread, this);
+}
+
+RandomStream::~RandomStream() {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	m_stop.store(true);
+	m_refill.join();
+
+	// drain what the generators still had, so the next stream starts with its own kind
+	pcie->userWriteWord(2*4, 0);
+	uint32_t written;
+	do {
+		written = pcie->userReadWord(2*4);
+		pcie->userWriteWord(3*4, written);
+		usleep(100);
+	} while ( pcie->userReadWord(2*4) != written );
+}
+
+void
+RandomStream::refillThread() {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	uint32_t posted = m_consumed.load(std::memory_order_relaxed);
+	uint32_t written = m_written.load(std::memory_order_relaxed);
+	uint64_t idle = 0;
+	double lastProgress = streamNow();
+
+	while ( !m_stop.load(std::memory_order_relaxed) ) {
+		uint32_t consumed = m_consumed.load(std::memory_order_acquire);
+		if ( consumed != posted ) {
+			pcie->userWriteWord(3*4, consumed);
+			posted = consumed;
+			idle = 0;
+		}
+
+		uint32_t w = pcie->userReadWord(2*4);
+		if ( w != written ) {
+			written = w;
+			m_written.store(w, std::memory_order_release);
+			idle = 0;
+			lastProgress = streamNow();
+			continue;
+		}
+
+		// a full ring waits on the consumer, anything else on the card
+		if ( written - posted < RS_RING_BYTES && idle >= PCIE_COMPLETION_SPINS
+			&& (streamNow() - lastProgress)*1000 > PCIE_COMPLETION_TIMEOUT_MS ) {
+			fprintf(stderr, "RandomStream: card wrote nothing for %.3f s with %u ring bytes free, written %u consumed %u\n",
+				streamNow() - lastProgress, RS_RING_BYTES - (written - posted), written, posted);
+			m_failed.store(true, std::memory_order_release);
+			return;
+		}
+		if ( written - posted >= RS_RING_BYTES ) lastProgress = streamNow();
+		pcieBackoff(idle++, RS_SLEEP_MAX_US);
+	}
+}
+
+bool
+RandomStream::refresh() {
+	m_numbers += (uint32_t)(m_cursor - m_numbers_base)/sizeof(uint32_t);
+	m_numbers_base = m_cursor;
+
+	m_limit = m_written.load(std::memory_order_acquire);
+	if ( m_limit != m_cursor ) return true;
+
+	// everything read, give it all back before waiting
+	release();
+	m_waits++;
+	uint64_t idle = 0;
+	while ( (m_limit = m_written.load(std::memory_order_acquire)) == m_cursor ) {
+		if ( m_failed.load(std::memory_order_acquire) ) return false;
+		pcieBackoff(idle++, RS_SLEEP_MAX_US);
+	}
+	return true;
+}
+
+bool
+RandomStream::fill(uint32_t* out, size_t n) {
+	uint8_t* dst = (uint8_t*)out;
+	size_t left = n*sizeof(uint32_t);
+	while ( left > 0 ) {
+		if ( m_cursor == m_limit && !refresh() ) return false;
+
+		// up to what has arrived, and the end of the ring
+		uint32_t off = m_cursor % RS_RING_BYTES;
+		size_t take = m_limit - m_cursor;
+		if ( take > RS_RING_BYTES - off ) take = RS_RING_BYTES - off;
+		if ( take > left ) take = left;
+		memcpy(dst, m_ring + off, take);
+		dst += take;
+		left -= take;
+		m_cursor += take;
+		if ( m_cursor - m_released >= RS_RELEASE_BYTES ) release();
+	}
+	return true;
+}
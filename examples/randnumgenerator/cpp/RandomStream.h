@@ -0,0 +1,101 @@
+#ifndef __RANDOM_STREAM__H__
+#define __RANDOM_STREAM__H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <atomic>
+#include <thread>
+
+/****
+Bulk random numbers from the card (HwMain.bsv)
+
+Instead of one userReadWord round trip per number, the card runs four generators of one kind
+and writes their numbers in 128 byte bursts to a ring in the DMA buffer, as fast as the host
+frees it. fill() and next() read straight out of the ring.
+
+Two threads share the ring without locks:
+	consumer : the thread calling fill() and next(). Publishes how far it has read every
+	           RS_RELEASE_BYTES, and whenever the ring runs dry
+	refill   : a background thread that hands the consumed space back to the card and
+	           publishes how far the card has written, backing off while nothing changes
+Only one thread may consume from a RandomStream.
+
+Integers are 32 bit xorshift values, four independent lanes of period 2^32-1 each
+(mkRandomGeneratorXorshiftSeed), floats their top 24 bits in [0.0, 1.0). If the card stops writing while the ring has room for
+PCIE_COMPLETION_TIMEOUT_MS, the refill thread says so on stderr, fill() returns false and
+next() returns 0, and failed() stays true from then on.
+
+User registers:
+	write 2 : stream kind (1 integers, 2 floats, 0 stops), write 3 : ring bytes consumed
+	read 2  : ring bytes written
+****/
+
+#define RS_RING_OFFSET 0
+#define RS_RING_BYTES (512*1024)
+#define RS_RELEASE_BYTES (64*1024)
+
+typedef enum {
+	RANDOM_INT = 1,
+	RANDOM_FLOAT = 2
+} RandomKind;
+
+class RandomStream {
+public:
+	RandomStream(RandomKind kind);
+	~RandomStream();
+
+	// n numbers into out, waiting for the card when the ring runs dry. false if the card stopped
+	bool fill(uint32_t* out, size_t n);
+	bool fill(float* out, size_t n) { return fill((uint32_t*)out, n); }
+
+	// 0 once the card stopped, check failed()
+	inline uint32_t nextInt() {
+		if ( m_cursor == m_limit && !refresh() ) return 0;
+		uint32_t v = *(uint32_t*)(m_ring + (m_cursor % RS_RING_BYTES));
+		m_cursor += sizeof(uint32_t);
+		if ( m_cursor - m_released >= RS_RELEASE_BYTES ) release();
+		return v;
+	}
+	inline float next() {
+		uint32_t v = nextInt();
+		float f;
+		memcpy(&f, &v, sizeof(float));
+		return f;
+	}
+
+	uint64_t numbers() { return m_numbers + (uint32_t)(m_cursor - m_numbers_base)/sizeof(uint32_t); }
+	// times the consumer found the ring empty
+	uint64_t waits() { return m_waits; }
+	// the card stopped writing, nothing more will come
+	bool failed() { return m_failed.load(std::memory_order_acquire); }
+
+private:
+	void refillThread();
+	// waits for more than m_cursor in the ring and moves m_limit up to it, false if the card stopped
+	bool refresh();
+	inline void release() {
+		m_consumed.store(m_cursor, std::memory_order_release);
+		m_released = m_cursor;
+	}
+
+	RandomKind m_kind;
+	uint8_t* m_ring;
+
+	// consumer only, in ring bytes modulo 2^32 like the card's counters
+	uint32_t m_cursor;
+	uint32_t m_limit;
+	uint32_t m_released;
+	uint32_t m_numbers_base;
+	uint64_t m_numbers;
+	uint64_t m_waits;
+
+	std::atomic<uint32_t> m_written;
+	std::atomic<uint32_t> m_consumed;
+	std::atomic<bool> m_stop;
+	std::atomic<bool> m_failed;
+	std::thread m_refill;
+};
+
+#endif
@@ -10,6 +10,8 @@
 
 #include "bdbmpcie.h"
 #include "dmasplitter.h"
+#include "PcieCompletion.h"
+#include "RandomStream.h"
 
 
 // Elapsed time checker
@@ -32,16 +34,41 @@ int main(int argc, char** argv) {
 	// Send the system start signal
 	pcie->userWriteWord(0, 0);
 
-	// Wait until the system is finished
-	for ( uint32_t i = 0; i < 1024; i ++ ) {
-		pcie->userWriteWord(4, 0);
-	}
-
-	// Get the values from HW
+	// Get the values from HW, a read pops one and returns 7777 until it is there
+	PcieCompletion resultReady("random number", 4);
 	for ( uint32_t i = 0; i < 50; i ++ ) {
-		uint32_t f = pcie->userReadWord(4);
+		if ( !resultReady.waitNotEqual(7777) ) return 1;
+		uint32_t f = resultReady.value();
 		printf( "Random Number (FP): %f\n", *(float*)&f );
 	}
 
+	// Bulk floats through the DMA ring
+	size_t count = (argc > 1) ? strtoul(argv[1], NULL, 10) : 64*1024*1024;
+	size_t chunk = 1024*1024;
+	float* numbers = (float*)malloc(sizeof(float)*chunk);
+	RandomStream stream(RANDOM_FLOAT);
+
+	timespec start, finish;
+	double sum = 0;
+	clock_gettime(CLOCK_REALTIME, &start);
+	for ( size_t i = 0; i < count; i += chunk ) {
+		size_t n = (count - i < chunk) ? count - i : chunk;
+		if ( !stream.fill(numbers, n) ) return 1;
+		for ( size_t j = 0; j < n; j ++ ) sum += numbers[j];
+	}
+	clock_gettime(CLOCK_REALTIME, &finish);
+	double elapsed = timespec_diff_sec(start, finish);
+	printf( "fill: %lu floats in %f s, %.2f M/s, mean %f\n", count, elapsed, count/elapsed/1000000, sum/count );
+
+	sum = 0;
+	clock_gettime(CLOCK_REALTIME, &start);
+	for ( size_t i = 0; i < count; i ++ ) sum += stream.next();
+	clock_gettime(CLOCK_REALTIME, &finish);
+	if ( stream.failed() ) return 1;
+	elapsed = timespec_diff_sec(start, finish);
+	printf( "next: %lu floats in %f s, %.2f M/s, mean %f\n", count, elapsed, count/elapsed/1000000, sum/count );
+	printf( "Ring ran dry %lu times over %lu numbers\n", stream.waits(), stream.numbers() );
+
+	free(numbers);
 	return 0;
 }
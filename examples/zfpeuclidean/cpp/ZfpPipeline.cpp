@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <thread>
+
+#include "bdbmpcie.h"
+#include "Benchmark.h"
+#include "Zfp.h"
+#include "ZfpPipeline.h"
+
+ZfpPipeline::ZfpPipeline()
+	: m_ring("zfp result ring", ZP_RING_OFFSET, ZP_RING_BYTES, 1*4, 17*4), m_free_slots(ZP_SLOTS), m_send_queue(ZP_SLOTS), m_receive_queue(ZP_SLOTS) {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	m_dmabuf = (uint8_t*)pcie->dmaBuffer();
+	m_failed = false;
+
+	// starts the result ring, which counts from 0
+	pcie->userWriteWord(16*4, 0);
+
+	for ( int i = 0; i < ZP_SLOTS; i++ ) m_free_slots.push(i);
+
+	m_chunks = 0;
+	m_bytes_sent = 0;
+	m_bytes_received = 0;
+	m_compress_time = 0;
+	m_send_time = 0;
+	m_receive_time = 0;
+}
+
+void
+ZfpPipeline::compressStage(const Point* points, size_t n) {
+	for ( size_t start = 0; start < n; start += ZP_CHUNK_POINTS ) {
+		Chunk c;
+		if ( !m_free_slots.pop(c.slot) ) break;
+
+		double begin = timeCheckerWall();
+		c.start = start;
+		c.count = (n - start < ZP_CHUNK_POINTS) ? n - start : ZP_CHUNK_POINTS;
+		c.padded = (c.count + ZP_BURST_POINTS - 1) / ZP_BURST_POINTS * ZP_BURST_POINTS;
+		uint8_t* slot = m_dmabuf + ZP_SLOT_OFFSET + c.slot*ZP_SLOT_BYTES;
+		size_t bytes = zfp_compress_points(points + start, c.count, slot, ZP_BIT_BUDGET, 1);
+		// padding targets repeat the last block
+		for ( size_t b = bytes; b < c.padded/2*ZFP_BLOCK_BYTES; b += ZFP_BLOCK_BYTES ) {
+			memcpy(slot + b, slot + bytes - ZFP_BLOCK_BYTES, ZFP_BLOCK_BYTES);
+		}
+		m_compress_time += timeCheckerWall() - begin;
+
+		if ( !m_send_queue.push(c) ) break;
+	}
+	m_send_queue.close();
+}
+
+void
+ZfpPipeline::sendStage() {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	Chunk c;
+	while ( m_send_queue.pop(c) ) {
+		double begin = timeCheckerWall();
+		// two blocks per 16 byte word
+		uint32_t words = c.padded/4;
+		pcie->userWriteWord(4*4, ZP_SLOT_OFFSET + c.slot*ZP_SLOT_BYTES);
+		pcie->userWriteWord(5*4, words);
+		m_chunks++;
+		m_bytes_sent += words*16;
+		m_send_time += timeCheckerWall() - begin;
+
+		if ( !m_receive_queue.push(c) ) break;
+	}
+	m_receive_queue.close();
+}
+
+void
+ZfpPipeline::receiveStage(float* dist) {
+	Chunk c;
+	while ( m_receive_queue.pop(c) ) {
+		uint32_t bytes = c.padded*sizeof(float);
+		if ( !m_ring.wait(bytes) ) {
+			// stops compress and send, distances() returns false after the join
+			fprintf(stderr, "ZfpPipeline: no results for targets %lu to %lu\n", c.start, c.start + c.count);
+			m_failed = true;
+			m_free_slots.close();
+			m_send_queue.close();
+			m_receive_queue.close();
+			return;
+		}
+
+		// copy the real results, then hand the whole padded range back to the card
+		double begin = timeCheckerWall();
+		m_ring.take(dist + c.start, c.count*sizeof(float), bytes);
+		m_bytes_received += bytes;
+		m_receive_time += timeCheckerWall() - begin;
+
+		// all results in means the card has read the whole slot
+		m_free_slots.push(c.slot);
+	}
+}
+
+bool
+ZfpPipeline::distances(Point core, const Point* points, float* dist, size_t n) {
+	if ( m_failed ) {
+		fprintf(stderr, "ZfpPipeline: failed earlier, the card may still hold chunks\n");
+		return false;
+	}
+	m_send_queue.reopen();
+	m_receive_queue.reopen();
+
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+	pcie->userWriteWord(0*4, *(uint32_t*)&core.lat);
+	pcie->userWriteWord(1*4, *(uint32_t*)&core.lon);
+
+	m_compress_time = 0;
+	m_send_time = 0;
+	m_receive_time = 0;
+	std::thread sender(&ZfpPipeline::sendStage, this);
+	std::thread receiver(&ZfpPipeline::receiveStage, this, dist);
+	compressStage(points, n);
+	sender.join();
+	receiver.join();
+	return !m_failed;
+}
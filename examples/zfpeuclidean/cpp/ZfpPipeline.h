@@ -0,0 +1,110 @@
+#ifndef __ZFP_PIPELINE__H__
+#define __ZFP_PIPELINE__H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Point.h"
+#include "BoundedQueue.h"
+#include "DMAResultRing.h"
+
+/****
+Compressed-domain host pipeline for the zfpeuclidean design (HwMain.bsv)
+
+Targets cross PCIe as 8 byte ZFP pair blocks (Zfp.h) instead of 16 bytes of floats. The card
+decompresses them with ZfpDecompress.bsv, feeds the Euclidean kernel, and returns one float per
+target through a DMAResultRing.
+
+Three host stages run in their own threads, joined by BoundedQueues:
+	compress : zfp_compress_points() of one chunk straight into a free DMA slot
+	send     : rings the card for the slot (offset, then size in words)
+	receive  : waits for the chunk's results in the ring, copies them out, frees the slot
+So chunk k+2 is compressed while chunk k+1 is on the link and chunk k's results drain.
+The free slot queue bounds the whole pipeline to ZP_SLOTS chunks. Each stage closes the queue
+it feeds once it is done. If the results of a chunk do not arrive within the DMAResultRing
+timeout, receive closes every queue so the other stages stop, and distances() returns false.
+The card may still hold chunks then, so the pipeline stays failed() and refuses later calls.
+
+The bit budget is fixed by the hardware (ZP_BIT_BUDGET), so it is not a parameter.
+
+DMA buffer layout:
+	[0, 256 KB)    result ring, one float per target
+	[256 KB, 1 MB) ZP_SLOTS compressed chunk slots of 128 KB
+The driver backs only the first 1 MB of the buffer, so everything stays inside it.
+Chunks are padded with their last block to whole 32 target (128 byte) result bursts.
+
+User registers:
+	write 0, 1 : core lat, lon
+	write 4    : slot offset in the DMA buffer, write 5 : chunk size in words (starts it)
+	write 16   : start the result ring, write 17 : ring bytes consumed (as in DMACircularQueue)
+	read 1     : ring bytes written
+****/
+
+#define ZP_RING_OFFSET 0
+#define ZP_RING_BYTES (256*1024)
+#define ZP_SLOT_OFFSET (256*1024)
+#define ZP_SLOT_BYTES (128*1024)
+#define ZP_SLOTS 6
+#define ZP_BURST_POINTS 32
+// A chunk takes ZFP_BLOCK_BYTES (8) per two targets in its slot and 4 bytes per target in the ring
+#define ZP_CHUNK_POINTS (32*1024)
+
+#if ZP_CHUNK_POINTS/2*8 > ZP_SLOT_BYTES
+#error "ZP_CHUNK_POINTS targets do not fit a slot"
+#endif
+#if ZP_CHUNK_POINTS*4 > ZP_RING_BYTES
+#error "the results of a chunk do not fit the result ring"
+#endif
+#if ZP_SLOT_OFFSET + ZP_SLOTS*ZP_SLOT_BYTES > 1024*1024
+#error "slots beyond the 1 MB the driver maps"
+#endif
+// BitBudget of ZfpDecompress.bsv, ZfpComprTypeSz 33 = 9 + 4*(5+1)
+#define ZP_BIT_BUDGET 5
+
+class ZfpPipeline {
+public:
+	ZfpPipeline();
+
+	// dist[i] = euclidean(core, points[i]), computed by the card from compressed points.
+	// false if the card stopped returning results
+	bool distances(Point core, const Point* points, float* dist, size_t n);
+	bool failed() { return m_failed; }
+
+	uint64_t chunks() { return m_chunks; }
+	// DMA bytes host->card (compressed blocks) and card->host (results, padding included)
+	uint64_t bytesSent() { return m_bytes_sent; }
+	uint64_t bytesReceived() { return m_bytes_received; }
+	// Seconds each stage spent working, not waiting on its queues, in the last distances()
+	double compressTime() { return m_compress_time; }
+	double sendTime() { return m_send_time; }
+	double receiveTime() { return m_receive_time; }
+
+private:
+	typedef struct {
+		int slot;
+		size_t start;
+		size_t count;
+		size_t padded;
+	} Chunk;
+
+	void compressStage(const Point* points, size_t n);
+	void sendStage();
+	void receiveStage(float* dist);
+
+	uint8_t* m_dmabuf;
+	DMAResultRing m_ring;
+	bool m_failed;
+
+	BoundedQueue<int> m_free_slots;
+	BoundedQueue<Chunk> m_send_queue;
+	BoundedQueue<Chunk> m_receive_queue;
+
+	uint64_t m_chunks;
+	uint64_t m_bytes_sent;
+	uint64_t m_bytes_received;
+	double m_compress_time;
+	double m_send_time;
+	double m_receive_time;
+};
+
+#endif
@@ -0,0 +1,57 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include <vector>
+
+#include "bdbmpcie.h"
+#include "Benchmark.h"
+#include "Zfp.h"
+#include "ZfpPipeline.h"
+
+
+#define NumCities 44691
+
+
+// Main
+int main(int argc, char** argv) {
+	BdbmPcie* pcie = BdbmPcie::getInstance();
+
+	unsigned int d = pcie->readWord(0);
+	printf( "Magic: %x\n", d );
+	fflush( stdout );
+
+	// Read benchmark file
+	std::vector<Point> cities(1);
+	char cities_filename[] = "worldcities.bin";
+	readBenchmarkData(cities, cities_filename, NumCities);
+	Point core = cities[8];
+
+	// Every city against city 8, compressed on the host, decompressed on the card
+	ZfpPipeline pipeline;
+	std::vector<float> dist(NumCities);
+	double start = timeCheckerWall();
+	if ( !pipeline.distances(core, &cities[0], &dist[0], NumCities) ) return 1;
+	double elapsed = timeCheckerWall() - start;
+
+	// The card sees the decompressed points, so compare against those, and the originals
+	std::vector<uint8_t> compressed(zfp_compressed_bytes(NumCities));
+	std::vector<Point> decompressed(NumCities);
+	zfp_compress_points(&cities[0], NumCities, &compressed[0], ZP_BIT_BUDGET);
+	zfp_decompress_points(&compressed[0], NumCities, &decompressed[0], ZP_BIT_BUDGET);
+	float maxDiff = 0, maxErr = 0;
+	for ( int i = 0; i < NumCities; i ++ ) {
+		float ref = Metric<Euclidean>::scalar(core, decompressed[i]);
+		float exact = Metric<Euclidean>::scalar(core, cities[i]);
+		maxDiff = std::max(maxDiff, std::fabs(dist[i] - ref));
+		maxErr = std::max(maxErr, std::fabs(dist[i] - exact));
+	}
+
+	printf( "Streamed %d pairs in %lu chunks: %f s, %.2f Mpairs/s\n", NumCities, pipeline.chunks(), elapsed, NumCities/elapsed/1000000 );
+	printf( "DMA bytes sent %lu (%lu uncompressed) received %lu\n", pipeline.bytesSent(), NumCities*sizeof(Point), pipeline.bytesReceived() );
+	printf( "Stage busy time: compress %f s, send %f s, receive %f s\n", pipeline.compressTime(), pipeline.sendTime(), pipeline.receiveTime() );
+	printf( "Max difference to CPU on decompressed points: %f, to exact distances: %f\n", maxDiff, maxErr );
+
+	return 0;
+}
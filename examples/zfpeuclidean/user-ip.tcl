@@ -0,0 +1,3 @@
+set libdir ../../../../bluelib/src/coregen/vc707/
+
+source $libdir/../fp_import.tcl